@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/*! std::allocator replacement that hands out 'Alignment' aligned
+	memory, for vectors of SIMD friendly, cache line sized structs
+	(operator new only guarantees 16 bytes before C++17) */
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t n) {
+		if (n == 0)
+			return nullptr;
+#ifdef _WIN32
+		void* ptr = _aligned_malloc(n * sizeof(T), Alignment);
+		if (!ptr)
+			throw std::bad_alloc();
+#else
+		void* ptr = nullptr;
+		if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0)
+			throw std::bad_alloc();
+#endif
+		return (T*)ptr;
+	}
+
+	void deallocate(T* ptr, size_t) {
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
+};
+
+template <typename T, typename U, size_t Alignment>
+inline bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+
+template <typename T, typename U, size_t Alignment>
+inline bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
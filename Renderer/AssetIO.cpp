@@ -0,0 +1,374 @@
+#include "AssetIO.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <stdlib.h>
+#else
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef _WIN32
+/*! opens every file and sizes its buffer; done in parallel as well
+	because on network file systems the open itself is a round trip */
+static void openFiles(std::vector<FileData>& files, std::vector<int>& fds) {
+	fds.assign(files.size(), -1);
+	parallelFor(0, (int)files.size(), [&](int i) {
+		int fd = open(files[i].path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			close(fd);
+			return;
+		}
+		files[i].bytes.resize((size_t)info.st_size);
+		fds[i] = fd;
+	});
+}
+
+static void closeFiles(std::vector<int>& fds) {
+	for (int fd : fds)
+		if (fd >= 0) close(fd);
+}
+
+/*! a blocking pread loop over the whole (already sized) file */
+static void readFile(FileData& file, int fd) {
+	std::vector<unsigned char>& bytes = file.bytes;
+	size_t done = 0;
+	while (done < bytes.size()) {
+		ssize_t n = pread(fd, bytes.data() + done, bytes.size() - done, (off_t)done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		done += (size_t)n;
+	}
+	file.ok = true;
+}
+
+/*! thread pool fallback: one blocking pread loop per file */
+static void readWithThreads(std::vector<FileData>& files, const std::vector<int>& fds) {
+	parallelFor(0, (int)files.size(), [&](int i) {
+		if (fds[i] >= 0)
+			readFile(files[i], fds[i]);
+	});
+}
+
+/*! opens and reads one file after the other */
+static void readSequentially(std::vector<FileData>& files) {
+	for (auto& file : files) {
+		int fd = open(file.path.c_str(), O_RDONLY);
+		if (fd < 0)
+			continue;
+		struct stat info;
+		if (fstat(fd, &info) == 0) {
+			file.bytes.resize((size_t)info.st_size);
+			readFile(file, fd);
+		}
+		close(fd);
+	}
+}
+#endif
+
+#ifdef HAVE_IO_URING
+/*! just enough of an io_uring to queue up reads and wait for them,
+	talking to the kernel directly so there is no liburing dependency */
+struct IoRing {
+	~IoRing() {
+		if (sqes) munmap(sqes, sqesSize);
+		if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+		if (sqRing) munmap(sqRing, sqRingSize);
+		if (fd >= 0) close(fd);
+	}
+
+	bool init(unsigned numEntries) {
+		io_uring_params params = {};
+		fd = (int)syscall(__NR_io_uring_setup, numEntries, &params);
+		if (fd < 0)
+			return false;
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMmap)
+			sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+		sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sqRing == MAP_FAILED) { sqRing = nullptr; return false; }
+		cqRing = singleMmap ? sqRing
+			: mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED) { cqRing = nullptr; return false; }
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) { sqes = nullptr; return false; }
+
+		char* sq = (char*)sqRing;
+		sqHead = (unsigned*)(sq + params.sq_off.head);
+		sqTail = (unsigned*)(sq + params.sq_off.tail);
+		sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+		sqArray = (unsigned*)(sq + params.sq_off.array);
+		char* cq = (char*)cqRing;
+		cqHead = (unsigned*)(cq + params.cq_off.head);
+		cqTail = (unsigned*)(cq + params.cq_off.tail);
+		cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+		entries = params.sq_entries;
+		return true;
+	}
+
+	/*! queues a readv of one iovec; caller keeps 'iov' alive until completion */
+	void queueRead(int fileFd, const iovec* iov, uint64_t offset, uint64_t userData) {
+		unsigned tail = *sqTail;
+		unsigned index = tail & sqMask;
+		io_uring_sqe& sqe = sqes[index];
+		sqe = {};
+		sqe.opcode = IORING_OP_READV;
+		sqe.fd = fileFd;
+		sqe.addr = (uint64_t)(uintptr_t)iov;
+		sqe.len = 1;
+		sqe.off = offset;
+		sqe.user_data = userData;
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		queued++;
+	}
+
+	/*! submits everything queued so far and waits for at least one completion */
+	bool submitAndWait() {
+		int rc;
+		do {
+			rc = (int)syscall(__NR_io_uring_enter, fd, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+		} while (rc < 0 && errno == EINTR);
+		if (rc < 0)
+			return false;
+		queued -= std::min(queued, (unsigned)rc);
+		return true;
+	}
+
+	/*! pops one completion, if there is one */
+	bool popCompletion(io_uring_cqe& cqe) {
+		unsigned head = *cqHead;
+		if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+			return false;
+		cqe = cqes[head & cqMask];
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	int fd{ -1 };
+	unsigned entries{ 0 };
+	unsigned queued{ 0 };
+
+	void* sqRing{ nullptr };
+	void* cqRing{ nullptr };
+	size_t sqRingSize{ 0 };
+	size_t cqRingSize{ 0 };
+	io_uring_sqe* sqes{ nullptr };
+	size_t sqesSize{ 0 };
+
+	unsigned* sqHead{ nullptr };
+	unsigned* sqTail{ nullptr };
+	unsigned sqMask{ 0 };
+	unsigned* sqArray{ nullptr };
+	unsigned* cqHead{ nullptr };
+	unsigned* cqTail{ nullptr };
+	unsigned cqMask{ 0 };
+	io_uring_cqe* cqes{ nullptr };
+};
+
+/*! io_uring path: keeps up to ring-size reads in flight at once.
+	Returns false if io_uring is not available or fails part way; no
+	file is marked ok then, so the caller reads them all again */
+static bool readWithIoUring(std::vector<FileData>& files, const std::vector<int>& fds) {
+	// single reads are capped so huge files are split into several requests
+	const size_t maxChunk = size_t(1) << 28;
+
+	struct Request {
+		int file;
+		size_t offset;
+		iovec iov;
+	};
+	std::vector<Request> pending;
+	for (int i = 0; i < (int)files.size(); i++) {
+		if (fds[i] < 0)
+			continue;
+		if (files[i].bytes.empty())
+			files[i].ok = true;
+		for (size_t offset = 0; offset < files[i].bytes.size(); offset += maxChunk) {
+			Request req;
+			req.file = i;
+			req.offset = offset;
+			req.iov.iov_base = files[i].bytes.data() + offset;
+			req.iov.iov_len = std::min(maxChunk, files[i].bytes.size() - offset);
+			pending.push_back(req);
+		}
+	}
+	if (pending.empty())
+		return true;
+
+	IoRing ring;
+	if (!ring.init((unsigned)std::min<size_t>(pending.size(), 256)))
+		return false;
+
+	// the kernel holds on to each request's iovec until it completes, so
+	// they live in a deque that never moves them; the ring carries indices
+	std::deque<Request> requests;
+	std::vector<size_t> remaining(files.size(), 0);
+	for (auto& req : pending)
+		remaining[req.file] += req.iov.iov_len;
+	std::vector<bool> failed(files.size(), false);
+
+	size_t next = 0;
+	unsigned inFlight = 0;
+	while (next < pending.size() || inFlight > 0) {
+		while (next < pending.size() && inFlight < ring.entries) {
+			requests.push_back(pending[next++]);
+			const Request& req = requests.back();
+			ring.queueRead(fds[req.file], &req.iov, req.offset, requests.size() - 1);
+			inFlight++;
+		}
+		if (!ring.submitAndWait()) {
+			// reads already submitted may still complete, into the same
+			// bytes the fallback then reads
+			for (auto& file : files)
+				file.ok = false;
+			return false;
+		}
+
+		io_uring_cqe cqe;
+		while (ring.popCompletion(cqe)) {
+			inFlight--;
+			Request req = requests[(size_t)cqe.user_data];
+			if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+				pending.push_back(req);
+				continue;
+			}
+			if (cqe.res <= 0) {
+				failed[req.file] = true;
+				continue;
+			}
+			remaining[req.file] -= (size_t)cqe.res;
+			if ((size_t)cqe.res < req.iov.iov_len) {
+				// short read, queue up the rest
+				req.offset += (size_t)cqe.res;
+				req.iov.iov_base = (char*)req.iov.iov_base + cqe.res;
+				req.iov.iov_len -= (size_t)cqe.res;
+				pending.push_back(req);
+			}
+		}
+	}
+
+	for (int i = 0; i < (int)files.size(); i++)
+		if (fds[i] >= 0 && !failed[i] && remaining[i] == 0)
+			files[i].ok = true;
+	return true;
+}
+#endif
+
+std::vector<FileData> readFiles(const std::vector<std::string>& paths, ReadMethod method) {
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<FileData> files(paths.size());
+	for (size_t i = 0; i < paths.size(); i++)
+		files[i].path = paths[i];
+
+	const char* methodName = method == ReadMethod::SEQUENTIAL ? "sequential reads" : "threads";
+#ifdef _WIN32
+	auto readOne = [&](int i) {
+		std::ifstream file(files[i].path, std::ios::binary | std::ios::ate);
+		if (!file)
+			return;
+		files[i].bytes.resize((size_t)file.tellg());
+		file.seekg(0);
+		file.read((char*)files[i].bytes.data(), files[i].bytes.size());
+		files[i].ok = (bool)file;
+	};
+	if (method == ReadMethod::SEQUENTIAL)
+		for (int i = 0; i < (int)files.size(); i++)
+			readOne(i);
+	else
+		parallelFor(0, (int)files.size(), readOne);
+#else
+	if (method == ReadMethod::SEQUENTIAL)
+		readSequentially(files);
+	else {
+		std::vector<int> fds;
+		openFiles(files, fds);
+		bool done = false;
+#ifdef HAVE_IO_URING
+		if (method != ReadMethod::THREADS) {
+			done = readWithIoUring(files, fds);
+			if (done)
+				methodName = "io_uring";
+		}
+#endif
+		if (!done)
+			readWithThreads(files, fds);
+		closeFiles(fds);
+	}
+#endif
+
+	size_t numBytes = 0;
+	for (auto& file : files)
+		numBytes += file.bytes.size();
+	auto end = std::chrono::steady_clock::now();
+	if (!files.empty())
+		std::cout << "Read " << files.size() << " files (" << numBytes / (1024.0 * 1024.0) << " MB) in "
+			<< std::chrono::duration<double, std::milli>(end - start).count() << " ms using " << methodName << std::endl;
+	return files;
+}
+
+bool dropCachedFiles(const std::vector<std::string>& paths) {
+#ifdef _WIN32
+	return false;
+#else
+	bool dropped = true;
+	for (auto& path : paths) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			dropped = false;
+			continue;
+		}
+		// pages still dirty would survive, so write them out first
+		if (fdatasync(fd) != 0 || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+			dropped = false;
+		close(fd);
+	}
+	return dropped;
+#endif
+}
+
+std::string canonicalPath(const std::string& path) {
+#ifdef _WIN32
+	char resolved[_MAX_PATH];
+	if (!_fullpath(resolved, path.c_str(), _MAX_PATH))
+		return path;
+	std::string result = resolved;
+	for (auto& c : result)
+		if (c == '\\') c = '/';
+	return result;
+#else
+	char resolved[PATH_MAX];
+	if (!realpath(path.c_str(), resolved))
+		return path;
+	return resolved;
+#endif
+}
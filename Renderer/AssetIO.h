@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+/*! contents of one file read by readFiles() */
+struct FileData {
+	std::string path;
+	std::vector<unsigned char> bytes;
+	//! false if the file could not be opened or read completely
+	bool ok{ false };
+};
+
+/*! how readFiles() fetches its files */
+enum class ReadMethod {
+	//! io_uring where the kernel supports it, THREADS otherwise
+	AUTO,
+	//! falls back to THREADS if there is no io_uring
+	IO_URING,
+	THREADS,
+	//! one file after the other on the calling thread, as stdio loads did
+	SEQUENTIAL
+};
+
+/*! reads all given files into memory in one batch. All reads are
+	submitted up front (through io_uring where the kernel supports it,
+	otherwise through a pool of threads doing pread), so on high
+	latency storage the files are fetched concurrently instead of one
+	after the other. Results come back in the order of 'paths' */
+std::vector<FileData> readFiles(const std::vector<std::string>& paths, ReadMethod method = ReadMethod::AUTO);
+
+/*! asks the OS to drop its cached pages of the given files, so that the
+	next reads go to the storage again, as in a cold start. Returns
+	false where that is not supported */
+bool dropCachedFiles(const std::vector<std::string>& paths);
+
+/*! absolute path with '.', '..' and duplicate separators resolved, so
+	two spellings of one file compare equal. Returns 'path' unchanged
+	if the file does not exist */
+std::string canonicalPath(const std::string& path);
@@ -0,0 +1,212 @@
+#include "Bsdf.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const float PI = 3.14159265f;
+
+namespace {
+	//! an orthonormal frame around a unit normal, without branches or
+	//! trigonometry (Duff et al., "Building an Orthonormal Basis,
+	//! Revisited", 2017); local z is the normal
+	struct Frame {
+		glm::vec3 s, t, n;
+
+		explicit Frame(const glm::vec3& normal) : n(normal) {
+			const float sign = n.z >= 0.f ? 1.f : -1.f;
+			const float a = -1.f / (sign + n.z);
+			const float b = n.x * n.y * a;
+			s = glm::vec3(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+			t = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+		}
+		glm::vec3 toLocal(const glm::vec3& v) const { return glm::vec3(glm::dot(v, s), glm::dot(v, t), glm::dot(v, n)); }
+		glm::vec3 toWorld(const glm::vec3& v) const { return v.x * s + v.y * t + v.z * n; }
+	};
+}
+
+/*! a point on the unit disk, uniformly distributed, by Shirley and
+	Chiu's concentric mapping of the square, which keeps strata apart */
+static glm::vec2 concentricDisk(float u0, float u1) {
+	const float a = 2.f * u0 - 1.f;
+	const float b = 2.f * u1 - 1.f;
+	if (a == 0.f && b == 0.f)
+		return glm::vec2(0.f);
+	float r, phi;
+	if (std::abs(a) > std::abs(b)) {
+		r = a;
+		phi = (PI / 4.f) * (b / a);
+	}
+	else {
+		r = b;
+		phi = PI / 2.f - (PI / 4.f) * (a / b);
+	}
+	return r * glm::vec2(std::cos(phi), std::sin(phi));
+}
+
+//! GGX normal distribution, for a unit microfacet normal h in the local frame
+static float ggxD(const glm::vec3& h, float alpha) {
+	const float a2 = alpha * alpha;
+	const float d = h.z * h.z * (a2 - 1.f) + 1.f;
+	return a2 / (PI * d * d);
+}
+
+//! Smith's Lambda of GGX, for a direction v above the local surface
+static float ggxLambda(const glm::vec3& v, float alpha) {
+	const float cos2 = v.z * v.z;
+	const float tan2 = std::max(1.f - cos2, 0.f) / cos2;
+	return 0.5f * (std::sqrt(1.f + alpha * alpha * tan2) - 1.f);
+}
+
+/*! a microfacet normal of GGX, distributed as visible from wo (above
+	the local surface): stretched to roughness 1, a point on the
+	projected hemisphere, then back */
+static glm::vec3 sampleVisibleNormal(const glm::vec3& wo, float alpha, float u0, float u1) {
+	const glm::vec3 v = glm::normalize(glm::vec3(alpha * wo.x, alpha * wo.y, wo.z));
+	const float lengthSquared = v.x * v.x + v.y * v.y;
+	const glm::vec3 t1 = lengthSquared > 0.f
+		? glm::vec3(-v.y, v.x, 0.f) / std::sqrt(lengthSquared) : glm::vec3(1.f, 0.f, 0.f);
+	const glm::vec3 t2 = glm::cross(v, t1);
+
+	const float r = std::sqrt(u0);
+	const float phi = 2.f * PI * u1;
+	const float p1 = r * std::cos(phi);
+	float p2 = r * std::sin(phi);
+	const float s = 0.5f * (1.f + v.z);
+	p2 = (1.f - s) * std::sqrt(std::max(1.f - p1 * p1, 0.f)) + s * p2;
+	const glm::vec3 h = p1 * t1 + p2 * t2 + std::sqrt(std::max(1.f - p1 * p1 - p2 * p2, 0.f)) * v;
+	return glm::normalize(glm::vec3(alpha * h.x, alpha * h.y, std::max(h.z, 0.f)));
+}
+
+static glm::vec3 fresnelSchlick(const glm::vec3& f0, float cosTheta) {
+	const float m = std::min(std::max(1.f - cosTheta, 0.f), 1.f);
+	const float m2 = m * m;
+	return f0 + (glm::vec3(1.f) - f0) * (m2 * m2 * m);
+}
+
+/*! reflectance of a smooth dielectric boundary for unpolarized light,
+	arriving at cosI >= 0 to the normal; eta is the index of
+	refraction of the far side over that of the near side */
+static float fresnelDielectric(float cosI, float eta) {
+	const float sin2T = (1.f - cosI * cosI) / (eta * eta);
+	if (sin2T >= 1.f)
+		return 1.f;
+	const float cosT = std::sqrt(1.f - sin2T);
+	const float rs = (cosI - eta * cosT) / (cosI + eta * cosT);
+	const float rp = (eta * cosI - cosT) / (eta * cosI + cosT);
+	return 0.5f * (rs * rs + rp * rp);
+}
+
+Bsdf Bsdf::diffuse(const glm::vec3& albedo) {
+	Bsdf bsdf;
+	bsdf.type = DIFFUSE;
+	bsdf.color = albedo;
+	bsdf.alpha = 1.f;
+	bsdf.ior = 1.f;
+	return bsdf;
+}
+
+Bsdf Bsdf::glossy(const glm::vec3& specular, float alpha) {
+	Bsdf bsdf;
+	bsdf.type = GLOSSY;
+	bsdf.color = specular;
+	// much smoother lobes are mirrors, beyond float precision of D
+	bsdf.alpha = std::min(std::max(alpha, 1e-3f), 1.f);
+	bsdf.ior = 1.f;
+	return bsdf;
+}
+
+Bsdf Bsdf::dielectric(float ior) {
+	Bsdf bsdf;
+	bsdf.type = DIELECTRIC;
+	bsdf.color = glm::vec3(1.f);
+	bsdf.alpha = 0.f;
+	bsdf.ior = ior;
+	return bsdf;
+}
+
+bool Bsdf::sample(const glm::vec3& wo, const glm::vec3& normal, float u0, float u1, float u2,
+				  BsdfSample& sample) const {
+	const float cosO = glm::dot(wo, normal);
+	if (type == DIELECTRIC) {
+		const bool entering = cosO > 0.f;
+		const glm::vec3 n = entering ? normal : -normal;
+		const float cosI = std::abs(cosO);
+		const float eta = entering ? ior : 1.f / ior;
+		const float reflectance = fresnelDielectric(cosI, eta);
+		if (u2 < reflectance) {
+			sample.direction = 2.f * cosI * n - wo;
+			sample.pdf = reflectance;
+		}
+		else {
+			// the radiance scale of 1/eta^2 is left out; it cancels over
+			// a path into and out of a closed object
+			const float cosT = std::sqrt(std::max(1.f - (1.f - cosI * cosI) / (eta * eta), 0.f));
+			sample.direction = glm::normalize(-wo / eta + (cosI / eta - cosT) * n);
+			sample.pdf = 1.f - reflectance;
+		}
+		sample.weight = color;
+		sample.delta = true;
+		return true;
+	}
+
+	if (cosO == 0.f)
+		return false;
+	const Frame frame(cosO > 0.f ? normal : -normal);
+	sample.delta = false;
+	if (type == DIFFUSE) {
+		const glm::vec2 d = concentricDisk(u0, u1);
+		const float z = std::sqrt(std::max(1.f - d.x * d.x - d.y * d.y, 0.f));
+		sample.direction = frame.toWorld(glm::vec3(d.x, d.y, z));
+		sample.weight = color;
+		sample.pdf = z / PI;
+		return sample.pdf > 0.f;
+	}
+
+	const glm::vec3 woLocal = frame.toLocal(wo);
+	const glm::vec3 h = sampleVisibleNormal(woLocal, alpha, u0, u1);
+	const float cosH = glm::dot(woLocal, h);
+	const glm::vec3 wi = 2.f * cosH * h - woLocal;
+	if (wi.z <= 0.f)
+		return false;
+	const float lambdaO = ggxLambda(woLocal, alpha);
+	const float lambdaI = ggxLambda(wi, alpha);
+	sample.direction = frame.toWorld(wi);
+	// f cos / pdf, with f = D G2 F / (4 cosO cosI) and pdf = G1(wo) D / (4 cosO)
+	sample.weight = fresnelSchlick(color, cosH) * ((1.f + lambdaO) / (1.f + lambdaO + lambdaI));
+	sample.pdf = ggxD(h, alpha) / (4.f * woLocal.z * (1.f + lambdaO));
+	return true;
+}
+
+glm::vec3 Bsdf::eval(const glm::vec3& wo, const glm::vec3& wi, const glm::vec3& normal) const {
+	const float cosO = glm::dot(wo, normal);
+	const float cosI = glm::dot(wi, normal);
+	if (type == DIELECTRIC || cosO * cosI <= 0.f)
+		return glm::vec3(0.f);
+	if (type == DIFFUSE)
+		return color * (std::abs(cosI) / PI);
+
+	const Frame frame(cosO > 0.f ? normal : -normal);
+	const glm::vec3 woLocal = frame.toLocal(wo);
+	const glm::vec3 wiLocal = frame.toLocal(wi);
+	const glm::vec3 h = glm::normalize(woLocal + wiLocal);
+	const float g2 = 1.f / (1.f + ggxLambda(woLocal, alpha) + ggxLambda(wiLocal, alpha));
+	return fresnelSchlick(color, glm::dot(woLocal, h)) * (ggxD(h, alpha) * g2 / (4.f * woLocal.z));
+}
+
+float Bsdf::pdf(const glm::vec3& wo, const glm::vec3& wi, const glm::vec3& normal) const {
+	const float cosO = glm::dot(wo, normal);
+	const float cosI = glm::dot(wi, normal);
+	if (type == DIELECTRIC || cosO * cosI <= 0.f)
+		return 0.f;
+	if (type == DIFFUSE)
+		return std::abs(cosI) / PI;
+
+	const Frame frame(cosO > 0.f ? normal : -normal);
+	const glm::vec3 woLocal = frame.toLocal(wo);
+	const glm::vec3 h = glm::normalize(woLocal + frame.toLocal(wi));
+	return ggxD(h, alpha) / (4.f * woLocal.z * (1.f + ggxLambda(woLocal, alpha)));
+}
+
+float roughnessFromShininess(float shininess) {
+	return std::sqrt(2.f / (std::max(shininess, 0.f) + 2.f));
+}
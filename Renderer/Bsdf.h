@@ -0,0 +1,70 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+/*! a direction drawn by Bsdf::sample */
+struct BsdfSample {
+	//! unit direction towards where the light arrives from
+	glm::vec3 direction;
+	//! f(wo, wi) |cos| / pdf, what the path attenuation is multiplied by
+	glm::vec3 weight;
+	//! density per unit solid angle of 'direction'; for a delta lobe the
+	//! probability of having picked it
+	float pdf;
+	//! from a mirror or refraction lobe, which eval and pdf do not cover
+	bool delta;
+};
+
+/*! how a surface scatters light: drawing directions proportional to
+	(about) its contribution, and evaluating given ones, so that other
+	sampling strategies can be weighed against it. All directions are
+	unit vectors pointing away from the surface, wo towards where the
+	path came from, wi towards where the light arrives from; 'normal' is
+	the unit shading normal. DIFFUSE and GLOSSY surfaces are two sided
+	and reflect on the side of wo; a DIELECTRIC's normal points out of
+	it. The same sampling runs on the GPU, in devicePrograms.slang */
+struct Bsdf {
+	enum Type {
+		//! Lambertian, of albedo 'color', sampled cosine weighted
+		DIFFUSE,
+		//! GGX microfacets (Walter et al., "Microfacet Models for
+		//! Refraction through Rough Surfaces", 2007) of roughness 'alpha',
+		//! with Schlick's Fresnel term from 'color' at normal incidence;
+		//! visible normals are sampled (Heitz, "Sampling the GGX
+		//! Distribution of Visible Normals", 2018)
+		GLOSSY,
+		//! a smooth boundary to a medium of index of refraction 'ior',
+		//! reflecting with the probability of the exact Fresnel term and
+		//! refracting otherwise
+		DIELECTRIC
+	} type;
+	glm::vec3 color;
+	float alpha;
+	float ior;
+
+	static Bsdf diffuse(const glm::vec3& albedo);
+
+	static Bsdf glossy(const glm::vec3& specular, float alpha);
+
+	static Bsdf dielectric(float ior);
+
+	//! whether all its lobes are delta lobes, so that eval and pdf are 0
+	bool isDelta() const { return type == DIELECTRIC; }
+
+	/*! draws wi for 'wo' from three uniform numbers in [0,1): u0 and u1
+		for the direction, u2 to pick between reflection and refraction.
+		False if the path ends there: wo grazes the surface, or a glossy
+		reflection would go below it */
+	bool sample(const glm::vec3& wo, const glm::vec3& normal, float u0, float u1, float u2,
+				BsdfSample& sample) const;
+
+	//! f(wo, wi) |cos(normal, wi)|, 0 for delta lobes
+	glm::vec3 eval(const glm::vec3& wo, const glm::vec3& wi, const glm::vec3& normal) const;
+
+	//! density per unit solid angle of sample() drawing wi, 0 for delta lobes
+	float pdf(const glm::vec3& wo, const glm::vec3& wi, const glm::vec3& normal) const;
+};
+
+/*! GGX roughness for a Phong exponent (an OBJ material's Ns), such that
+	both lobes have about the same width (Walter et al.) */
+float roughnessFromShininess(float shininess);
@@ -0,0 +1,451 @@
+#include "Bvh.h"
+#include "BvhBuild.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+// SBVH reference growth cap, as a fraction of the triangle count
+static const float maxSpatialSplitGrowth = 0.3f;
+
+// ranges with fewer triangles are built serially by one thread
+static const int parallelBuildThreshold = 4096;
+// ranges with more triangles are binned with all threads
+static const int parallelBinThreshold = 256 * 1024;
+
+/*! top-down binned SAH builder. Both children of a node are allocated
+	together from a shared counter; the larger subtrees are handed to
+	new threads while there are cores left to run them */
+class BvhBuilder {
+public:
+	BvhBuilder(std::vector<BvhNode>& nodes, std::vector<BuildPrim>& prims)
+		: nodes(nodes), prims(prims), numNodes(1), activeThreads(1), maxThreads(numHostThreads()) {}
+
+	void build(uint32_t nodeID, int begin, int end, int depth);
+
+	uint32_t size() const { return numNodes; }
+
+private:
+	void computeBounds(int begin, int end, Box& bounds, Box& centroidBounds) const;
+	void binPrims(int begin, int end, const Box& centroidBounds, Bins& bins) const;
+
+	std::vector<BvhNode>& nodes;
+	std::vector<BuildPrim>& prims;
+	std::atomic<uint32_t> numNodes;
+	std::atomic<int> activeThreads;
+	const int maxThreads;
+};
+
+void BvhBuilder::computeBounds(int begin, int end, Box& bounds, Box& centroidBounds) const {
+	for (int i = begin; i < end; i++) {
+		bounds.extend(prims[i].lower);
+		bounds.extend(prims[i].upper);
+		centroidBounds.extend(prims[i].centroid);
+	}
+}
+
+void BvhBuilder::binPrims(int begin, int end, const Box& centroidBounds, Bins& bins) const {
+	const glm::vec3 extent = centroidBounds.upper - centroidBounds.lower;
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; axis++)
+		scale[axis] = extent[axis] > 0.f ? numBins / extent[axis] : 0.f;
+
+	auto binRange = [&](int first, int last, Bins& out) {
+		for (int i = first; i < last; i++) {
+			const BuildPrim& prim = prims[i];
+			for (int axis = 0; axis < 3; axis++) {
+				const int bin = binOf(prim.centroid[axis], centroidBounds.lower[axis], scale[axis]);
+				out.count[axis][bin]++;
+				out.bounds[axis][bin].extend(prim.lower);
+				out.bounds[axis][bin].extend(prim.upper);
+			}
+		}
+	};
+
+	if (end - begin < parallelBinThreshold) {
+		binRange(begin, end, bins);
+		return;
+	}
+
+	// the top few levels have too few subtrees to keep all threads busy,
+	// so their binning is split into chunks instead
+	const int chunkSize = 32 * 1024;
+	const int numChunks = (end - begin + chunkSize - 1) / chunkSize;
+	std::vector<Bins> chunkBins(numChunks);
+	parallelFor(0, numChunks, [&](int chunk) {
+		const int first = begin + chunk * chunkSize;
+		binRange(first, std::min(end, first + chunkSize), chunkBins[chunk]);
+	});
+	for (auto& chunk : chunkBins)
+		bins.merge(chunk);
+}
+
+void BvhBuilder::build(uint32_t nodeID, int begin, int end, int depth) {
+	const int count = end - begin;
+	Box bounds, centroidBounds;
+	computeBounds(begin, end, bounds, centroidBounds);
+	nodes[nodeID].lower = bounds.lower;
+	nodes[nodeID].upper = bounds.upper;
+
+	auto makeLeaf = [&]() {
+		nodes[nodeID].offset = begin;
+		nodes[nodeID].count = count;
+	};
+
+	const glm::vec3 extent = centroidBounds.upper - centroidBounds.lower;
+	if (count == 1 || glm::max(extent.x, glm::max(extent.y, extent.z)) <= 0.f) {
+		// all centroids coincide; no plane separates them
+		if (count <= maxLeafSize) {
+			makeLeaf();
+			return;
+		}
+	}
+
+	int mid = -1;
+	if (depth < maxSahDepth && glm::max(extent.x, glm::max(extent.y, extent.z)) > 0.f) {
+		Bins bins;
+		binPrims(begin, end, centroidBounds, bins);
+
+		// sweep from the right for suffix areas and counts, then from the
+		// left to evaluate each of the numBins-1 planes per axis
+		float bestCost = 1e30f;
+		int bestAxis = -1, bestSplit = -1;
+		for (int axis = 0; axis < 3; axis++) {
+			if (extent[axis] <= 0.f)
+				continue;
+			float rightArea[numBins];
+			int rightCount[numBins];
+			Box box;
+			int n = 0;
+			for (int bin = numBins - 1; bin > 0; bin--) {
+				box.extend(bins.bounds[axis][bin]);
+				n += bins.count[axis][bin];
+				rightArea[bin] = box.halfArea();
+				rightCount[bin] = n;
+			}
+			box = Box();
+			n = 0;
+			for (int bin = 0; bin < numBins - 1; bin++) {
+				box.extend(bins.bounds[axis][bin]);
+				n += bins.count[axis][bin];
+				if (n == 0 || rightCount[bin + 1] == 0)
+					continue;
+				const float cost = box.halfArea() * n + rightArea[bin + 1] * rightCount[bin + 1];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = bin;
+				}
+			}
+		}
+
+		const float parentArea = bounds.halfArea();
+		const float splitCost = traversalCost + intersectionCost * bestCost / std::max(parentArea, 1e-30f);
+		const float leafCost = intersectionCost * count;
+		if (bestAxis >= 0 && (splitCost < leafCost || count > maxLeafSize)) {
+			const float lower = centroidBounds.lower[bestAxis];
+			const float scale = numBins / extent[bestAxis];
+			mid = int(std::partition(prims.begin() + begin, prims.begin() + end,
+				[&](const BuildPrim& prim) { return binOf(prim.centroid[bestAxis], lower, scale) <= bestSplit; })
+				- prims.begin());
+		}
+		else if (count <= maxLeafSize) {
+			makeLeaf();
+			return;
+		}
+	}
+
+	if (mid <= begin || mid >= end) {
+		// too deep, or no usable plane: split at the object median
+		const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		mid = (begin + end) / 2;
+		std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+			[axis](const BuildPrim& a, const BuildPrim& b) { return a.centroid[axis] < b.centroid[axis]; });
+	}
+
+	const uint32_t leftID = numNodes.fetch_add(2);
+	nodes[nodeID].offset = leftID;
+	nodes[nodeID].count = 0;
+
+	// run the left half on a new thread if it is big enough to pay for
+	// one and a core is idle; the current thread continues on the right
+	bool spawn = false;
+	if (std::min(mid - begin, end - mid) >= parallelBuildThreshold) {
+		if (activeThreads.fetch_add(1) < maxThreads)
+			spawn = true;
+		else
+			activeThreads--;
+	}
+	if (spawn) {
+		std::thread left([=]() { build(leftID, begin, mid, depth + 1); });
+		build(leftID + 1, mid, end, depth + 1);
+		left.join();
+		activeThreads--;
+	}
+	else {
+		build(leftID, begin, mid, depth + 1);
+		build(leftID + 1, mid, end, depth + 1);
+	}
+}
+
+void buildSahBvh(std::vector<BuildPrim>& prims, std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs) {
+	const int numPrims = (int)prims.size();
+	// a binary tree over n leaves of at least one primitive has < 2n nodes
+	nodes.assign(2 * numPrims, BvhNode());
+	BvhBuilder builder(nodes, prims);
+	builder.build(0, 0, numPrims, 0);
+	nodes.resize(builder.size());
+	nodes.shrink_to_fit();
+
+	refs.resize(numPrims);
+	for (int i = 0; i < numPrims; i++)
+		refs[i] = prims[i].ref;
+}
+
+float sahCost(const BvhNode* nodes, size_t numNodes) {
+	auto area = [](const BvhNode& node) {
+		const glm::vec3 d = glm::max(node.upper - node.lower, glm::vec3(0.f));
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	};
+	const float rootArea = std::max(area(nodes[0]), 1e-30f);
+	double cost = 0.0;
+	for (size_t i = 0; i < numNodes; i++)
+		cost += area(nodes[i]) / rootArea * (nodes[i].isLeaf() ? intersectionCost * nodes[i].count : traversalCost);
+	return float(cost);
+}
+
+float Bvh::sahCost() const {
+	return ::sahCost(nodes.data(), nodes.size());
+}
+
+const char* bvhBuildQualityName(BvhBuildQuality quality) {
+	switch (quality) {
+	case BvhBuildQuality::SBVH: return "SBVH";
+	case BvhBuildQuality::LBVH: return "LBVH";
+	case BvhBuildQuality::PLOC: return "PLOC";
+	default: return "SAH";
+	}
+}
+
+void Bvh::build(const Model* model, BvhBuildQuality quality) {
+	auto start = std::chrono::steady_clock::now();
+	this->model = model;
+	this->quality = quality;
+	builtTriangleCounts.resize(model->meshes.size());
+	for (size_t meshID = 0; meshID < model->meshes.size(); meshID++)
+		builtTriangleCounts[meshID] = model->meshes[meshID]->index.size();
+
+	std::vector<size_t> meshOffset(model->meshes.size() + 1, 0);
+	for (size_t meshID = 0; meshID < model->meshes.size(); meshID++)
+		meshOffset[meshID + 1] = meshOffset[meshID] + model->meshes[meshID]->index.size();
+	const int numPrims = (int)meshOffset.back();
+
+	std::vector<BuildPrim> buildPrims(numPrims);
+	parallelFor(0, (int)model->meshes.size(), [&](int meshID) {
+		const TriangleMesh& mesh = *model->meshes[meshID];
+		for (int primID = 0; primID < (int)mesh.index.size(); primID++) {
+			const glm::ivec3 index = mesh.index[primID];
+			BuildPrim& prim = buildPrims[meshOffset[meshID] + primID];
+			prim.lower = glm::min(mesh.vertex[index.x], glm::min(mesh.vertex[index.y], mesh.vertex[index.z]));
+			prim.upper = glm::max(mesh.vertex[index.x], glm::max(mesh.vertex[index.y], mesh.vertex[index.z]));
+			prim.centroid = 0.5f * (prim.lower + prim.upper);
+			prim.ref = { meshID, primID };
+		}
+	});
+
+	std::vector<BvhNode> builtNodes;
+	std::vector<PrimRef> builtPrims;
+	if (numPrims == 0) {
+		// an empty leaf with inverted bounds, never hit
+		builtNodes.assign(1, BvhNode());
+		builtNodes[0] = { glm::vec3(1e30f), 0, glm::vec3(-1e30f), 0 };
+	}
+	else if (quality == BvhBuildQuality::SBVH) {
+		buildSpatialBvh(model, buildPrims, maxSpatialSplitGrowth, builtNodes, builtPrims);
+	}
+	else if (quality != BvhBuildQuality::SAH) {
+		buildLinearBvh(buildPrims, quality == BvhBuildQuality::PLOC, builtNodes, builtPrims);
+	}
+	else {
+		buildSahBvh(buildPrims, builtNodes, builtPrims);
+	}
+	nodes.assign(std::move(builtNodes));
+	prims.assign(std::move(builtPrims));
+
+	builtSahCost = sahCost();
+	auto end = std::chrono::steady_clock::now();
+	const double seconds = std::chrono::duration<double>(end - start).count();
+	std::cout << "BVH: " << bvhBuildQualityName(quality) << " over " << numPrims << " triangles, " << nodes.size() << " nodes in "
+		<< seconds * 1e3 << " ms (" << numPrims / std::max(seconds, 1e-9) * 1e-6 << " Mtris/s, "
+		<< numHostThreads() << " threads), SAH cost " << builtSahCost;
+	if (prims.size() != size_t(numPrims))
+		std::cout << ", " << prims.size() << " references";
+	std::cout << "\n";
+}
+
+void Bvh::optimize(int rounds) {
+	auto start = std::chrono::steady_clock::now();
+	const float before = sahCost();
+	std::vector<BvhNode> optimizedNodes(nodes.begin(), nodes.end());
+	std::vector<PrimRef> optimizedPrims(prims.begin(), prims.end());
+	optimizeTreelets(optimizedNodes, optimizedPrims, rounds);
+	nodes.assign(std::move(optimizedNodes));
+	prims.assign(std::move(optimizedPrims));
+	builtSahCost = sahCost();
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "BVH: treelet optimization in " << std::chrono::duration<double, std::milli>(end - start).count()
+		<< " ms, SAH cost " << before << " -> " << builtSahCost << "\n";
+}
+
+void Bvh::refit() {
+	if (prims.empty())
+		return;
+	refitBvh(nodes, [this](const BvhNode& leaf) {
+		Box box;
+		for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+			const TriangleMesh& mesh = *model->meshes[prims[i].meshID];
+			const glm::ivec3 index = mesh.index[prims[i].primID];
+			box.extend(mesh.vertex[index.x]);
+			box.extend(mesh.vertex[index.y]);
+			box.extend(mesh.vertex[index.z]);
+		}
+		return box;
+	});
+}
+
+bool Bvh::update(float maxSahGrowth) {
+	bool sameTriangles = model->meshes.size() == builtTriangleCounts.size();
+	for (size_t meshID = 0; sameTriangles && meshID < model->meshes.size(); meshID++)
+		sameTriangles = model->meshes[meshID]->index.size() == builtTriangleCounts[meshID];
+	if (sameTriangles) {
+		refit();
+		if (sahGrowth() <= maxSahGrowth)
+			return false;
+		std::cout << "BVH: SAH cost grew by " << sahGrowth() << "x since the last build, rebuilding\n";
+	}
+	build(model, quality);
+	return true;
+}
+
+float Bvh::sahGrowth() const {
+	return prims.empty() ? 1.f : sahCost() / std::max(builtSahCost, 1e-30f);
+}
+
+/*! Moeller-Trumbore; u and v weigh the second and third vertex, like
+	the barycentrics OptiX reports for triangles. Edges are tested on
+	undivided values with det's sign folded in, in the same form (and
+	order of operations) as Bvh8's triangle blocks and ray packets, so
+	all traversals agree on rays through shared edges */
+bool Bvh::intersectTriangle(const Ray& ray, const PrimRef& prim, float tmax, Hit& hit) const {
+	const TriangleMesh& mesh = *model->meshes[prim.meshID];
+	const glm::ivec3 index = mesh.index[prim.primID];
+	const glm::vec3 A = mesh.vertex[index.x];
+	const glm::vec3 e1 = mesh.vertex[index.y] - A;
+	const glm::vec3 e2 = mesh.vertex[index.z] - A;
+	const glm::vec3 N = glm::cross(e1, e2);
+	const glm::vec3& d = ray.direction;
+
+	// det = -dot(d, N); a det of 0 fails the u + v test below
+	const float det = 0.f - (d.x * N.x + (d.y * N.y + d.z * N.z));
+	const float sign = std::signbit(det) ? -1.f : 1.f;
+	const float absDet = det * sign;
+	if (det == 0.f)
+		return false;
+
+	// with s = o - A and R = cross(s, d): u * det = dot(e2, R),
+	// v * det = -dot(e1, R) and t * det = dot(s, N)
+	const glm::vec3 s = ray.origin - A;
+	const glm::vec3 R(s.y * d.z - s.z * d.y, s.z * d.x - s.x * d.z, s.x * d.y - s.y * d.x);
+	const float u = (e2.x * R.x + (e2.y * R.y + e2.z * R.z)) * sign;
+	const float v = (0.f - (e1.x * R.x + (e1.y * R.y + e1.z * R.z))) * sign;
+	if (!(0.f <= u && 0.f <= v && u + v <= absDet))
+		return false;
+	const float tDet = (s.x * N.x + (s.y * N.y + s.z * N.z)) * sign;
+	if (!(absDet * ray.tmin < tDet && tDet < absDet * tmax))
+		return false;
+	const float t = tDet / absDet;
+	if (!(ray.tmin < t && t < tmax))
+		return false;
+
+	const float invDet = 1.f / absDet;
+	hit.t = t;
+	hit.meshID = prim.meshID;
+	hit.primID = prim.primID;
+	hit.barycentrics = glm::vec2(u * invDet, v * invDet);
+	hit.normal = N;
+	return true;
+}
+
+bool Bvh::closestHit(const Ray& ray, Hit& hit, uint32_t rootID) const {
+	const glm::vec3 invDir = 1.f / ray.direction;
+	float tmax = ray.tmax;
+	bool found = false;
+
+	uint32_t stack[128];
+	int stackSize = 0;
+	uint32_t nodeID = rootID;
+	if (intersectBox(nodes[rootID], ray, invDir, tmax) >= tmax)
+		return false;
+
+	while (true) {
+		const BvhNode& node = nodes[nodeID];
+		if (node.isLeaf()) {
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+				if (intersectTriangle(ray, prims[i], tmax, hit)) {
+					tmax = hit.t;
+					found = true;
+				}
+		}
+		else {
+			// visit the nearer child first, keep the other for later
+			uint32_t near = node.offset, far = node.offset + 1;
+			float tNear = intersectBox(nodes[near], ray, invDir, tmax);
+			float tFar = intersectBox(nodes[far], ray, invDir, tmax);
+			if (tFar < tNear) {
+				std::swap(near, far);
+				std::swap(tNear, tFar);
+			}
+			if (tNear < tmax) {
+				if (tFar < tmax)
+					stack[stackSize++] = far;
+				nodeID = near;
+				continue;
+			}
+		}
+
+		// pop the next node that is still in front of the closest hit
+		if (stackSize == 0)
+			break;
+		nodeID = stack[--stackSize];
+	}
+	return found;
+}
+
+bool Bvh::anyHit(const Ray& ray, Hit& hit, uint32_t rootID) const {
+	const glm::vec3 invDir = 1.f / ray.direction;
+	uint32_t stack[128];
+	int stackSize = 0;
+	stack[stackSize++] = rootID;
+
+	// no ordering needed: the first hit found ends the query
+	while (stackSize > 0) {
+		const BvhNode& node = nodes[stack[--stackSize]];
+		if (intersectBox(node, ray, invDir, ray.tmax) >= ray.tmax)
+			continue;
+		if (node.isLeaf()) {
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+				if (intersectTriangle(ray, prims[i], ray.tmax, hit))
+					return true;
+		}
+		else {
+			stack[stackSize++] = node.offset + 1;
+			stack[stackSize++] = node.offset;
+		}
+	}
+	return false;
+}
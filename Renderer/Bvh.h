@@ -0,0 +1,144 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include "Model.h"
+#include "MappableArray.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+struct Ray {
+	glm::vec3 origin;
+	float tmin{ 0.f };
+	glm::vec3 direction;
+	float tmax{ 1e20f };
+};
+
+/*! what a closest hit query reports; the same values OptiX hands to
+	closesthit_radiance (PrimitiveIndex, barycentrics, RayTCurrent) */
+struct Hit {
+	float t;
+	int meshID{ -1 };
+	int primID{ -1 };
+	//! weights of the triangle's second and third vertex
+	glm::vec2 barycentrics;
+	//! geometric normal cross(B - A, C - A), not normalized; in world
+	//! space also for instanced geometry
+	glm::vec3 normal;
+	//! the instance hit, in an InstanceBvh; -1 for a plain Bvh
+	int instanceID{ -1 };
+};
+
+/*! 32 byte node; inner nodes store their two children next to each
+	other at 'offset', leaves 'count' triangles starting at 'offset' */
+struct BvhNode {
+	glm::vec3 lower;
+	uint32_t offset;
+	glm::vec3 upper;
+	uint32_t count;
+
+	bool isLeaf() const { return count > 0; }
+};
+
+/*! slab test; returns the entry distance, or tmax if the box is missed */
+inline float intersectBox(const BvhNode& node, const Ray& ray, const glm::vec3& invDir, float tmax) {
+	const glm::vec3 t0 = (node.lower - ray.origin) * invDir;
+	const glm::vec3 t1 = (node.upper - ray.origin) * invDir;
+	const glm::vec3 tnear = glm::min(t0, t1);
+	const glm::vec3 tfar = glm::max(t0, t1);
+	const float entry = std::max(std::max(tnear.x, tnear.y), std::max(tnear.z, ray.tmin));
+	const float exit = std::min(std::min(tfar.x, tfar.y), std::min(tfar.z, tmax));
+	return entry <= exit ? entry : tmax;
+}
+
+//! a triangle of the model: mesh ID and index into mesh->index
+struct PrimRef {
+	int meshID;
+	int primID;
+};
+
+/*! how Bvh::build trades build time for trace speed */
+enum class BvhBuildQuality {
+	//! top-down binned SAH; the best trees, for static scenes
+	SAH,
+	//! SAH with spatial splits, which clip long triangles into several
+	//! leaves; faster traversal of architectural scenes for a slower
+	//! build and up to 30% more triangle references
+	SBVH,
+	//! Morton order radix tree; the fastest build, for rebuilding every frame
+	LBVH,
+	//! Morton order, then agglomerative clustering; near SAH quality at
+	//! a fraction of its build time
+	PLOC
+};
+
+//! "SAH", "SBVH", "LBVH" or "PLOC"
+const char* bvhBuildQualityName(BvhBuildQuality quality);
+
+/*! host side bounding volume hierarchy over all triangles of a model,
+	for the CPU backend. Built in parallel, top-down with a binned SAH
+	(optionally with spatial splits) or bottom-up from Morton order.
+	With spatial splits a triangle may be in 'prims' more than once */
+class Bvh {
+public:
+	/*! (re-)builds over all triangles of the model, and prints build
+		time, throughput and SAH cost of the result */
+	void build(const Model* model, BvhBuildQuality quality = BvhBuildQuality::SAH);
+
+	/*! lowers the SAH cost of the built tree by treelet restructuring
+		(see optimizeTreelets), in parallel; for static scenes, which
+		are traced far more often than built. Prints the time taken and
+		the SAH cost before and after. Rebuilds by update() are not
+		optimized again */
+	void optimize(int rounds = 3);
+
+	/*! recomputes all node bounds bottom-up from the model's current
+		vertices, in parallel; the tree keeps its topology, so its
+		quality degrades as the triangles move away from where they were
+		built. Spatial split references get whole triangle bounds */
+	void refit();
+
+	/*! brings the tree up to date after the vertices of the built model
+		moved: refits, and rebuilds with the last build's quality instead
+		where the meshes' triangle counts changed or the refitted tree's
+		SAH cost grew past maxSahGrowth times that of the last build.
+		Returns true if it rebuilt */
+	bool update(float maxSahGrowth = 1.5f);
+
+	//! current SAH cost relative to that right after the last build
+	float sahGrowth() const;
+
+	/*! closest intersection in (ray.tmin, ray.tmax); returns false (and
+		leaves 'hit' alone) if there is none. Only the subtree below
+		rootID is searched */
+	bool closestHit(const Ray& ray, Hit& hit, uint32_t rootID = 0) const;
+
+	/*! some intersection in (ray.tmin, ray.tmax), whichever is found
+		first, below rootID; for shadow rays and other visibility tests */
+	bool anyHit(const Ray& ray, Hit& hit, uint32_t rootID = 0) const;
+
+	/*! ray-triangle test against one of the model's triangles; fills in
+		'hit' and returns true for an intersection in (ray.tmin, tmax) */
+	bool intersectTriangle(const Ray& ray, const PrimRef& prim, float tmax, Hit& hit) const;
+
+	/*! expected cost of a ray through the tree by the SAH, relative to
+		the root's surface area; lower is better */
+	float sahCost() const;
+
+	//! the model of the last build(), which 'prims' refer to
+	const Model* builtModel() const { return model; }
+
+	//! owned after build(), or used in place from a BvhCache file
+	MappableArray<BvhNode> nodes;
+	MappableArray<PrimRef> prims;
+
+private:
+	friend class BvhCache;
+
+	const Model* model{ nullptr };
+	BvhBuildQuality quality{ BvhBuildQuality::SAH };
+	float builtSahCost{ 0.f };
+	//! per mesh, to tell a refit from a rebuild in update()
+	std::vector<size_t> builtTriangleCounts;
+};
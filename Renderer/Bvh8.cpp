@@ -0,0 +1,717 @@
+#include "Bvh8.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define BVH8_SSE
+#endif
+
+typedef std::vector<TriangleBlock, AlignedAllocator<TriangleBlock, 32>> TriangleBlocks;
+typedef std::vector<Bvh8Node, AlignedAllocator<Bvh8Node, 64>> WideNodes;
+
+//! smallest grid step of quantized bounds, for flat frames
+static const int minQuantizationExponent = -100;
+
+static inline float halfArea(const BvhNode& node) {
+	const glm::vec3 d = glm::max(node.upper - node.lower, glm::vec3(0.f));
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+/*! the binary nodes with subtrees of at most simdWidth triangles made
+	leaves, since a triangle block tests that many as fast as one */
+static std::vector<BvhNode> mergeSmallLeaves(const Bvh& bvh) {
+	std::vector<BvhNode> binary(bvh.nodes.begin(), bvh.nodes.end());
+	// children are allocated after their parents
+	for (size_t i = binary.size(); i-- > 0;) {
+		BvhNode& node = binary[i];
+		if (node.isLeaf())
+			continue;
+		const BvhNode& left = binary[node.offset];
+		const BvhNode& right = binary[node.offset + 1];
+		if (!left.isLeaf() || !right.isLeaf() || left.count + right.count > (uint32_t)simdWidth)
+			continue;
+		if (left.offset + left.count != right.offset && right.offset + right.count != left.offset)
+			continue;
+		node.offset = std::min(left.offset, right.offset);
+		node.count = left.count + right.count;
+	}
+	return binary;
+}
+
+static inline void setTriangle(TriangleBlock& block, int lane, const glm::vec3& A, const glm::vec3& e1, const glm::vec3& e2) {
+	const glm::vec3 normal = glm::cross(e1, e2);
+	block.ax[lane] = A.x; block.ay[lane] = A.y; block.az[lane] = A.z;
+	block.e1x[lane] = e1.x; block.e1y[lane] = e1.y; block.e1z[lane] = e1.z;
+	block.e2x[lane] = e2.x; block.e2y[lane] = e2.y; block.e2z[lane] = e2.z;
+	block.nx[lane] = normal.x; block.ny[lane] = normal.y; block.nz[lane] = normal.z;
+}
+
+static inline void setTriangle(TriangleBlock& block, int lane, const Model* model, const PrimRef& prim) {
+	const TriangleMesh& mesh = *model->meshes[prim.meshID];
+	const glm::ivec3 index = mesh.index[prim.primID];
+	const glm::vec3 A = mesh.vertex[index.x];
+	setTriangle(block, lane, A, mesh.vertex[index.y] - A, mesh.vertex[index.z] - A);
+}
+
+/*! appends the records of a binary leaf's triangles to 'triangles' */
+static void appendTriangleBlocks(const Bvh& bvh, const BvhNode& leaf, TriangleBlocks& triangles) {
+	const Model* model = bvh.builtModel();
+	for (uint32_t first = 0; first < leaf.count; first += simdWidth) {
+		TriangleBlock block;
+		for (int lane = 0; lane < simdWidth; lane++) {
+			PrimRef prim = { -1, -1 };
+			if (first + lane < leaf.count) {
+				prim = bvh.prims[leaf.offset + first + lane];
+				setTriangle(block, lane, model, prim);
+			}
+			else
+				setTriangle(block, lane, glm::vec3(0.f), glm::vec3(0.f), glm::vec3(0.f));
+			block.meshID[lane] = prim.meshID;
+			block.primID[lane] = prim.primID;
+		}
+		triangles.push_back(block);
+	}
+}
+
+/*! fills wide node 'wideID' with the (at most 8) binary nodes that are
+	left after opening the largest inner descendants of 'binaryID', and
+	recurses into the ones that are still inner nodes */
+static void collapse(const Bvh& bvh, const BvhNode* binary, WideNodes& nodes,
+					 TriangleBlocks* triangles, std::vector<uint32_t>& sourceNodes, uint32_t wideID, uint32_t binaryID) {
+	uint32_t open[8];
+	int numOpen = 0;
+	const BvhNode& root = binary[binaryID];
+	if (root.isLeaf()) {
+		open[numOpen++] = binaryID;
+	}
+	else {
+		open[numOpen++] = root.offset;
+		open[numOpen++] = root.offset + 1;
+	}
+
+	while (numOpen < 8) {
+		int best = -1;
+		float bestArea = -1.f;
+		for (int i = 0; i < numOpen; i++) {
+			const BvhNode& node = binary[open[i]];
+			if (!node.isLeaf() && halfArea(node) > bestArea) {
+				bestArea = halfArea(node);
+				best = i;
+			}
+		}
+		if (best < 0)
+			break;
+		const uint32_t children = binary[open[best]].offset;
+		open[best] = children;
+		open[numOpen++] = children + 1;
+	}
+
+	uint32_t innerChildren[8];
+	int numInner = 0;
+	{
+		Bvh8Node& wide = nodes[wideID];
+		wide.numChildren = numOpen;
+		for (int i = 0; i < 8; i++) {
+			// empty slots get inverted bounds; traversal masks them out anyway
+			wide.lowerX[i] = wide.lowerY[i] = wide.lowerZ[i] = 1e30f;
+			wide.upperX[i] = wide.upperY[i] = wide.upperZ[i] = -1e30f;
+			wide.child[i] = 0;
+			wide.count[i] = 0;
+		}
+		for (int i = 0; i < numOpen; i++) {
+			const BvhNode& node = binary[open[i]];
+			sourceNodes[8 * wideID + i] = open[i];
+			wide.lowerX[i] = node.lower.x; wide.upperX[i] = node.upper.x;
+			wide.lowerY[i] = node.lower.y; wide.upperY[i] = node.upper.y;
+			wide.lowerZ[i] = node.lower.z; wide.upperZ[i] = node.upper.z;
+			if (node.isLeaf()) {
+				wide.child[i] = triangles ? (uint32_t)triangles->size() : node.offset;
+				wide.count[i] = (uint8_t)node.count;
+				if (triangles)
+					appendTriangleBlocks(bvh, node, *triangles);
+			}
+			else {
+				innerChildren[numInner++] = i;
+			}
+		}
+	}
+
+	// allocate first, since push_back may move 'wide'
+	for (int i = 0; i < numInner; i++) {
+		const uint32_t childID = (uint32_t)nodes.size();
+		nodes.push_back(Bvh8Node());
+		nodes[wideID].child[innerChildren[i]] = childID;
+	}
+	sourceNodes.resize(8 * nodes.size());
+	for (int i = 0; i < numInner; i++)
+		collapse(bvh, binary, nodes, triangles, sourceNodes, nodes[wideID].child[innerChildren[i]], open[innerChildren[i]]);
+}
+
+//! 2^exponent, built from the bits; exact for normal floats
+static inline float exponentScale(int exponent) {
+	const uint32_t bits = uint32_t(exponent + 127) << 23;
+	float scale;
+	std::memcpy(&scale, &bits, sizeof(scale));
+	return scale;
+}
+
+/*! the bounds of the first numChildren children of 'wide' as grid
+	coordinates of a frame around all of them. The step is the smallest
+	power of two that spans the frame in 255 steps, so that decoding,
+	origin + q * step, rounds only once; each coordinate is then moved
+	outward until its decoded value contains the exact bound */
+static void quantizeBounds(const Bvh8Node& wide, uint32_t numChildren, Bvh8QuantizedNode& node) {
+	for (int axis = 0; axis < 3; axis++) {
+		const float* lower = wide.lowerX + 16 * axis;
+		const float* upper = lower + 8;
+		uint8_t* quantizedLower = node.lowerX + 16 * axis;
+		uint8_t* quantizedUpper = quantizedLower + 8;
+
+		float frameLower = 0.f, frameUpper = 0.f;
+		if (numChildren > 0) {
+			frameLower = *std::min_element(lower, lower + numChildren);
+			frameUpper = *std::max_element(upper, upper + numChildren);
+		}
+		int exponent = minQuantizationExponent;
+		if (frameUpper > frameLower) {
+			std::frexp((frameUpper - frameLower) / 255.f, &exponent);
+			exponent = std::max(exponent, minQuantizationExponent);
+		}
+		while (exponent < 127 && frameLower + 255.f * exponentScale(exponent) < frameUpper)
+			exponent++;
+		const float step = exponentScale(exponent);
+		node.origin[axis] = frameLower;
+		node.exponent[axis] = (int8_t)exponent;
+
+		for (uint32_t i = 0; i < 8; i++) {
+			if (i >= numChildren) {
+				quantizedLower[i] = quantizedUpper[i] = 0;
+				continue;
+			}
+			int low = (int)std::min(std::max(std::floor((lower[i] - frameLower) / step), 0.f), 255.f);
+			while (low > 0 && frameLower + low * step > lower[i])
+				low--;
+			int high = (int)std::min(std::max(std::ceil((upper[i] - frameLower) / step), 0.f), 255.f);
+			while (high < 255 && frameLower + high * step < upper[i])
+				high++;
+			quantizedLower[i] = (uint8_t)low;
+			quantizedUpper[i] = (uint8_t)high;
+		}
+	}
+}
+
+/*! the quantized form of a collapsed node; its inner children and the
+	triangle blocks of its leaf children were allocated consecutively */
+static Bvh8QuantizedNode quantizeNode(const Bvh8Node& wide) {
+	Bvh8QuantizedNode node;
+	std::memset(&node, 0, sizeof(node));
+	node.numChildren = (uint8_t)wide.numChildren;
+	node.childBase = node.triangleBase = UINT32_MAX;
+	for (uint32_t i = 0; i < wide.numChildren; i++) {
+		uint32_t& base = wide.count[i] > 0 ? node.triangleBase : node.childBase;
+		base = std::min(base, wide.child[i]);
+	}
+	for (uint32_t i = 0; i < wide.numChildren; i++) {
+		const uint32_t offset = wide.child[i] - (wide.count[i] > 0 ? node.triangleBase : node.childBase);
+		if (offset > 255)
+			throw std::runtime_error("BVH8 node has children too far apart to quantize");
+		node.offset[i] = (uint8_t)offset;
+		node.count[i] = wide.count[i];
+	}
+	quantizeBounds(wide, wide.numChildren, node);
+	return node;
+}
+
+void Bvh8::build(const Bvh& bvh, bool triangleRecords, bool quantizedBounds) {
+	if (quantizedBounds && !triangleRecords)
+		throw std::runtime_error("quantized BVH8 nodes need triangle records");
+	auto start = std::chrono::steady_clock::now();
+	this->bvh = &bvh;
+
+	WideNodes wideNodes;
+	wideNodes.reserve(bvh.nodes.size() / 4 + 1);
+	wideNodes.push_back(Bvh8Node());
+	std::vector<uint32_t> sources(8, 0);
+	TriangleBlocks blocks;
+	if (triangleRecords)
+		blocks.reserve(bvh.prims.size() / 2);
+	if (!bvh.prims.empty()) {
+		if (triangleRecords) {
+			const std::vector<BvhNode> merged = mergeSmallLeaves(bvh);
+			collapse(bvh, merged.data(), wideNodes, &blocks, sources, 0, 0);
+		}
+		else
+			collapse(bvh, bvh.nodes.data(), wideNodes, nullptr, sources, 0, 0);
+	}
+	blocks.shrink_to_fit();
+	sourceNodes.assign(std::move(sources));
+	triangles.assign(std::move(blocks));
+
+	const size_t numNodes = wideNodes.size();
+	size_t numChildren = 0;
+	for (const Bvh8Node& node : wideNodes)
+		numChildren += node.numChildren;
+	if (quantizedBounds) {
+		std::vector<Bvh8QuantizedNode> quantized(numNodes);
+		parallelFor(0, (int)numNodes, [&](int wideID) {
+			quantized[wideID] = quantizeNode(wideNodes[wideID]);
+		}, 1024);
+		quantizedNodes.assign(std::move(quantized));
+		nodes.clear();
+	}
+	else {
+		nodes.assign(std::move(wideNodes));
+		quantizedNodes.clear();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "BVH8: " << numNodes << (quantizedBounds ? " quantized" : "") << " nodes, "
+		<< double(numChildren) / numNodes << " children per node, " << nodeBytes() / (1024.0 * 1024.0) << " MB, collapsed in "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << " ms (" << simdName() << " traversal)\n";
+	if (triangleRecords)
+		std::cout << "BVH8: " << triangles.size() << " triangle blocks, "
+			<< 100.0 * bvh.prims.size() / std::max<size_t>(triangles.size() * simdWidth, 1) << "% of lanes used, "
+			<< triangles.size() * sizeof(TriangleBlock) / (1024.0 * 1024.0) << " MB\n";
+}
+
+void Bvh8::refit() {
+	// merged leaves keep the index, and so the bounds, of the binary
+	// node they replaced
+	auto copyBounds = [&](int wideID, uint32_t numChildren, Bvh8Node& wide) {
+		for (uint32_t i = 0; i < numChildren; i++) {
+			const BvhNode& node = bvh->nodes[sourceNodes[8 * wideID + i]];
+			wide.lowerX[i] = node.lower.x; wide.upperX[i] = node.upper.x;
+			wide.lowerY[i] = node.lower.y; wide.upperY[i] = node.upper.y;
+			wide.lowerZ[i] = node.lower.z; wide.upperZ[i] = node.upper.z;
+		}
+	};
+	parallelFor(0, (int)nodes.size(), [&](int wideID) {
+		copyBounds(wideID, nodes[wideID].numChildren, nodes[wideID]);
+	}, 1024);
+	parallelFor(0, (int)quantizedNodes.size(), [&](int wideID) {
+		Bvh8QuantizedNode& node = quantizedNodes[wideID];
+		Bvh8Node wide;
+		copyBounds(wideID, node.numChildren, wide);
+		quantizeBounds(wide, node.numChildren, node);
+	}, 1024);
+
+	const Model* model = bvh->builtModel();
+	parallelFor(0, (int)triangles.size(), [&](int blockID) {
+		TriangleBlock& block = triangles[blockID];
+		for (int lane = 0; lane < simdWidth; lane++)
+			if (block.meshID[lane] >= 0)
+				setTriangle(block, lane, model, PrimRef{ block.meshID[lane], block.primID[lane] });
+	}, 1024);
+}
+
+const char* Bvh8::simdName() {
+#if defined(__AVX2__)
+	return "AVX2";
+#elif defined(BVH8_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+namespace {
+	/*! per ray constants of the slab test. The near plane of an axis is
+		the lower bound for positive directions and the upper one for
+		negative directions; nearX etc. are the float offsets of those
+		arrays within a Bvh8Node */
+	struct TraversalRay {
+		float invDir[3];
+		float originInvDir[3];
+		int nearX, nearY, nearZ;
+		int farX, farY, farZ;
+		float tmin;
+
+		TraversalRay(const Ray& ray) {
+			for (int axis = 0; axis < 3; axis++) {
+				invDir[axis] = 1.f / ray.direction[axis];
+				originInvDir[axis] = ray.origin[axis] * invDir[axis];
+			}
+			nearX = invDir[0] >= 0.f ? 0 : 8;
+			nearY = invDir[1] >= 0.f ? 16 : 24;
+			nearZ = invDir[2] >= 0.f ? 32 : 40;
+			farX = nearX ^ 8;
+			farY = 40 - nearY;
+			farZ = 72 - nearZ;
+			tmin = ray.tmin;
+		}
+	};
+}
+
+/*! slab test of a ray against all children of a node. Returns a bit
+	mask of the children hit before tmax, and their entry distances in
+	dist. Any NaN (from 0 * inf) is kept in the first operand of min/max,
+	which the SSE/AVX instructions then drop */
+static inline uint32_t intersectChildren(const Bvh8Node& node, const TraversalRay& ray, float tmax, float dist[8]) {
+	const float* base = node.lowerX;
+	const uint32_t valid = (1u << node.numChildren) - 1;
+#if defined(__AVX2__)
+	const __m256 invX = _mm256_set1_ps(ray.invDir[0]);
+	const __m256 invY = _mm256_set1_ps(ray.invDir[1]);
+	const __m256 invZ = _mm256_set1_ps(ray.invDir[2]);
+	const __m256 oX = _mm256_set1_ps(ray.originInvDir[0]);
+	const __m256 oY = _mm256_set1_ps(ray.originInvDir[1]);
+	const __m256 oZ = _mm256_set1_ps(ray.originInvDir[2]);
+#ifdef __FMA__
+	const __m256 nearX = _mm256_fmsub_ps(_mm256_load_ps(base + ray.nearX), invX, oX);
+	const __m256 nearY = _mm256_fmsub_ps(_mm256_load_ps(base + ray.nearY), invY, oY);
+	const __m256 nearZ = _mm256_fmsub_ps(_mm256_load_ps(base + ray.nearZ), invZ, oZ);
+	const __m256 farX = _mm256_fmsub_ps(_mm256_load_ps(base + ray.farX), invX, oX);
+	const __m256 farY = _mm256_fmsub_ps(_mm256_load_ps(base + ray.farY), invY, oY);
+	const __m256 farZ = _mm256_fmsub_ps(_mm256_load_ps(base + ray.farZ), invZ, oZ);
+#else
+	const __m256 nearX = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(base + ray.nearX), invX), oX);
+	const __m256 nearY = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(base + ray.nearY), invY), oY);
+	const __m256 nearZ = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(base + ray.nearZ), invZ), oZ);
+	const __m256 farX = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(base + ray.farX), invX), oX);
+	const __m256 farY = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(base + ray.farY), invY), oY);
+	const __m256 farZ = _mm256_sub_ps(_mm256_mul_ps(_mm256_load_ps(base + ray.farZ), invZ), oZ);
+#endif
+	const __m256 tnear = _mm256_max_ps(nearX, _mm256_max_ps(nearY, _mm256_max_ps(nearZ, _mm256_set1_ps(ray.tmin))));
+	const __m256 tfar = _mm256_min_ps(farX, _mm256_min_ps(farY, _mm256_min_ps(farZ, _mm256_set1_ps(tmax))));
+	_mm256_storeu_ps(dist, tnear);
+	return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ)) & valid;
+#elif defined(BVH8_SSE)
+	const __m128 invX = _mm_set1_ps(ray.invDir[0]);
+	const __m128 invY = _mm_set1_ps(ray.invDir[1]);
+	const __m128 invZ = _mm_set1_ps(ray.invDir[2]);
+	const __m128 oX = _mm_set1_ps(ray.originInvDir[0]);
+	const __m128 oY = _mm_set1_ps(ray.originInvDir[1]);
+	const __m128 oZ = _mm_set1_ps(ray.originInvDir[2]);
+	const __m128 tmin4 = _mm_set1_ps(ray.tmin);
+	const __m128 tmax4 = _mm_set1_ps(tmax);
+	uint32_t mask = 0;
+	// two halves of four children each
+	for (int half = 0; half < 8; half += 4) {
+		const __m128 nearX = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(base + ray.nearX + half), invX), oX);
+		const __m128 nearY = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(base + ray.nearY + half), invY), oY);
+		const __m128 nearZ = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(base + ray.nearZ + half), invZ), oZ);
+		const __m128 farX = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(base + ray.farX + half), invX), oX);
+		const __m128 farY = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(base + ray.farY + half), invY), oY);
+		const __m128 farZ = _mm_sub_ps(_mm_mul_ps(_mm_load_ps(base + ray.farZ + half), invZ), oZ);
+		const __m128 tnear = _mm_max_ps(nearX, _mm_max_ps(nearY, _mm_max_ps(nearZ, tmin4)));
+		const __m128 tfar = _mm_min_ps(farX, _mm_min_ps(farY, _mm_min_ps(farZ, tmax4)));
+		_mm_storeu_ps(dist + half, tnear);
+		mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(tnear, tfar)) << half;
+	}
+	return mask & valid;
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < 8; i++) {
+		const float tnear = std::max(std::max(base[ray.nearX + i] * ray.invDir[0] - ray.originInvDir[0],
+											  base[ray.nearY + i] * ray.invDir[1] - ray.originInvDir[1]),
+									 std::max(base[ray.nearZ + i] * ray.invDir[2] - ray.originInvDir[2], ray.tmin));
+		const float tfar = std::min(std::min(base[ray.farX + i] * ray.invDir[0] - ray.originInvDir[0],
+											 base[ray.farY + i] * ray.invDir[1] - ray.originInvDir[1]),
+									std::min(base[ray.farZ + i] * ray.invDir[2] - ray.originInvDir[2], tmax));
+		dist[i] = tnear;
+		if (tnear <= tfar)
+			mask |= 1u << i;
+	}
+	return mask & valid;
+#endif
+}
+
+/*! as above for quantized bounds. Per node and axis the decode and the
+	slab test fold into one multiply-add per plane, q * (step / d) +
+	(origin - o) / d, on the grid coordinates widened to floats */
+static inline uint32_t intersectChildren(const Bvh8QuantizedNode& node, const TraversalRay& ray, float tmax, float dist[8]) {
+	const uint8_t* base = node.lowerX;
+	const uint32_t valid = (1u << node.numChildren) - 1;
+	float scale[3], offset[3];
+	for (int axis = 0; axis < 3; axis++) {
+		scale[axis] = exponentScale(node.exponent[axis]) * ray.invDir[axis];
+		offset[axis] = node.origin[axis] * ray.invDir[axis] - ray.originInvDir[axis];
+	}
+#if defined(__AVX2__)
+	auto plane = [&](int byteOffset, int axis) {
+		const __m128i bytes = _mm_loadl_epi64((const __m128i*)(base + byteOffset));
+		const __m256 q = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+#ifdef __FMA__
+		return _mm256_fmadd_ps(q, _mm256_set1_ps(scale[axis]), _mm256_set1_ps(offset[axis]));
+#else
+		return _mm256_add_ps(_mm256_mul_ps(q, _mm256_set1_ps(scale[axis])), _mm256_set1_ps(offset[axis]));
+#endif
+	};
+	const __m256 tnear = _mm256_max_ps(plane(ray.nearX, 0), _mm256_max_ps(plane(ray.nearY, 1),
+		_mm256_max_ps(plane(ray.nearZ, 2), _mm256_set1_ps(ray.tmin))));
+	const __m256 tfar = _mm256_min_ps(plane(ray.farX, 0), _mm256_min_ps(plane(ray.farY, 1),
+		_mm256_min_ps(plane(ray.farZ, 2), _mm256_set1_ps(tmax))));
+	_mm256_storeu_ps(dist, tnear);
+	return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ)) & valid;
+#elif defined(BVH8_SSE)
+	const __m128i zero = _mm_setzero_si128();
+	auto plane = [&](int byteOffset, int axis) {
+		int32_t packed;
+		std::memcpy(&packed, base + byteOffset, sizeof(packed));
+		const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+		const __m128 q = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+		return _mm_add_ps(_mm_mul_ps(q, _mm_set1_ps(scale[axis])), _mm_set1_ps(offset[axis]));
+	};
+	const __m128 tmin4 = _mm_set1_ps(ray.tmin);
+	const __m128 tmax4 = _mm_set1_ps(tmax);
+	uint32_t mask = 0;
+	for (int half = 0; half < 8; half += 4) {
+		const __m128 tnear = _mm_max_ps(plane(ray.nearX + half, 0), _mm_max_ps(plane(ray.nearY + half, 1),
+			_mm_max_ps(plane(ray.nearZ + half, 2), tmin4)));
+		const __m128 tfar = _mm_min_ps(plane(ray.farX + half, 0), _mm_min_ps(plane(ray.farY + half, 1),
+			_mm_min_ps(plane(ray.farZ + half, 2), tmax4)));
+		_mm_storeu_ps(dist + half, tnear);
+		mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(tnear, tfar)) << half;
+	}
+	return mask & valid;
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < 8; i++) {
+		const float tnear = std::max(std::max(base[ray.nearX + i] * scale[0] + offset[0], base[ray.nearY + i] * scale[1] + offset[1]),
+									 std::max(base[ray.nearZ + i] * scale[2] + offset[2], ray.tmin));
+		const float tfar = std::min(std::min(base[ray.farX + i] * scale[0] + offset[0], base[ray.farY + i] * scale[1] + offset[1]),
+									std::min(base[ray.farZ + i] * scale[2] + offset[2], tmax));
+		dist[i] = tnear;
+		if (tnear <= tfar)
+			mask |= 1u << i;
+	}
+	return mask & valid;
+#endif
+}
+
+//! the node or first triangle block child i refers to
+static inline uint32_t childIndex(const Bvh8Node& node, int i) {
+	return node.child[i];
+}
+
+static inline uint32_t childIndex(const Bvh8QuantizedNode& node, int i) {
+	return (node.count[i] > 0 ? node.triangleBase : node.childBase) + node.offset[i];
+}
+
+namespace {
+	//! undivided per lane values of intersectTriangleBlock()
+	struct BlockLanes {
+		alignas(32) float t[simdWidth], u[simdWidth], v[simdWidth], det[simdWidth];
+	};
+}
+
+/*! Moeller-Trumbore of one ray against all triangles of a block, in
+	the form that needs the stored normal N: with s = o - A and
+	R = cross(s, d), det = -dot(d, N), u * det = dot(e2, R),
+	v * det = -dot(e1, R) and t * det = dot(s, N). All tests run on
+	these undivided values, with det's sign folded in, so rounding of a
+	reciprocal cannot open cracks along shared edges. Acceptance matches
+	Bvh::intersectTriangle: u >= 0, v >= 0, u + v <= 1 and
+	tmin < t < tmax. Returns the mask of lanes hit; their values go to
+	'lanes' unless that is null, as for occlusion tests */
+static inline uint32_t triangleBlockMask(const TriangleBlock& block, const Ray& ray, float tmax, BlockLanes* lanes) {
+#ifdef SIMD_FLOAT
+	const vfloat signBit = vset(-0.f);
+	const vfloat zero = vset(0.f);
+	const vfloat dx = vset(ray.direction.x), dy = vset(ray.direction.y), dz = vset(ray.direction.z);
+	const vfloat sx = vsub(vset(ray.origin.x), vload(block.ax));
+	const vfloat sy = vsub(vset(ray.origin.y), vload(block.ay));
+	const vfloat sz = vsub(vset(ray.origin.z), vload(block.az));
+	const vfloat nx = vload(block.nx), ny = vload(block.ny), nz = vload(block.nz);
+
+	const vfloat det = vsub(zero, vadd(vmul(dx, nx), vadd(vmul(dy, ny), vmul(dz, nz))));
+	const vfloat sign = vand(det, signBit);
+	const vfloat absDet = vxor(det, sign);
+
+	const vfloat rx = vsub(vmul(sy, dz), vmul(sz, dy));
+	const vfloat ry = vsub(vmul(sz, dx), vmul(sx, dz));
+	const vfloat rz = vsub(vmul(sx, dy), vmul(sy, dx));
+	const vfloat u = vxor(vadd(vmul(vload(block.e2x), rx), vadd(vmul(vload(block.e2y), ry), vmul(vload(block.e2z), rz))), sign);
+	const vfloat v = vxor(vsub(zero, vadd(vmul(vload(block.e1x), rx), vadd(vmul(vload(block.e1y), ry), vmul(vload(block.e1z), rz)))), sign);
+	const vfloat t = vxor(vadd(vmul(sx, nx), vadd(vmul(sy, ny), vmul(sz, nz))), sign);
+
+	vfloat valid = vand(vneq(det, zero), vand(vle(zero, u), vle(zero, v)));
+	valid = vand(valid, vle(vadd(u, v), absDet));
+	valid = vand(valid, vand(vlt(vmul(absDet, vset(ray.tmin)), t), vlt(t, vmul(absDet, vset(tmax)))));
+	const uint32_t mask = vmovemask(valid);
+	if (mask && lanes) {
+		vstore(lanes->t, t);
+		vstore(lanes->u, u);
+		vstore(lanes->v, v);
+		vstore(lanes->det, absDet);
+	}
+	return mask;
+#else
+	uint32_t mask = 0;
+	for (int lane = 0; lane < simdWidth; lane++) {
+		const glm::vec3 s = ray.origin - glm::vec3(block.ax[lane], block.ay[lane], block.az[lane]);
+		const glm::vec3 normal(block.nx[lane], block.ny[lane], block.nz[lane]);
+		const glm::vec3 r = glm::cross(s, ray.direction);
+		const float det = -glm::dot(ray.direction, normal);
+		const float sign = det < 0.f ? -1.f : 1.f;
+		const float absDet = det * sign;
+		const float u = glm::dot(glm::vec3(block.e2x[lane], block.e2y[lane], block.e2z[lane]), r) * sign;
+		const float v = -glm::dot(glm::vec3(block.e1x[lane], block.e1y[lane], block.e1z[lane]), r) * sign;
+		const float t = glm::dot(s, normal) * sign;
+		if (det != 0.f && u >= 0.f && v >= 0.f && u + v <= absDet && absDet * ray.tmin < t && t < absDet * tmax) {
+			mask |= 1u << lane;
+			if (lanes) {
+				lanes->t[lane] = t;
+				lanes->u[lane] = u;
+				lanes->v[lane] = v;
+				lanes->det[lane] = absDet;
+			}
+		}
+	}
+	return mask;
+#endif
+}
+
+/*! closest hit of a ray in a block: only that one pays for the
+	division. Returns its lane, or -1 */
+static inline int intersectTriangleBlock(const TriangleBlock& block, const Ray& ray, float tmax, Hit& hit) {
+	BlockLanes lanes;
+	uint32_t mask = triangleBlockMask(block, ray, tmax, &lanes);
+	int best = -1;
+	float bestT = tmax;
+	for (; mask; mask &= mask - 1) {
+		const int lane = firstBit(mask);
+		const float laneT = lanes.t[lane] / lanes.det[lane];
+		if (laneT < bestT && laneT > ray.tmin) {
+			bestT = laneT;
+			best = lane;
+		}
+	}
+	if (best < 0)
+		return -1;
+
+	const float invDet = 1.f / lanes.det[best];
+	hit.t = bestT;
+	hit.meshID = block.meshID[best];
+	hit.primID = block.primID[best];
+	hit.barycentrics = glm::vec2(lanes.u[best] * invDet, lanes.v[best] * invDet);
+	hit.normal = glm::vec3(block.nx[best], block.ny[best], block.nz[best]);
+	return best;
+}
+
+template <Bvh8::Query query, typename Node>
+bool Bvh8::traverse(const Node* wideNodes, const Ray& ray, Hit& hit) const {
+	const TraversalRay traversalRay(ray);
+
+	// each level leaves at most 7 entries behind, and the binary tree
+	// (and so the wide one) is less than 72 levels deep
+	struct Entry {
+		uint32_t child;
+		uint32_t count;
+		float t;
+	};
+	Entry stack[512];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, 0, ray.tmin };
+
+	float tmax = ray.tmax;
+	bool found = false;
+	while (stackSize > 0) {
+		const Entry entry = stack[--stackSize];
+		// skip what lies behind a hit found since it was pushed
+		if (entry.t > tmax)
+			continue;
+
+		if (entry.count > 0) {
+			if (!triangles.empty()) {
+				const uint32_t numBlocks = (entry.count + simdWidth - 1) / simdWidth;
+				for (uint32_t i = entry.child; i < entry.child + numBlocks; i++) {
+					if (query == OCCLUSION) {
+						if (triangleBlockMask(triangles[i], ray, tmax, nullptr))
+							return true;
+						continue;
+					}
+					if (intersectTriangleBlock(triangles[i], ray, tmax, hit) >= 0) {
+						if (query == ANY_HIT)
+							return true;
+						tmax = hit.t;
+						found = true;
+					}
+				}
+				continue;
+			}
+			for (uint32_t i = entry.child; i < entry.child + entry.count; i++)
+				if (bvh->intersectTriangle(ray, bvh->prims[i], tmax, hit)) {
+					if (query != CLOSEST_HIT)
+						return true;
+					tmax = hit.t;
+					found = true;
+				}
+			continue;
+		}
+
+		const Node& node = wideNodes[entry.child];
+		float dist[8];
+		uint32_t mask = intersectChildren(node, traversalRay, tmax, dist);
+		if (query != CLOSEST_HIT) {
+			while (mask) {
+				const int i = firstBit(mask);
+				mask &= mask - 1;
+				stack[stackSize++] = { childIndex(node, i), node.count[i], dist[i] };
+			}
+			continue;
+		}
+
+		// push far to near, so the nearest child is popped next
+		Entry sorted[8];
+		int numSorted = 0;
+		while (mask) {
+			const int i = firstBit(mask);
+			mask &= mask - 1;
+			Entry child = { childIndex(node, i), node.count[i], dist[i] };
+			int j = numSorted++;
+			while (j > 0 && sorted[j - 1].t < child.t) {
+				sorted[j] = sorted[j - 1];
+				j--;
+			}
+			sorted[j] = child;
+		}
+		for (int i = 0; i < numSorted; i++)
+			stack[stackSize++] = sorted[i];
+	}
+	return found;
+}
+
+bool Bvh8::closestHit(const Ray& ray, Hit& hit) const {
+	if (!quantizedNodes.empty())
+		return traverse<CLOSEST_HIT>(quantizedNodes.data(), ray, hit);
+	return traverse<CLOSEST_HIT>(nodes.data(), ray, hit);
+}
+
+bool Bvh8::anyHit(const Ray& ray, Hit& hit) const {
+	if (!quantizedNodes.empty())
+		return traverse<ANY_HIT>(quantizedNodes.data(), ray, hit);
+	return traverse<ANY_HIT>(nodes.data(), ray, hit);
+}
+
+bool Bvh8::occluded(const Ray& ray) const {
+	// only written by the path without triangle records
+	Hit hit;
+	if (!quantizedNodes.empty())
+		return traverse<OCCLUSION>(quantizedNodes.data(), ray, hit);
+	return traverse<OCCLUSION>(nodes.data(), ray, hit);
+}
+
+void Bvh8::occluded(const Ray* rays, size_t count, uint8_t* results) const {
+	parallelFor(0, (int)count, [&](int i) { results[i] = occluded(rays[i]) ? 1 : 0; }, 64);
+}
+
+size_t Bvh8::nodeBytes() const {
+	return nodes.size() * sizeof(Bvh8Node) + quantizedNodes.size() * sizeof(Bvh8QuantizedNode);
+}
+
+size_t Bvh8::triangleBytes() const {
+	if (!triangles.empty())
+		return triangles.size() * sizeof(TriangleBlock);
+	size_t bytes = bvh->prims.size() * sizeof(PrimRef);
+	for (const TriangleMesh* mesh : bvh->builtModel()->meshes)
+		bytes += mesh->index.size() * sizeof(glm::ivec3) + mesh->vertex.size() * sizeof(glm::vec3);
+	return bytes;
+}
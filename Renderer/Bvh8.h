@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Bvh.h"
+#include "AlignedAllocator.h"
+#include "Simd.h"
+
+/*! one node of the 8-wide BVH: the bounds of up to 8 children, stored
+	per axis so that one SIMD load fetches a plane of all children.
+	Lower and upper arrays of an axis sit next to each other, so a ray
+	can pick its near and far plane by direction sign with an offset.
+	Valid children come first; 'child' is a node index for inner
+	children. Leaves have count > 0 triangles starting at 'child', a
+	TriangleBlock index or, without triangle records, an index into
+	Bvh::prims */
+struct alignas(64) Bvh8Node {
+	float lowerX[8], upperX[8];
+	float lowerY[8], upperY[8];
+	float lowerZ[8], upperZ[8];
+	uint32_t child[8];
+	uint8_t count[8];
+	uint32_t numChildren;
+};
+
+/*! compressed Bvh8Node, 88 instead of 256 bytes: child bounds are
+	stored as 8-bit grid coordinates in a frame around all children, the
+	origin plus multiples of a power of two step per axis, rounded
+	outward so that the decoded boxes contain the exact ones. Inner
+	children are consecutive nodes from 'childBase', and the triangle
+	blocks of leaf children consecutive from 'triangleBase'; 'offset'
+	adds to the one or the other. Near and far planes are picked by
+	direction sign with a byte offset, as in Bvh8Node */
+struct Bvh8QuantizedNode {
+	float origin[3];
+	//! the grid step of each axis is 2^exponent
+	int8_t exponent[3];
+	uint8_t numChildren;
+	uint32_t childBase;
+	uint32_t triangleBase;
+	uint8_t offset[8];
+	//! triangles of leaf children, 0 for inner ones
+	uint8_t count[8];
+	uint8_t lowerX[8], upperX[8];
+	uint8_t lowerY[8], upperY[8];
+	uint8_t lowerZ[8], upperZ[8];
+};
+
+/*! precomputed records of up to simdWidth triangles of a leaf, stored
+	by component so one SIMD load fetches a value of all of them: the
+	first vertex A, the edges e1 = B - A and e2 = C - A, and the normal
+	cross(e1, e2). Intersection reads nothing else; the mesh arrays are
+	only needed again for shading. Unused lanes have zero edges, which
+	no ray hits */
+struct alignas(32) TriangleBlock {
+	float ax[simdWidth], ay[simdWidth], az[simdWidth];
+	float e1x[simdWidth], e1y[simdWidth], e1z[simdWidth];
+	float e2x[simdWidth], e2y[simdWidth], e2z[simdWidth];
+	float nx[simdWidth], ny[simdWidth], nz[simdWidth];
+	int meshID[simdWidth];
+	int primID[simdWidth];
+};
+
+/*! wide BVH collapsed from a binary Bvh, traversed with AVX2 (8 box
+	tests per instruction) where the build enables it, SSE otherwise.
+	Leaves are the ones of the binary BVH it was built from, which has
+	to outlive it, merged up to simdWidth triangles; their triangles
+	are copied into TriangleBlocks */
+class Bvh8 {
+public:
+	/*! collapses 'bvh' by repeatedly opening the child with the
+		largest surface area until a node has 8 children. Without
+		triangleRecords, leaves fetch their triangles through the
+		meshes' index buffers, as the binary BVH does; that saves the
+		memory of the records and is there for comparison. With
+		quantizedBounds, the nodes are stored as Bvh8QuantizedNodes,
+		which need triangle records */
+	void build(const Bvh& bvh, bool triangleRecords = true, bool quantizedBounds = false);
+
+	/*! follows a Bvh::refit() of the tree this was built from: copies
+		the new bounds and re-reads the triangle records, in parallel,
+		keeping the layout. Trees that Bvh::update() rebuilt need a new
+		build() instead */
+	void refit();
+
+	//! same queries and results as Bvh::closestHit and Bvh::anyHit
+	bool closestHit(const Ray& ray, Hit& hit) const;
+	bool anyHit(const Ray& ray, Hit& hit) const;
+
+	/*! visibility test for shadow rays: true if anything lies in
+		(ray.tmin, ray.tmax). Stops at the first triangle found, without
+		ordering children, and leaves out what anyHit still computes for
+		its hit: the division for t, barycentrics, IDs and normal */
+	bool occluded(const Ray& ray) const;
+
+	//! occluded() of 'count' rays, in parallel; results[i] is 1 or 0
+	void occluded(const Ray* rays, size_t count, uint8_t* results) const;
+
+	//! memory of the nodes, in whichever format they were built
+	size_t nodeBytes() const;
+
+	/*! memory that leaves read triangles from: the records, or without
+		them Bvh::prims and the meshes' index and vertex arrays */
+	size_t triangleBytes() const;
+
+	//! "AVX2", "SSE" or "scalar"
+	static const char* simdName();
+
+	//! owned after build(), or used in place from a BvhCache file
+	MappableArray<Bvh8Node, AlignedAllocator<Bvh8Node, 64>> nodes;
+	//! used instead of 'nodes', which are then empty, with quantizedBounds
+	MappableArray<Bvh8QuantizedNode> quantizedNodes;
+	//! empty when built without triangle records
+	MappableArray<TriangleBlock, AlignedAllocator<TriangleBlock, 32>> triangles;
+
+private:
+	enum Query { CLOSEST_HIT, ANY_HIT, OCCLUSION };
+
+	template <Query query, typename Node>
+	bool traverse(const Node* nodes, const Ray& ray, Hit& hit) const;
+
+	friend class BvhCache;
+
+	const Bvh* bvh{ nullptr };
+	//! the binary node of each child slot, 8 per node, for refit()
+	MappableArray<uint32_t> sourceNodes;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Bvh.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <cstring>
+
+/*! internals shared by the BVH builders in Bvh.cpp (binned SAH),
+	SpatialBvh.cpp (SBVH) and LinearBvh.cpp (LBVH, PLOC), and by the
+	treelet optimizer in TreeletOptimizer.cpp */
+
+// SAH constants: cost of one node traversal step and one triangle test
+static const float traversalCost = 1.f;
+static const float intersectionCost = 1.f;
+// leaves are forced below this size, and preferably as small as SAH allows
+static const int maxLeafSize = 8;
+
+struct BuildPrim {
+	glm::vec3 lower;
+	glm::vec3 upper;
+	glm::vec3 centroid;
+	PrimRef ref;
+};
+
+struct Box {
+	glm::vec3 lower{ 1e30f };
+	glm::vec3 upper{ -1e30f };
+
+	void extend(const glm::vec3& p) { lower = glm::min(lower, p); upper = glm::max(upper, p); }
+	void extend(const Box& b) { lower = glm::min(lower, b.lower); upper = glm::max(upper, b.upper); }
+	float halfArea() const {
+		const glm::vec3 d = glm::max(upper - lower, glm::vec3(0.f));
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	}
+};
+
+static const int numBins = 16;
+// past this depth splits fall back to the object median, which keeps the
+// tree depth (and so the traversal stack) bounded for degenerate inputs
+static const int maxSahDepth = 40;
+
+static inline int binOf(float centroid, float lower, float scale) {
+	return std::min(numBins - 1, std::max(0, int((centroid - lower) * scale)));
+}
+
+//! per axis bin bounds and counts of one range of triangles
+struct Bins {
+	Box bounds[3][numBins];
+	int count[3][numBins];
+
+	Bins() { std::memset(count, 0, sizeof(count)); }
+
+	void merge(const Bins& other) {
+		for (int axis = 0; axis < 3; axis++)
+			for (int bin = 0; bin < numBins; bin++) {
+				bounds[axis][bin].extend(other.bounds[axis][bin]);
+				count[axis][bin] += other.count[axis][bin];
+			}
+	}
+};
+
+//! SAH cost of a tree relative to its root's surface area, see Bvh::sahCost
+float sahCost(const BvhNode* nodes, size_t numNodes);
+
+template<typename Nodes, typename LeafBounds>
+static Box refitSubtree(Nodes& nodes, uint32_t nodeID, const LeafBounds& leafBounds) {
+	BvhNode& node = nodes[nodeID];
+	Box box;
+	if (node.isLeaf())
+		box = leafBounds(node);
+	else {
+		box = refitSubtree(nodes, node.offset, leafBounds);
+		box.extend(refitSubtree(nodes, node.offset + 1, leafBounds));
+	}
+	node.lower = box.lower;
+	node.upper = box.upper;
+	return box;
+}
+
+/*! recomputes the bounds of all nodes bottom-up, keeping the topology;
+	'nodes' is a vector or MappableArray of BvhNodes, and leafBounds(node)
+	returns the bounds of a leaf's primitives. The top
+	levels are expanded breadth first until there are enough subtrees
+	to keep all threads busy; those are refitted in parallel, and the
+	nodes above them serially afterwards */
+template<typename Nodes, typename LeafBounds>
+void refitBvh(Nodes& nodes, const LeafBounds& leafBounds) {
+	const size_t minSubtrees = 16 * numHostThreads();
+	std::vector<uint32_t> above;
+	std::vector<uint32_t> subtrees(1, 0);
+	while (subtrees.size() < minSubtrees) {
+		std::vector<uint32_t> next;
+		for (uint32_t nodeID : subtrees) {
+			if (nodes[nodeID].isLeaf())
+				next.push_back(nodeID);
+			else {
+				above.push_back(nodeID);
+				next.push_back(nodes[nodeID].offset);
+				next.push_back(nodes[nodeID].offset + 1);
+			}
+		}
+		if (next.size() == subtrees.size())
+			break;
+		subtrees.swap(next);
+	}
+
+	parallelFor(0, (int)subtrees.size(), [&](int i) { refitSubtree(nodes, subtrees[i], leafBounds); });
+	// breadth first order has children after their parents
+	for (auto it = above.rbegin(); it != above.rend(); ++it) {
+		BvhNode& node = nodes[*it];
+		node.lower = glm::min(nodes[node.offset].lower, nodes[node.offset + 1].lower);
+		node.upper = glm::max(nodes[node.offset].upper, nodes[node.offset + 1].upper);
+	}
+}
+
+/*! the top-down binned SAH build of Bvh::build, over any primitives
+	with bounds; also builds the top level over instances. Reorders
+	'prims'; 'refs' gets their refs in leaf order */
+void buildSahBvh(std::vector<BuildPrim>& prims, std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs);
+
+/*! bottom-up builds over the triangles sorted by Morton code of their
+	centroids: Karras' radix tree for LBVH, optionally replaced by PLOC
+	clustering of the same order. Subtrees are collapsed into leaves
+	where the SAH prefers that; the result has the layout of the SAH
+	builder, children allocated in pairs after their parents */
+void buildLinearBvh(const std::vector<BuildPrim>& prims, bool agglomerative,
+					std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs);
+
+/*! treelet restructuring (Karras and Aila 2013) of a built tree: each
+	inner node in turn roots a treelet of up to 7 leaves, whose topology
+	is replaced by the one of lowest SAH cost. Runs up to 'rounds' passes
+	over the tree, each one bottom-up and in parallel, and stops early
+	once a pass finds nothing to improve. Leaves keep their primitives,
+	so it works on the output of any of the builders; nodes and 'refs'
+	are then put back into their layout, depth first */
+void optimizeTreelets(std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs, int rounds);
+
+/*! top-down binned SAH build that also considers spatial splits: where
+	the children of the best object split would overlap, the triangles
+	are clipped against planes, and those straddling the best one are
+	referenced from both sides (Stich et al. 2009). The references may
+	grow by at most maxGrowth times the triangle count; 'refs' can hold
+	the same triangle more than once */
+void buildSpatialBvh(const Model* model, const std::vector<BuildPrim>& prims, float maxGrowth,
+					 std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs);
@@ -0,0 +1,275 @@
+#include "BvhCache.h"
+#include "ParallelFor.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*! bumped whenever a builder or the layout of the file changes, which
+	makes all files written before stale */
+static const uint32_t formatVersion = 2;
+//! sections start at multiples of this, as Bvh8Node needs
+static const uint64_t sectionAlignment = 64;
+
+enum Section { NODES, PRIMS, WIDE_NODES, QUANTIZED_NODES, TRIANGLE_BLOCKS, SOURCE_NODES, NUM_SECTIONS };
+
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t quality;
+	//! what the file name says, to catch renamed files
+	uint64_t key;
+	uint64_t fileSize;
+	float builtSahCost;
+	uint32_t pad;
+	//! byte offset and element count of each section
+	uint64_t offset[NUM_SECTIONS];
+	uint64_t count[NUM_SECTIONS];
+};
+
+static const char fileMagic[8] = { 'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E' };
+
+static inline uint64_t mix(uint64_t hash, uint64_t word) {
+	hash ^= word * 0x87c37b91114253d5ull;
+	hash = (hash << 31) | (hash >> 33);
+	return hash * 0x4cf5ad432745937full;
+}
+
+static uint64_t hashWords(const unsigned char* bytes, size_t size, uint64_t hash) {
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes + i, 8);
+		hash = mix(hash, word);
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, bytes + i, size - i);
+	return mix(mix(hash, tail), size);
+}
+
+uint64_t BvhCache::geometryHash(const Model* model) {
+	// the arrays in chunks, hashed in parallel and combined in order
+	const size_t chunkSize = size_t(1) << 20;
+	struct Chunk {
+		const unsigned char* bytes;
+		size_t size;
+	};
+	std::vector<Chunk> chunks;
+	auto addArray = [&](const void* data, size_t size) {
+		for (size_t begin = 0; begin < size; begin += chunkSize)
+			chunks.push_back({ (const unsigned char*)data + begin, std::min(chunkSize, size - begin) });
+	};
+	uint64_t hash = mix(0, model->meshes.size());
+	for (const TriangleMesh* mesh : model->meshes) {
+		hash = mix(mix(hash, mesh->vertex.size()), mesh->index.size());
+		addArray(mesh->vertex.data(), mesh->vertex.size() * sizeof(glm::vec3));
+		addArray(mesh->index.data(), mesh->index.size() * sizeof(glm::ivec3));
+	}
+
+	std::vector<uint64_t> chunkHashes(chunks.size());
+	parallelFor(0, (int)chunks.size(), [&](int i) {
+		chunkHashes[i] = hashWords(chunks[i].bytes, chunks[i].size, i);
+	});
+	for (uint64_t chunkHash : chunkHashes)
+		hash = mix(hash, chunkHash);
+	return hash;
+}
+
+/*! everything that makes a file unusable for a build: the geometry,
+	the build settings and what the file layout depends on */
+static uint64_t cacheKey(uint64_t geometryHash, BvhBuildQuality quality, bool quantizedBvh8, int treeletRounds) {
+	const uint64_t settings[] = { geometryHash, (uint64_t)quality, quantizedBvh8, (uint64_t)treeletRounds,
+		formatVersion, simdWidth, sizeof(BvhNode), sizeof(PrimRef), sizeof(Bvh8Node), sizeof(Bvh8QuantizedNode), sizeof(TriangleBlock) };
+	uint64_t key = 0;
+	for (uint64_t value : settings)
+		key = mix(key, value);
+	return key;
+}
+
+//! files are named after their key
+static std::string keyPath(const std::string& directory, uint64_t key) {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)key);
+	return directory + "/" + name;
+}
+
+BvhCache::BvhCache(const std::string& directory) : directory(directory) {}
+
+std::string BvhCache::path(const Model* model, BvhBuildQuality quality, bool quantizedBvh8, int treeletRounds) const {
+	return keyPath(directory, cacheKey(geometryHash(model), quality, quantizedBvh8, treeletRounds));
+}
+
+bool BvhCache::buildOrLoad(const Model* model, BvhBuildQuality quality, Bvh& bvh, Bvh8& bvh8,
+						   bool quantizedBvh8, int treeletRounds) const {
+	const uint64_t key = cacheKey(geometryHash(model), quality, quantizedBvh8, treeletRounds);
+	const std::string file = keyPath(directory, key);
+
+	if (load(file, key, model, quality, bvh, bvh8))
+		return true;
+	bvh.build(model, quality);
+	if (treeletRounds > 0)
+		bvh.optimize(treeletRounds);
+	bvh8.build(bvh, true, quantizedBvh8);
+	save(file, key, bvh, bvh8);
+	return false;
+}
+
+/*! a read-only file mapped copy-on-write; unmapped when the last
+	array using it goes */
+static std::shared_ptr<void> mapFile(const std::string& path, size_t& size) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return nullptr;
+	void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data)
+		return nullptr;
+	size = (size_t)fileSize.QuadPart;
+	return std::shared_ptr<void>(data, [](void* data) { UnmapViewOfFile(data); });
+#else
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+	struct stat info;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+		data = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+	const size_t mappedSize = (size_t)info.st_size;
+	size = mappedSize;
+	return std::shared_ptr<void>(data, [mappedSize](void* data) { munmap(data, mappedSize); });
+#endif
+}
+
+template <typename T, typename Allocator>
+static void mapSection(MappableArray<T, Allocator>& array, const FileHeader& header, Section section,
+					   const std::shared_ptr<void>& file) {
+	array.map((T*)((char*)file.get() + header.offset[section]), (size_t)header.count[section], file);
+}
+
+bool BvhCache::load(const std::string& path, uint64_t key, const Model* model, BvhBuildQuality quality,
+					Bvh& bvh, Bvh8& bvh8) const {
+	auto start = std::chrono::steady_clock::now();
+	size_t size = 0;
+	std::shared_ptr<void> file = mapFile(path, size);
+	if (!file)
+		return false;
+
+	const FileHeader& header = *(const FileHeader*)file.get();
+	static const size_t elementSize[NUM_SECTIONS] = {
+		sizeof(BvhNode), sizeof(PrimRef), sizeof(Bvh8Node), sizeof(Bvh8QuantizedNode), sizeof(TriangleBlock), sizeof(uint32_t) };
+	bool valid = size >= sizeof(FileHeader) && std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) == 0
+		&& header.version == formatVersion && header.key == key && header.fileSize == size
+		&& header.count[NODES] > 0 && (header.count[WIDE_NODES] > 0) != (header.count[QUANTIZED_NODES] > 0)
+		&& header.count[SOURCE_NODES] == 8 * (header.count[WIDE_NODES] + header.count[QUANTIZED_NODES]);
+	for (int section = 0; valid && section < NUM_SECTIONS; section++)
+		valid = header.offset[section] % sectionAlignment == 0 && header.offset[section] <= size
+			&& header.count[section] <= (size - header.offset[section]) / elementSize[section];
+	if (!valid) {
+		std::cout << "BVH cache: ignoring " << path << ", which is damaged or from another version\n";
+		return false;
+	}
+
+	mapSection(bvh.nodes, header, NODES, file);
+	mapSection(bvh.prims, header, PRIMS, file);
+	bvh.model = model;
+	bvh.quality = quality;
+	bvh.builtSahCost = header.builtSahCost;
+	bvh.builtTriangleCounts.resize(model->meshes.size());
+	for (size_t meshID = 0; meshID < model->meshes.size(); meshID++)
+		bvh.builtTriangleCounts[meshID] = model->meshes[meshID]->index.size();
+
+	mapSection(bvh8.nodes, header, WIDE_NODES, file);
+	mapSection(bvh8.quantizedNodes, header, QUANTIZED_NODES, file);
+	mapSection(bvh8.triangles, header, TRIANGLE_BLOCKS, file);
+	mapSection(bvh8.sourceNodes, header, SOURCE_NODES, file);
+	bvh8.bvh = &bvh;
+
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "BVH cache: mapped " << bvhBuildQualityName(quality) << " BVH and BVH8 from " << path << " ("
+		<< size / (1024.0 * 1024.0) << " MB) in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+	return true;
+}
+
+template <typename Array>
+static void writeSection(std::ofstream& out, FileHeader& header, Section section, const Array& array) {
+	const uint64_t position = (uint64_t)out.tellp();
+	const uint64_t offset = (position + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+	static const char zeros[sectionAlignment] = {};
+	out.write(zeros, std::streamsize(offset - position));
+	out.write((const char*)array.data(), std::streamsize(array.size() * sizeof(array[0])));
+	header.offset[section] = offset;
+	header.count[section] = array.size();
+}
+
+void BvhCache::save(const std::string& path, uint64_t key, const Bvh& bvh, const Bvh8& bvh8) const {
+	auto start = std::chrono::steady_clock::now();
+	FileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+	header.version = formatVersion;
+	header.quality = (uint32_t)bvh.quality;
+	header.key = key;
+	header.builtSahCost = bvh.builtSahCost;
+
+	const std::string temporary = path + ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary);
+		if (!out) {
+			std::cout << "BVH cache: cannot write " << temporary << "\n";
+			return;
+		}
+		out.write((const char*)&header, sizeof(header));
+		writeSection(out, header, NODES, bvh.nodes);
+		writeSection(out, header, PRIMS, bvh.prims);
+		writeSection(out, header, WIDE_NODES, bvh8.nodes);
+		writeSection(out, header, QUANTIZED_NODES, bvh8.quantizedNodes);
+		writeSection(out, header, TRIANGLE_BLOCKS, bvh8.triangles);
+		writeSection(out, header, SOURCE_NODES, bvh8.sourceNodes);
+		header.fileSize = (uint64_t)out.tellp();
+		out.seekp(0);
+		out.write((const char*)&header, sizeof(header));
+		if (!out) {
+			std::cout << "BVH cache: cannot write " << temporary << "\n";
+			out.close();
+			std::remove(temporary.c_str());
+			return;
+		}
+	}
+#ifdef _WIN32
+	std::remove(path.c_str());
+#endif
+	if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+		std::cout << "BVH cache: cannot replace " << path << "\n";
+		std::remove(temporary.c_str());
+		return;
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "BVH cache: saved " << path << " (" << header.fileSize / (1024.0 * 1024.0) << " MB) in "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+}
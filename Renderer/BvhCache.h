@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Bvh8.h"
+
+#include <string>
+
+/*! on-disk cache of the host acceleration structures, so that a scene
+	loaded again starts without waiting for its BVH build. A file holds
+	the binary Bvh and the Bvh8 collapsed from it exactly as they sit in
+	memory, keyed on a hash of the model's geometry and on everything
+	that changes the build: build quality, file format version, node
+	and record layouts. Files are memory-mapped and used in place, so
+	loading costs a few page faults rather than a read of the whole
+	file; pages are copy-on-write, so refits do not touch the file */
+class BvhCache {
+public:
+	//! files go into 'directory', which has to exist
+	explicit BvhCache(const std::string& directory);
+
+	/*! maps the cached trees for the model and build settings into
+		'bvh' and 'bvh8' if there are any; otherwise builds them, with
+		treeletRounds passes of Bvh::optimize and 'bvh8' with quantized
+		bounds if asked to, and saves them for the next run. Returns
+		true on a cache hit */
+	bool buildOrLoad(const Model* model, BvhBuildQuality quality, Bvh& bvh, Bvh8& bvh8,
+					 bool quantizedBvh8 = false, int treeletRounds = 0) const;
+
+	//! the file the trees of a model and build settings are cached in
+	std::string path(const Model* model, BvhBuildQuality quality, bool quantizedBvh8 = false,
+					 int treeletRounds = 0) const;
+
+	/*! 64-bit hash over the vertex and index arrays of all meshes, in
+		parallel; other attributes do not change the trees */
+	static uint64_t geometryHash(const Model* model);
+
+private:
+	bool load(const std::string& path, uint64_t key, const Model* model, BvhBuildQuality quality,
+			  Bvh& bvh, Bvh8& bvh8) const;
+	void save(const std::string& path, uint64_t key, const Bvh& bvh, const Bvh8& bvh8) const;
+
+	std::string directory;
+};
@@ -0,0 +1,689 @@
+#include "CpuRenderer.h"
+#include "BvhCache.h"
+#include "HostPrograms.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+CpuRenderer::CpuRenderer(const Model* model, const EnvironmentMap* environment, BvhBuildQuality bvhQuality,
+						 const std::string& bvhCacheDirectory, bool quantizedBvh8, int treeletRounds,
+						 bool nextEventEstimation, LightSelection lightSelection, ReservoirReuse reuse,
+						 SampleSequence sequence)
+	: model(model), environment(environment), bvhQuality(bvhQuality), quantizedBvh8(quantizedBvh8),
+	nextEventEstimation(nextEventEstimation), lightSelection(lightSelection), reuse(reuse), sequence(sequence) {
+	std::cout << "CPU Renderer: Building BVH ..\n";
+	if (!bvhCacheDirectory.empty())
+		BvhCache(bvhCacheDirectory).buildOrLoad(model, bvhQuality, bvh, bvh8, quantizedBvh8, treeletRounds);
+	else {
+		bvh.build(model, bvhQuality);
+		if (treeletRounds > 0)
+			bvh.optimize(treeletRounds);
+		bvh8.build(bvh, true, quantizedBvh8);
+	}
+	buildMaterials();
+	std::cout << TERMINAL_GREEN << "CPU Renderer: Ready to be used with "
+		<< numHostThreads() << " threads\n" << TERMINAL_DEFAULT;
+}
+
+/*! same material setup as SampleRenderer::buildHitgroupRecords */
+void CpuRenderer::buildMaterials() {
+	materials.resize(model->meshes.size());
+	for (size_t meshID = 0; meshID < model->meshes.size(); meshID++) {
+		const TriangleMesh* mesh = model->meshes[meshID];
+		Material& material = materials[meshID];
+		material.color = mesh->diffuse;
+		material.emissive = mesh->emmissive;
+		material.specular = mesh->specular;
+		material.roughness = roughnessFromShininess(mesh->shininess);
+		material.ior = mesh->ior;
+		material.type = Material::DIFFUSE;
+		if (mesh->illum == 7 || mesh->illum == 6)
+			material.type = Material::DIELECTRIC;
+		else if (mesh->specular.x > 0 || mesh->specular.y > 0 || mesh->specular.z > 0)
+			material.type = Material::SPECULAR;
+		material.textureID = mesh->diffuseTextureID;
+	}
+	if (nextEventEstimation)
+		lights.build(model, lightSelection);
+}
+
+Bsdf CpuRenderer::materialBsdf(const Material& material, const glm::vec3& diffuseColor) {
+	if (material.type == Material::SPECULAR)
+		return Bsdf::glossy(material.specular, material.roughness);
+	if (material.type == Material::DIELECTRIC)
+		return Bsdf::dielectric(material.ior);
+	return Bsdf::diffuse(diffuseColor);
+}
+
+bool CpuRenderer::sampleDirectLight(const glm::vec3& hitPoint, const glm::vec3& normal, const glm::vec3& wo,
+									const Bsdf& bsdf, PathSampler& sampler, Ray& shadowRay, glm::vec3& radiance) const {
+	const float u0 = sampler.next();
+	const float u1 = sampler.next();
+	const float u2 = sampler.next();
+	const float u3 = sampler.next();
+	const LightSample light = lights.sample(hitPoint, normal, u0, u1, u2, u3);
+
+	glm::vec3 toLight = light.position - hitPoint;
+	const float dist = glm::length(toLight);
+	if (!(dist > 0.f) || !(light.pdfArea > 0.f))
+		return false;
+	toLight /= dist;
+	const float cosLight = std::abs(glm::dot(light.normal, toLight));
+	if (glm::dot(normal, toLight) <= 0.f || cosLight <= 0.f)
+		return false;
+	const glm::vec3 f = bsdf.eval(wo, toLight, normal);
+	if (f == glm::vec3(0.f))
+		return false;
+
+	// both densities per unit solid angle
+	const float lightPdf = light.pdfArea * dist * dist / cosLight;
+	const float bsdfPdf = bsdf.pdf(wo, toLight, normal);
+	const glm::vec3 emitted = 10.f * materials[light.meshID].emissive;
+	radiance = f * emitted * (misWeight(lightPdf, bsdfPdf) / lightPdf);
+
+	const float err = 1e-5f;
+	shadowRay.origin = hitPoint + err * toLight;
+	shadowRay.direction = toLight;
+	shadowRay.tmin = 0.f;
+	shadowRay.tmax = dist * 0.999f;
+	return true;
+}
+
+float CpuRenderer::emissionWeight(int meshID, int primID, const glm::vec3& normal, const glm::vec3& direction,
+								  float t, float bsdfPdf, const glm::vec3& scatterPoint,
+								  const glm::vec3& scatterNormal) const {
+	if (bsdfPdf <= 0.f)
+		return 1.f;
+	const float pdfArea = lights.pdfArea(scatterPoint, scatterNormal, meshID, primID);
+	const float length = glm::length(direction);
+	const float cosLight = std::abs(glm::dot(glm::normalize(normal), direction)) / length;
+	if (pdfArea <= 0.f || cosLight <= 0.f)
+		return 1.f;
+	const float dist = t * length;
+	return misWeight(bsdfPdf, pdfArea * dist * dist / cosLight);
+}
+
+glm::vec3 CpuRenderer::sampleTexture(int textureID, const glm::vec2& tc) const {
+	const Texture* texture = model->textures[textureID];
+	const glm::ivec2 res = texture->resolution;
+
+	// texel centers sit at (i + 0.5) / res, as for cudaFilterModeLinear
+	const float x = tc.x * res.x - 0.5f;
+	const float y = tc.y * res.y - 0.5f;
+	const float fx = std::floor(x), fy = std::floor(y);
+	const float wx = x - fx, wy = y - fy;
+
+	auto wrap = [](int i, int n) { i %= n; return i < 0 ? i + n : i; };
+	const int x0 = wrap((int)fx, res.x), x1 = wrap((int)fx + 1, res.x);
+	const int y0 = wrap((int)fy, res.y), y1 = wrap((int)fy + 1, res.y);
+
+	auto texel = [&](int tx, int ty) {
+		uint32_t p = texture->pixel[tx + ty * res.x];
+		return glm::vec3(p & 0xff, (p >> 8) & 0xff, (p >> 16) & 0xff) * (1.f / 255.f);
+	};
+	return (1.f - wy) * ((1.f - wx) * texel(x0, y0) + wx * texel(x1, y0))
+		+ wy * ((1.f - wx) * texel(x0, y1) + wx * texel(x1, y1));
+}
+
+void CpuRenderer::closestHit(const Ray& ray, const Hit& hit, Payload& prd) const {
+	const TriangleMesh& mesh = *model->meshes[hit.meshID];
+	const Material& material = materials[hit.meshID];
+	const glm::ivec3 index = mesh.index[hit.primID];
+	const float u = hit.barycentrics.x;
+	const float v = hit.barycentrics.y;
+
+	// ------------------------------------------------------------------
+	// compute normal, using either shading normal (if avail), or
+	// geometry normal (fallback, from the hit record)
+	// ------------------------------------------------------------------
+	glm::vec3 sN = glm::normalize(hit.normal);
+	if (!mesh.normal.empty())
+		sN = (1.f - u - v) * mesh.normal[index.x]
+			+ u * mesh.normal[index.y]
+			+ v * mesh.normal[index.z];
+
+	glm::vec3 diffuseColor = material.color;
+	if (material.textureID >= 0 && !mesh.texcoord.empty()) {
+		const glm::vec2 tc = (1.f - u - v) * mesh.texcoord[index.x]
+			+ u * mesh.texcoord[index.y]
+			+ v * mesh.texcoord[index.z];
+		diffuseColor *= sampleTexture(material.textureID, tc);
+	}
+
+	const glm::vec3 rayDir = ray.direction;
+	const glm::vec3 wo = -glm::normalize(rayDir);
+	const glm::vec3 normal = glm::normalize(sN);
+	const Bsdf bsdf = materialBsdf(material, diffuseColor);
+
+	const float err = 1e-5f;
+	const glm::vec3 hitPoint = ray.origin + hit.t * rayDir;
+	prd.emitted = 10.f * material.emissive;
+	if (prd.directResampled)
+		prd.emitted = glm::vec3(0.f);
+	else if (nextEventEstimation)
+		prd.emitted *= emissionWeight(hit.meshID, hit.primID, hit.normal, rayDir, hit.t, prd.bsdfPdf,
+			prd.scatterPoint, prd.scatterNormal);
+	prd.radiance += prd.emitted * prd.attenuation;
+	prd.bsdfPdf = 0.f;
+	prd.directResampled = false;
+	ShadingPoint* shadingPoint = prd.shadingPoint;
+	prd.shadingPoint = nullptr;
+
+	// lights are sampled on the side of the surface the path is on
+	const bool sampleLights = nextEventEstimation && !bsdf.isDelta() && !lights.empty();
+	const glm::vec3 facing = glm::dot(normal, wo) < 0.f ? -normal : normal;
+	if (sampleLights && shadingPoint) {
+		// the direct light is added once all pixels have their reservoirs
+		shadingPoint->position = hitPoint;
+		shadingPoint->normal = facing;
+		shadingPoint->wo = wo;
+		shadingPoint->bsdf = bsdf;
+		shadingPoint->depth = hit.t * glm::length(rayDir);
+		shadingPoint->valid = true;
+		prd.directResampled = true;
+		prd.sampler.skip(lightDimensions);
+	}
+	else if (sampleLights) {
+		Ray shadowRay;
+		glm::vec3 radiance;
+		if (sampleDirectLight(hitPoint, facing, wo, bsdf, prd.sampler, shadowRay, radiance) && !bvh8.occluded(shadowRay))
+			prd.radiance += prd.attenuation * radiance;
+	}
+	else
+		prd.sampler.skip(lightDimensions);
+
+	const float u0 = prd.sampler.next();
+	const float u1 = prd.sampler.next();
+	const float u2 = prd.sampler.next();
+	prd.sampler.skip(bounceDimensions - lightDimensions - bsdfDimensions);
+	BsdfSample sample;
+	if (!bsdf.sample(wo, normal, u0, u1, u2, sample)) {
+		prd.done = true;
+		return;
+	}
+	prd.attenuation *= sample.weight;
+	prd.direction = sample.direction;
+	prd.origin = hitPoint + err * sample.direction;
+	if (sampleLights && !prd.directResampled) {
+		prd.bsdfPdf = sample.pdf;
+		prd.scatterPoint = hitPoint;
+		prd.scatterNormal = facing;
+	}
+}
+
+void CpuRenderer::miss(const Ray& ray, Payload& prd) const {
+	const glm::vec3 rayDir = ray.direction;
+	if (environment && environment->resolution.x > 0) {
+		prd.emitted = environment->lookup(glm::normalize(rayDir));
+	}
+	else {
+		// sky type blue
+		float a = 0.5f * (rayDir.y + 1.0f);
+		prd.emitted = (1.0f - a) * glm::vec3(1.f, 1.0f, 1.0f) + a * glm::vec3(0.5f, 0.7f, 1.0f);
+	}
+	prd.radiance += prd.attenuation * prd.emitted;
+	prd.done = true;
+}
+
+void CpuRenderer::trace(const Ray& ray, Payload& prd) const {
+	Hit hit;
+	if (bvh8.closestHit(ray, hit))
+		closestHit(ray, hit, prd);
+	else
+		miss(ray, prd);
+}
+
+/*! renderFrame for the pixels of one tile. Each pixel keeps its own
+	sampler, so the image is the same as when rendering pixel by pixel;
+	only the primary rays of a sample are traced together */
+void CpuRenderer::renderTile(int tileX, int tileY) {
+	Payload prd[packetSize];
+	glm::vec3 accumColor[packetSize];
+	uint32_t active = 0;
+	for (int k = 0; k < packetSize; k++) {
+		const int ix = tileX * tileSize + k % tileSize;
+		const int iy = tileY * tileSize + k / tileSize;
+		if (ix >= fbSize.x || iy >= fbSize.y)
+			continue;
+		active |= 1u << k;
+
+		prd[k].sampler = PathSampler::forPixel(sequence, ix, iy, fbSize.x, frameID);
+		prd[k].shadingPoint = nullptr;
+		accumColor[k] = (accumBuffer[ix + iy * fbSize.x] * float(frameID)) / (frameID + 1.f);
+	}
+
+	for (int i = 0; i < raysPerPixel; i++) {
+		for (int k = 0; k < packetSize; k++)
+			prd[k].sampler.startSample(frameID * raysPerPixel + i);
+		tracePaths(tileX, tileY, active, prd);
+		for (int k = 0; k < packetSize; k++)
+			if (active & (1u << k))
+				accumColor[k] += prd[k].radiance / (raysPerPixel * (frameID + 1.f));
+	}
+
+	for (int k = 0; k < packetSize; k++) {
+		if (!(active & (1u << k)))
+			continue;
+		const int fbIndex = tileX * tileSize + k % tileSize + (tileY * tileSize + k / tileSize) * fbSize.x;
+		writePixel(fbIndex, accumColor[k]);
+	}
+}
+
+/*! one sample of the pixels of a tile in 'active': their camera rays as
+	one packet, then each path to its end */
+void CpuRenderer::tracePaths(int tileX, int tileY, uint32_t active, Payload prd[]) const {
+	RayPacket packet = RayPacket();
+	packet.activeMask = active;
+	for (int k = 0; k < packetSize; k++) {
+		if (!(active & (1u << k)))
+			continue;
+		const int ix = tileX * tileSize + k % tileSize;
+		const int iy = tileY * tileSize + k / tileSize;
+		float xShift = prd[k].sampler.next();
+		float yShift = prd[k].sampler.next();
+
+		// normalized screen plane position, in [0,1]^2
+		const glm::vec2 screen = glm::vec2(ix + xShift, iy + yShift) * glm::vec2(1.f / fbSize.x, 1.f / fbSize.y);
+
+		prd[k].attenuation = glm::vec3(1.f);
+		prd[k].origin = camera.position;
+		prd[k].direction = glm::normalize(camera.direction
+			+ (screen.x - 0.5f) * camera.horizontal
+			+ (screen.y - 0.5f) * camera.vertical);
+		prd[k].emitted = glm::vec3(0.f);
+		prd[k].radiance = glm::vec3(0.f);
+		prd[k].done = false;
+		prd[k].bsdfPdf = 0.f;
+		prd[k].directResampled = false;
+
+		Ray ray;
+		ray.origin = prd[k].origin;
+		ray.direction = prd[k].direction;
+		packet.set(k, ray);
+	}
+
+	HitPacket hits;
+	const uint32_t hitMask = closestHitPacket(bvh, bvh8, packet, hits);
+
+	for (int k = 0; k < packetSize; k++) {
+		if (!(active & (1u << k)))
+			continue;
+		if (hitMask & (1u << k))
+			closestHit(packet.get(k), hits.get(k), prd[k]);
+		else
+			miss(packet.get(k), prd[k]);
+
+		for (int j = 1; j < maxDepth && !prd[k].done; j++) {
+			Ray ray;
+			ray.origin = prd[k].origin;
+			ray.direction = prd[k].direction;
+			ray.tmin = 0.f;
+			ray.tmax = 1e20f;
+			trace(ray, prd[k]);
+		}
+	}
+}
+
+// reservoir resampling of the direct light at camera hits; light
+// samples drawn per hit, and reservoirs merged per pixel with spatial
+// reuse, within spatialRadius pixels
+static const int initialCandidates = 4;
+static const int spatialNeighbours = 4;
+static const float spatialRadius = 16.f;
+// temporal reuse weighs the previous reservoir as at most this many
+// times a fresh one, so that it follows changes in lighting
+static const float historyLimit = 20.f;
+// the PathSampler dimensions of resampling, after those of the path:
+// per candidate four for the light sample and one to keep it, one per
+// merged reservoir, and two per neighbour to pick it
+static const uint32_t candidateDimensions = cameraDimensions + maxDepth * bounceDimensions;
+static const uint32_t neighbourDimensions = candidateDimensions + 5 * initialCandidates + 2;
+
+static inline float luminance(const glm::vec3& color) {
+	return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+}
+
+/*! whether two shading points are on about the same surface, to share
+	light samples: normals within 25 degrees and depths within 10% */
+static inline bool similarSurface(const glm::vec3& normal, float depth, const glm::vec3& otherNormal,
+								  float otherDepth) {
+	return glm::dot(normal, otherNormal) >= 0.9f && std::abs(depth - otherDepth) <= 0.1f * otherDepth;
+}
+
+/*! the pixel of an image of 'size' that 'point' is seen in through
+	'camera', false if it is outside */
+static bool projectToPixel(const CameraBasis& camera, const glm::ivec2& size, const glm::vec3& point,
+						   glm::ivec2& pixel) {
+	glm::vec3 toPoint = point - camera.position;
+	const float z = glm::dot(toPoint, camera.direction);
+	if (!(z > 0.f))
+		return false;
+	toPoint /= z;
+	const float x = (glm::dot(toPoint, camera.horizontal) / glm::dot(camera.horizontal, camera.horizontal) + 0.5f) * size.x;
+	const float y = (glm::dot(toPoint, camera.vertical) / glm::dot(camera.vertical, camera.vertical) + 0.5f) * size.y;
+	if (!(x >= 0.f && x < size.x && y >= 0.f && y < size.y))
+		return false;
+	pixel = glm::ivec2(int(x), int(y));
+	return true;
+}
+
+glm::vec3 CpuRenderer::unshadowedLight(const ShadingPoint& point, const glm::vec3& lightPosition,
+									   const glm::vec3& lightNormal, int meshID) const {
+	glm::vec3 toLight = lightPosition - point.position;
+	const float dist2 = glm::dot(toLight, toLight);
+	if (!(dist2 > 0.f))
+		return glm::vec3(0.f);
+	toLight /= std::sqrt(dist2);
+	if (glm::dot(point.normal, toLight) <= 0.f)
+		return glm::vec3(0.f);
+	// what sampleDirectLight weighs a light sample by, times its density
+	const float cosLight = std::abs(glm::dot(lightNormal, toLight));
+	return point.bsdf.eval(point.wo, toLight, point.normal) * (10.f * materials[meshID].emissive)
+		* (cosLight / dist2);
+}
+
+float CpuRenderer::targetPdf(const ShadingPoint& point, const Reservoir& reservoir) const {
+	if (reservoir.meshID < 0)
+		return 0.f;
+	return luminance(unshadowedLight(point, reservoir.position, reservoir.normal, reservoir.meshID));
+}
+
+bool CpuRenderer::visible(const ShadingPoint& point, const glm::vec3& lightPosition) const {
+	glm::vec3 toLight = lightPosition - point.position;
+	const float dist = glm::length(toLight);
+	if (!(dist > 0.f))
+		return false;
+	toLight /= dist;
+
+	const float err = 1e-5f;
+	Ray ray;
+	ray.origin = point.position + err * toLight;
+	ray.direction = toLight;
+	ray.tmin = 0.f;
+	ray.tmax = dist * 0.999f;
+	return !bvh8.occluded(ray);
+}
+
+Reservoir CpuRenderer::combineReservoirs(const Reservoir* inputs[], const ShadingPoint* points[], int count,
+										 PathSampler& sampler) const {
+	const ShadingPoint& point = *points[0];
+	Reservoir combined;
+	for (int i = 0; i < count; i++) {
+		const Reservoir& input = *inputs[i];
+		const float u = sampler.next();
+		combined.update(input.position, input.normal, input.meshID, targetPdf(point, input) * input.W * input.count, u);
+		combined.count += input.count;
+	}
+	const float target = targetPdf(point, combined);
+	if (!(target > 0.f))
+		return combined;
+
+	float normalization = combined.count;
+	if (reuse == ReservoirReuse::UNBIASED) {
+		// only the reservoirs that could have held the sample count. As
+		// stored reservoirs only keep samples their point sees, that takes
+		// a shadow ray; the pixel's own one counts anyway, as the sample
+		// adds nothing where it could not
+		normalization = inputs[0]->count;
+		for (int i = 1; i < count; i++)
+			if (targetPdf(*points[i], combined) > 0.f && visible(*points[i], combined.position))
+				normalization += inputs[i]->count;
+	}
+	combined.W = combined.weightSum / (normalization * target);
+	return combined;
+}
+
+/*! a reservoir for a pixel's shading point, resampled from
+	initialCandidates light samples and merged with the reservoir of the
+	same surface in the previous sample, found by reprojection */
+void CpuRenderer::resampleCandidates(int ix, int iy) {
+	const int fbIndex = ix + iy * fbSize.x;
+	const ShadingPoint& point = shadingPoints[fbIndex];
+	Reservoir& reservoir = candidates[fbIndex];
+	reservoir = Reservoir();
+	if (!point.valid)
+		return;
+
+	PathSampler& sampler = pixelSamplers[fbIndex];
+	sampler.seek(candidateDimensions);
+	Reservoir initial;
+	for (int i = 0; i < initialCandidates; i++) {
+		const float u0 = sampler.next();
+		const float u1 = sampler.next();
+		const float u2 = sampler.next();
+		const float u3 = sampler.next();
+		const LightSample light = lights.sample(point.position, point.normal, u0, u1, u2, u3);
+		float weight = 0.f;
+		if (light.pdfArea > 0.f)
+			weight = luminance(unshadowedLight(point, light.position, light.normal, light.meshID)) / light.pdfArea;
+		initial.update(light.position, light.normal, light.meshID, weight, sampler.next());
+	}
+	initial.count = float(initialCandidates);
+	const float target = targetPdf(point, initial);
+	if (target > 0.f)
+		initial.W = initial.weightSum / (initial.count * target);
+
+	const Reservoir* inputs[2] = { &initial, nullptr };
+	const ShadingPoint* points[2] = { &point, nullptr };
+	int count = 1;
+	Reservoir previous;
+	glm::ivec2 previousPixel;
+	if (projectToPixel(previousCamera, fbSize, point.position, previousPixel)) {
+		const int previousIndex = previousPixel.x + previousPixel.y * fbSize.x;
+		const ShadingPoint& previousPoint = previousShadingPoints[previousIndex];
+		if (previousPoint.valid && similarSurface(point.normal, glm::length(point.position - previousCamera.position),
+												  previousPoint.normal, previousPoint.depth)) {
+			previous = reservoirs[previousIndex];
+			previous.count = std::min(previous.count, historyLimit * initialCandidates);
+			inputs[count] = &previous;
+			points[count++] = &previousPoint;
+		}
+	}
+	reservoir = combineReservoirs(inputs, points, count, sampler);
+	if (reservoir.W > 0.f && !visible(point, reservoir.position))
+		reservoir.W = 0.f;
+}
+
+/*! merges a pixel's reservoir with those of random neighbours on about
+	the same surface, and adds the direct light of the sample it keeps;
+	that reservoir is the one for temporal reuse */
+void CpuRenderer::resampleNeighbours(int ix, int iy) {
+	const int fbIndex = ix + iy * fbSize.x;
+	const ShadingPoint& point = shadingPoints[fbIndex];
+	Reservoir& reservoir = reservoirs[fbIndex];
+	reservoir = Reservoir();
+	if (!point.valid)
+		return;
+
+	PathSampler& sampler = pixelSamplers[fbIndex];
+	sampler.seek(neighbourDimensions);
+	const Reservoir* inputs[1 + spatialNeighbours] = { &candidates[fbIndex] };
+	const ShadingPoint* points[1 + spatialNeighbours] = { &point };
+	int count = 1;
+	for (int i = 0; i < spatialNeighbours; i++) {
+		const float radius = spatialRadius * std::sqrt(sampler.next());
+		const float angle = 2.f * PI * sampler.next();
+		const int x = ix + int(std::round(radius * std::cos(angle)));
+		const int y = iy + int(std::round(radius * std::sin(angle)));
+		if (x < 0 || y < 0 || x >= fbSize.x || y >= fbSize.y || (x == ix && y == iy))
+			continue;
+		const int neighbour = x + y * fbSize.x;
+		const ShadingPoint& other = shadingPoints[neighbour];
+		if (!other.valid || !similarSurface(point.normal, point.depth, other.normal, other.depth))
+			continue;
+		inputs[count] = &candidates[neighbour];
+		points[count++] = &other;
+	}
+	reservoir = combineReservoirs(inputs, points, count, sampler);
+	if (reservoir.W > 0.f && !visible(point, reservoir.position))
+		reservoir.W = 0.f;
+	if (reservoir.W > 0.f)
+		frameColor[fbIndex] += unshadowedLight(point, reservoir.position, reservoir.normal, reservoir.meshID)
+			* (reservoir.W / (raysPerPixel * (frameID + 1.f)));
+}
+
+/*! one sample of the paths of a tile, as renderTile traces them, that
+	leaves the direct light at their first hits to resampling */
+void CpuRenderer::traceResampledTile(int tileX, int tileY, int sample) {
+	Payload prd[packetSize];
+	int fbIndex[packetSize];
+	uint32_t active = 0;
+	for (int k = 0; k < packetSize; k++) {
+		const int ix = tileX * tileSize + k % tileSize;
+		const int iy = tileY * tileSize + k / tileSize;
+		if (ix >= fbSize.x || iy >= fbSize.y)
+			continue;
+		active |= 1u << k;
+
+		fbIndex[k] = ix + iy * fbSize.x;
+		if (sample == 0) {
+			pixelSamplers[fbIndex[k]] = PathSampler::forPixel(sequence, ix, iy, fbSize.x, frameID);
+			frameColor[fbIndex[k]] = (accumBuffer[fbIndex[k]] * float(frameID)) / (frameID + 1.f);
+		}
+		prd[k].sampler = pixelSamplers[fbIndex[k]];
+		prd[k].sampler.startSample(frameID * raysPerPixel + sample);
+		prd[k].shadingPoint = &shadingPoints[fbIndex[k]];
+		prd[k].shadingPoint->valid = false;
+	}
+
+	tracePaths(tileX, tileY, active, prd);
+
+	for (int k = 0; k < packetSize; k++) {
+		if (!(active & (1u << k)))
+			continue;
+		frameColor[fbIndex[k]] += prd[k].radiance / (raysPerPixel * (frameID + 1.f));
+		pixelSamplers[fbIndex[k]] = prd[k].sampler;
+	}
+}
+
+/*! a frame whose direct light at camera hits comes from reservoir
+	resampling (ReSTIR), a pass over the image per step. For each sample:
+	- trace the paths, recording their first hits
+	- resample light samples at each hit, and merge the reservoir its
+	  surface had in the previous sample (temporal reuse)
+	- merge the reservoirs of nearby pixels (spatial reuse), and shade
+	  with the sample that is kept
+	A reservoir's sample is dropped once it turns out occluded, so that
+	reservoirs only pass on samples that their point sees */
+void CpuRenderer::renderResampled() {
+	const int tilesX = (fbSize.x + tileSize - 1) / tileSize;
+	const int tilesY = (fbSize.y + tileSize - 1) / tileSize;
+	for (int i = 0; i < raysPerPixel; i++) {
+		parallelFor(0, tilesY, [&](int tileY) {
+			for (int tileX = 0; tileX < tilesX; tileX++)
+				traceResampledTile(tileX, tileY, i);
+		});
+		parallelFor(0, fbSize.y, [&](int iy) {
+			for (int ix = 0; ix < fbSize.x; ix++)
+				resampleCandidates(ix, iy);
+		});
+		parallelFor(0, fbSize.y, [&](int iy) {
+			for (int ix = 0; ix < fbSize.x; ix++)
+				resampleNeighbours(ix, iy);
+		});
+		shadingPoints.swap(previousShadingPoints);
+		previousCamera = camera;
+	}
+	parallelFor(0, fbSize.y, [&](int iy) {
+		for (int ix = 0; ix < fbSize.x; ix++)
+			writePixel(ix + iy * fbSize.x, frameColor[ix + iy * fbSize.x]);
+	});
+}
+
+void CpuRenderer::writePixel(int fbIndex, const glm::vec3& accumColor) {
+	accumBuffer[fbIndex] = accumColor;
+
+	const int r = int(255.99f * glm::clamp(linearToGamma(accumColor.x), 0.f, 1.f));
+	const int g = int(255.99f * glm::clamp(linearToGamma(accumColor.y), 0.f, 1.f));
+	const int b = int(255.99f * glm::clamp(linearToGamma(accumColor.z), 0.f, 1.f));
+	colorBuffer[fbIndex] = 0xff000000 | (r << 0) | (g << 8) | (b << 16);
+}
+
+void CpuRenderer::render() {
+	if (fbSize.x == 0) return;
+
+	auto start = std::chrono::steady_clock::now();
+	if (reuse != ReservoirReuse::NONE && nextEventEstimation)
+		renderResampled();
+	else {
+		const int tilesX = (fbSize.x + tileSize - 1) / tileSize;
+		const int tilesY = (fbSize.y + tileSize - 1) / tileSize;
+		parallelFor(0, tilesY, [&](int tileY) {
+			for (int tileX = 0; tileX < tilesX; tileX++)
+				renderTile(tileX, tileY);
+		});
+	}
+	auto end = std::chrono::steady_clock::now();
+	frameID++;
+
+	statSamples += double(fbSize.x) * fbSize.y * raysPerPixel;
+	reportThroughput(std::chrono::duration<double>(end - start).count());
+}
+
+/*! prints samples (camera paths) per second, overall and per core,
+	about once a second */
+void CpuRenderer::reportThroughput(double seconds) {
+	statSeconds += seconds;
+	if (statSeconds < 1.0)
+		return;
+
+	const int numThreads = numHostThreads();
+	const double samplesPerSecond = statSamples / statSeconds;
+	std::cout << "CPU Renderer: " << samplesPerSecond * 1e-6 << " Msamples/s, "
+		<< samplesPerSecond / numThreads * 1e-3 << " Ksamples/s per core ("
+		<< numThreads << " threads)\n";
+	statSamples = 0.0;
+	statSeconds = 0.0;
+}
+
+void CpuRenderer::resize(const glm::ivec2& newSize) {
+	if (newSize.x == 0 || newSize.y == 0) return;
+
+	fbSize = newSize;
+	colorBuffer.assign((size_t)newSize.x * newSize.y, 0);
+	accumBuffer.assign((size_t)newSize.x * newSize.y, glm::vec3(0.f));
+	if (reuse != ReservoirReuse::NONE) {
+		const size_t numPixels = (size_t)newSize.x * newSize.y;
+		shadingPoints.assign(numPixels, ShadingPoint());
+		previousShadingPoints.assign(numPixels, ShadingPoint());
+		candidates.assign(numPixels, Reservoir());
+		reservoirs.assign(numPixels, Reservoir());
+		pixelSamplers.assign(numPixels, PathSampler());
+		frameColor.assign(numPixels, glm::vec3(0.f));
+	}
+	frameID = 0;
+}
+
+void CpuRenderer::downloadPixels(uint32_t h_pixels[]) {
+	std::memcpy(h_pixels, colorBuffer.data(), colorBuffer.size() * sizeof(uint32_t));
+}
+
+void CpuRenderer::setCamera(const Camera& camera) {
+	lastSetCamera = camera;
+	this->camera = cameraBasis(camera, fbSize);
+	frameID = 0;
+}
+
+void CpuRenderer::applyChanges(const ModelChanges& changes) {
+	if (changes.empty())
+		return;
+
+	// textures are read straight from the model, only geometry and
+	// materials have derived state here
+	if (!changes.meshes.empty() || materials.size() != model->meshes.size()) {
+		// edited vertices only need a refit, other edits a rebuild
+		if (bvh.update())
+			bvh8.build(bvh, true, quantizedBvh8);
+		else
+			bvh8.refit();
+	}
+	buildMaterials();
+	// emitters and surfaces may have moved; no temporal reuse from before
+	for (ShadingPoint& point : previousShadingPoints)
+		point.valid = false;
+	frameID = 0;
+}
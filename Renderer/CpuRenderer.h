@@ -0,0 +1,202 @@
+#pragma once
+
+#include "Renderer.h"
+#include "Bvh8.h"
+#include "RayPacket.h"
+#include "EnvironmentMap.h"
+#include "LightSampler.h"
+#include "Reservoir.h"
+#include "Bsdf.h"
+#include "Sampler.h"
+
+/*! reference backend that runs the integrator of devicePrograms.slang
+	(renderFrame, closesthit_radiance, miss_radiance) on host threads,
+	for machines without a CUDA device. Given the same model, camera and
+	frame it accumulates the same image as SampleRenderer, up to float
+	rounding and texture filtering precision */
+class CpuRenderer : public Renderer {
+public:
+	/*! 'bvhQuality' applies to the initial build and to rebuilds after
+		geometry changes. With a bvhCacheDirectory, the initial BVHs are
+		mapped from there if an earlier run saved them (see BvhCache).
+		quantizedBvh8 stores the BVH8 with 8-bit child bounds, for
+		scenes whose nodes would not fit into memory otherwise, and
+		treeletRounds > 0 optimizes the initial BVH (see Bvh::optimize).
+		nextEventEstimation samples the emissive triangles directly at
+		diffuse and glossy hits, combined with the scattered rays by multiple
+		importance sampling; much less noise from small emitters, but no
+		longer the same image as SampleRenderer. lightSelection is how
+		it picks the emitter to sample; with 'reuse' the direct light
+		at camera hits comes from reservoirs of light samples shared
+		with neighbouring pixels and kept between frames instead (see
+		renderResampled). 'sequence' is where the paths' random numbers
+		come from; only SampleSequence::RANDOM gives the same image as a
+		SampleRenderer using another one */
+	CpuRenderer(const Model* model, const EnvironmentMap* environment = nullptr,
+				BvhBuildQuality bvhQuality = BvhBuildQuality::SAH, const std::string& bvhCacheDirectory = "",
+				bool quantizedBvh8 = false, int treeletRounds = 0, bool nextEventEstimation = false,
+				LightSelection lightSelection = LightSelection::POWER, ReservoirReuse reuse = ReservoirReuse::NONE,
+				SampleSequence sequence = SampleSequence::RANDOM);
+
+	void render() override;
+
+	void resize(const glm::ivec2& newSize) override;
+
+	void downloadPixels(uint32_t h_pixels[]) override;
+
+	void setCamera(const Camera& camera) override;
+
+	void applyChanges(const ModelChanges& changes) override;
+
+protected:
+	//! what SampleRenderer puts into a mesh's hitgroup record
+	struct Material {
+		enum Type { DIFFUSE, SPECULAR, DIELECTRIC } type;
+		glm::vec3 color;
+		glm::vec3 emissive;
+		glm::vec3 specular;
+		//! GGX roughness of SPECULAR, from the mesh's shininess
+		float roughness;
+		float ior;
+		int textureID;
+	};
+
+	//! a pixel's first hit, where its direct light is resampled
+	struct ShadingPoint {
+		glm::vec3 position;
+		//! unit shading normal, facing the camera
+		glm::vec3 normal;
+		//! unit direction towards the camera
+		glm::vec3 wo;
+		Bsdf bsdf;
+		//! distance from the camera
+		float depth;
+		//! false if the camera ray missed or hit a surface without
+		//! next event estimation
+		bool valid;
+	};
+
+	//! per path state, as in the Payload of devicePrograms.slang
+	struct Payload {
+		glm::vec3 attenuation;
+		PathSampler sampler;
+
+		glm::vec3 origin;
+		glm::vec3 direction;
+		glm::vec3 emitted;
+		glm::vec3 radiance;
+		bool done;
+		//! density of the last scatter direction, 0 if it came from a
+		//! delta lobe or without next event estimation
+		float bsdfPdf;
+		//! where that scatter was, for the density of light samples
+		glm::vec3 scatterPoint;
+		glm::vec3 scatterNormal;
+		//! where to record the path's first hit, if it is resampled;
+		//! null past that hit
+		ShadingPoint* shadingPoint;
+		//! the last hit's direct light comes from its reservoir,
+		//! so emitters found by its scattered ray count for nothing
+		bool directResampled;
+	};
+
+	void buildMaterials();
+
+	//! how 'material' scatters, with its diffuse color textured
+	static Bsdf materialBsdf(const Material& material, const glm::vec3& diffuseColor);
+
+	void renderTile(int tileX, int tileY);
+
+	void tracePaths(int tileX, int tileY, uint32_t active, Payload prd[]) const;
+
+	void renderResampled();
+
+	void traceResampledTile(int tileX, int tileY, int sample);
+
+	void resampleCandidates(int ix, int iy);
+
+	void resampleNeighbours(int ix, int iy);
+
+	/*! merges the reservoirs inputs[i], each resampled at points[i], into
+		one for points[0], whose own reservoir is inputs[0] */
+	Reservoir combineReservoirs(const Reservoir* inputs[], const ShadingPoint* points[], int count,
+								PathSampler& sampler) const;
+
+	//! unshadowed light from a point on an emitter, per unit emitter area
+	glm::vec3 unshadowedLight(const ShadingPoint& point, const glm::vec3& lightPosition,
+							  const glm::vec3& lightNormal, int meshID) const;
+
+	//! the resampling target, the luminance of unshadowedLight
+	float targetPdf(const ShadingPoint& point, const Reservoir& reservoir) const;
+
+	bool visible(const ShadingPoint& point, const glm::vec3& lightPosition) const;
+
+	void trace(const Ray& ray, Payload& prd) const;
+
+	void closestHit(const Ray& ray, const Hit& hit, Payload& prd) const;
+
+	void miss(const Ray& ray, Payload& prd) const;
+
+	/*! next event estimation at a hit with unit normal 'normal', on the
+		side of wo, the unit direction back along the path: a shadow ray
+		towards a point on an emitter, and the radiance per unit path
+		attenuation it brings through 'bsdf', MIS weighted, unless
+		occluded. False if the point cannot contribute */
+	bool sampleDirectLight(const glm::vec3& hitPoint, const glm::vec3& normal, const glm::vec3& wo,
+						   const Bsdf& bsdf, PathSampler& sampler, Ray& shadowRay, glm::vec3& radiance) const;
+
+	/*! MIS weight of the emission a scattered ray of density bsdfPdf
+		found at (meshID, primID), with geometric normal 'normal', at
+		t along 'direction'; the ray left scatterPoint, where the
+		surface has unit normal scatterNormal */
+	float emissionWeight(int meshID, int primID, const glm::vec3& normal, const glm::vec3& direction, float t,
+						 float bsdfPdf, const glm::vec3& scatterPoint, const glm::vec3& scatterNormal) const;
+
+	//! bilinear, wrapping lookup like the CUDA texture objects do
+	glm::vec3 sampleTexture(int textureID, const glm::vec2& tc) const;
+
+	//! stores a pixel's accumulated color, and its gamma corrected RGBA
+	void writePixel(int fbIndex, const glm::vec3& accumColor);
+
+	void reportThroughput(double seconds);
+
+protected:
+	const Model* model;
+	const EnvironmentMap* environment;
+	const BvhBuildQuality bvhQuality;
+	const bool quantizedBvh8;
+	const bool nextEventEstimation;
+	const LightSelection lightSelection;
+	const ReservoirReuse reuse;
+	const SampleSequence sequence;
+	Bvh bvh;
+	//! collapsed from bvh, used for all ray queries
+	Bvh8 bvh8;
+	std::vector<Material> materials;
+	//! the emitters, with nextEventEstimation
+	LightSampler lights;
+
+	glm::ivec2 fbSize{ 0 };
+	std::vector<uint32_t> colorBuffer;
+	std::vector<glm::vec3> accumBuffer;
+	CameraBasis camera;
+	Camera lastSetCamera;
+	uint32_t frameID{ 0 };
+
+	// per pixel state of reservoir resampling; the shading points and
+	// reservoirs of the previous sample stay for temporal reuse, also
+	// across frames and camera moves, until the scene or size change
+	std::vector<ShadingPoint> shadingPoints;
+	std::vector<ShadingPoint> previousShadingPoints;
+	std::vector<Reservoir> candidates;
+	std::vector<Reservoir> reservoirs;
+	//! the pixels' samplers, for their paths and then their resampling
+	std::vector<PathSampler> pixelSamplers;
+	std::vector<glm::vec3> frameColor;
+	//! the camera of previousShadingPoints
+	CameraBasis previousCamera{};
+
+	//! samples and render time since throughput was last printed
+	double statSamples{ 0.0 };
+	double statSeconds{ 0.0 };
+};
@@ -0,0 +1,143 @@
+#include "EnvironmentMap.h"
+#include "ParallelFor.h"
+
+#include "3rdParty/stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+static const float PI = 3.14159265358979f;
+
+static inline float luminance(const glm::vec3& c) {
+	return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+/*! finds the interval [cdf[i], cdf[i+1]) that contains u, for a CDF
+	with 'count' intervals */
+static inline int findInterval(const float* cdf, int count, float u) {
+	int i = int(std::upper_bound(cdf, cdf + count + 1, u) - cdf) - 1;
+	return glm::clamp(i, 0, count - 1);
+}
+
+static inline glm::vec2 directionToUV(const glm::vec3& dir) {
+	float phi = atan2f(dir.x, -dir.z);
+	float theta = acosf(glm::clamp(dir.y, -1.f, 1.f));
+	return glm::vec2(phi / (2.f * PI) + 0.5f, theta / PI);
+}
+
+static inline glm::vec3 uvToDirection(const glm::vec2& uv) {
+	float phi = (uv.x - 0.5f) * 2.f * PI;
+	float theta = uv.y * PI;
+	return glm::vec3(sinf(theta) * sinf(phi), cosf(theta), -sinf(theta) * cosf(phi));
+}
+
+static inline glm::ivec2 uvToPixel(const glm::vec2& uv, const glm::ivec2& res) {
+	return glm::clamp(glm::ivec2(uv * glm::vec2(res)), glm::ivec2(0), res - 1);
+}
+
+glm::vec3 EnvironmentMap::lookup(const glm::vec3& dir) const {
+	glm::ivec2 p = uvToPixel(directionToUV(dir), resolution);
+	return pixel[p.x + p.y * resolution.x];
+}
+
+glm::vec3 EnvironmentMap::sample(const glm::vec2& u, float& pdf) const {
+	pdf = 0.f;
+	if (integral <= 0.f)
+		return glm::vec3(0.f, 1.f, 0.f);
+
+	const int width = resolution.x;
+	const int height = resolution.y;
+
+	// row first, then the column within that row
+	int y = findInterval(marginalCdf.data(), height, u.y);
+	float dv = (u.y - marginalCdf[y]) / std::max(marginalCdf[y + 1] - marginalCdf[y], 1e-20f);
+
+	const float* rowCdf = conditionalCdf.data() + y * (width + 1);
+	int x = findInterval(rowCdf, width, u.x);
+	float du = (u.x - rowCdf[x]) / std::max(rowCdf[x + 1] - rowCdf[x], 1e-20f);
+
+	glm::vec2 uv((x + du) / width, (y + dv) / height);
+	glm::vec3 dir = uvToDirection(uv);
+
+	float sinTheta = sinf(uv.y * PI);
+	if (sinTheta <= 0.f)
+		return dir;
+
+	float sinThetaRow = sinf((y + .5f) * PI / height);
+	pdf = luminance(pixel[x + y * width]) * sinThetaRow / (integral * 2.f * PI * PI * sinTheta);
+	return dir;
+}
+
+float EnvironmentMap::pdf(const glm::vec3& dir) const {
+	if (integral <= 0.f)
+		return 0.f;
+
+	glm::vec2 uv = directionToUV(dir);
+	float sinTheta = sinf(uv.y * PI);
+	if (sinTheta <= 0.f)
+		return 0.f;
+
+	glm::ivec2 p = uvToPixel(uv, resolution);
+	float sinThetaRow = sinf((p.y + .5f) * PI / resolution.y);
+	return luminance(pixel[p.x + p.y * resolution.x]) * sinThetaRow / (integral * 2.f * PI * PI * sinTheta);
+}
+
+void buildSamplingTables(EnvironmentMap& env) {
+	auto start = std::chrono::steady_clock::now();
+
+	const int width = env.resolution.x;
+	const int height = env.resolution.y;
+
+	env.conditionalCdf.resize((size_t)height * (width + 1));
+	env.marginalCdf.resize(height + 1);
+	std::vector<float> rowIntegral(height);
+
+	// every row is independent of the others
+	parallelFor(0, height, [&](int y) {
+		float* cdf = env.conditionalCdf.data() + (size_t)y * (width + 1);
+		const glm::vec3* row = env.pixel.data() + (size_t)y * width;
+
+		cdf[0] = 0.f;
+		for (int x = 0; x < width; x++)
+			cdf[x + 1] = cdf[x] + luminance(row[x]) / width;
+
+		float sum = cdf[width];
+		rowIntegral[y] = sum * sinf((y + .5f) * PI / height);
+
+		// black rows never get picked by the marginal, but keep them valid
+		for (int x = 1; x <= width; x++)
+			cdf[x] = sum > 0.f ? cdf[x] / sum : float(x) / width;
+	}, 16);
+
+	env.marginalCdf[0] = 0.f;
+	for (int y = 0; y < height; y++)
+		env.marginalCdf[y + 1] = env.marginalCdf[y] + rowIntegral[y] / height;
+
+	env.integral = env.marginalCdf[height];
+	for (int y = 1; y <= height; y++)
+		env.marginalCdf[y] = env.integral > 0.f ? env.marginalCdf[y] / env.integral : float(y) / height;
+
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "Built environment sampling tables for " << width << "x" << height << " in "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+}
+
+EnvironmentMap* loadEnvironmentMap(const std::string& hdrFile) {
+	glm::ivec2 res;
+	int comp;
+	float* image = stbi_loadf(hdrFile.c_str(), &res.x, &res.y, &comp, STBI_rgb);
+	if (!image)
+		throw std::runtime_error("Could not load environment map from " + hdrFile);
+
+	EnvironmentMap* env = new EnvironmentMap;
+	env->resolution = res;
+	env->pixel.assign((const glm::vec3*)image, (const glm::vec3*)image + (size_t)res.x * res.y);
+	stbi_image_free(image);
+
+	std::cout << "Loaded " << res.x << "x" << res.y << " environment map from " << hdrFile << std::endl;
+
+	buildSamplingTables(*env);
+	return env;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include <vector>
+#include <string>
+
+/*! an HDR lat-long environment map, plus the tables needed to
+	importance sample it proportional to luminance. Direction
+	(x,y,z) maps to u = phi / 2pi, v = theta / pi, with theta measured
+	from +y (the renderer's up axis) and row 0 at the top */
+struct EnvironmentMap {
+	glm::ivec2 resolution{ 0 };
+	std::vector<glm::vec3> pixel;
+
+	//! one normalized (width+1)-entry CDF per row, over luminance
+	std::vector<float> conditionalCdf;
+	//! normalized (height+1)-entry CDF over the rows, weighted by sin(theta)
+	std::vector<float> marginalCdf;
+	//! integral of luminance * sin(theta) over the unit square
+	float integral{ 0.f };
+
+	//! radiance arriving from (normalized) direction dir
+	glm::vec3 lookup(const glm::vec3& dir) const;
+
+	/*! picks a direction for two uniform numbers in [0,1), and returns
+		its solid angle pdf in 'pdf' (0 if nothing could be sampled) */
+	glm::vec3 sample(const glm::vec2& u, float& pdf) const;
+
+	//! solid angle pdf with which sample() returns direction dir
+	float pdf(const glm::vec3& dir) const;
+};
+
+/*! loads a lat-long HDR image (anything stbi_loadf reads) and builds
+	its sampling tables. Throws if the file could not be loaded */
+EnvironmentMap* loadEnvironmentMap(const std::string& hdrFile);
+
+/*! (re-)builds the marginal and conditional CDFs of the map, rows in
+	parallel */
+void buildSamplingTables(EnvironmentMap& env);
@@ -0,0 +1,119 @@
+#include "FileWatcher.h"
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+static std::string directoryOf(const std::string& file) {
+	size_t slash = file.rfind('/');
+	return slash == std::string::npos ? "." : file.substr(0, slash);
+}
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher() {
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+FileWatcher::~FileWatcher() {
+	if (inotifyFd >= 0)
+		close(inotifyFd);
+}
+
+void FileWatcher::watch(const std::vector<std::string>& newFiles) {
+	files = std::set<std::string>(newFiles.begin(), newFiles.end());
+	if (inotifyFd < 0)
+		return;
+
+	std::set<std::string> wanted;
+	for (auto& file : files)
+		wanted.insert(directoryOf(file));
+
+	for (auto it = directories.begin(); it != directories.end();) {
+		if (wanted.count(it->second)) {
+			wanted.erase(it->second);
+			++it;
+		}
+		else {
+			inotify_rm_watch(inotifyFd, it->first);
+			it = directories.erase(it);
+		}
+	}
+	for (auto& dir : wanted) {
+		// rename covers editors that write a temp file and move it over
+		int wd = inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (wd >= 0)
+			directories[wd] = dir;
+	}
+}
+
+std::vector<std::string> FileWatcher::poll() {
+	std::set<std::string> changed;
+	if (inotifyFd < 0)
+		return {};
+
+	alignas(inotify_event) char buffer[16 * 1024];
+	while (true) {
+		ssize_t len = read(inotifyFd, buffer, sizeof(buffer));
+		if (len <= 0)
+			break;
+		for (char* ptr = buffer; ptr < buffer + len;) {
+			const inotify_event* event = (const inotify_event*)ptr;
+			ptr += sizeof(inotify_event) + event->len;
+
+			auto dir = directories.find(event->wd);
+			if (dir == directories.end() || event->len == 0)
+				continue;
+			std::string file = dir->second + "/" + event->name;
+			if (files.count(file))
+				changed.insert(file);
+		}
+	}
+	return std::vector<std::string>(changed.begin(), changed.end());
+}
+
+#else
+
+static long long modificationTime(const std::string& file) {
+	struct stat info;
+	if (stat(file.c_str(), &info) != 0)
+		return -1;
+	return (long long)info.st_mtime;
+}
+
+FileWatcher::FileWatcher() {}
+
+FileWatcher::~FileWatcher() {}
+
+void FileWatcher::watch(const std::vector<std::string>& newFiles) {
+	files = std::set<std::string>(newFiles.begin(), newFiles.end());
+	std::map<std::string, long long> times;
+	for (auto& file : files)
+		times[file] = modificationTimes.count(file) ? modificationTimes[file] : modificationTime(file);
+	modificationTimes.swap(times);
+	lastScan = std::chrono::steady_clock::now();
+}
+
+std::vector<std::string> FileWatcher::poll() {
+	// stat()ing every file each frame would be wasteful
+	auto now = std::chrono::steady_clock::now();
+	if (now - lastScan < std::chrono::milliseconds(250))
+		return {};
+	lastScan = now;
+
+	std::vector<std::string> changed;
+	for (auto& entry : modificationTimes) {
+		long long time = modificationTime(entry.first);
+		if (time != entry.second && time >= 0) {
+			entry.second = time;
+			changed.push_back(entry.first);
+		}
+	}
+	return changed;
+}
+
+#endif
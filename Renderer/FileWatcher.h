@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/*! reports which of a set of files were modified on disk. Uses inotify
+	on Linux (watching the files' directories, so editors that save via
+	rename are caught as well); elsewhere it polls modification times */
+class FileWatcher {
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	/*! replaces the set of watched files; paths should be canonical
+		(see canonicalPath) since changes are reported as such */
+	void watch(const std::vector<std::string>& files);
+
+	/*! files that changed since the last call; never blocks */
+	std::vector<std::string> poll();
+
+private:
+	std::set<std::string> files;
+
+#ifdef __linux__
+	int inotifyFd{ -1 };
+	//! inotify watch descriptor -> watched directory
+	std::map<int, std::string> directories;
+#else
+	std::map<std::string, long long> modificationTimes;
+	std::chrono::steady_clock::time_point lastScan;
+#endif
+};
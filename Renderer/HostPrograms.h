@@ -0,0 +1,29 @@
+#pragma once
+
+#include "RayPacket.h"
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// the constants of devicePrograms.slang, bit for bit, so that the CPU
+// integrators (CpuRenderer and WavefrontRenderer) trace the same paths
+// as the GPU; scattering is in Bsdf, random numbers in Sampler
+static const float PI = 3.14159f;
+static const int raysPerPixel = 4;
+static const int maxDepth = 10;
+// pixels are rendered in tiles of one ray packet
+static const int tileSize = 4;
+static_assert(tileSize * tileSize == packetSize, "a tile fills one ray packet");
+// the PathSampler dimensions of a path: two for the camera ray, then
+// per hit four for next event estimation, three for the BSDF and one
+// unused, whether or not the hit takes them
+static const uint32_t cameraDimensions = 2;
+static const uint32_t bounceDimensions = 8;
+static const uint32_t lightDimensions = 4;
+static const uint32_t bsdfDimensions = 3;
+
+static inline float linearToGamma(float linear) {
+	return linear > 0 ? std::sqrt(linear) : 0.f;
+}
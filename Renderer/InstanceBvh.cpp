@@ -0,0 +1,186 @@
+#include "InstanceBvh.h"
+#include "BvhBuild.h"
+
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+/*! world bounds of an instance: its bottom level root box, transformed */
+Box InstanceBvh::instanceBounds(uint32_t instanceID) const {
+	const Instance& instance = instances[instanceID];
+	const BvhNode& root = instance.blas->nodes[0];
+	Box box;
+	for (int corner = 0; corner < 8; corner++) {
+		const glm::vec3 p(corner & 1 ? root.upper.x : root.lower.x,
+						  corner & 2 ? root.upper.y : root.lower.y,
+						  corner & 4 ? root.upper.z : root.lower.z);
+		box.extend(glm::vec3(instance.transform * glm::vec4(p, 1.f)));
+	}
+	return box;
+}
+
+void InstanceBvh::build(const std::vector<Instance>& instances) {
+	auto start = std::chrono::steady_clock::now();
+	this->instances = instances;
+	worldToObject.resize(instances.size());
+
+	std::vector<BuildPrim> buildPrims(instances.size());
+	for (size_t i = 0; i < instances.size(); i++) {
+		const Instance& instance = instances[i];
+		if (!instance.blas)
+			throw std::runtime_error("instance " + std::to_string(i) + " has no bottom level BVH");
+		worldToObject[i] = glm::inverse(instance.transform);
+
+		const Box bounds = instanceBounds(uint32_t(i));
+		BuildPrim& prim = buildPrims[i];
+		prim.lower = bounds.lower;
+		prim.upper = bounds.upper;
+		prim.centroid = 0.5f * (prim.lower + prim.upper);
+		prim.ref = { 0, int(i) };
+	}
+
+	if (instances.empty()) {
+		// count 0 makes this an inner node (there are no empty leaves),
+		// but its inverted bounds mean no ray ever enters it to visit
+		// the children it does not have; refit() skips it as well
+		nodes.assign(1, BvhNode());
+		nodes[0] = { glm::vec3(1e30f), 0, glm::vec3(-1e30f), 0 };
+		leafInstances.clear();
+	}
+	else {
+		std::vector<PrimRef> refs;
+		buildSahBvh(buildPrims, nodes, refs);
+		leafInstances.resize(refs.size());
+		for (size_t i = 0; i < refs.size(); i++)
+			leafInstances[i] = uint32_t(refs[i].primID);
+	}
+	builtSahCost = sahCost(nodes.data(), nodes.size());
+
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "Instance BVH: " << instances.size() << " instances, " << nodes.size() << " top level nodes in "
+		<< std::chrono::duration<double>(end - start).count() * 1e3 << " ms\n";
+}
+
+void InstanceBvh::setTransform(uint32_t instanceID, const glm::mat4& transform) {
+	instances[instanceID].transform = transform;
+	worldToObject[instanceID] = glm::inverse(transform);
+}
+
+void InstanceBvh::refit() {
+	if (instances.empty())
+		return;
+	refitBvh(nodes, [this](const BvhNode& leaf) {
+		Box box;
+		for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++)
+			box.extend(instanceBounds(leafInstances[i]));
+		return box;
+	});
+}
+
+bool InstanceBvh::update(float maxSahGrowth) {
+	refit();
+	if (sahCost(nodes.data(), nodes.size()) <= maxSahGrowth * builtSahCost)
+		return false;
+	const std::vector<Instance> current = instances;
+	build(current);
+	return true;
+}
+
+size_t InstanceBvh::topLevelBytes() const {
+	return nodes.size() * sizeof(BvhNode) + leafInstances.size() * sizeof(uint32_t)
+		+ instances.size() * (sizeof(Instance) + sizeof(glm::mat4));
+}
+
+/*! traces the ray through one instance's bottom level in object space.
+	The direction is not renormalized, so t is the same in both spaces */
+bool InstanceBvh::intersectInstance(const Ray& ray, uint32_t instanceID, float tmax, Hit& hit, bool anyHit) const {
+	const glm::mat4& toObject = worldToObject[instanceID];
+	Ray objectRay;
+	objectRay.origin = glm::vec3(toObject * glm::vec4(ray.origin, 1.f));
+	objectRay.direction = glm::vec3(toObject * glm::vec4(ray.direction, 0.f));
+	objectRay.tmin = ray.tmin;
+	objectRay.tmax = tmax;
+
+	const Bvh& blas = *instances[instanceID].blas;
+	if (!(anyHit ? blas.anyHit(objectRay, hit) : blas.closestHit(objectRay, hit)))
+		return false;
+	hit.instanceID = int(instanceID);
+	return true;
+}
+
+bool InstanceBvh::closestHit(const Ray& ray, Hit& hit, uint8_t rayMask) const {
+	const glm::vec3 invDir = 1.f / ray.direction;
+	float tmax = ray.tmax;
+	bool found = false;
+
+	uint32_t stack[128];
+	int stackSize = 0;
+	uint32_t nodeID = 0;
+	if (intersectBox(nodes[0], ray, invDir, tmax) >= tmax)
+		return false;
+
+	while (true) {
+		const BvhNode& node = nodes[nodeID];
+		if (node.isLeaf()) {
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+				const uint32_t instanceID = leafInstances[i];
+				if ((instances[instanceID].mask & rayMask) && intersectInstance(ray, instanceID, tmax, hit, false)) {
+					tmax = hit.t;
+					found = true;
+				}
+			}
+		}
+		else {
+			uint32_t near = node.offset, far = node.offset + 1;
+			float tNear = intersectBox(nodes[near], ray, invDir, tmax);
+			float tFar = intersectBox(nodes[far], ray, invDir, tmax);
+			if (tFar < tNear) {
+				std::swap(near, far);
+				std::swap(tNear, tFar);
+			}
+			if (tNear < tmax) {
+				if (tFar < tmax)
+					stack[stackSize++] = far;
+				nodeID = near;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+			break;
+		nodeID = stack[--stackSize];
+	}
+
+	// normals transform with the inverse transpose, once for the closest hit
+	if (found)
+		hit.normal = glm::transpose(glm::mat3(worldToObject[hit.instanceID])) * hit.normal;
+	return found;
+}
+
+bool InstanceBvh::anyHit(const Ray& ray, Hit& hit, uint8_t rayMask) const {
+	const glm::vec3 invDir = 1.f / ray.direction;
+	uint32_t stack[128];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const BvhNode& node = nodes[stack[--stackSize]];
+		if (intersectBox(node, ray, invDir, ray.tmax) >= ray.tmax)
+			continue;
+		if (node.isLeaf()) {
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+				const uint32_t instanceID = leafInstances[i];
+				if ((instances[instanceID].mask & rayMask) && intersectInstance(ray, instanceID, ray.tmax, hit, true)) {
+					hit.normal = glm::transpose(glm::mat3(worldToObject[instanceID])) * hit.normal;
+					return true;
+				}
+			}
+		}
+		else {
+			stack[stackSize++] = node.offset + 1;
+			stack[stackSize++] = node.offset;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Bvh.h"
+
+struct Box;
+
+/*! one placement of a bottom level BVH in the world, like an
+	OptixInstance over a GAS */
+struct Instance {
+	//! object to world; only the affine part is used
+	glm::mat4 transform{ 1.f };
+	//! the instanced geometry: a BVH over its own model, usually of a
+	//! single mesh, shared by any number of instances
+	const Bvh* blas{ nullptr };
+	//! rays whose mask shares no bit with this one skip the instance
+	uint8_t mask{ 0xff };
+};
+
+/*! host side two-level acceleration structure: a top level BVH over
+	instances, each a transform of a bottom level Bvh. Rays are moved
+	into the object space of every instance they reach, so that one copy
+	of a mesh and its BVH serves all of its instances */
+class InstanceBvh {
+public:
+	/*! (re-)builds the top level over the instances with the binned SAH;
+		the bottom level BVHs must be built and outlive this */
+	void build(const std::vector<Instance>& instances);
+
+	/*! closest intersection in (ray.tmin, ray.tmax) with the instances
+		whose mask shares a bit with rayMask, like the visibility mask
+		of TraceRay. hit.instanceID names the instance, and meshID and
+		primID its bottom level model's triangle */
+	bool closestHit(const Ray& ray, Hit& hit, uint8_t rayMask = 0xff) const;
+
+	//! some intersection, whichever is found first; for visibility tests
+	bool anyHit(const Ray& ray, Hit& hit, uint8_t rayMask = 0xff) const;
+
+	/*! moves an instance; queries only find it at its new place once
+		refit() or update() have moved the top level bounds along */
+	void setTransform(uint32_t instanceID, const glm::mat4& transform);
+
+	/*! recomputes the top level bounds after setTransform() calls or
+		refits of the bottom level BVHs, in parallel, keeping the tree */
+	void refit();
+
+	/*! refits, and rebuilds the top level if its SAH cost grew past
+		maxSahGrowth times that of the last build; returns true if it
+		rebuilt */
+	bool update(float maxSahGrowth = 1.5f);
+
+	//! bytes of the top level: nodes, leaf references and instances
+	size_t topLevelBytes() const;
+
+	const std::vector<Instance>& instanceList() const { return instances; }
+
+	//! top level nodes; leaves index 'leafInstances'
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> leafInstances;
+
+private:
+	Box instanceBounds(uint32_t instanceID) const;
+	bool intersectInstance(const Ray& ray, uint32_t instanceID, float tmax, Hit& hit, bool anyHit) const;
+
+	std::vector<Instance> instances;
+	//! inverse transforms, which take world space rays to object space
+	std::vector<glm::mat4> worldToObject;
+	float builtSahCost{ 0.f };
+};
@@ -12,7 +12,8 @@ struct TriangleMeshSBTData {
 	float3 color;
 	float3 emmisive;
 	float3 specular;
-	float shininess;
+	// GGX roughness of SPECULAR materials
+	float roughness;
 	float ior;
 	enum MaterialType {
 		DIFFUSE,
@@ -41,4 +42,18 @@ struct LaunchParams {
 
 	OptixTraversableHandle traversable;
 	unsigned int frameID{ 0 };
+
+	// HDR lat-long environment and its importance sampling tables;
+	// resolution.x == 0 means "no environment, use the sky gradient"
+	struct Environment {
+		StructuredBuffer<float3> pixel;
+		StructuredBuffer<float> conditionalCdf;
+		StructuredBuffer<float> marginalCdf;
+		int2 resolution;
+		float integral;
+	} environment;
+
+	// a SampleSequence, and the blue-noise ranks it may need
+	unsigned int sampleSequence{ 0 };
+	StructuredBuffer<uint32_t> blueNoise;
 };
\ No newline at end of file
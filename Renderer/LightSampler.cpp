@@ -0,0 +1,400 @@
+#include "LightSampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+static const float pi = 3.14159265f;
+// the largest float below 1, so remapped random numbers stay in [0,1)
+static const float oneMinusEpsilon = 0.99999994f;
+// subtrees with more levels than this are split at the median, so that
+// every path from the root fits into a 64-bit trail
+static const int maxSahDepth = 40;
+static const int numBuckets = 12;
+
+static inline float safeSqrt(float x) {
+	return std::sqrt(std::max(x, 0.f));
+}
+
+/*! cos(max(0, a - b)) from the sines and cosines of angles a and b */
+static inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+	if (cosA > cosB)
+		return 1.f;
+	return cosA * cosB + sinA * sinB;
+}
+
+/*! sin(max(0, a - b)) */
+static inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+	if (cosA > cosB)
+		return 0.f;
+	return sinA * cosB - cosA * sinB;
+}
+
+/*! an upper bound on the light a subtree sends towards 'point', where
+	the surface has normal 'normal' (zero if it scatters all ways):
+	power over squared distance, times the cosine at the emitters and at
+	the surface, each for the angle that the bounds and the normal cone
+	allow to be smallest. After Conty Estevez and Kulla, as in pbrt-v4 */
+float LightSampler::Node::importance(const glm::vec3& point, const glm::vec3& normal) const {
+	const glm::vec3 toPoint = point - center;
+	const float dist2 = glm::dot(toPoint, toPoint);
+	const float invDist = dist2 > 0.f ? 1.f / std::sqrt(dist2) : 0.f;
+	const glm::vec3 wi = dist2 > 0.f ? toPoint * invDist : axis;
+
+	// emitters shine both ways, so only the angle to the axis' line counts
+	const float cosThetaW = std::abs(glm::dot(axis, wi));
+	const float sinThetaW = safeSqrt(1.f - cosThetaW * cosThetaW);
+
+	// the angle the bounding sphere takes up as seen from 'point'
+	float cosThetaB = -1.f, sinThetaB = 0.f;
+	if (dist2 > radius * radius) {
+		sinThetaB = radius * invDist;
+		cosThetaB = safeSqrt(1.f - sinThetaB * sinThetaB);
+	}
+
+	const float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinTheta, cosTheta);
+	const float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinTheta, cosTheta);
+	const float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= 0.f)
+		return 0.f;
+
+	// not closer than the radius, so big nodes around the point do not
+	// take all samples
+	float importance = power * cosThetaP / std::max(dist2, radius);
+	if (normal != glm::vec3(0.f)) {
+		const float cosThetaI = glm::dot(-wi, normal);
+		const float sinThetaI = safeSqrt(1.f - cosThetaI * cosThetaI);
+		importance *= std::max(cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB), 0.f);
+	}
+	return importance;
+}
+
+/*! rotates v by 'angle' around the unit vector 'axis' */
+static glm::vec3 rotate(const glm::vec3& v, const glm::vec3& axis, float angle) {
+	const float c = std::cos(angle), s = std::sin(angle);
+	return c * v + s * glm::cross(axis, v) + (1.f - c) * glm::dot(axis, v) * axis;
+}
+
+LightSampler::Node LightSampler::makeNode(const LightBounds& bounds, uint32_t offset, uint32_t count) {
+	Node node;
+	node.center = 0.5f * (bounds.lower + bounds.upper);
+	node.radius = 0.5f * glm::length(bounds.upper - bounds.lower);
+	node.axis = bounds.axis;
+	node.power = bounds.power;
+	node.cosTheta = bounds.cosTheta;
+	node.sinTheta = safeSqrt(1.f - bounds.cosTheta * bounds.cosTheta);
+	node.offset = offset;
+	node.count = count;
+	return node;
+}
+
+LightSampler::LightBounds LightSampler::merge(const LightBounds& a, const LightBounds& b) {
+	LightBounds bounds;
+	bounds.lower = glm::min(a.lower, b.lower);
+	bounds.upper = glm::max(a.upper, b.upper);
+	bounds.power = a.power + b.power;
+
+	// the smallest cone around both normal cones
+	const float thetaA = std::acos(glm::clamp(a.cosTheta, -1.f, 1.f));
+	const float thetaB = std::acos(glm::clamp(b.cosTheta, -1.f, 1.f));
+	const float thetaD = std::acos(glm::clamp(glm::dot(a.axis, b.axis), -1.f, 1.f));
+	if (std::min(thetaD + thetaB, pi) <= thetaA) {
+		bounds.axis = a.axis;
+		bounds.cosTheta = a.cosTheta;
+		return bounds;
+	}
+	if (std::min(thetaD + thetaA, pi) <= thetaB) {
+		bounds.axis = b.axis;
+		bounds.cosTheta = b.cosTheta;
+		return bounds;
+	}
+	const float thetaO = 0.5f * (thetaA + thetaD + thetaB);
+	const glm::vec3 w = glm::cross(a.axis, b.axis);
+	if (thetaO >= pi || glm::dot(w, w) == 0.f) {
+		bounds.axis = a.axis;
+		bounds.cosTheta = -1.f;
+		return bounds;
+	}
+	bounds.axis = glm::normalize(rotate(a.axis, glm::normalize(w), thetaO - thetaA));
+	bounds.cosTheta = std::cos(thetaO);
+	return bounds;
+}
+
+/*! the surface area orientation heuristic of Conty Estevez and Kulla:
+	power, times the solid angle measure of the normal cone widened by
+	the 90 degrees of falloff, times surface area */
+static float orientationCost(float power, float cosTheta, const glm::vec3& lower, const glm::vec3& upper) {
+	const float thetaO = std::acos(glm::clamp(cosTheta, -1.f, 1.f));
+	const float thetaW = std::min(thetaO + 0.5f * pi, pi);
+	const float sinThetaO = safeSqrt(1.f - cosTheta * cosTheta);
+	const float measure = 2.f * pi * (1.f - cosTheta)
+		+ 0.5f * pi * (2.f * thetaW * sinThetaO - std::cos(thetaO - 2.f * thetaW) - 2.f * thetaO * sinThetaO + cosTheta);
+	const glm::vec3 d = upper - lower;
+	return power * measure * 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+uint32_t LightSampler::buildNode(std::vector<LightBounds>& bounds, std::vector<uint32_t>& order, uint32_t begin,
+								 uint32_t end, uint64_t trail, int depth) {
+	const uint32_t nodeID = (uint32_t)nodes.size();
+	nodes.push_back(Node());
+	if (end - begin == 1) {
+		nodes[nodeID] = makeNode(bounds[order[begin]], order[begin], 1);
+		trails[order[begin]] = trail;
+		return nodeID;
+	}
+
+	LightBounds nodeBounds = bounds[order[begin]];
+	glm::vec3 centroidLower(1e30f), centroidUpper(-1e30f);
+	for (uint32_t i = begin; i < end; i++) {
+		const LightBounds& b = bounds[order[i]];
+		if (i > begin)
+			nodeBounds = merge(nodeBounds, b);
+		const glm::vec3 centroid = 0.5f * (b.lower + b.upper);
+		centroidLower = glm::min(centroidLower, centroid);
+		centroidUpper = glm::max(centroidUpper, centroid);
+	}
+
+	// binned SAOH over all three axes, as SAH is for the ray BVH
+	const glm::vec3 extent = centroidUpper - centroidLower;
+	const glm::vec3 diagonal = nodeBounds.upper - nodeBounds.lower;
+	const float maxDiagonal = std::max(std::max(diagonal.x, diagonal.y), diagonal.z);
+	int bestAxis = -1, bestSplit = 0;
+	float bestCost = 1e30f;
+	for (int axis = 0; depth < maxSahDepth && axis < 3; axis++) {
+		if (!(extent[axis] > 0.f))
+			continue;
+		LightBounds buckets[numBuckets];
+		int counts[numBuckets] = {};
+		for (uint32_t i = begin; i < end; i++) {
+			const LightBounds& b = bounds[order[i]];
+			const float centroid = 0.5f * (b.lower[axis] + b.upper[axis]);
+			const int bucket = std::min(int(numBuckets * (centroid - centroidLower[axis]) / extent[axis]), numBuckets - 1);
+			buckets[bucket] = counts[bucket]++ ? merge(buckets[bucket], b) : b;
+		}
+		// elongated nodes are better split across their long side
+		const float kr = maxDiagonal / diagonal[axis];
+		for (int split = 0; split < numBuckets - 1; split++) {
+			LightBounds below, above;
+			int countBelow = 0, countAbove = 0;
+			for (int i = 0; i <= split; i++)
+				if (counts[i])
+					below = countBelow++ ? merge(below, buckets[i]) : buckets[i];
+			for (int i = split + 1; i < numBuckets; i++)
+				if (counts[i])
+					above = countAbove++ ? merge(above, buckets[i]) : buckets[i];
+			if (!countBelow || !countAbove)
+				continue;
+			const float cost = kr * (orientationCost(below.power, below.cosTheta, below.lower, below.upper)
+				+ orientationCost(above.power, above.cosTheta, above.lower, above.upper));
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	uint32_t middle;
+	if (bestAxis >= 0) {
+		middle = uint32_t(std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t light) {
+			const LightBounds& b = bounds[light];
+			const float centroid = 0.5f * (b.lower[bestAxis] + b.upper[bestAxis]);
+			const int bucket = std::min(int(numBuckets * (centroid - centroidLower[bestAxis]) / extent[bestAxis]),
+				numBuckets - 1);
+			return bucket <= bestSplit;
+		}) - order.begin());
+	}
+	else {
+		// too deep, or all centroids in one place: halves along the
+		// longest axis
+		int axis = 0;
+		if (extent.y > extent[axis]) axis = 1;
+		if (extent.z > extent[axis]) axis = 2;
+		middle = (begin + end) / 2;
+		std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b) {
+			return bounds[a].lower[axis] + bounds[a].upper[axis] < bounds[b].lower[axis] + bounds[b].upper[axis];
+		});
+	}
+
+	buildNode(bounds, order, begin, middle, trail, depth + 1);
+	const uint32_t second = buildNode(bounds, order, middle, end, trail | (uint64_t(1) << depth), depth + 1);
+	nodes[nodeID] = makeNode(nodeBounds, second, 0);
+	return nodeID;
+}
+
+void LightSampler::buildHierarchy(const std::vector<double>& weights) {
+	std::vector<LightBounds> bounds(lights.size());
+	std::vector<uint32_t> order;
+	for (uint32_t i = 0; i < lights.size(); i++) {
+		const Light& light = lights[i];
+		bounds[i].lower = glm::min(light.v0, glm::min(light.v0 + light.e1, light.v0 + light.e2));
+		bounds[i].upper = glm::max(light.v0, glm::max(light.v0 + light.e1, light.v0 + light.e2));
+		bounds[i].power = float(weights[i]);
+		bounds[i].axis = light.normal;
+		bounds[i].cosTheta = 1.f;
+		// degenerate triangles never get picked
+		if (weights[i] > 0.0)
+			order.push_back(i);
+	}
+	trails.assign(lights.size(), 0);
+	nodes.reserve(2 * order.size());
+	buildNode(bounds, order, 0, (uint32_t)order.size(), 0, 0);
+}
+
+void LightSampler::buildAliasTable(const std::vector<double>& weights, double totalWeight) {
+	// probabilities scaled so that they average 1; buckets below that
+	// are topped up with the excess of one above it
+	const size_t n = lights.size();
+	std::vector<double> scaled(n);
+	std::vector<uint32_t> small, large;
+	for (size_t i = 0; i < n; i++) {
+		const double probability = weights[i] / totalWeight;
+		lights[i].pdfArea = float(lights[i].pdfArea * probability);
+		scaled[i] = probability * n;
+		(scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+	}
+	buckets.resize(n);
+	while (!small.empty() && !large.empty()) {
+		const uint32_t s = small.back(), l = large.back();
+		small.pop_back();
+		buckets[s].threshold = float(scaled[s]);
+		buckets[s].alias = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// what is left is 1 up to rounding
+	for (uint32_t i : small)
+		buckets[i] = { 1.f, i };
+	for (uint32_t i : large)
+		buckets[i] = { 1.f, i };
+}
+
+void LightSampler::build(const Model* model, LightSelection selection) {
+	this->selection = selection;
+	lights.clear();
+	buckets.clear();
+	nodes.clear();
+	trails.clear();
+	firstLight.assign(model->meshes.size(), -1);
+
+	std::vector<double> weights;
+	double totalWeight = 0.0;
+	for (size_t meshID = 0; meshID < model->meshes.size(); meshID++) {
+		const TriangleMesh* mesh = model->meshes[meshID];
+		const glm::vec3 e = mesh->emmissive;
+		const float power = (e.x + e.y + e.z) / 3.f;
+		if (!(power > 0.f))
+			continue;
+		firstLight[meshID] = (int)lights.size();
+		for (const glm::ivec3& index : mesh->index) {
+			Light light;
+			light.v0 = mesh->vertex[index.x];
+			light.e1 = mesh->vertex[index.y] - light.v0;
+			light.e2 = mesh->vertex[index.z] - light.v0;
+			const glm::vec3 n = glm::cross(light.e1, light.e2);
+			const float area = 0.5f * glm::length(n);
+			light.normal = area > 0.f ? n / (2.f * area) : glm::vec3(0.f, 0.f, 1.f);
+			light.meshID = (int)meshID;
+			light.pdfArea = area > 0.f ? 1.f / area : 0.f;
+			lights.push_back(light);
+			weights.push_back(double(area) * power);
+			totalWeight += weights.back();
+		}
+	}
+	if (!(totalWeight > 0.0)) {
+		lights.clear();
+		firstLight.assign(model->meshes.size(), -1);
+		return;
+	}
+
+	if (selection == LightSelection::HIERARCHY) {
+		buildHierarchy(weights);
+		std::cout << "Lights: " << lights.size() << " emissive triangles, hierarchy of " << nodes.size() << " nodes\n";
+	}
+	else {
+		buildAliasTable(weights, totalWeight);
+		std::cout << "Lights: " << lights.size() << " emissive triangles\n";
+	}
+}
+
+LightSample LightSampler::sample(const glm::vec3& point, const glm::vec3& normal, float u0, float u1, float u2,
+								 float u3) const {
+	LightSample sample;
+	uint32_t i;
+	float pdf = 1.f;
+	if (selection == LightSelection::HIERARCHY) {
+		// one random number for the whole descent, rescaled at each node
+		uint32_t nodeID = 0;
+		while (!nodes[nodeID].isLeaf()) {
+			const float first = nodes[nodeID + 1].importance(point, normal);
+			const float second = nodes[nodes[nodeID].offset].importance(point, normal);
+			if (!(first + second > 0.f)) {
+				sample.pdfArea = 0.f;
+				return sample;
+			}
+			const float p = first / (first + second);
+			if (u0 < p) {
+				nodeID = nodeID + 1;
+				u0 = std::min(u0 / p, oneMinusEpsilon);
+				pdf *= p;
+			}
+			else {
+				nodeID = nodes[nodeID].offset;
+				u0 = std::min((u0 - p) / (1.f - p), oneMinusEpsilon);
+				pdf *= 1.f - p;
+			}
+		}
+		i = nodes[nodeID].offset;
+	}
+	else {
+		i = std::min(uint32_t(u0 * lights.size()), uint32_t(lights.size() - 1));
+		if (u1 >= buckets[i].threshold)
+			i = buckets[i].alias;
+	}
+	const Light& light = lights[i];
+
+	// uniform over the triangle
+	const float su = std::sqrt(u2);
+	const float b1 = su * (1.f - u3);
+	const float b2 = su * u3;
+
+	sample.position = light.v0 + b1 * light.e1 + b2 * light.e2;
+	sample.normal = light.normal;
+	sample.meshID = light.meshID;
+	sample.pdfArea = pdf * light.pdfArea;
+	return sample;
+}
+
+float LightSampler::pdfArea(const glm::vec3& point, const glm::vec3& normal, int meshID, int primID) const {
+	const int first = firstLight[meshID];
+	if (first < 0)
+		return 0.f;
+	const Light& light = lights[first + primID];
+	if (selection != LightSelection::HIERARCHY || light.pdfArea == 0.f)
+		return light.pdfArea;
+
+	// the descent of sample() that ends at this light
+	uint64_t trail = trails[first + primID];
+	uint32_t nodeID = 0;
+	float pdf = 1.f;
+	while (!nodes[nodeID].isLeaf()) {
+		const float firstImportance = nodes[nodeID + 1].importance(point, normal);
+		const float secondImportance = nodes[nodes[nodeID].offset].importance(point, normal);
+		if (!(firstImportance + secondImportance > 0.f))
+			return 0.f;
+		const float p = firstImportance / (firstImportance + secondImportance);
+		if (trail & 1) {
+			nodeID = nodes[nodeID].offset;
+			pdf *= 1.f - p;
+		}
+		else {
+			nodeID = nodeID + 1;
+			pdf *= p;
+		}
+		trail >>= 1;
+	}
+	return pdf * light.pdfArea;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "Model.h"
+
+#include <cstdint>
+#include <vector>
+
+/*! how LightSampler picks an emissive triangle for a shading point */
+enum class LightSelection {
+	//! by area times power from an alias table, the same everywhere; best
+	//! for few lights
+	POWER,
+	//! by the importance estimated from a hierarchy over the lights'
+	//! bounds, power and normals; for scenes with many lights, of which
+	//! only a few matter at any one point
+	HIERARCHY
+};
+
+/*! a point on an emissive triangle, as drawn by LightSampler::sample */
+struct LightSample {
+	glm::vec3 position;
+	//! unit geometric normal of the triangle; emitters shine both ways
+	glm::vec3 normal;
+	int meshID;
+	//! probability density of having drawn this point, per unit area;
+	//! 0 if no light could contribute to the shading point
+	float pdfArea;
+};
+
+/*! all triangles of the meshes with a nonzero emissive color, for next
+	event estimation. A triangle is picked, then a point uniformly on it.
+	With LightSelection::POWER the triangle comes in O(1) from an alias
+	table (Vose's method) with probability proportional to its area
+	times its emitted power, so pdfArea is the same over an emitter.
+	With LightSelection::HIERARCHY it comes from a stochastic descent
+	of a binary tree over the triangles: each node bounds the positions,
+	total power and normals (as a cone) of its lights, and at each node
+	the child with the larger estimated contribution to the shading
+	point is more likely taken (the light BVH of Conty Estevez and
+	Kulla, "Importance Sampling of Many Lights with Adaptive Tree
+	Splitting", 2018, without the splitting) */
+class LightSampler {
+public:
+	//! (re)collects the emitters of 'model'
+	void build(const Model* model, LightSelection selection = LightSelection::POWER);
+
+	bool empty() const { return lights.empty(); }
+
+	size_t size() const { return lights.size(); }
+
+	/*! a point on a light, for the shading point 'point' with unit normal
+		'normal' (only used with LightSelection::HIERARCHY), from four
+		uniform numbers in [0,1): two pick the triangle, two the point */
+	LightSample sample(const glm::vec3& point, const glm::vec3& normal, float u0, float u1, float u2,
+					   float u3) const;
+
+	/*! density per unit area of sample() returning a given point of the
+		triangle, 0 for triangles that do not emit */
+	float pdfArea(const glm::vec3& point, const glm::vec3& normal, int meshID, int primID) const;
+
+private:
+	struct Light {
+		glm::vec3 v0, e1, e2;
+		glm::vec3 normal;
+		int meshID;
+		//! 1 / area; times the probability of picking the triangle with
+		//! LightSelection::POWER
+		float pdfArea;
+	};
+
+	//! one alias table bucket: keep it below 'threshold', else take 'alias'
+	struct Bucket {
+		float threshold;
+		uint32_t alias;
+	};
+
+	/*! what a subtree of lights can emit: their bounds, total power, and
+		a cone around 'axis' that holds all their normals. The lights'
+		emission falls off to 0 at 90 degrees from the normal (and
+		shines both ways) */
+	struct LightBounds {
+		glm::vec3 lower;
+		float power;
+		glm::vec3 upper;
+		float cosTheta;
+		glm::vec3 axis;
+	};
+
+	/*! a light BVH node, with its LightBounds in the form importance()
+		needs: the bounding sphere of the box, and the cone's sine. The
+		first child follows its parent, 'offset' is the second one; a
+		leaf (count == 1) holds light 'offset' */
+	struct Node {
+		glm::vec3 center;
+		float radius;
+		glm::vec3 axis;
+		float power;
+		float cosTheta;
+		float sinTheta;
+		uint32_t offset;
+		uint32_t count;
+
+		bool isLeaf() const { return count > 0; }
+
+		float importance(const glm::vec3& point, const glm::vec3& normal) const;
+	};
+
+	static Node makeNode(const LightBounds& bounds, uint32_t offset, uint32_t count);
+
+	static LightBounds merge(const LightBounds& a, const LightBounds& b);
+
+	uint32_t buildNode(std::vector<LightBounds>& bounds, std::vector<uint32_t>& order, uint32_t begin,
+					   uint32_t end, uint64_t trail, int depth);
+
+	void buildHierarchy(const std::vector<double>& weights);
+
+	void buildAliasTable(const std::vector<double>& weights, double totalWeight);
+
+	LightSelection selection{ LightSelection::POWER };
+	//! the triangles of each emissive mesh, in primID order
+	std::vector<Light> lights;
+	std::vector<Bucket> buckets;
+	//! index of a mesh's first triangle in 'lights', -1 if it does not emit
+	std::vector<int> firstLight;
+
+	std::vector<Node> nodes;
+	//! per light, its path from the root: bit i says whether level i
+	//! takes the second child
+	std::vector<uint64_t> trails;
+};
+
+/*! the power heuristic for combining a sample of density pdf with one of
+	another strategy, of density otherPdf, for the same direction */
+inline float misWeight(float pdf, float otherPdf) {
+	const float a = pdf * pdf;
+	return a / (a + otherPdf * otherPdf);
+}
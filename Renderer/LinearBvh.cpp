@@ -0,0 +1,518 @@
+#include "BvhBuild.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <initializer_list>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// above this many triangles, 10 bits per axis no longer separate
+// neighbouring triangles well, and 21 bit (63 bit) codes are used
+static const int wideCodeThreshold = 1 << 20;
+// PLOC searches this many clusters to each side for a nearest neighbour
+static const int plocRadius = 8;
+// PLOC trees deeper than this are replaced by the LBVH one; traversal
+// stacks hold 128 entries
+static const int maxLinearDepth = 96;
+// subtrees with fewer triangles are written out by a single thread
+static const uint32_t serialEmitThreshold = 64 * 1024;
+
+static const uint32_t invalidID = 0xffffffffu;
+
+static inline int countLeadingZeros(uint32_t x) {
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanReverse(&index, x) ? 31 - (int)index : 32;
+#else
+	return x ? __builtin_clz(x) : 32;
+#endif
+}
+
+static inline int countLeadingZeros(uint64_t x) {
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanReverse64(&index, x) ? 63 - (int)index : 64;
+#else
+	return x ? __builtin_clzll(x) : 64;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Morton codes
+//------------------------------------------------------------------------------
+
+//! spreads the low 10 bits of x to every third bit
+static inline uint32_t expandBits(uint32_t x) {
+	x = (x | (x << 16)) & 0x030000ffu;
+	x = (x | (x << 8)) & 0x0300f00fu;
+	x = (x | (x << 4)) & 0x030c30c3u;
+	x = (x | (x << 2)) & 0x09249249u;
+	return x;
+}
+
+//! spreads the low 21 bits of x to every third bit
+static inline uint64_t expandBits(uint64_t x) {
+	x &= 0x1fffffull;
+	x = (x | (x << 32)) & 0x001f00000000ffffull;
+	x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+	x = (x | (x << 8)) & 0x100f00f00f00f00full;
+	x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+	x = (x | (x << 2)) & 0x1249249249249249ull;
+	return x;
+}
+
+//! 30 or 63 bit code of a point in [0,1]^3
+template <typename Code>
+static inline Code mortonCode(const glm::vec3& p) {
+	const int bits = sizeof(Code) == 4 ? 10 : 21;
+	const float scale = float((1u << bits) - 1);
+	const glm::vec3 q = glm::clamp(p * scale, glm::vec3(0.f), glm::vec3(scale));
+	return (expandBits(Code(q.x)) << 2) | (expandBits(Code(q.y)) << 1) | expandBits(Code(q.z));
+}
+
+/*! sorts keys, and values along with them, by least significant digit
+	radix sort with 8 bit digits. Each pass histograms and scatters
+	chunks of the input in parallel; passes whose digit is the same for
+	all keys are skipped */
+template <typename Key>
+static void radixSort(std::vector<Key>& keys, std::vector<uint32_t>& values) {
+	const int n = (int)keys.size();
+	const int chunkSize = std::max(64 * 1024, (n + 4 * numHostThreads() - 1) / (4 * numHostThreads()));
+	const int numChunks = (n + chunkSize - 1) / chunkSize;
+	std::vector<Key> keysOut(n);
+	std::vector<uint32_t> valuesOut(n);
+	std::vector<uint32_t> offsets(numChunks * 256);
+
+	for (int shift = 0; shift < int(8 * sizeof(Key)); shift += 8) {
+		std::fill(offsets.begin(), offsets.end(), 0);
+		parallelFor(0, numChunks, [&](int chunk) {
+			uint32_t* count = &offsets[chunk * 256];
+			const int end = std::min(n, (chunk + 1) * chunkSize);
+			for (int i = chunk * chunkSize; i < end; i++)
+				count[(keys[i] >> shift) & 0xff]++;
+		});
+
+		// exclusive prefix sum, digit major, so that chunks keep their order
+		uint32_t sum = 0;
+		bool allSame = false;
+		for (int digit = 0; digit < 256; digit++) {
+			uint32_t digitCount = 0;
+			for (int chunk = 0; chunk < numChunks; chunk++) {
+				const uint32_t count = offsets[chunk * 256 + digit];
+				offsets[chunk * 256 + digit] = sum;
+				sum += count;
+				digitCount += count;
+			}
+			if (digitCount == (uint32_t)n)
+				allSame = true;
+		}
+		if (allSame)
+			continue;
+
+		parallelFor(0, numChunks, [&](int chunk) {
+			uint32_t* offset = &offsets[chunk * 256];
+			const int end = std::min(n, (chunk + 1) * chunkSize);
+			for (int i = chunk * chunkSize; i < end; i++) {
+				const uint32_t target = offset[(keys[i] >> shift) & 0xff]++;
+				keysOut[target] = keys[i];
+				valuesOut[target] = values[i];
+			}
+		});
+		keys.swap(keysOut);
+		values.swap(valuesOut);
+	}
+}
+
+//------------------------------------------------------------------------------
+// intermediate tree
+//------------------------------------------------------------------------------
+
+namespace {
+	/*! a node of the tree as the bottom-up builders produce it. Leaves
+		hold one triangle (an index into the Morton order) in child[0]
+		and invalidID in child[1]. 'collapse' marks subtrees that become
+		one leaf in the final tree, which has 'numNodes' nodes below and
+		including this one */
+	struct TempNode {
+		Box bounds;
+		uint32_t child[2];
+		uint32_t count;
+		float cost;
+		uint32_t numNodes;
+		uint16_t depth;
+		bool collapse;
+
+		bool isLeaf() const { return child[1] == invalidID; }
+	};
+}
+
+static inline void makeTempLeaf(TempNode& node, const BuildPrim& prim, uint32_t sortedIndex) {
+	node.bounds.lower = prim.lower;
+	node.bounds.upper = prim.upper;
+	node.child[0] = sortedIndex;
+	node.child[1] = invalidID;
+	node.count = 1;
+	node.cost = intersectionCost * node.bounds.halfArea();
+	node.numNodes = 1;
+	node.depth = 1;
+	node.collapse = true;
+}
+
+/*! fills in an inner node from its two finished children, and decides
+	by SAH whether its subtree becomes a leaf */
+static inline void makeTempInner(std::vector<TempNode>& temp, uint32_t nodeID, uint32_t left, uint32_t right) {
+	TempNode& node = temp[nodeID];
+	const TempNode& a = temp[left];
+	const TempNode& b = temp[right];
+	node.bounds = a.bounds;
+	node.bounds.extend(b.bounds);
+	node.child[0] = left;
+	node.child[1] = right;
+	node.count = a.count + b.count;
+
+	const float area = node.bounds.halfArea();
+	const float splitCost = traversalCost * area + a.cost + b.cost;
+	const float leafCost = intersectionCost * area * node.count;
+	node.collapse = node.count <= (uint32_t)maxLeafSize && leafCost <= splitCost;
+	node.cost = node.collapse ? leafCost : splitCost;
+	node.numNodes = node.collapse ? 1 : 1 + a.numNodes + b.numNodes;
+	node.depth = node.collapse ? 1 : 1 + std::max(a.depth, b.depth);
+}
+
+//------------------------------------------------------------------------------
+// LBVH: Karras, "Maximizing Parallelism in the Construction of BVHs,
+// Octrees, and k-d Trees", HPG 2012
+//------------------------------------------------------------------------------
+
+/*! inner nodes are temp[0, n-1), root first; leaf i is temp[n-1+i].
+	Returns the root */
+template <typename Code>
+static uint32_t buildRadixTree(const std::vector<BuildPrim>& prims, const std::vector<Code>& codes,
+							   const std::vector<uint32_t>& order, std::vector<TempNode>& temp) {
+	const int n = (int)codes.size();
+	const uint32_t firstLeaf = n - 1;
+	temp.resize(2 * n - 1);
+	if (n == 1) {
+		makeTempLeaf(temp[0], prims[order[0]], 0);
+		return 0;
+	}
+
+	// common prefix length of the codes at i and j; equal codes are told
+	// apart by their index
+	const int codeBits = 8 * sizeof(Code);
+	auto delta = [&](int i, int j) {
+		if (j < 0 || j >= n)
+			return -1;
+		const Code x = codes[i] ^ codes[j];
+		return x ? countLeadingZeros(x) : codeBits + countLeadingZeros(uint32_t(i ^ j));
+	};
+
+	std::vector<uint32_t> parent(2 * n - 1, invalidID);
+	parallelFor(0, n - 1, [&](int i) {
+		// direction of the range, and its other end j
+		const int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+		const int deltaMin = delta(i, i - d);
+		int lengthMax = 2;
+		while (delta(i, i + lengthMax * d) > deltaMin)
+			lengthMax *= 2;
+		int length = 0;
+		for (int t = lengthMax / 2; t >= 1; t /= 2)
+			if (delta(i, i + (length + t) * d) > deltaMin)
+				length += t;
+		const int j = i + length * d;
+
+		// split position, by binary search for the end of the common prefix
+		const int deltaNode = delta(i, j);
+		int split = 0;
+		int t = length;
+		do {
+			t = (t + 1) >> 1;
+			if (delta(i, i + (split + t) * d) > deltaNode)
+				split += t;
+		} while (t > 1);
+		const int gamma = i + split * d + std::min(d, 0);
+
+		const uint32_t left = std::min(i, j) == gamma ? firstLeaf + gamma : gamma;
+		const uint32_t right = std::max(i, j) == gamma + 1 ? firstLeaf + gamma + 1 : gamma + 1;
+		temp[i].child[0] = left;
+		temp[i].child[1] = right;
+		parent[left] = i;
+		parent[right] = i;
+	}, 1024);
+
+	// bounds and SAH bottom-up: the second of two children to arrive at
+	// a parent carries on with it
+	std::vector<std::atomic<int>> arrivals(n - 1);
+	parallelFor(0, n, [&](int i) {
+		makeTempLeaf(temp[firstLeaf + i], prims[order[i]], i);
+		uint32_t nodeID = parent[firstLeaf + i];
+		while (nodeID != invalidID && arrivals[nodeID].fetch_add(1) == 1) {
+			makeTempInner(temp, nodeID, temp[nodeID].child[0], temp[nodeID].child[1]);
+			nodeID = parent[nodeID];
+		}
+	}, 1024);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+// PLOC: Meister and Bittner, "Parallel Locally-Ordered Clustering for
+// Bounding Volume Hierarchy Construction", TVCG 2018
+//------------------------------------------------------------------------------
+
+namespace {
+	/*! cluster bounds by component, padded with plocRadius empty slots
+		on both ends, so that the neighbour search reads whole windows
+		and vectorizes */
+	struct ClusterBoxes {
+		std::vector<float> lowerX, lowerY, lowerZ, upperX, upperY, upperZ;
+
+		void resize(int size) {
+			for (std::vector<float>* v : { &lowerX, &lowerY, &lowerZ })
+				v->assign(size + 2 * plocRadius, -1e30f);
+			for (std::vector<float>* v : { &upperX, &upperY, &upperZ })
+				v->assign(size + 2 * plocRadius, 1e30f);
+		}
+		//! boxes past the last cluster cover everything, and so are never nearest
+		void clearFrom(int i) {
+			Box everything;
+			everything.lower = glm::vec3(-1e30f);
+			everything.upper = glm::vec3(1e30f);
+			for (int k = i; k < i + plocRadius; k++)
+				set(k, everything);
+		}
+		void set(int i, const Box& box) {
+			lowerX[i + plocRadius] = box.lower.x; lowerY[i + plocRadius] = box.lower.y; lowerZ[i + plocRadius] = box.lower.z;
+			upperX[i + plocRadius] = box.upper.x; upperY[i + plocRadius] = box.upper.y; upperZ[i + plocRadius] = box.upper.z;
+		}
+		Box get(int i) const {
+			Box box;
+			box.lower = glm::vec3(lowerX[i + plocRadius], lowerY[i + plocRadius], lowerZ[i + plocRadius]);
+			box.upper = glm::vec3(upperX[i + plocRadius], upperY[i + plocRadius], upperZ[i + plocRadius]);
+			return box;
+		}
+
+		/*! the cluster within plocRadius of i whose union with i has the
+			least surface area. Ties go to the lowest index, which orders
+			the pairs (min(i, j), max(i, j)) too, so the best pair overall
+			is always mutual */
+		int nearest(int i) const {
+			const float* lx = &lowerX[i]; const float* ly = &lowerY[i]; const float* lz = &lowerZ[i];
+			const float* ux = &upperX[i]; const float* uy = &upperY[i]; const float* uz = &upperZ[i];
+			const int c = plocRadius;
+			float areas[2 * plocRadius + 1];
+			for (int k = 0; k <= 2 * plocRadius; k++) {
+				const float dx = std::max(ux[c], ux[k]) - std::min(lx[c], lx[k]);
+				const float dy = std::max(uy[c], uy[k]) - std::min(ly[c], ly[k]);
+				const float dz = std::max(uz[c], uz[k]) - std::min(lz[c], lz[k]);
+				areas[k] = dx * dy + dy * dz + dz * dx;
+			}
+			int best = c == 0 ? 1 : 0;
+			for (int k = 1; k <= 2 * plocRadius; k++)
+				if (k != c && areas[k] < areas[best])
+					best = k;
+			return i - plocRadius + best;
+		}
+	};
+}
+
+/*! leaves are temp[0, n) in Morton order, clusters merged into inner
+	nodes after them. Returns the root */
+static uint32_t buildPloc(const std::vector<BuildPrim>& prims, const std::vector<uint32_t>& order,
+						  std::vector<TempNode>& temp) {
+	const int n = (int)order.size();
+	temp.resize(2 * n - 1);
+	std::vector<uint32_t> clusters(n), nextClusters(n);
+	ClusterBoxes boxes, nextBoxes;
+	boxes.resize(n);
+	nextBoxes.resize(n);
+	parallelFor(0, n, [&](int i) {
+		makeTempLeaf(temp[i], prims[order[i]], i);
+		clusters[i] = i;
+		boxes.set(i, temp[i].bounds);
+	}, 1024);
+
+	std::vector<int> nearest(n);
+	uint32_t nextID = n;
+	const int chunkSize = 16 * 1024;
+	while (clusters.size() > 1) {
+		const int m = (int)clusters.size();
+		parallelFor(0, m, [&](int i) { nearest[i] = boxes.nearest(i); }, 1024);
+
+		// mutual nearest neighbours merge into the lower index' slot, the
+		// higher one drops out; chunk offsets keep the Morton order
+		const int numChunks = (m + chunkSize - 1) / chunkSize;
+		std::vector<uint32_t> chunkMerges(numChunks + 1, 0), chunkClusters(numChunks + 1, 0);
+		parallelFor(0, numChunks, [&](int chunk) {
+			const int end = std::min(m, (chunk + 1) * chunkSize);
+			for (int i = chunk * chunkSize; i < end; i++) {
+				const bool mutual = nearest[nearest[i]] == i;
+				if (mutual && i < nearest[i])
+					chunkMerges[chunk + 1]++;
+				if (!mutual || i < nearest[i])
+					chunkClusters[chunk + 1]++;
+			}
+		});
+		for (int chunk = 0; chunk < numChunks; chunk++) {
+			chunkMerges[chunk + 1] += chunkMerges[chunk];
+			chunkClusters[chunk + 1] += chunkClusters[chunk];
+		}
+
+		parallelFor(0, numChunks, [&](int chunk) {
+			uint32_t merge = nextID + chunkMerges[chunk];
+			uint32_t out = chunkClusters[chunk];
+			const int end = std::min(m, (chunk + 1) * chunkSize);
+			for (int i = chunk * chunkSize; i < end; i++) {
+				const bool mutual = nearest[nearest[i]] == i;
+				if (mutual && i < nearest[i]) {
+					makeTempInner(temp, merge, clusters[i], clusters[nearest[i]]);
+					nextBoxes.set(out, temp[merge].bounds);
+					nextClusters[out++] = merge++;
+				}
+				else if (!mutual) {
+					nextBoxes.set(out, boxes.get(i));
+					nextClusters[out++] = clusters[i];
+				}
+			}
+		});
+		const int remaining = (int)chunkClusters[numChunks];
+		nextID += chunkMerges[numChunks];
+		nextClusters.resize(remaining);
+		nextBoxes.clearFrom(remaining);
+		clusters.swap(nextClusters);
+		std::swap(boxes, nextBoxes);
+	}
+	return clusters[0];
+}
+
+//------------------------------------------------------------------------------
+// final layout
+//------------------------------------------------------------------------------
+
+namespace {
+	/*! writes temp node 'tempID' to nodes[nodeID], its children (if any)
+		to nodes[childrenID] and nodes[childrenID + 1], and its triangles
+		to refs[primID...]. Every subtree's node and triangle count is
+		known, so disjoint subtrees are written independently */
+	struct EmitTask {
+		uint32_t tempID;
+		uint32_t nodeID;
+		uint32_t childrenID;
+		uint32_t primID;
+	};
+
+	struct Emitter {
+		const std::vector<BuildPrim>& prims;
+		const std::vector<uint32_t>& order;
+		const std::vector<TempNode>& temp;
+		std::vector<BvhNode>& nodes;
+		std::vector<PrimRef>& refs;
+
+		void gather(uint32_t tempID, uint32_t& primID) const {
+			const TempNode& node = temp[tempID];
+			if (node.isLeaf()) {
+				refs[primID++] = prims[order[node.child[0]]].ref;
+				return;
+			}
+			gather(node.child[0], primID);
+			gather(node.child[1], primID);
+		}
+
+		//! the node itself; returns false for leaves
+		bool emitNode(const EmitTask& task, EmitTask children[2]) const {
+			const TempNode& node = temp[task.tempID];
+			BvhNode& out = nodes[task.nodeID];
+			out.lower = node.bounds.lower;
+			out.upper = node.bounds.upper;
+			if (node.collapse) {
+				out.offset = task.primID;
+				out.count = node.count;
+				uint32_t primID = task.primID;
+				gather(task.tempID, primID);
+				return false;
+			}
+			out.offset = task.childrenID;
+			out.count = 0;
+			const TempNode& left = temp[node.child[0]];
+			children[0] = { node.child[0], task.childrenID, task.childrenID + 2, task.primID };
+			children[1] = { node.child[1], task.childrenID + 1, task.childrenID + 2 + left.numNodes - 1,
+							task.primID + left.count };
+			return true;
+		}
+
+		void emit(const EmitTask& task) const {
+			EmitTask children[2];
+			if (emitNode(task, children)) {
+				emit(children[0]);
+				emit(children[1]);
+			}
+		}
+
+		//! emits the top of the tree, and collects the subtrees below it
+		void split(const EmitTask& task, std::vector<EmitTask>& tasks) const {
+			if (temp[task.tempID].count <= serialEmitThreshold) {
+				tasks.push_back(task);
+				return;
+			}
+			EmitTask children[2];
+			if (emitNode(task, children)) {
+				split(children[0], tasks);
+				split(children[1], tasks);
+			}
+		}
+	};
+}
+
+template <typename Code>
+static void buildSorted(const std::vector<BuildPrim>& prims, bool agglomerative,
+						std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs) {
+	const int n = (int)prims.size();
+	Box centroidBounds;
+	for (const BuildPrim& prim : prims)
+		centroidBounds.extend(prim.centroid);
+	const glm::vec3 extent = centroidBounds.upper - centroidBounds.lower;
+	const glm::vec3 scale(extent.x > 0.f ? 1.f / extent.x : 0.f,
+						  extent.y > 0.f ? 1.f / extent.y : 0.f,
+						  extent.z > 0.f ? 1.f / extent.z : 0.f);
+
+	std::vector<Code> codes(n);
+	std::vector<uint32_t> order(n);
+	parallelFor(0, n, [&](int i) {
+		codes[i] = mortonCode<Code>((prims[i].centroid - centroidBounds.lower) * scale);
+		order[i] = i;
+	}, 4096);
+	radixSort(codes, order);
+
+	std::vector<TempNode> temp;
+	uint32_t root = invalidID;
+	if (agglomerative) {
+		root = buildPloc(prims, order, temp);
+		if (temp[root].depth > maxLinearDepth) {
+			std::cout << "BVH: PLOC tree is " << temp[root].depth << " levels deep, using LBVH instead\n";
+			root = invalidID;
+		}
+	}
+	if (root == invalidID)
+		root = buildRadixTree(prims, codes, order, temp);
+	std::vector<Code>().swap(codes);
+
+	nodes.assign(temp[root].numNodes, BvhNode());
+	refs.resize(n);
+	const Emitter emitter = { prims, order, temp, nodes, refs };
+	std::vector<EmitTask> tasks;
+	emitter.split({ root, 0, 1, 0 }, tasks);
+	parallelFor(0, (int)tasks.size(), [&](int i) { emitter.emit(tasks[i]); });
+}
+
+void buildLinearBvh(const std::vector<BuildPrim>& prims, bool agglomerative,
+					std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs) {
+	if (prims.size() > (size_t)wideCodeThreshold)
+		buildSorted<uint64_t>(prims, agglomerative, nodes, refs);
+	else
+		buildSorted<uint32_t>(prims, agglomerative, nodes, refs);
+}
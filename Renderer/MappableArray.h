@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/*! array of trivially copyable T that either owns its elements, in a
+	vector, or uses them in place in memory it does not own, such as a
+	mapped cache file (see BvhCache). Element access is the same plain
+	pointer either way; builders fill a vector and hand it over with
+	assign() */
+template <typename T, typename Allocator = std::allocator<T>>
+class MappableArray {
+public:
+	typedef std::vector<T, Allocator> Vector;
+
+	MappableArray() {}
+	MappableArray(const MappableArray& other) { *this = other; }
+	MappableArray(MappableArray&& other) { *this = std::move(other); }
+
+	//! copies own their elements, also copies of mapped arrays
+	MappableArray& operator=(const MappableArray& other) {
+		if (this != &other)
+			assign(Vector(other.begin(), other.end()));
+		return *this;
+	}
+
+	MappableArray& operator=(MappableArray&& other) {
+		storage = std::move(other.storage);
+		owner = std::move(other.owner);
+		items = owner ? other.items : storage.data();
+		count = other.count;
+		other.clear();
+		return *this;
+	}
+
+	//! takes over the elements of a vector
+	void assign(Vector&& elements) {
+		storage = std::move(elements);
+		owner.reset();
+		items = storage.data();
+		count = storage.size();
+	}
+
+	/*! uses 'count' elements at 'items' in place; 'owner' keeps that
+		memory alive for as long as this array (or a move of it) refers
+		to it. Writes go to the memory as it is mapped */
+	void map(T* items, size_t count, std::shared_ptr<const void> owner) {
+		storage = Vector();
+		this->owner = std::move(owner);
+		this->items = items;
+		this->count = count;
+	}
+
+	void clear() { assign(Vector()); }
+
+	//! true if the elements are used in place rather than owned
+	bool isMapped() const { return (bool)owner; }
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	T* data() { return items; }
+	const T* data() const { return items; }
+	T& operator[](size_t i) { return items[i]; }
+	const T& operator[](size_t i) const { return items[i]; }
+	T* begin() { return items; }
+	T* end() { return items + count; }
+	const T* begin() const { return items; }
+	const T* end() const { return items + count; }
+
+private:
+	Vector storage;
+	std::shared_ptr<const void> owner;
+	T* items{ nullptr };
+	size_t count{ 0 };
+};
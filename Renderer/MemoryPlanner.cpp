@@ -0,0 +1,178 @@
+#include "MemoryPlanner.h"
+
+#include <algorithm>
+#include <iostream>
+
+// cudaMalloc hands out memory in (at least) 512 byte granules
+static size_t allocationSize(size_t bytes) {
+	const size_t granule = 512;
+	return bytes == 0 ? 0 : (bytes + granule - 1) / granule * granule;
+}
+
+static double toMB(size_t bytes) {
+	return bytes / (1024.0 * 1024.0);
+}
+
+// textures are never shrunk below this in either dimension
+static const int minDownscaledSize = 64;
+// nor more often than this
+static const int maxDownscaleSteps = 4;
+
+void AccelSizeModel::calibrate(size_t numTriangles, size_t outputBytes, size_t tempBytes, size_t compactedBytes) {
+	if (numTriangles == 0)
+		return;
+	outputBytesPerTriangle = double(outputBytes) / numTriangles;
+	tempBytesPerTriangle = double(tempBytes) / numTriangles;
+	compactedBytesPerTriangle = double(compactedBytes) / numTriangles;
+}
+
+glm::ivec2 MemoryPlan::textureResolution(const Model* model, int textureID) const {
+	glm::ivec2 res = model->textures[textureID]->resolution;
+	int steps = textureID < (int)textureDownscale.size() ? textureDownscale[textureID] : 0;
+	for (int i = 0; i < steps; i++)
+		res = glm::max(res / 2, glm::ivec2(1));
+	return res;
+}
+
+void MemoryPlan::print() const {
+	std::cout << "Device memory plan: geometry " << toMB(geometryBytes)
+		<< " MB, textures " << toMB(textureBytes)
+		<< " MB, accel " << toMB(accelBytes) << " MB (+" << toMB(accelBuildBytes) << " MB while building)"
+		<< ", framebuffers " << toMB(framebufferBytes)
+		<< " MB, environment " << toMB(environmentBytes)
+		<< " MB; peak " << toMB(peakBytes) << " of " << toMB(budgetBytes) << " MB budget\n";
+
+	int numDownscaled = 0;
+	for (int steps : textureDownscale)
+		if (steps > 0) numDownscaled++;
+	if (dropUnusedTexcoords)
+		std::cout << "  - not uploading texcoords of untextured meshes\n";
+	if (numDownscaled > 0)
+		std::cout << "  - downscaling " << numDownscaled << " textures\n";
+	if (dropShadingNormals)
+		std::cout << "  - dropping shading normals, using geometric normals\n";
+}
+
+/*! fills in the byte counts of 'plan' for its current mitigations */
+static void estimate(MemoryPlan& plan,
+					 const Model* model,
+					 const EnvironmentMap* environment,
+					 const glm::ivec2& fbSize,
+					 const AccelSizeModel& accelModel,
+					 bool mipmappedTextures) {
+	size_t numTriangles = 0;
+	plan.geometryBytes = 0;
+	for (auto mesh : model->meshes) {
+		numTriangles += mesh->index.size();
+		plan.geometryBytes += allocationSize(mesh->vertex.size() * sizeof(glm::vec3));
+		plan.geometryBytes += allocationSize(mesh->index.size() * sizeof(glm::ivec3));
+		if (plan.uploadNormals(*mesh))
+			plan.geometryBytes += allocationSize(mesh->normal.size() * sizeof(glm::vec3));
+		if (plan.uploadTexcoords(*mesh))
+			plan.geometryBytes += allocationSize(mesh->texcoord.size() * sizeof(glm::vec2));
+	}
+
+	plan.textureBytes = 0;
+	for (int textureID = 0; textureID < (int)model->textures.size(); textureID++) {
+		glm::ivec2 res = plan.textureResolution(model, textureID);
+		size_t bytes = (size_t)res.x * res.y * sizeof(uint32_t);
+		// a full mip chain adds a third
+		if (mipmappedTextures)
+			bytes += bytes / 3;
+		plan.textureBytes += allocationSize(bytes);
+	}
+
+	plan.accelBytes = allocationSize(size_t(numTriangles * accelModel.compactedBytesPerTriangle));
+	plan.accelBuildBytes = allocationSize(size_t(numTriangles * accelModel.outputBytesPerTriangle))
+		+ allocationSize(size_t(numTriangles * accelModel.tempBytesPerTriangle));
+
+	const size_t numPixels = (size_t)std::max(fbSize.x, 0) * std::max(fbSize.y, 0);
+	plan.framebufferBytes = allocationSize(numPixels * sizeof(uint32_t))
+		+ allocationSize(numPixels * sizeof(glm::vec3));
+
+	plan.environmentBytes = 0;
+	if (environment) {
+		plan.environmentBytes = allocationSize(environment->pixel.size() * sizeof(glm::vec3))
+			+ allocationSize(environment->conditionalCdf.size() * sizeof(float))
+			+ allocationSize(environment->marginalCdf.size() * sizeof(float));
+	}
+
+	// the renderer uploads geometry and builds the accel (with temp and
+	// uncompacted output alive during compaction) before it creates the
+	// textures and the environment map; framebuffers come last
+	const size_t buildPeak = plan.geometryBytes + plan.accelBuildBytes + plan.accelBytes;
+	const size_t renderPeak = plan.geometryBytes + plan.accelBytes + plan.textureBytes + plan.environmentBytes
+		+ plan.framebufferBytes;
+	plan.peakBytes = std::max(buildPeak, renderPeak);
+	plan.fits = plan.peakBytes <= plan.budgetBytes;
+}
+
+MemoryPlan planDeviceMemory(const Model* model,
+							const EnvironmentMap* environment,
+							const glm::ivec2& fbSize,
+							size_t budgetBytes,
+							const AccelSizeModel& accelModel,
+							bool mipmappedTextures) {
+	MemoryPlan plan;
+	plan.budgetBytes = budgetBytes;
+	plan.textureDownscale.assign(model->textures.size(), 0);
+
+	estimate(plan, model, environment, fbSize, accelModel, mipmappedTextures);
+	if (plan.fits)
+		return plan;
+
+	// free: nobody reads those
+	plan.dropUnusedTexcoords = true;
+	estimate(plan, model, environment, fbSize, accelModel, mipmappedTextures);
+
+	// halve all textures that are still large, one step at a time
+	for (int step = 1; step <= maxDownscaleSteps && !plan.fits; step++) {
+		bool changed = false;
+		for (int textureID = 0; textureID < (int)model->textures.size(); textureID++) {
+			glm::ivec2 res = plan.textureResolution(model, textureID);
+			if (res.x / 2 >= minDownscaledSize && res.y / 2 >= minDownscaledSize) {
+				plan.textureDownscale[textureID]++;
+				changed = true;
+			}
+		}
+		if (!changed)
+			break;
+		estimate(plan, model, environment, fbSize, accelModel, mipmappedTextures);
+	}
+
+	// last resort: shading normals go, the closest hit program then
+	// uses the geometric normal
+	if (!plan.fits) {
+		plan.dropShadingNormals = true;
+		estimate(plan, model, environment, fbSize, accelModel, mipmappedTextures);
+	}
+	return plan;
+}
+
+std::vector<uint32_t> halveTexture(const uint32_t* pixel, const glm::ivec2& res, glm::ivec2& newRes) {
+	newRes = glm::max(res / 2, glm::ivec2(1));
+	std::vector<uint32_t> result((size_t)newRes.x * newRes.y);
+
+	for (int y = 0; y < newRes.y; y++) {
+		for (int x = 0; x < newRes.x; x++) {
+			// average the 2x2 block (or what is left of it at odd borders)
+			uint32_t sum[4] = { 0, 0, 0, 0 };
+			int count = 0;
+			for (int dy = 0; dy < 2; dy++) {
+				for (int dx = 0; dx < 2; dx++) {
+					int sx = std::min(2 * x + dx, res.x - 1);
+					int sy = std::min(2 * y + dy, res.y - 1);
+					uint32_t p = pixel[sx + sy * res.x];
+					for (int c = 0; c < 4; c++)
+						sum[c] += (p >> (8 * c)) & 0xff;
+					count++;
+				}
+			}
+			uint32_t avg = 0;
+			for (int c = 0; c < 4; c++)
+				avg |= ((sum[c] + count / 2) / count) << (8 * c);
+			result[x + y * newRes.x] = avg;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Model.h"
+#include "EnvironmentMap.h"
+
+#include <vector>
+#include <cstdint>
+
+/*! size model for a compacted triangle GAS, in bytes per triangle.
+	The defaults are typical for optixAccelBuild; calibrate() replaces
+	them with what a real build on this device produced */
+struct AccelSizeModel {
+	double outputBytesPerTriangle{ 96.0 };
+	double tempBytesPerTriangle{ 64.0 };
+	double compactedBytesPerTriangle{ 56.0 };
+
+	void calibrate(size_t numTriangles, size_t outputBytes, size_t tempBytes, size_t compactedBytes);
+};
+
+/*! what the renderer will allocate on the device for a model, and the
+	mitigations that were picked to make it fit into a budget */
+struct MemoryPlan {
+	size_t geometryBytes{ 0 };
+	size_t textureBytes{ 0 };
+	//! final (compacted) acceleration structure
+	size_t accelBytes{ 0 };
+	//! temp + uncompacted output, only alive while building
+	size_t accelBuildBytes{ 0 };
+	size_t framebufferBytes{ 0 };
+	//! environment map pixels and its sampling CDFs
+	size_t environmentBytes{ 0 };
+	//! high water mark over the whole upload sequence
+	size_t peakBytes{ 0 };
+	size_t budgetBytes{ 0 };
+	bool fits{ false };
+
+	// ------------------------------------------------------------------
+	// mitigations, cheapest first
+	// ------------------------------------------------------------------
+	//! meshes without a texture never read their texcoords
+	bool dropUnusedTexcoords{ false };
+	//! how often each texture gets halved in both dimensions
+	std::vector<int> textureDownscale;
+	//! meshes fall back to geometric normals
+	bool dropShadingNormals{ false };
+
+	bool uploadTexcoords(const TriangleMesh& mesh) const {
+		return !mesh.texcoord.empty() && !(dropUnusedTexcoords && mesh.diffuseTextureID < 0);
+	}
+	bool uploadNormals(const TriangleMesh& mesh) const {
+		return !mesh.normal.empty() && !dropShadingNormals;
+	}
+	glm::ivec2 textureResolution(const Model* model, int textureID) const;
+
+	void print() const;
+};
+
+/*! estimates the device memory needed to render 'model', lit by
+	'environment' (if not null), at 'fbSize' (framebuffers as allocated
+	by SampleRenderer::resize). If that is more than 'budgetBytes',
+	mitigations are switched on one by one until it fits, or there is
+	nothing left to try (plan.fits == false) */
+MemoryPlan planDeviceMemory(const Model* model,
+							const EnvironmentMap* environment,
+							const glm::ivec2& fbSize,
+							size_t budgetBytes,
+							const AccelSizeModel& accelModel = AccelSizeModel(),
+							bool mipmappedTextures = false);
+
+/*! box filters an RGBA8 image down to half its size in each dimension
+	(odd sizes round down, minimum 1) */
+std::vector<uint32_t> halveTexture(const uint32_t* pixel, const glm::ivec2& res, glm::ivec2& newRes);
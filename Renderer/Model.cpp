@@ -1,4 +1,5 @@
 #include "Model.h"
+#include "AssetIO.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "3rdParty/tiny_obj_loader.h"
@@ -11,8 +12,11 @@
 #include <assimp/postprocess.h>
 
 #include <iostream>
+#include <fstream>
 #include <set>
 #include <limits>
+#include <cstring>
+#include <algorithm>
 
 namespace std {
 	inline bool operator<(const tinyobj::index_t& a,
@@ -85,54 +89,239 @@ int addVertex(TriangleMesh *mesh,
 	return newID;
 }
 
-/*! load a texture (if not already loaded), and return its ID in the
-	model's textures[] vector. Textures that could not get loaded
-	return -1 */
-int loadTexture(Model* model,
-				std::map<std::string, int> &knownTextures,
-				const std::string &inFileName,
-				const std::string &modelPath) {
-	
-	// If the input file is empty send this
-	if (inFileName == "")
-		return -1;
+/*! 64-bit FNV-1a over a block of bytes; good enough to key textures
+	on their content (matches are compared in full before sharing) */
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
 
-	// Check if the file is already loaded, and if so return the file index
-	if (knownTextures.find(inFileName) != knownTextures.end())
-		return knownTextures[inFileName];
+Texture::~Texture() {
+	stbi_image_free(pixel);
+}
+
+/*! read a whole file into memory, returns false if it could not be opened */
+static bool readFile(const std::string& fileName, std::vector<unsigned char>& bytes) {
+	std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+	if (!file)
+		return false;
+	bytes.resize((size_t)file.tellg());
+	file.seekg(0);
+	file.read((char*)bytes.data(), bytes.size());
+	return (bool)file;
+}
 
+/*! full path of a texture referenced by a material */
+static std::string texturePath(const std::string& inFileName, const std::string& modelPath) {
 	// Fix any file name issues and get the exact file path
 	std::string fileName = inFileName;
 	for (auto& c : fileName)
 		if (c == '\\') c = '/';
-	fileName = modelPath + "/" + fileName;
+	return modelPath + "/" + fileName;
+}
 
-	// Get the image and its resolution
-	glm::ivec2 res;
-	int comp;
+/*! reads all given texture files in one batch, so the loads below
+	only have to decode from memory */
+static std::map<std::string, FileData> prefetchTextures(const std::set<std::string>& inFileNames,
+														const std::string& modelPath) {
+	std::vector<std::string> paths;
+	for (auto& inFileName : inFileNames)
+		if (inFileName != "")
+			paths.push_back(texturePath(inFileName, modelPath));
+
+	std::map<std::string, FileData> prefetched;
+	for (auto& file : readFiles(paths))
+		prefetched[file.path] = std::move(file);
+	return prefetched;
+}
+
+static uint64_t fileContentHash(const std::vector<unsigned char>& fileBytes) {
+	const uint64_t fileSize = fileBytes.size();
+	return hashBytes(fileBytes.data(), fileBytes.size(), hashBytes(&fileSize, sizeof(fileSize)));
+}
 
+/*! decodes an image file held in memory to RGBA8, returns nullptr on failure */
+static unsigned char* decodeTexture(const std::vector<unsigned char>& fileBytes, glm::ivec2& res) {
+	int comp;
 	// STBI has a habit of inversing images
 	stbi_set_flip_vertically_on_load(true);
-	unsigned char* image = stbi_load(fileName.c_str(), &res.x, &res.y, &comp, STBI_rgb_alpha);
+	unsigned char* image = stbi_load_from_memory(fileBytes.data(), (int)fileBytes.size(),
+												 &res.x, &res.y, &comp, STBI_rgb_alpha);
 	stbi_set_flip_vertically_on_load(false);
+	return image;
+}
+
+/*! ID of an already loaded texture with exactly these pixels, or -1 */
+static int findTexturePixels(const Model* model, const unsigned char* image,
+							 const glm::ivec2& res, uint64_t pixelHash) {
+	auto known = model->knownTexturePixels.find(pixelHash);
+	if (known == model->knownTexturePixels.end())
+		return -1;
+	const Texture* texture = model->textures[known->second];
+	if (texture->resolution != res
+		|| memcmp(texture->pixel, image, (size_t)res.x * res.y * sizeof(uint32_t)) != 0)
+		return -1;
+	return known->second;
+}
+
+/*! turns the bytes of an image file into a texture of the model, or
+	returns the ID of an identical texture that is already there */
+static int addTexture(Model* model, const std::vector<unsigned char>& fileBytes, const std::string& fileName) {
+	// Cheap check first: the very same file under a different name
+	const uint64_t fileHash = fileContentHash(fileBytes);
+	auto knownFile = model->knownTextureFiles.find(fileHash);
+	// (a hash match alone may be a collision, so compare the bytes too)
+	if (knownFile != model->knownTextureFiles.end() && knownFile->second.bytes == fileBytes) {
+		const Texture* shared = model->textures[knownFile->second.textureID];
+		model->numSharedTextures++;
+		model->textureBytesSaved += (size_t)shared->resolution.x * shared->resolution.y * sizeof(uint32_t);
+		return knownFile->second.textureID;
+	}
+
+	// Get the image and its resolution
+	glm::ivec2 res;
+	unsigned char* image = decodeTexture(fileBytes, res);
+	if (!image) {
+		std::cout << "Could not load texture from " << fileName << "!\n";
+		return -1;
+	}
 
-	int textureID = -1;
-	if (image) {
+	// Decoded pixels might still match an image stored in another format
+	const size_t numBytes = (size_t)res.x * res.y * sizeof(uint32_t);
+	const uint64_t pixelHash = hashBytes(image, numBytes, hashBytes(&res, sizeof(res)));
+	int textureID = findTexturePixels(model, image, res, pixelHash);
+	if (textureID >= 0) {
+		stbi_image_free(image);
+		model->numSharedTextures++;
+		model->textureBytesSaved += numBytes;
+	}
+	else {
 		textureID = (int)model->textures.size();
 		Texture* texture = new Texture;
 		texture->resolution = res;
 		texture->pixel = (uint32_t*)image;
+		texture->contentHash = pixelHash;
 
 		model->textures.push_back(texture);
+		model->knownTexturePixels[pixelHash] = textureID;
 	}
-	else {
+	model->knownTextureFiles[fileHash] = TextureFile{ fileBytes, textureID };
+	return textureID;
+}
+
+/*! load a texture (if not already loaded), and return its ID in the
+	model's textures[] vector. Textures that could not get loaded
+	return -1. Images that are byte- or pixel-identical to an already
+	loaded texture share that texture's ID (and thus its device array).
+	'knownTextures' is keyed by canonical path. File contents come from
+	'prefetched' when they have been read ahead */
+int loadTexture(Model* model,
+				std::map<std::string, int> &knownTextures,
+				const std::string &inFileName,
+				const std::string &modelPath,
+				std::map<std::string, FileData> &prefetched) {
+	
+	// If the input file is empty send this
+	if (inFileName == "")
+		return -1;
+
+	const std::string fileName = texturePath(inFileName, modelPath);
+	const std::string canonicalName = canonicalPath(fileName);
+
+	// Check if the file is already loaded, and if so return the file index
+	if (knownTextures.find(canonicalName) != knownTextures.end())
+		return knownTextures[canonicalName];
+
+	std::vector<unsigned char> readBytes;
+	auto ahead = prefetched.find(fileName);
+	bool readOK = (ahead != prefetched.end())
+		? ahead->second.ok
+		: readFile(fileName, readBytes);
+	const std::vector<unsigned char>& fileBytes
+		= (ahead != prefetched.end()) ? ahead->second.bytes : readBytes;
+	if (!readOK) {
 		std::cout << "Could not load texture from " << fileName << "!\n";
+		knownTextures[canonicalName] = -1;
+		return -1;
 	}
 
-	knownTextures[inFileName] = textureID;
+	int textureID = addTexture(model, fileBytes, fileName);
+	knownTextures[canonicalName] = textureID;
 	return textureID;
 }
 
+/*! sets the material properties (and texture) of an OBJ mesh */
+static void applyMaterial(Model* model,
+						  TriangleMesh* mesh,
+						  const tinyobj::material_t& material,
+						  std::map<std::string, int>& knownTexture,
+						  const std::string& modelDir,
+						  std::map<std::string, FileData>& prefetched) {
+	mesh->materialName = material.name;
+	// Anything with the same material ID is given the same diffuse color
+	mesh->diffuse = (const glm::vec3&)material.diffuse;
+	mesh->emmissive = 1.f * (const glm::vec3&)material.emission;
+	mesh->diffuseTextureID = loadTexture(model, knownTexture, material.diffuse_texname, modelDir, prefetched);
+	mesh->diffuseTextureFile = material.diffuse_texname == ""
+		? "" : canonicalPath(texturePath(material.diffuse_texname, modelDir));
+	mesh->specular = (const glm::vec3&)material.specular;
+	mesh->shininess = material.shininess;
+	mesh->ior = material.ior;
+	mesh->illum = material.illum;
+}
+
+/*! reads .mtl files like tinyobj's own reader, but remembers which
+	files were read so they can be watched for changes */
+class RecordingMaterialReader : public tinyobj::MaterialFileReader {
+public:
+	explicit RecordingMaterialReader(const std::string& mtlBaseDir)
+		: tinyobj::MaterialFileReader(mtlBaseDir), baseDir(mtlBaseDir) {}
+
+	virtual bool operator()(const std::string& matId,
+							std::vector<tinyobj::material_t>* materials,
+							std::map<std::string, int>* matMap,
+							std::string* warn,
+							std::string* err) override {
+		bool readOK = tinyobj::MaterialFileReader::operator()(matId, materials, matMap, warn, err);
+		if (readOK)
+			files.push_back(canonicalPath(baseDir + matId));
+		return readOK;
+	}
+
+	std::string baseDir;
+	std::vector<std::string> files;
+};
+
+/*! bounding box of all vertices in the model */
+static void computeBounds(Model* model) {
+	// of course, you should be using tbb::parallel_for for stuff
+	// like this:
+	model->boundsMin = glm::vec3(std::numeric_limits<float>::max());
+	model->boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+
+	for (auto mesh : model->meshes) {
+		for (auto vtx : mesh->vertex) {
+			model->boundsMin = glm::min(model->boundsMin, vtx);
+			model->boundsMax = glm::max(model->boundsMax, vtx);
+		}
+	}
+
+	model->boundsCenter = model->boundsMin + (model->boundsMax - model->boundsMin) * .5f;
+	model->boundsSpan = model->boundsMax - model->boundsMin;
+}
+
+/*! print how much texture memory the content based sharing saved */
+static void reportTextureSharing(const Model* model) {
+	if (model->numSharedTextures == 0)
+		return;
+	std::cout << "Shared " << model->numSharedTextures << " duplicate texture loads, saving "
+		<< model->textureBytesSaved / (1024.0 * 1024.0) << " MB of texture memory" << std::endl;
+}
+
 Model* loadOBJ(const std::string& objFile) {
 	Model* model = new Model;
 
@@ -147,15 +336,20 @@ Model* loadOBJ(const std::string& objFile) {
 	std::string err = "";
 
 	// Check if the read went well, and fill the variables
+	std::ifstream objStream(objFile);
+	RecordingMaterialReader materialReader(modelDir);
 	bool readOK
-		= tinyobj::LoadObj(	&attributes,
+		= objStream
+		&& tinyobj::LoadObj(&attributes,
 							&shapes,
 							&materials,
 							&err,
 							&err,
-							objFile.c_str(),
-							modelDir.c_str(),
+							&objStream,
+							&materialReader,
 							/*triangulate*/ true);
+	model->sourceFile = canonicalPath(objFile);
+	model->materialFiles = materialReader.files;
 
 	// Read error handling
 	if (!readOK)
@@ -166,6 +360,12 @@ Model* loadOBJ(const std::string& objFile) {
 	// Read went well
 	std::cout << "Done loading obj file - Found " << shapes.size() << "shapes with " << materials.size() << "materials\n";
 
+	// Fetch every texture the materials reference before decoding any of them
+	std::set<std::string> textureNames;
+	for (auto& material : materials)
+		textureNames.insert(material.diffuse_texname);
+	std::map<std::string, FileData> prefetched = prefetchTextures(textureNames, modelDir);
+
 	//// Now to fill our Model with meshes!
 	// For every shape rerun the loop
 	for (int shapeID = 0; shapeID < (int)shapes.size(); shapeID++) {
@@ -203,44 +403,27 @@ Model* loadOBJ(const std::string& objFile) {
 					addVertex(mesh, attributes, idx_1, knownVertices),
 					addVertex(mesh, attributes, idx_2, knownVertices));
 				mesh->index.push_back(idx);
-				// Anything with the same material ID is given the same diffuse color
-				mesh->diffuse = (const glm::vec3&)materials[materialID].diffuse;
-				mesh->emmissive = 1.f * (const glm::vec3&)materials[materialID].emission;
-				mesh->diffuseTextureID = loadTexture(model, knownTexture, materials[materialID].diffuse_texname, modelDir);
-				mesh->specular = (const glm::vec3&)materials[materialID].specular;
-				mesh->shininess = materials[materialID].shininess;
-				mesh->ior = materials[materialID].ior;
-				mesh->illum = materials[materialID].illum;
 			}
 
 			if (mesh->vertex.empty())
 				delete mesh;
-			else
+			else {
+				applyMaterial(model, mesh, materials[materialID], knownTexture, modelDir, prefetched);
 				model->meshes.push_back(mesh);
+			}
 		}
 	}
 
-	// of course, you should be using tbb::parallel_for for stuff
-	// like this:
-	model->boundsMin = glm::vec3(std::numeric_limits<float>::max());
-	model->boundsMax = glm::vec3(-std::numeric_limits<float>::max());
-
-	for (auto mesh : model->meshes) {
-		for (auto vtx : mesh->vertex) {
-			model->boundsMin = glm::min(model->boundsMin, vtx);
-			model->boundsMax = glm::max(model->boundsMax, vtx);
-		}
-	}
-
-	model->boundsCenter = model->boundsMin + (model->boundsMax - model->boundsMin) * .5f;
-	model->boundsSpan = model->boundsMax - model->boundsMin;
+	computeBounds(model);
 
 	std::cout << "created a total of " << model->meshes.size() << " meshes" << std::endl;
 	std::cout << "Loaded " << model->textures.size() << " textures" << std::endl;
+	reportTextureSharing(model);
 	return model;
 }
 
-TriangleMesh* processMesh(Model* model, aiMesh* mesh, const aiScene* scene, std::string modelDir) {
+TriangleMesh* processMesh(Model* model, aiMesh* mesh, const aiScene* scene, std::string modelDir,
+						  std::map<std::string, FileData>& prefetched) {
 	TriangleMesh* triMesh = new TriangleMesh;
 
 	for (int idx = 0; idx < mesh->mNumVertices; idx++) {
@@ -271,6 +454,7 @@ TriangleMesh* processMesh(Model* model, aiMesh* mesh, const aiScene* scene, std:
 		aiString str;
 		aiMaterial* mtl = scene->mMaterials[mesh->mMaterialIndex];
 		mtl->GetTexture(aiTextureType_DIFFUSE, 0, &str);
+		triMesh->materialName = mtl->GetName().C_Str();
 		
 		aiColor4D getColor;
 		float getFloat;
@@ -308,24 +492,26 @@ TriangleMesh* processMesh(Model* model, aiMesh* mesh, const aiScene* scene, std:
 		// std::cout << std::endl;
 		std::string texname = str.C_Str();
 		texname = texname;
-		triMesh->diffuseTextureID = loadTexture(model, knownTexture, texname, modelDir);
+		triMesh->diffuseTextureID = loadTexture(model, knownTexture, texname, modelDir, prefetched);
+		triMesh->diffuseTextureFile = texname == "" ? "" : canonicalPath(texturePath(texname, modelDir));
 	}
 
 	return triMesh;
 }
 
-void processNode(Model* model, aiNode* node, const aiScene* scene, std::string modelDir)
+void processNode(Model* model, aiNode* node, const aiScene* scene, std::string modelDir,
+				 std::map<std::string, FileData>& prefetched)
 {
 	// process all the node's meshes (if any)
 	for (unsigned int i = 0; i < node->mNumMeshes; i++)
 	{
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		model->meshes.push_back(processMesh(model, mesh, scene, modelDir));
+		model->meshes.push_back(processMesh(model, mesh, scene, modelDir, prefetched));
 	}
 	// then do the same for each of its children
 	for (unsigned int i = 0; i < node->mNumChildren; i++)
 	{
-		processNode(model, node->mChildren[i], scene, modelDir);
+		processNode(model, node->mChildren[i], scene, modelDir, prefetched);
 	}
 }
 
@@ -342,26 +528,262 @@ Model* loadModel(const std::string& modelFile) {
 	std::string modelDir = modelFile.substr(0, modelFile.find_last_of('/'));
 
 	std::cout << "Loading Model Using ASSIMP\n";
+	model->sourceFile = canonicalPath(modelFile);
+	model->loadedWithAssimp = true;
 
-	processNode(model, scene->mRootNode, scene, modelDir);
-
-	// of course, you should be using tbb::parallel_for for stuff
-	// like this:
-	model->boundsMin = glm::vec3(std::numeric_limits<float>::max());
-	model->boundsMax = glm::vec3(-std::numeric_limits<float>::max());
-
-	for (auto mesh : model->meshes) {
-		for (auto vtx : mesh->vertex) {
-			model->boundsMin = glm::min(model->boundsMin, vtx);
-			model->boundsMax = glm::max(model->boundsMax, vtx);
-		}
+	// Fetch every texture the materials reference before decoding any of them
+	std::set<std::string> textureNames;
+	for (unsigned int i = 0; i < scene->mNumMaterials; i++) {
+		aiString str;
+		if (scene->mMaterials[i]->GetTexture(aiTextureType_DIFFUSE, 0, &str) == AI_SUCCESS)
+			textureNames.insert(str.C_Str());
 	}
+	std::map<std::string, FileData> prefetched = prefetchTextures(textureNames, modelDir);
 
-	model->boundsCenter = model->boundsMin + (model->boundsMax - model->boundsMin) * .5f;
-	model->boundsSpan = model->boundsMax - model->boundsMin;
+	processNode(model, scene->mRootNode, scene, modelDir, prefetched);
+
+	computeBounds(model);
 
 	std::cout << "created a total of " << model->meshes.size() << " meshes" << std::endl;
 	std::cout << "Loaded " << model->textures.size() << " textures" << std::endl;
+	reportTextureSharing(model);
 
 	return model;
-}
\ No newline at end of file
+}
+
+// ==================================================================
+// hot reloading
+// ==================================================================
+
+std::vector<std::string> watchedFiles(const Model* model) {
+	std::set<std::string> files;
+	files.insert(model->sourceFile);
+	for (auto& file : model->materialFiles)
+		files.insert(file);
+	for (auto mesh : model->meshes)
+		if (!mesh->diffuseTextureFile.empty())
+			files.insert(mesh->diffuseTextureFile);
+	return std::vector<std::string>(files.begin(), files.end());
+}
+
+static void addChange(std::vector<int>& ids, int id) {
+	if (std::find(ids.begin(), ids.end(), id) == ids.end())
+		ids.push_back(id);
+}
+
+static bool sameGeometry(const TriangleMesh& a, const TriangleMesh& b) {
+	return a.vertex == b.vertex
+		&& a.index == b.index
+		&& a.normal == b.normal
+		&& a.texcoord == b.texcoord;
+}
+
+/*! the model file itself changed: load it again, and take over
+	everything, but only report meshes whose data actually differ */
+static void reloadSource(Model* model, ModelChanges& changes) {
+	Model* fresh = model->loadedWithAssimp
+		? loadModel(model->sourceFile)
+		: loadOBJ(model->sourceFile);
+
+	for (int meshID = 0; meshID < (int)fresh->meshes.size(); meshID++) {
+		if (meshID >= (int)model->meshes.size()
+			|| !sameGeometry(*model->meshes[meshID], *fresh->meshes[meshID]))
+			addChange(changes.meshes, meshID);
+		addChange(changes.materials, meshID);
+	}
+	for (int textureID = 0; textureID < (int)fresh->textures.size(); textureID++)
+		addChange(changes.textures, textureID);
+
+	std::swap(model->meshes, fresh->meshes);
+	std::swap(model->textures, fresh->textures);
+	std::swap(model->materialFiles, fresh->materialFiles);
+	std::swap(model->knownTextureFiles, fresh->knownTextureFiles);
+	std::swap(model->knownTexturePixels, fresh->knownTexturePixels);
+	model->numSharedTextures = fresh->numSharedTextures;
+	model->textureBytesSaved = fresh->textureBytesSaved;
+	computeBounds(model);
+
+	// now holds the old meshes and textures
+	delete fresh;
+}
+
+/*! an .mtl file changed: re-parse it and update the meshes that use
+	one of its materials */
+static void reloadMaterials(Model* model, const std::string& mtlFile, ModelChanges& changes) {
+	std::ifstream stream(mtlFile);
+	if (!stream) {
+		std::cout << "Could not reload materials from " << mtlFile << "!\n";
+		return;
+	}
+
+	std::map<std::string, int> materialMap;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn, err;
+	tinyobj::LoadMtl(&materialMap, &materials, &stream, &warn, &err);
+
+	const std::string modelDir = model->sourceFile.substr(0, model->sourceFile.rfind('/') + 1);
+	// textures that are already loaded are not read (or shared) again;
+	// files that failed before get another try
+	std::map<std::string, int> knownTexture;
+	for (auto mesh : model->meshes)
+		if (!mesh->diffuseTextureFile.empty() && mesh->diffuseTextureID >= 0)
+			knownTexture[mesh->diffuseTextureFile] = mesh->diffuseTextureID;
+	std::map<std::string, FileData> prefetched;
+	for (int meshID = 0; meshID < (int)model->meshes.size(); meshID++) {
+		TriangleMesh* mesh = model->meshes[meshID];
+		auto material = materialMap.find(mesh->materialName);
+		if (material == materialMap.end())
+			continue;
+
+		const int numTextures = (int)model->textures.size();
+		applyMaterial(model, mesh, materials[material->second], knownTexture, modelDir, prefetched);
+		addChange(changes.materials, meshID);
+		for (int textureID = numTextures; textureID < (int)model->textures.size(); textureID++)
+			addChange(changes.textures, textureID);
+	}
+}
+
+/*! a texture file changed: replace its pixels in place if nothing else
+	shares the texture, otherwise give its meshes a texture of their own */
+static void reloadTexture(Model* model, const std::string& file, ModelChanges& changes) {
+	std::vector<int> users;
+	int oldID = -1;
+	for (int meshID = 0; meshID < (int)model->meshes.size(); meshID++) {
+		if (model->meshes[meshID]->diffuseTextureFile == file) {
+			users.push_back(meshID);
+			oldID = model->meshes[meshID]->diffuseTextureID;
+		}
+	}
+	if (users.empty())
+		return;
+
+	bool shared = false;
+	for (auto mesh : model->meshes)
+		if (mesh->diffuseTextureID == oldID && mesh->diffuseTextureFile != file)
+			shared = true;
+
+	std::vector<unsigned char> bytes;
+	if (!readFile(file, bytes)) {
+		// probably caught in the middle of a save; the next event brings it back
+		std::cout << "Could not reload texture from " << file << "!\n";
+		return;
+	}
+
+	int newID;
+	if (oldID >= 0 && !shared) {
+		glm::ivec2 res;
+		unsigned char* image = decodeTexture(bytes, res);
+		if (!image) {
+			std::cout << "Could not reload texture from " << file << "!\n";
+			return;
+		}
+		const size_t numBytes = (size_t)res.x * res.y * sizeof(uint32_t);
+		const uint64_t pixelHash = hashBytes(image, numBytes, hashBytes(&res, sizeof(res)));
+		newID = findTexturePixels(model, image, res, pixelHash);
+		if (newID < 0) {
+			// forget the old content, then swap the pixels in place
+			for (auto it = model->knownTextureFiles.begin(); it != model->knownTextureFiles.end();)
+				it = it->second.textureID == oldID ? model->knownTextureFiles.erase(it) : ++it;
+			for (auto it = model->knownTexturePixels.begin(); it != model->knownTexturePixels.end();)
+				it = it->second == oldID ? model->knownTexturePixels.erase(it) : ++it;
+
+			Texture* texture = model->textures[oldID];
+			stbi_image_free(texture->pixel);
+			texture->pixel = (uint32_t*)image;
+			texture->resolution = res;
+			texture->contentHash = pixelHash;
+			model->knownTexturePixels[pixelHash] = oldID;
+			model->knownTextureFiles[fileContentHash(bytes)] = TextureFile{ bytes, oldID };
+			addChange(changes.textures, oldID);
+			return;
+		}
+		stbi_image_free(image);
+		if (newID == oldID)
+			return;
+	}
+	else {
+		const int numTextures = (int)model->textures.size();
+		newID = addTexture(model, bytes, file);
+		if (newID >= numTextures)
+			addChange(changes.textures, newID);
+	}
+
+	for (int meshID : users) {
+		model->meshes[meshID]->diffuseTextureID = newID;
+		addChange(changes.materials, meshID);
+	}
+}
+
+/*! frees textures that no mesh uses any more (after a material edit
+	or a texture reload moved their meshes elsewhere), and closes the
+	gaps in textures[]; moved textures and remapped meshes are changes */
+static void dropUnusedTextures(Model* model, ModelChanges& changes) {
+	const int numTextures = (int)model->textures.size();
+	std::vector<bool> used(numTextures, false);
+	for (auto mesh : model->meshes)
+		if (mesh->diffuseTextureID >= 0)
+			used[mesh->diffuseTextureID] = true;
+	if (std::find(used.begin(), used.end(), false) == used.end())
+		return;
+
+	std::vector<int> newID(numTextures, -1);
+	std::vector<Texture*> textures;
+	for (int textureID = 0; textureID < numTextures; textureID++) {
+		if (used[textureID]) {
+			newID[textureID] = (int)textures.size();
+			textures.push_back(model->textures[textureID]);
+		}
+		else
+			delete model->textures[textureID];
+	}
+	model->textures.swap(textures);
+
+	for (int meshID = 0; meshID < (int)model->meshes.size(); meshID++) {
+		TriangleMesh* mesh = model->meshes[meshID];
+		if (mesh->diffuseTextureID >= 0 && newID[mesh->diffuseTextureID] != mesh->diffuseTextureID) {
+			mesh->diffuseTextureID = newID[mesh->diffuseTextureID];
+			addChange(changes.materials, meshID);
+		}
+	}
+	for (auto it = model->knownTextureFiles.begin(); it != model->knownTextureFiles.end();) {
+		it->second.textureID = newID[it->second.textureID];
+		it = it->second.textureID < 0 ? model->knownTextureFiles.erase(it) : ++it;
+	}
+	for (auto it = model->knownTexturePixels.begin(); it != model->knownTexturePixels.end();) {
+		it->second = newID[it->second];
+		it = it->second < 0 ? model->knownTexturePixels.erase(it) : ++it;
+	}
+
+	std::vector<int> changedTextures;
+	for (int textureID : changes.textures)
+		if (newID[textureID] >= 0)
+			addChange(changedTextures, newID[textureID]);
+	for (int textureID = 0; textureID < numTextures; textureID++)
+		if (newID[textureID] >= 0 && newID[textureID] != textureID)
+			addChange(changedTextures, newID[textureID]);
+	changes.textures.swap(changedTextures);
+}
+
+ModelChanges reloadChangedFiles(Model* model, const std::vector<std::string>& changedFiles) {
+	ModelChanges changes;
+	std::set<std::string> changed(changedFiles.begin(), changedFiles.end());
+
+	if (changed.count(model->sourceFile)) {
+		reloadSource(model, changes);
+		return changes;
+	}
+
+	for (auto& mtlFile : model->materialFiles)
+		if (changed.count(mtlFile))
+			reloadMaterials(model, mtlFile, changes);
+
+	std::set<std::string> textureFiles;
+	for (auto mesh : model->meshes)
+		if (changed.count(mesh->diffuseTextureFile))
+			textureFiles.insert(mesh->diffuseTextureFile);
+	for (auto& file : textureFiles)
+		reloadTexture(model, file, changes);
+
+	dropUnusedTextures(model, changes);
+	return changes;
+}
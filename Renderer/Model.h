@@ -3,6 +3,8 @@
 #include "glm/glm.hpp"
 #include <vector>
 #include <string>
+#include <map>
+#include <cstdint>
 
 struct TriangleMesh {
 	std::vector<glm::vec3> vertex;
@@ -18,13 +20,29 @@ struct TriangleMesh {
 	float ior;
 	int illum;
 	int diffuseTextureID{ -1 };
+
+	// where the material came from, so edits on disk can be patched in
+	std::string materialName;
+	//! canonical path of the diffuse texture, empty if there is none
+	std::string diffuseTextureFile;
 };
 
 struct Texture {
-	~Texture() { if (pixel) delete[] pixel; }
+	~Texture();
 
-	uint32_t *pixel;
+	//! RGBA8, as decoded (and allocated) by stb_image
+	uint32_t *pixel{ nullptr };
 	glm::ivec2 resolution{ -1 };
+	//! hash of the decoded pixels, used to share identical images
+	//  that come in under different file names
+	uint64_t contentHash{ 0 };
+};
+
+//! the (still encoded) bytes of a file an already loaded texture was
+//  decoded from, kept so hash matches are confirmed without a re-read
+struct TextureFile {
+	std::vector<unsigned char> bytes;
+	int textureID;
 };
 
 struct Model {
@@ -40,9 +58,46 @@ struct Model {
 	glm::vec3 boundsMax;
 	glm::vec3 boundsCenter;
 	glm::vec3 boundsSpan;
+
+	//! canonical paths of the files the model was loaded from
+	std::string sourceFile;
+	std::vector<std::string> materialFiles;
+	bool loadedWithAssimp{ false };
+
+	//! texture files keyed by the hash of their raw bytes (cheap, checked
+	//  first) and texture IDs keyed by the hash of the decoded pixels
+	//  (catches re-encodes); hash matches are confirmed byte by byte
+	std::map<uint64_t, TextureFile> knownTextureFiles;
+	std::map<uint64_t, int> knownTexturePixels;
+	//! how many texture loads were served by an already loaded image,
+	//  and how many host (and later device) bytes that saved
+	int numSharedTextures{ 0 };
+	size_t textureBytesSaved{ 0 };
 };
 
 
 Model* loadOBJ(const std::string& objFile);
 
-Model* loadModel(const std::string& modelFile);
\ No newline at end of file
+Model* loadModel(const std::string& modelFile);
+
+/*! what reloadChangedFiles() patched in a live model, so that the
+	renderer only has to re-upload or rebuild those parts */
+struct ModelChanges {
+	//! mesh IDs with new geometry; these need new buffers and an accel rebuild
+	std::vector<int> meshes;
+	//! mesh IDs whose material or texture binding changed
+	std::vector<int> materials;
+	//! texture IDs whose pixels changed or that were added
+	std::vector<int> textures;
+
+	bool empty() const { return meshes.empty() && materials.empty() && textures.empty(); }
+};
+
+/*! model, material and texture files the model depends on */
+std::vector<std::string> watchedFiles(const Model* model);
+
+/*! reloads the given (changed) files and patches the results into
+	the model: a texture file only replaces that texture, a material
+	file only updates the meshes using its materials, and the model
+	file itself replaces the meshes whose data actually differ */
+ModelChanges reloadChangedFiles(Model* model, const std::vector<std::string>& changedFiles);
\ No newline at end of file
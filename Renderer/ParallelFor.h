@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*! number of worker threads the host side helpers use */
+inline int numHostThreads() {
+	return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+/*! calls body(i) for every i in [begin, end) using all hardware threads.
+	Indices are handed out in chunks of 'grain' from a shared counter, so
+	items of very different cost still balance out between threads */
+template <typename Body>
+inline void parallelFor(int begin, int end, const Body& body, int grain = 1) {
+	const int count = end - begin;
+	if (count <= 0)
+		return;
+
+	const int numThreads = std::min(numHostThreads(), (count + grain - 1) / grain);
+	if (numThreads <= 1) {
+		for (int i = begin; i < end; i++)
+			body(i);
+		return;
+	}
+
+	std::atomic<int> next(begin);
+	auto worker = [&]() {
+		while (true) {
+			const int first = next.fetch_add(grain);
+			if (first >= end)
+				break;
+			const int last = std::min(end, first + grain);
+			for (int i = first; i < last; i++)
+				body(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < numThreads; t++)
+		threads.push_back(std::thread(worker));
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+}
@@ -0,0 +1,2039 @@
+#include "RayBenchmark.h"
+#include "AssetIO.h"
+#include "Bsdf.h"
+#include "Bvh.h"
+#include "Bvh8.h"
+#include "BvhCache.h"
+#include "EnvironmentMap.h"
+#include "InstanceBvh.h"
+#include "MemoryPlanner.h"
+#include "RayPacket.h"
+#include "RaySorter.h"
+#include "Renderer.h"
+#include "WavefrontRenderer.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+
+static const float PI = 3.14159265f;
+// primary rays are shot at this resolution
+static const int benchmarkWidth = 1024;
+static const int benchmarkHeight = 768;
+
+//------------------------------------------------------------------------------
+// generated scenes
+//------------------------------------------------------------------------------
+
+static void addQuad(TriangleMesh* mesh, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d) {
+	const int base = (int)mesh->vertex.size();
+	mesh->vertex.push_back(a);
+	mesh->vertex.push_back(b);
+	mesh->vertex.push_back(c);
+	mesh->vertex.push_back(d);
+	mesh->index.push_back(glm::ivec3(base, base + 1, base + 2));
+	mesh->index.push_back(glm::ivec3(base, base + 2, base + 3));
+}
+
+static void addSphere(TriangleMesh* mesh, const glm::vec3& center, float radius, int tessellation) {
+	const int base = (int)mesh->vertex.size();
+	for (int i = 0; i <= tessellation; i++) {
+		const float theta = PI * i / tessellation;
+		for (int j = 0; j < tessellation; j++) {
+			const float phi = 2.f * PI * j / tessellation;
+			mesh->vertex.push_back(center + radius * glm::vec3(std::sin(theta) * std::cos(phi),
+															   std::cos(theta),
+															   std::sin(theta) * std::sin(phi)));
+		}
+	}
+	for (int i = 0; i < tessellation; i++)
+		for (int j = 0; j < tessellation; j++) {
+			const int a = base + i * tessellation + j;
+			const int b = base + i * tessellation + (j + 1) % tessellation;
+			mesh->index.push_back(glm::ivec3(a, a + tessellation, b));
+			mesh->index.push_back(glm::ivec3(b, a + tessellation, b + tessellation));
+		}
+}
+
+static void finishModel(Model* model) {
+	model->boundsMin = glm::vec3(1e30f);
+	model->boundsMax = glm::vec3(-1e30f);
+	for (auto mesh : model->meshes)
+		for (auto& v : mesh->vertex) {
+			model->boundsMin = glm::min(model->boundsMin, v);
+			model->boundsMax = glm::max(model->boundsMax, v);
+		}
+	model->boundsCenter = 0.5f * (model->boundsMin + model->boundsMax);
+	model->boundsSpan = model->boundsMax - model->boundsMin;
+}
+
+/*! a ground plane with a grid of finely tessellated spheres; many
+	small, evenly sized triangles with lots of occlusion */
+static Model* makeSpheres() {
+	Model* model = new Model;
+	TriangleMesh* ground = new TriangleMesh;
+	addQuad(ground, glm::vec3(-1, 0, -1), glm::vec3(-1, 0, 17), glm::vec3(17, 0, 17), glm::vec3(17, 0, -1));
+	model->meshes.push_back(ground);
+
+	TriangleMesh* spheres = new TriangleMesh;
+	for (int z = 0; z < 8; z++)
+		for (int x = 0; x < 8; x++)
+			addSphere(spheres, glm::vec3(2.f * x + 1.f, 0.8f, 2.f * z + 1.f), 0.8f, 64);
+	model->meshes.push_back(spheres);
+	finishModel(model);
+	return model;
+}
+
+/*! an n^2 height field; long thin triangles at grazing angles */
+static Model* makeTerrain(int n = 1024) {
+	Model* model = new Model;
+	TriangleMesh* mesh = new TriangleMesh;
+	for (int z = 0; z <= n; z++)
+		for (int x = 0; x <= n; x++) {
+			const float fx = float(x) / n, fz = float(z) / n;
+			const float height = 0.05f * std::sin(13.f * fx) * std::cos(9.f * fz)
+				+ 0.01f * std::sin(71.f * fx + 3.f * fz) + 0.004f * std::cos(157.f * fz - 11.f * fx);
+			mesh->vertex.push_back(glm::vec3(fx, height, fz));
+		}
+	for (int z = 0; z < n; z++)
+		for (int x = 0; x < n; x++) {
+			const int a = z * (n + 1) + x;
+			mesh->index.push_back(glm::ivec3(a, a + n + 1, a + 1));
+			mesh->index.push_back(glm::ivec3(a + 1, a + n + 1, a + n + 2));
+		}
+	model->meshes.push_back(mesh);
+	finishModel(model);
+	return model;
+}
+
+/*! the floor plan of an n x n grid of rooms with a sphere in each,
+	turned by 30 degrees: every wall is one quad along the whole
+	building, so its triangles are long and thin, and with the turn
+	their boxes cover much of the floor */
+static Model* makeRooms(int n = 16) {
+	Model* model = new Model;
+	TriangleMesh* walls = new TriangleMesh;
+	const float height = 0.8f;
+	const float extent = float(n);
+	addQuad(walls, glm::vec3(0, 0, 0), glm::vec3(0, 0, extent), glm::vec3(extent, 0, extent), glm::vec3(extent, 0, 0));
+	for (int i = 0; i <= n; i++) {
+		const float w = float(i);
+		addQuad(walls, glm::vec3(0, 0, w), glm::vec3(0, height, w), glm::vec3(extent, height, w), glm::vec3(extent, 0, w));
+		addQuad(walls, glm::vec3(w, 0, 0), glm::vec3(w, height, 0), glm::vec3(w, height, extent), glm::vec3(w, 0, extent));
+	}
+	model->meshes.push_back(walls);
+
+	TriangleMesh* furniture = new TriangleMesh;
+	for (int z = 0; z < n; z++)
+		for (int x = 0; x < n; x++)
+			addSphere(furniture, glm::vec3(x + 0.5f, 0.25f, z + 0.5f), 0.25f, 16);
+	model->meshes.push_back(furniture);
+
+	const float c = std::cos(PI / 6.f), s = std::sin(PI / 6.f);
+	for (auto mesh : model->meshes)
+		for (auto& v : mesh->vertex)
+			v = glm::vec3(c * v.x - s * v.z, v.y, s * v.x + c * v.z);
+	finishModel(model);
+	return model;
+}
+
+static inline uint32_t hashIndex(uint32_t x) {
+	x ^= x >> 16; x *= 0x7feb352d;
+	x ^= x >> 15; x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline float hashFloat(uint32_t x) {
+	return (hashIndex(x) >> 8) * (1.f / 16777216.f);
+}
+
+/*! randomly placed and oriented small triangles; the worst case for
+	coherence and for bounding box overlap */
+static Model* makeSoup(int n = 1000000) {
+	Model* model = new Model;
+	TriangleMesh* mesh = new TriangleMesh;
+	// keep the density, and so the overlap, of the million triangle soup
+	const float size = 0.01f * std::pow(1e6f / n, 1.f / 3.f);
+	for (int i = 0; i < n; i++) {
+		const glm::vec3 center(hashFloat(6 * i), hashFloat(6 * i + 1), hashFloat(6 * i + 2));
+		for (int k = 0; k < 3; k++) {
+			const uint32_t seed = 6 * n + 9 * i + 3 * k;
+			mesh->vertex.push_back(center + size * glm::vec3(hashFloat(seed), hashFloat(seed + 1), hashFloat(seed + 2)));
+		}
+		mesh->index.push_back(glm::ivec3(3 * i, 3 * i + 1, 3 * i + 2));
+	}
+	model->meshes.push_back(mesh);
+	finishModel(model);
+	return model;
+}
+
+/*! gives a generated mesh one of the renderer's three material types,
+	as the OBJ loader would for the corresponding .mtl values */
+static void setMaterial(TriangleMesh* mesh, int illum, const glm::vec3& diffuse, const glm::vec3& specular) {
+	mesh->diffuse = diffuse;
+	mesh->emmissive = glm::vec3(0.f);
+	mesh->specular = specular;
+	mesh->shininess = 900.f;
+	mesh->ior = 1.5f;
+	mesh->illum = illum;
+}
+
+/*! the spheres scene with its spheres split into diffuse, metal and
+	glass ones, in a checkerboard, so that neighboring paths hit
+	different materials */
+static Model* makeMaterials() {
+	Model* model = new Model;
+	TriangleMesh* ground = new TriangleMesh;
+	addQuad(ground, glm::vec3(-1, 0, -1), glm::vec3(-1, 0, 17), glm::vec3(17, 0, 17), glm::vec3(17, 0, -1));
+	setMaterial(ground, 2, glm::vec3(0.6f), glm::vec3(0.f));
+	model->meshes.push_back(ground);
+
+	TriangleMesh* spheres[3];
+	for (int type = 0; type < 3; type++) {
+		spheres[type] = new TriangleMesh;
+		model->meshes.push_back(spheres[type]);
+	}
+	setMaterial(spheres[0], 2, glm::vec3(0.8f, 0.3f, 0.2f), glm::vec3(0.f));
+	setMaterial(spheres[1], 3, glm::vec3(0.f), glm::vec3(0.8f));
+	setMaterial(spheres[2], 7, glm::vec3(0.f), glm::vec3(0.f));
+	for (int z = 0; z < 8; z++)
+		for (int x = 0; x < 8; x++)
+			addSphere(spheres[(x + z) % 3], glm::vec3(2.f * x + 1.f, 0.8f, 2.f * z + 1.f), 0.8f, 64);
+	finishModel(model);
+	return model;
+}
+
+/*! a closed, all diffuse Cornell box with two spheres, lit only by a
+	small light in the ceiling (1/16 of its area); walls face inwards */
+static Model* makeCornellBox() {
+	Model* model = new Model;
+	TriangleMesh* white = new TriangleMesh;
+	addQuad(white, glm::vec3(-1, 0, -1), glm::vec3(-1, 0, 1), glm::vec3(1, 0, 1), glm::vec3(1, 0, -1));
+	addQuad(white, glm::vec3(-1, 2, -1), glm::vec3(1, 2, -1), glm::vec3(1, 2, 1), glm::vec3(-1, 2, 1));
+	addQuad(white, glm::vec3(-1, 0, -1), glm::vec3(1, 0, -1), glm::vec3(1, 2, -1), glm::vec3(-1, 2, -1));
+	addQuad(white, glm::vec3(-1, 0, 1), glm::vec3(-1, 2, 1), glm::vec3(1, 2, 1), glm::vec3(1, 0, 1));
+	addSphere(white, glm::vec3(-0.4f, 0.4f, -0.3f), 0.4f, 32);
+	addSphere(white, glm::vec3(0.45f, 0.35f, 0.3f), 0.35f, 32);
+	setMaterial(white, 2, glm::vec3(0.73f), glm::vec3(0.f));
+	model->meshes.push_back(white);
+
+	TriangleMesh* red = new TriangleMesh;
+	addQuad(red, glm::vec3(-1, 0, -1), glm::vec3(-1, 2, -1), glm::vec3(-1, 2, 1), glm::vec3(-1, 0, 1));
+	setMaterial(red, 2, glm::vec3(0.65f, 0.05f, 0.05f), glm::vec3(0.f));
+	model->meshes.push_back(red);
+
+	TriangleMesh* green = new TriangleMesh;
+	addQuad(green, glm::vec3(1, 0, -1), glm::vec3(1, 0, 1), glm::vec3(1, 2, 1), glm::vec3(1, 2, -1));
+	setMaterial(green, 2, glm::vec3(0.12f, 0.45f, 0.15f), glm::vec3(0.f));
+	model->meshes.push_back(green);
+
+	TriangleMesh* light = new TriangleMesh;
+	addQuad(light, glm::vec3(-0.25f, 1.98f, -0.25f), glm::vec3(0.25f, 1.98f, -0.25f),
+		glm::vec3(0.25f, 1.98f, 0.25f), glm::vec3(-0.25f, 1.98f, 0.25f));
+	setMaterial(light, 2, glm::vec3(0.78f), glm::vec3(0.f));
+	light->emmissive = glm::vec3(1.7f, 1.5f, 1.2f);
+	model->meshes.push_back(light);
+	finishModel(model);
+	return model;
+}
+
+/*! a closed 96 x 3 x 96 garage with many small lights: a 48 x 48 grid
+	of ceiling panels and 24 signs of 48 x 12 LED pixels along the walls,
+	32k emissive triangles in colors and powers set by a hash, over a
+	floor with a grid of spheres. From any point nearly all of the power
+	is far away or behind it */
+static Model* makeGarage() {
+	Model* model = new Model;
+	const float size = 96.f, height = 3.f;
+	TriangleMesh* room = new TriangleMesh;
+	addQuad(room, glm::vec3(0, 0, 0), glm::vec3(0, 0, size), glm::vec3(size, 0, size), glm::vec3(size, 0, 0));
+	addQuad(room, glm::vec3(0, height, 0), glm::vec3(size, height, 0), glm::vec3(size, height, size),
+		glm::vec3(0, height, size));
+	addQuad(room, glm::vec3(0, 0, 0), glm::vec3(size, 0, 0), glm::vec3(size, height, 0), glm::vec3(0, height, 0));
+	addQuad(room, glm::vec3(0, 0, size), glm::vec3(0, height, size), glm::vec3(size, height, size),
+		glm::vec3(size, 0, size));
+	addQuad(room, glm::vec3(0, 0, 0), glm::vec3(0, height, 0), glm::vec3(0, height, size), glm::vec3(0, 0, size));
+	addQuad(room, glm::vec3(size, 0, 0), glm::vec3(size, 0, size), glm::vec3(size, height, size),
+		glm::vec3(size, height, 0));
+	for (int z = 0; z < 12; z++)
+		for (int x = 0; x < 12; x++)
+			addSphere(room, glm::vec3(8.f * x + 4.f, 0.6f, 8.f * z + 4.f), 0.6f, 16);
+	setMaterial(room, 2, glm::vec3(0.6f), glm::vec3(0.f));
+	model->meshes.push_back(room);
+
+	const glm::vec3 colors[] = { glm::vec3(1.f, 0.1f, 0.1f), glm::vec3(0.1f, 1.f, 0.1f), glm::vec3(0.1f, 0.1f, 1.f),
+								 glm::vec3(1.f, 0.9f, 0.7f) };
+	TriangleMesh* lights[8];
+	for (int i = 0; i < 8; i++) {
+		lights[i] = new TriangleMesh;
+		setMaterial(lights[i], 2, glm::vec3(0.5f), glm::vec3(0.f));
+		// pixels in three colors at two brightnesses, then dim and bright panels
+		lights[i]->emmissive = i < 6 ? colors[i % 3] * (i < 3 ? 0.2f : 1.f) : colors[3] * (i == 6 ? 0.5f : 4.f);
+		model->meshes.push_back(lights[i]);
+	}
+	for (int z = 0; z < 48; z++)
+		for (int x = 0; x < 48; x++) {
+			const glm::vec3 c(2.f * x + 1.f, height - 0.01f, 2.f * z + 1.f);
+			addQuad(lights[hashFloat(x + 48 * z) < 0.9f ? 6 : 7], c + glm::vec3(-0.15f, 0, -0.15f),
+				c + glm::vec3(0.15f, 0, -0.15f), c + glm::vec3(0.15f, 0, 0.15f), c + glm::vec3(-0.15f, 0, 0.15f));
+		}
+	for (int wall = 0; wall < 4; wall++)
+		for (int sign = 0; sign < 6; sign++)
+			for (int y = 0; y < 12; y++)
+				for (int u = 0; u < 48; u++) {
+					const float along = 16.f * sign + 4.f + 0.1f * u, up = 0.8f + 0.1f * y;
+					const float across = wall % 2 == 0 ? 0.01f : size - 0.01f;
+					const glm::vec3 c = wall < 2 ? glm::vec3(across, up, along) : glm::vec3(along, up, across);
+					const glm::vec3 du = wall < 2 ? glm::vec3(0, 0, 0.04f) : glm::vec3(0.04f, 0, 0);
+					const glm::vec3 dv(0, 0.04f, 0);
+					addQuad(lights[hashIndex(u + 48 * y + 576 * sign + 4000 * wall) % 6], c - du - dv, c + du - dv,
+						c + du + dv, c - du + dv);
+				}
+	finishModel(model);
+	return model;
+}
+
+/*! diffuse spheres on a floor, under a square light twice their size,
+	open to the sky: soft shadows, and direct light that is smooth
+	everywhere else */
+static Model* makeSoftShadows() {
+	Model* model = new Model;
+	TriangleMesh* floor = new TriangleMesh;
+	addQuad(floor, glm::vec3(-8, 0, -8), glm::vec3(-8, 0, 8), glm::vec3(8, 0, 8), glm::vec3(8, 0, -8));
+	addSphere(floor, glm::vec3(-0.7f, 0.5f, 0.f), 0.5f, 32);
+	addSphere(floor, glm::vec3(0.6f, 0.35f, 0.5f), 0.35f, 32);
+	setMaterial(floor, 2, glm::vec3(0.7f), glm::vec3(0.f));
+	model->meshes.push_back(floor);
+
+	TriangleMesh* light = new TriangleMesh;
+	addQuad(light, glm::vec3(-1, 3, -1), glm::vec3(1, 3, -1), glm::vec3(1, 3, 1), glm::vec3(-1, 3, 1));
+	setMaterial(light, 2, glm::vec3(0.f), glm::vec3(0.f));
+	light->emmissive = glm::vec3(0.5f);
+	model->meshes.push_back(light);
+	finishModel(model);
+	return model;
+}
+
+/*! the other scenes, all diffuse, for rendering */
+static Model* withDiffuseMaterial(Model* model) {
+	for (TriangleMesh* mesh : model->meshes)
+		setMaterial(mesh, 2, glm::vec3(0.7f), glm::vec3(0.f));
+	return model;
+}
+
+//------------------------------------------------------------------------------
+// ray sets
+//------------------------------------------------------------------------------
+
+/*! primary rays through pixel centers, spanned like renderFrame does;
+	ordered by 4x4 pixel tiles, so that each run of packetSize rays is
+	one tile as CpuRenderer traces it */
+static Camera benchmarkCamera(const Model* model) {
+	const glm::vec3 span = model->boundsSpan;
+	Camera camera = { model->boundsCenter + glm::vec3(0.6f * span.x, 0.5f * glm::length(span), 0.9f * span.z),
+					  model->boundsCenter,
+					  glm::vec3(0.f, 1.f, 0.f) };
+	return camera;
+}
+
+static std::vector<Ray> primaryRays(const Model* model) {
+	const CameraBasis basis = cameraBasis(benchmarkCamera(model), glm::ivec2(benchmarkWidth, benchmarkHeight));
+
+	const int tileSize = 4;
+	const int tilesX = benchmarkWidth / tileSize;
+	std::vector<Ray> rays(benchmarkWidth * benchmarkHeight);
+	for (int iy = 0; iy < benchmarkHeight; iy++)
+		for (int ix = 0; ix < benchmarkWidth; ix++) {
+			const glm::vec2 screen((ix + 0.5f) / benchmarkWidth, (iy + 0.5f) / benchmarkHeight);
+			const int tile = ix / tileSize + (iy / tileSize) * tilesX;
+			Ray& ray = rays[tile * packetSize + ix % tileSize + (iy % tileSize) * tileSize];
+			ray.origin = basis.position;
+			ray.direction = glm::normalize(basis.direction
+				+ (screen.x - 0.5f) * basis.horizontal
+				+ (screen.y - 0.5f) * basis.vertical);
+		}
+	return rays;
+}
+
+/*! one diffuse (cosine distributed) bounce off each primary hit */
+static std::vector<Ray> bounceRays(const Model* model, const Bvh& bvh, const std::vector<Ray>& primary) {
+	std::vector<Ray> rays(primary.size());
+	std::vector<char> valid(primary.size(), 0);
+	parallelFor(0, (int)primary.size(), [&](int i) {
+		Hit hit;
+		if (!bvh.closestHit(primary[i], hit))
+			return;
+		const TriangleMesh& mesh = *model->meshes[hit.meshID];
+		const glm::ivec3 index = mesh.index[hit.primID];
+		glm::vec3 normal = glm::normalize(glm::cross(mesh.vertex[index.y] - mesh.vertex[index.x],
+													 mesh.vertex[index.z] - mesh.vertex[index.x]));
+		if (glm::dot(normal, primary[i].direction) > 0.f)
+			normal = -normal;
+
+		// normal plus a uniform point on the sphere is cosine distributed
+		const float z = 1.f - 2.f * hashFloat(2 * i);
+		const float phi = 2.f * PI * hashFloat(2 * i + 1);
+		const float r = std::sqrt(std::max(0.f, 1.f - z * z));
+		const glm::vec3 direction = normal + glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+		if (glm::dot(direction, direction) < 1e-8f)
+			return;
+
+		rays[i].origin = primary[i].origin + hit.t * primary[i].direction + 1e-4f * normal;
+		rays[i].direction = glm::normalize(direction);
+		valid[i] = 1;
+	}, 1024);
+
+	std::vector<Ray> result;
+	for (size_t i = 0; i < rays.size(); i++)
+		if (valid[i])
+			result.push_back(rays[i]);
+	return result;
+}
+
+/*! a shadow ray from each primary hit to a point light, ending just
+	before it; in the tile order of the primary rays, so consecutive
+	rays are coherent */
+static std::vector<Ray> shadowRays(const Bvh& bvh, const std::vector<Ray>& primary, const glm::vec3& light) {
+	std::vector<Ray> rays(primary.size());
+	std::vector<char> valid(primary.size(), 0);
+	parallelFor(0, (int)primary.size(), [&](int i) {
+		Hit hit;
+		if (!bvh.closestHit(primary[i], hit))
+			return;
+		glm::vec3 normal = glm::normalize(hit.normal);
+		if (glm::dot(normal, primary[i].direction) > 0.f)
+			normal = -normal;
+		const glm::vec3 origin = primary[i].origin + hit.t * primary[i].direction + 1e-4f * normal;
+		const float distance = glm::length(light - origin);
+		rays[i].origin = origin;
+		rays[i].direction = (light - origin) / distance;
+		rays[i].tmax = distance * (1.f - 1e-4f);
+		valid[i] = 1;
+	}, 1024);
+
+	std::vector<Ray> result;
+	for (size_t i = 0; i < rays.size(); i++)
+		if (valid[i])
+			result.push_back(rays[i]);
+	return result;
+}
+
+//------------------------------------------------------------------------------
+// measurements
+//------------------------------------------------------------------------------
+
+/*! traces all rays with all threads; returns Mrays/s and the number of
+	rays that hit something */
+static double measure(const std::vector<Ray>& rays, const std::function<bool(const Ray&, Hit&)>& trace, int& numHits) {
+	const int chunkSize = 4096;
+	const int numChunks = (int)((rays.size() + chunkSize - 1) / chunkSize);
+	std::atomic<int> hits(0);
+
+	auto start = std::chrono::steady_clock::now();
+	parallelFor(0, numChunks, [&](int chunk) {
+		int localHits = 0;
+		const size_t end = std::min(rays.size(), size_t(chunk + 1) * chunkSize);
+		for (size_t i = size_t(chunk) * chunkSize; i < end; i++) {
+			Hit hit;
+			if (trace(rays[i], hit))
+				localHits++;
+		}
+		hits += localHits;
+	});
+	auto end = std::chrono::steady_clock::now();
+
+	numHits = hits;
+	return rays.size() / std::chrono::duration<double>(end - start).count() * 1e-6;
+}
+
+/*! as measure(), but traces consecutive runs of packetSize rays as
+	one packet, with occludedPacket() instead of closestHitPacket() if
+	asked to */
+static double measurePackets(const std::vector<Ray>& rays, const Bvh& bvh, const Bvh8& bvh8,
+							 int& numHits, PacketStats& stats, bool occlusion = false) {
+	const int packetsPerChunk = 256;
+	const int numPackets = (int)((rays.size() + packetSize - 1) / packetSize);
+	const int numChunks = (numPackets + packetsPerChunk - 1) / packetsPerChunk;
+	std::atomic<int> hits(0);
+	std::atomic<size_t> incoherent(0), fallbacks(0);
+
+	auto start = std::chrono::steady_clock::now();
+	parallelFor(0, numChunks, [&](int chunk) {
+		int localHits = 0;
+		PacketStats localStats;
+		const int end = std::min(numPackets, (chunk + 1) * packetsPerChunk);
+		for (int p = chunk * packetsPerChunk; p < end; p++) {
+			RayPacket packet = RayPacket();
+			for (int k = 0; k < packetSize && size_t(p) * packetSize + k < rays.size(); k++) {
+				packet.set(k, rays[size_t(p) * packetSize + k]);
+				packet.activeMask |= 1u << k;
+			}
+			HitPacket packetHits;
+			uint32_t mask = occlusion ? occludedPacket(bvh, bvh8, packet, &localStats)
+				: closestHitPacket(bvh, bvh8, packet, packetHits, &localStats);
+			for (; mask; mask &= mask - 1)
+				localHits++;
+		}
+		hits += localHits;
+		incoherent += localStats.incoherentPackets;
+		fallbacks += localStats.singleRayFallbacks;
+	});
+	auto end = std::chrono::steady_clock::now();
+
+	numHits = hits;
+	stats.packets = numPackets;
+	stats.incoherentPackets = incoherent;
+	stats.singleRayFallbacks = fallbacks;
+	return rays.size() / std::chrono::duration<double>(end - start).count() * 1e-6;
+}
+
+// packet traversal must hit exactly the rays single rays hit; runs
+// of --bench count the runs where it did not
+static int packetMismatches = 0;
+
+static void checkPacketHits(const char* rays, int packetHits, int singleHits) {
+	if (packetHits == singleHits)
+		return;
+	std::cout << TERMINAL_RED << "  " << rays << ": packets hit " << packetHits << " rays, single rays "
+		<< singleHits << "\n" << TERMINAL_DEFAULT;
+	packetMismatches++;
+}
+
+static void benchmarkScene(const char* name, Model* model) {
+	std::cout << TERMINAL_BOLD << "--- " << name << " ---" << TERMINAL_DEFAULT << "\n";
+	Bvh bvh;
+	bvh.build(model);
+	Bvh8 bvh8;
+	bvh8.build(bvh);
+	Bvh8 bvh8Gather;
+	bvh8Gather.build(bvh, false);
+	Bvh8 bvh8Quantized;
+	bvh8Quantized.build(bvh, true, true);
+	const double toMB = 1.0 / (1024.0 * 1024.0);
+	printf("  BVH8 nodes + triangles: %.2f + %.2f MB with records, %.2f + %.2f MB through index buffers, "
+		"%.2f + %.2f MB quantized\n",
+		bvh8.nodeBytes() * toMB, bvh8.triangleBytes() * toMB, bvh8Gather.nodeBytes() * toMB,
+		bvh8Gather.triangleBytes() * toMB, bvh8Quantized.nodeBytes() * toMB, bvh8Quantized.triangleBytes() * toMB);
+
+	const std::vector<Ray> primary = primaryRays(model);
+	const std::vector<Ray> bounce = bounceRays(model, bvh, primary);
+
+	struct Traverser {
+		const char* name;
+		std::function<bool(const Ray&, Hit&)> trace;
+	};
+	// BVH8ib reads triangles through the index buffers instead of
+	// records, BVH8q decodes 8-bit child bounds
+	const Traverser traversers[] = {
+		{ "BVH2", [&](const Ray& ray, Hit& hit) { return bvh.closestHit(ray, hit); } },
+		{ "BVH8", [&](const Ray& ray, Hit& hit) { return bvh8.closestHit(ray, hit); } },
+		{ "BVH8ib", [&](const Ray& ray, Hit& hit) { return bvh8Gather.closestHit(ray, hit); } },
+		{ "BVH8q", [&](const Ray& ray, Hit& hit) { return bvh8Quantized.closestHit(ray, hit); } },
+	};
+
+	const int numThreads = numHostThreads();
+	const std::pair<const char*, const std::vector<Ray>*> raySets[] = {
+		{ "primary", &primary },
+		{ "diffuse", &bounce },
+	};
+	for (auto& raySet : raySets) {
+		std::vector<int> singleHits;
+		for (auto& traverser : traversers) {
+			int numHits = 0;
+			const double mrays = measure(*raySet.second, traverser.trace, numHits);
+			printf("  %-8s %-6s %8.2f Mrays/s %8.2f per thread  (%zu rays, %d hits)\n",
+				raySet.first, traverser.name, mrays, mrays / numThreads, raySet.second->size(), numHits);
+			singleHits.push_back(numHits);
+		}
+
+		// bounce rays inherit the tile order of their primary rays
+		int numHits = 0;
+		PacketStats stats;
+		const double mrays = measurePackets(*raySet.second, bvh, bvh8, numHits, stats);
+		printf("  %-8s %-6s %8.2f Mrays/s %8.2f per thread  (%zu rays, %d hits; %.1f%% incoherent packets, %.2f single ray subtrees per ray)\n",
+			raySet.first, "packet", mrays, mrays / numThreads, raySet.second->size(), numHits,
+			100.0 * stats.incoherentPackets / std::max<size_t>(stats.packets, 1),
+			double(stats.singleRayFallbacks) / std::max<size_t>(raySet.second->size(), 1));
+		for (int hits : singleHits)
+			checkPacketHits(raySet.first, numHits, hits);
+	}
+	delete model;
+}
+
+/*! visibility queries: shadow rays to a point light above the scene
+	and diffuse bounce rays to the sky, as closest hit queries against
+	anyHit and occluded(), one by one, in batches and in packets */
+static void benchmarkShadowRays(const char* name, Model* model) {
+	std::cout << TERMINAL_BOLD << "--- " << name << ", occlusion ---" << TERMINAL_DEFAULT << "\n";
+	Bvh bvh;
+	bvh.build(model);
+	Bvh8 bvh8;
+	bvh8.build(bvh);
+	Bvh8 bvh8Quantized;
+	bvh8Quantized.build(bvh, true, true);
+
+	const std::vector<Ray> primary = primaryRays(model);
+	const glm::vec3 light = model->boundsCenter + glm::vec3(0.2f, 0.6f, 0.3f) * glm::length(model->boundsSpan);
+	const std::vector<Ray> shadow = shadowRays(bvh, primary, light);
+	const std::vector<Ray> bounce = bounceRays(model, bvh, primary);
+
+	struct Traverser {
+		const char* name;
+		std::function<bool(const Ray&, Hit&)> trace;
+	};
+	const Traverser traversers[] = {
+		{ "BVH2 closest", [&](const Ray& ray, Hit& hit) { return bvh.closestHit(ray, hit); } },
+		{ "BVH2 any", [&](const Ray& ray, Hit& hit) { return bvh.anyHit(ray, hit); } },
+		{ "BVH8 closest", [&](const Ray& ray, Hit& hit) { return bvh8.closestHit(ray, hit); } },
+		{ "BVH8 any", [&](const Ray& ray, Hit& hit) { return bvh8.anyHit(ray, hit); } },
+		{ "BVH8 occluded", [&](const Ray& ray, Hit&) { return bvh8.occluded(ray); } },
+		{ "BVH8q occluded", [&](const Ray& ray, Hit&) { return bvh8Quantized.occluded(ray); } },
+	};
+
+	const std::pair<const char*, const std::vector<Ray>*> raySets[] = {
+		{ "shadow", &shadow },
+		{ "sky", &bounce },
+	};
+	for (auto& raySet : raySets) {
+		const std::vector<Ray>& rays = *raySet.second;
+		std::vector<int> singleHits;
+		for (auto& traverser : traversers) {
+			int numHits = 0;
+			const double mrays = measure(rays, traverser.trace, numHits);
+			printf("  %-7s %-15s %8.2f Mrays/s  (%zu rays, %d blocked)\n", raySet.first, traverser.name, mrays,
+				rays.size(), numHits);
+			singleHits.push_back(numHits);
+		}
+
+		std::vector<uint8_t> results(rays.size());
+		auto start = std::chrono::steady_clock::now();
+		bvh8.occluded(rays.data(), rays.size(), results.data());
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		size_t numBlocked = 0;
+		for (uint8_t result : results)
+			numBlocked += result;
+		printf("  %-7s %-15s %8.2f Mrays/s  (%zu rays, %zu blocked)\n", raySet.first, "BVH8 batch",
+			rays.size() / seconds * 1e-6, rays.size(), numBlocked);
+
+		for (int occlusion = 0; occlusion < 2; occlusion++) {
+			int numHits = 0;
+			PacketStats stats;
+			const double mrays = measurePackets(rays, bvh, bvh8, numHits, stats, occlusion != 0);
+			printf("  %-7s %-15s %8.2f Mrays/s  (%zu rays, %d blocked; %.1f%% incoherent packets)\n", raySet.first,
+				occlusion ? "packet occluded" : "packet closest", mrays, rays.size(), numHits,
+				100.0 * stats.incoherentPackets / std::max<size_t>(stats.packets, 1));
+			for (int hits : singleHits)
+				checkPacketHits(raySet.first, numHits, hits);
+		}
+	}
+	delete model;
+}
+
+/*! bounce rays traced in the order they come, against binning them
+	with RaySorter first, in batches of different sizes as a wavefront
+	renderer would; timings include computing keys and sorting. Rays
+	come in the tile order of their primary rays, or shuffled, as they
+	would be after paths of many tiles were compacted together */
+static void benchmarkRaySorting(const char* name, Model* model) {
+	std::cout << TERMINAL_BOLD << "--- " << name << ", ray sorting ---" << TERMINAL_DEFAULT << "\n";
+	Bvh bvh;
+	bvh.build(model);
+	Bvh8 bvh8;
+	bvh8.build(bvh);
+	const std::vector<Ray> primary = primaryRays(model);
+	const std::vector<Ray> bounce = bounceRays(model, bvh, primary);
+	const std::vector<Ray> bounce2 = bounceRays(model, bvh, bounce);
+	std::vector<Ray> shuffled = bounce2;
+	for (size_t i = shuffled.size(); i > 1; i--)
+		std::swap(shuffled[i - 1], shuffled[hashIndex(uint32_t(i)) % i]);
+	const glm::vec3 lower = bvh.nodes[0].lower, upper = bvh.nodes[0].upper;
+
+	const std::pair<const char*, const std::vector<Ray>*> raySets[] = {
+		{ "diffuse", &bounce },
+		{ "diffuse2", &bounce2 },
+		{ "shuffled", &shuffled },
+	};
+	for (auto& raySet : raySets) {
+		const std::vector<Ray>& rays = *raySet.second;
+		int numHits = 0;
+		const double unsorted = measure(rays, [&](const Ray& ray, Hit& hit) { return bvh8.closestHit(ray, hit); }, numHits);
+		printf("  %-9s unsorted      %8.2f Mrays/s  (%zu rays, %d hits)\n", raySet.first, unsorted, rays.size(), numHits);
+
+		const int batchSizes[] = { 1024, 4096, 16384, 65536, 262144 };
+		for (int batchSize : batchSizes) {
+			const int numBatches = int((rays.size() + batchSize - 1) / batchSize);
+			std::atomic<int> hits(0);
+			std::atomic<int64_t> sortNanoseconds(0);
+			auto start = std::chrono::steady_clock::now();
+			parallelFor(0, numBatches, [&](int batch) {
+				auto sortStart = std::chrono::steady_clock::now();
+				const size_t first = size_t(batch) * batchSize;
+				const size_t count = std::min(rays.size() - first, size_t(batchSize));
+				RaySorter sorter(lower, upper);
+				std::vector<uint32_t> keys(count), order(count);
+				for (size_t i = 0; i < count; i++) {
+					keys[i] = sorter.key(rays[first + i].origin, rays[first + i].direction);
+					order[i] = uint32_t(first + i);
+				}
+				sorter.sort(keys, order);
+				sortNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - sortStart).count();
+
+				int localHits = 0;
+				for (uint32_t i : order) {
+					Hit hit;
+					if (bvh8.closestHit(rays[i], hit))
+						localHits++;
+				}
+				hits += localHits;
+			});
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			const double mrays = rays.size() / seconds * 1e-6;
+			printf("  %-9s sorted %6d %8.2f Mrays/s  %+6.1f%%, sorting %4.1f%% of the time  (%d hits)\n",
+				raySet.first, batchSize, mrays, 100.0 * (mrays / unsorted - 1.0),
+				100.0 * sortNanoseconds * 1e-9 / (seconds * numHostThreads()), int(hits));
+		}
+	}
+	delete model;
+}
+
+/*! trees of the SAH and LBVH builders before and after treelet
+	optimization: time taken, SAH cost and BVH2 / BVH8 throughput */
+static void benchmarkTreelets(const char* name, Model* model) {
+	std::cout << TERMINAL_BOLD << "--- " << name << ", treelet optimization ---" << TERMINAL_DEFAULT << "\n";
+	const std::vector<Ray> primary = primaryRays(model);
+	std::vector<Ray> bounce;
+
+	const BvhBuildQuality qualities[] = { BvhBuildQuality::SAH, BvhBuildQuality::LBVH };
+	for (BvhBuildQuality quality : qualities) {
+		Bvh bvh;
+		bvh.build(model, quality);
+		if (bounce.empty())
+			bounce = bounceRays(model, bvh, primary);
+		for (int optimized = 0; optimized < 2; optimized++) {
+			double seconds = 0.0;
+			if (optimized) {
+				auto start = std::chrono::steady_clock::now();
+				bvh.optimize();
+				seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+			Bvh8 bvh8;
+			bvh8.build(bvh);
+			int numHits = 0;
+			const double primaryBvh2 = measure(primary, [&](const Ray& ray, Hit& hit) { return bvh.closestHit(ray, hit); }, numHits);
+			const double primaryBvh8 = measure(primary, [&](const Ray& ray, Hit& hit) { return bvh8.closestHit(ray, hit); }, numHits);
+			const double bounceBvh8 = measure(bounce, [&](const Ray& ray, Hit& hit) { return bvh8.closestHit(ray, hit); }, numHits);
+			printf("  %-5s %-9s %8.1f ms  SAH cost %7.2f  primary BVH2 %6.2f BVH8 %6.2f, diffuse BVH8 %6.2f Mrays/s\n",
+				bvhBuildQualityName(quality), optimized ? "optimized" : "built", seconds * 1e3, bvh.sahCost(),
+				primaryBvh2, primaryBvh8, bounceBvh8);
+		}
+	}
+	delete model;
+}
+
+/*! SAH against SBVH trees of the same scene: build time, references,
+	memory and BVH8 / packet throughput */
+static void benchmarkSpatialSplits(const char* name, Model* model) {
+	std::cout << TERMINAL_BOLD << "--- " << name << ", spatial splits ---" << TERMINAL_DEFAULT << "\n";
+	const std::vector<Ray> primary = primaryRays(model);
+	std::vector<Ray> bounce;
+	const double toMB = 1.0 / (1024.0 * 1024.0);
+	const int numThreads = numHostThreads();
+
+	const BvhBuildQuality qualities[] = { BvhBuildQuality::SAH, BvhBuildQuality::SBVH };
+	for (BvhBuildQuality quality : qualities) {
+		Bvh bvh;
+		auto start = std::chrono::steady_clock::now();
+		bvh.build(model, quality);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		Bvh8 bvh8;
+		bvh8.build(bvh);
+		if (bounce.empty())
+			bounce = bounceRays(model, bvh, primary);
+
+		printf("  %-5s build %8.1f ms, %zu references, SAH cost %.2f, BVH2 %.2f MB, BVH8 nodes + triangles %.2f + %.2f MB\n",
+			bvhBuildQualityName(quality), seconds * 1e3, bvh.prims.size(), bvh.sahCost(),
+			(bvh.nodes.size() * sizeof(BvhNode) + bvh.prims.size() * sizeof(PrimRef)) * toMB,
+			bvh8.nodeBytes() * toMB, bvh8.triangleBytes() * toMB);
+
+		const std::pair<const char*, const std::vector<Ray>*> raySets[] = {
+			{ "primary", &primary },
+			{ "diffuse", &bounce },
+		};
+		for (auto& raySet : raySets) {
+			int numHits = 0;
+			double mrays = measure(*raySet.second, [&](const Ray& ray, Hit& hit) { return bvh8.closestHit(ray, hit); }, numHits);
+			printf("  %-5s %-8s %-6s %8.2f Mrays/s %8.2f per thread  (%zu rays, %d hits)\n",
+				bvhBuildQualityName(quality), raySet.first, "BVH8", mrays, mrays / numThreads, raySet.second->size(), numHits);
+			const int singleHits = numHits;
+			PacketStats stats;
+			mrays = measurePackets(*raySet.second, bvh, bvh8, numHits, stats);
+			printf("  %-5s %-8s %-6s %8.2f Mrays/s %8.2f per thread  (%zu rays, %d hits)\n",
+				bvhBuildQualityName(quality), raySet.first, "packet", mrays, mrays / numThreads, raySet.second->size(), numHits);
+			checkPacketHits(raySet.first, numHits, singleHits);
+		}
+	}
+	delete model;
+}
+
+static size_t geometryBytes(const Model* model) {
+	size_t bytes = 0;
+	for (auto mesh : model->meshes)
+		bytes += mesh->vertex.size() * sizeof(glm::vec3) + mesh->index.size() * sizeof(glm::ivec3);
+	return bytes;
+}
+
+/*! numInstances copies of one sphere, scaled, turned about y and laid
+	out on a grid: memory and speed of a two-level structure over one
+	bottom level BVH against one BVH over the flattened triangles */
+static void benchmarkInstances(int numInstances = 10000) {
+	std::cout << TERMINAL_BOLD << "--- " << numInstances << " instances ---" << TERMINAL_DEFAULT << "\n";
+	Model* sphere = new Model;
+	TriangleMesh* mesh = new TriangleMesh;
+	addSphere(mesh, glm::vec3(0.f), 0.5f, 16);
+	sphere->meshes.push_back(mesh);
+	finishModel(sphere);
+
+	const int gridSize = (int)std::ceil(std::sqrt(double(numInstances)));
+	std::vector<Instance> instances(numInstances);
+	Model* flat = new Model;
+	TriangleMesh* flatMesh = new TriangleMesh;
+	for (int i = 0; i < numInstances; i++) {
+		const float angle = 2.f * PI * hashFloat(3 * i);
+		const float scale = 0.5f + 0.5f * hashFloat(3 * i + 1);
+		const float c = scale * std::cos(angle), s = scale * std::sin(angle);
+		glm::mat4& transform = instances[i].transform;
+		transform[0] = glm::vec4(c, 0.f, -s, 0.f);
+		transform[1] = glm::vec4(0.f, scale, 0.f, 0.f);
+		transform[2] = glm::vec4(s, 0.f, c, 0.f);
+		transform[3] = glm::vec4(float(i % gridSize), 0.5f * hashFloat(3 * i + 2), float(i / gridSize), 1.f);
+
+		const int base = (int)flatMesh->vertex.size();
+		for (const glm::vec3& v : mesh->vertex)
+			flatMesh->vertex.push_back(glm::vec3(transform * glm::vec4(v, 1.f)));
+		for (const glm::ivec3& index : mesh->index)
+			flatMesh->index.push_back(index + base);
+	}
+	flat->meshes.push_back(flatMesh);
+	finishModel(flat);
+
+	auto start = std::chrono::steady_clock::now();
+	Bvh blas;
+	blas.build(sphere);
+	for (Instance& instance : instances)
+		instance.blas = &blas;
+	InstanceBvh tlas;
+	tlas.build(instances);
+	const double instancedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	Bvh flatBvh;
+	flatBvh.build(flat);
+	const double flatSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	const double toMB = 1.0 / (1024.0 * 1024.0);
+	const size_t blasBytes = blas.nodes.size() * sizeof(BvhNode) + blas.prims.size() * sizeof(PrimRef);
+	const size_t flatBytes = flatBvh.nodes.size() * sizeof(BvhNode) + flatBvh.prims.size() * sizeof(PrimRef);
+	printf("  instanced: %8.2f MB (geometry %.2f, bottom level %.2f, top level %.2f), built in %.1f ms\n",
+		(geometryBytes(sphere) + blasBytes + tlas.topLevelBytes()) * toMB, geometryBytes(sphere) * toMB,
+		blasBytes * toMB, tlas.topLevelBytes() * toMB, instancedSeconds * 1e3);
+	printf("  flattened: %8.2f MB (geometry %.2f, BVH %.2f), built in %.1f ms\n",
+		(geometryBytes(flat) + flatBytes) * toMB, geometryBytes(flat) * toMB, flatBytes * toMB, flatSeconds * 1e3);
+
+	const std::vector<Ray> primary = primaryRays(flat);
+	const std::vector<Ray> bounce = bounceRays(flat, flatBvh, primary);
+	const int numThreads = numHostThreads();
+	const std::pair<const char*, const std::vector<Ray>*> raySets[] = {
+		{ "primary", &primary },
+		{ "diffuse", &bounce },
+	};
+	for (auto& raySet : raySets) {
+		int numHits = 0;
+		double mrays = measure(*raySet.second, [&](const Ray& ray, Hit& hit) { return tlas.closestHit(ray, hit); }, numHits);
+		printf("  %-8s %-9s %8.2f Mrays/s %8.2f per thread  (%zu rays, %d hits)\n",
+			raySet.first, "instanced", mrays, mrays / numThreads, raySet.second->size(), numHits);
+		mrays = measure(*raySet.second, [&](const Ray& ray, Hit& hit) { return flatBvh.closestHit(ray, hit); }, numHits);
+		printf("  %-8s %-9s %8.2f Mrays/s %8.2f per thread  (%zu rays, %d hits)\n",
+			raySet.first, "flattened", mrays, mrays / numThreads, raySet.second->size(), numHits);
+	}
+	delete flat;
+	delete sphere;
+}
+
+/*! per frame latency of Bvh::update() (a refit, or a rebuild once the
+	SAH cost has grown too much) and of collapsing the BVH8 again, while
+	'deform' moves the model's vertices for each frame */
+static void benchmarkUpdates(const char* name, Model* model, const std::function<void(Model*, int)>& deform,
+							 int numFrames = 8) {
+	std::cout << TERMINAL_BOLD << "--- " << name << ", updates ---" << TERMINAL_DEFAULT << "\n";
+	Bvh bvh;
+	auto start = std::chrono::steady_clock::now();
+	bvh.build(model);
+	const double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	Bvh8 bvh8;
+	start = std::chrono::steady_clock::now();
+	bvh8.build(bvh);
+	const double collapseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("  full build %.1f ms + BVH8 %.1f ms\n", buildSeconds * 1e3, collapseSeconds * 1e3);
+
+	for (int frame = 1; frame <= numFrames; frame++) {
+		deform(model, frame);
+		start = std::chrono::steady_clock::now();
+		const bool rebuilt = bvh.update();
+		const double updateSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		start = std::chrono::steady_clock::now();
+		if (rebuilt)
+			bvh8.build(bvh);
+		else
+			bvh8.refit();
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("  frame %d: %-7s %8.1f ms + BVH8 %.1f ms, SAH cost x%.2f of its build\n",
+			frame, rebuilt ? "rebuild" : "refit", updateSeconds * 1e3, seconds * 1e3, bvh.sahGrowth());
+	}
+	delete model;
+}
+
+/*! per frame latency of InstanceBvh::update() while every instance moves */
+static void benchmarkInstanceUpdates(int numInstances = 10000, int numFrames = 8) {
+	std::cout << TERMINAL_BOLD << "--- " << numInstances << " moving instances, updates ---" << TERMINAL_DEFAULT << "\n";
+	Model* sphere = new Model;
+	TriangleMesh* mesh = new TriangleMesh;
+	addSphere(mesh, glm::vec3(0.f), 0.5f, 16);
+	sphere->meshes.push_back(mesh);
+	finishModel(sphere);
+	Bvh blas;
+	blas.build(sphere);
+
+	const int gridSize = (int)std::ceil(std::sqrt(double(numInstances)));
+	std::vector<Instance> instances(numInstances);
+	for (int i = 0; i < numInstances; i++) {
+		instances[i].blas = &blas;
+		instances[i].transform[3] = glm::vec4(float(i % gridSize), 0.f, float(i / gridSize), 1.f);
+	}
+	InstanceBvh tlas;
+	tlas.build(instances);
+
+	for (int frame = 1; frame <= numFrames; frame++) {
+		// every instance drifts by up to half a grid cell per frame
+		for (int i = 0; i < numInstances; i++) {
+			glm::mat4 transform = tlas.instanceList()[i].transform;
+			const uint32_t seed = 3 * (frame * numInstances + i);
+			transform[3] += glm::vec4(hashFloat(seed) - 0.5f, hashFloat(seed + 1) - 0.5f, hashFloat(seed + 2) - 0.5f, 0.f);
+			tlas.setTransform(i, transform);
+		}
+		auto start = std::chrono::steady_clock::now();
+		const bool rebuilt = tlas.update();
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("  frame %d: %-7s %8.2f ms\n", frame, rebuilt ? "rebuild" : "refit", seconds * 1e3);
+	}
+	delete sphere;
+}
+
+void runRefitBenchmark() {
+	std::cout << "Refit benchmark: " << numHostThreads() << " threads\n";
+	// waves travel over the terrain: the triangles stay where they were
+	// built, so refits keep the tree's quality
+	benchmarkUpdates("waving terrain", makeTerrain(), [](Model* model, int frame) {
+		for (glm::vec3& v : model->meshes[0]->vertex)
+			v.y += 0.01f * std::sin(20.f * v.x + 0.7f * frame) * std::cos(17.f * v.z - 0.4f * frame);
+	});
+	// the soup's triangles drift apart, so its tree degrades and is rebuilt
+	benchmarkUpdates("drifting soup", makeSoup(), [](Model* model, int frame) {
+		std::vector<glm::vec3>& vertex = model->meshes[0]->vertex;
+		for (size_t i = 0; i < vertex.size() / 3; i++) {
+			const uint32_t seed = 3 * uint32_t(frame * vertex.size() + 3 * i);
+			const glm::vec3 offset = 0.01f * glm::vec3(hashFloat(seed) - 0.5f, hashFloat(seed + 1) - 0.5f, hashFloat(seed + 2) - 0.5f);
+			for (int k = 0; k < 3; k++)
+				vertex[3 * i + k] += offset;
+		}
+	});
+	benchmarkInstanceUpdates();
+}
+
+void runRayBenchmark() {
+	std::cout << "Ray benchmark: " << numHostThreads() << " threads, " << Bvh8::simdName()
+		<< " BVH8 traversal, " << benchmarkWidth << "x" << benchmarkHeight << " primary rays\n";
+	benchmarkScene("spheres", makeSpheres());
+	benchmarkScene("terrain", makeTerrain());
+	benchmarkScene("soup", makeSoup());
+	// long triangles, where spatial splits should pay off, and the
+	// terrain's short ones, where they should cost little
+	benchmarkSpatialSplits("rooms", makeRooms());
+	benchmarkSpatialSplits("terrain", makeTerrain());
+	benchmarkTreelets("rooms", makeRooms());
+	benchmarkTreelets("terrain", makeTerrain(512));
+	benchmarkShadowRays("terrain", makeTerrain());
+	benchmarkShadowRays("rooms", makeRooms());
+	benchmarkRaySorting("spheres", makeSpheres());
+	benchmarkRaySorting("soup", makeSoup());
+	benchmarkInstances();
+
+	if (packetMismatches > 0)
+		std::cout << TERMINAL_RED << packetMismatches << " packet hit counts differ from single rays\n" << TERMINAL_DEFAULT;
+	else
+		std::cout << TERMINAL_GREEN << "packets hit the same rays as single rays everywhere\n" << TERMINAL_DEFAULT;
+}
+
+/*! a cold start, which builds and saves the BVHs, against a warm one,
+	which maps them from the file the first wrote. The first frame of
+	primary rays after each includes faulting in the mapped pages */
+static void benchmarkCache(const char* name, Model* model) {
+	const BvhCache cache(".");
+	const std::string file = cache.path(model, BvhBuildQuality::SAH);
+	std::remove(file.c_str());
+	std::cout << TERMINAL_BOLD << "--- " << name << " ---" << TERMINAL_DEFAULT << "\n";
+	const std::vector<Ray> rays = primaryRays(model);
+
+	const char* runs[] = { "build+save", "mapped" };
+	int firstHits = -1;
+	for (const char* run : runs) {
+		Bvh bvh;
+		Bvh8 bvh8;
+		auto start = std::chrono::steady_clock::now();
+		cache.buildOrLoad(model, BvhBuildQuality::SAH, bvh, bvh8);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		int numHits = 0;
+		const double mrays = measure(rays, [&](const Ray& ray, Hit& hit) { return bvh8.closestHit(ray, hit); }, numHits);
+		printf("  %-10s startup %9.1f ms, first frame %6.2f Mrays/s\n", run, seconds * 1e3, mrays);
+		if (firstHits >= 0 && numHits != firstHits)
+			std::cout << TERMINAL_RED << "  mapped BVHs hit " << numHits << " rays, built ones " << firstHits
+				<< TERMINAL_DEFAULT << "\n";
+		firstHits = numHits;
+	}
+	std::remove(file.c_str());
+	delete model;
+}
+
+void runCacheBenchmark() {
+	std::cout << "BVH cache benchmark: " << numHostThreads() << " threads, cache files in the working directory\n";
+	benchmarkCache("terrain", makeTerrain());
+	benchmarkCache("soup", makeSoup(4000000));
+}
+
+static void benchmarkBuilds(const char* name, Model* model) {
+	size_t numTriangles = 0;
+	for (auto mesh : model->meshes)
+		numTriangles += mesh->index.size();
+	const BvhBuildQuality qualities[] = { BvhBuildQuality::SAH, BvhBuildQuality::SBVH, BvhBuildQuality::LBVH,
+										  BvhBuildQuality::PLOC };
+	for (BvhBuildQuality quality : qualities) {
+		Bvh bvh;
+		auto start = std::chrono::steady_clock::now();
+		bvh.build(model, quality);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("  %-8s %-5s %10.1f ms %8.2f Mtris/s  SAH cost %7.2f\n",
+			name, bvhBuildQualityName(quality), seconds * 1e3, numTriangles / seconds * 1e-6, bvh.sahCost());
+	}
+	delete model;
+}
+
+void runBuildBenchmark(int maxMillions) {
+	std::cout << "Build benchmark: " << numHostThreads() << " threads, up to " << maxMillions << "M triangles\n";
+	for (int millions = 1; millions <= maxMillions; millions *= 10) {
+		const int n = millions * 1000000;
+		std::cout << TERMINAL_BOLD << "--- " << millions << "M triangles ---" << TERMINAL_DEFAULT << "\n";
+		try {
+			benchmarkBuilds("soup", makeSoup(n));
+			benchmarkBuilds("terrain", makeTerrain(int(std::sqrt(n / 2.0))));
+		}
+		catch (std::bad_alloc&) {
+			std::cout << TERMINAL_YELLOW << "  out of memory" << TERMINAL_DEFAULT << "\n";
+			break;
+		}
+	}
+}
+
+/*! frames of the megakernel style integrator (CpuRenderer) against the
+	wavefront one, without and with ray sorting, at the same resolution;
+	and whether their images agree */
+static void benchmarkIntegrators(const char* name, Model* model, int numFrames = 2) {
+	std::cout << TERMINAL_BOLD << "--- " << name << " ---" << TERMINAL_DEFAULT << "\n";
+	const glm::ivec2 size(benchmarkWidth / 2, benchmarkHeight / 2);
+	const char* integrators[] = { "megakernel", "wavefront", "wavefront sorted" };
+	std::vector<uint32_t> images[3];
+	for (int integrator = 0; integrator < 3; integrator++) {
+		Renderer* renderer = integrator == 0 ? new CpuRenderer(model)
+			: new WavefrontRenderer(model, nullptr, BvhBuildQuality::SAH, "", false, 0, integrator == 2);
+		renderer->resize(size);
+		renderer->setCamera(benchmarkCamera(model));
+		double seconds = 0.0;
+		for (int frame = 0; frame < numFrames; frame++) {
+			auto start = std::chrono::steady_clock::now();
+			renderer->render();
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		images[integrator].resize(size_t(size.x) * size.y);
+		renderer->downloadPixels(images[integrator].data());
+		delete renderer;
+
+		// samples are camera paths, raysPerPixel of them per pixel
+		const double samples = double(size.x) * size.y * 4 * numFrames;
+		size_t differing = 0;
+		for (size_t i = 0; i < images[0].size(); i++)
+			if (images[0][i] != images[integrator][i])
+				differing++;
+		printf("  %-16s %8.3f Msamples/s %8.3f per thread  (%zu pixels differ from megakernel)\n",
+			integrators[integrator], samples / seconds * 1e-6, samples / seconds * 1e-6 / numHostThreads(), differing);
+	}
+	delete model;
+}
+
+/*! the displayed color channels, in [0,1], of an image rendered at
+	'factor' times 'size', over factor x factor pixel blocks; averaged
+	as linear values, which the display shows the square root of */
+static std::vector<float> downsampledColors(const std::vector<uint32_t>& image, const glm::ivec2& size, int factor) {
+	std::vector<float> colors(size_t(size.x) * size.y * 3);
+	for (int y = 0; y < size.y; y++)
+		for (int x = 0; x < size.x; x++)
+			for (int c = 0; c < 3; c++) {
+				float sum = 0.f;
+				for (int j = 0; j < factor; j++)
+					for (int i = 0; i < factor; i++) {
+						const float v = ((image[x * factor + i + (y * factor + j) * size.x * factor] >> (8 * c)) & 0xff) / 255.f;
+						sum += v * v;
+					}
+				colors[(x + y * size.x) * 3 + c] = std::sqrt(sum / (factor * factor));
+			}
+	return colors;
+}
+
+/*! root mean square difference of an image from reference colors (see
+	downsampledColors), over the color channels as displayed */
+static double imageRmse(const std::vector<uint32_t>& image, const std::vector<float>& reference) {
+	double sum = 0.0;
+	for (size_t i = 0; i < image.size(); i++)
+		for (int c = 0; c < 3; c++) {
+			const double d = ((image[i] >> (8 * c)) & 0xff) / 255.0 - reference[i * 3 + c];
+			sum += d * d;
+		}
+	return std::sqrt(sum / (3.0 * image.size()));
+}
+
+/*! how much brighter an image is than reference colors on average, as
+	a fraction of the reference, in linear values; shows bias once the
+	noise averages out */
+static double imageMeanError(const std::vector<uint32_t>& image, const std::vector<float>& reference) {
+	double sum = 0.0, referenceSum = 0.0;
+	for (size_t i = 0; i < image.size(); i++)
+		for (int c = 0; c < 3; c++) {
+			const double v = ((image[i] >> (8 * c)) & 0xff) / 255.0;
+			sum += v * v;
+			referenceSum += double(reference[i * 3 + c]) * reference[i * 3 + c];
+		}
+	return sum / referenceSum - 1.0;
+}
+
+/*! noise at equal render time of the megakernel integrator without
+	next event estimation, with it picking lights by power and from the
+	light BVH, and with reservoir resampling of the latter's samples:
+	the error of their images against a reference rendered with the
+	light BVH for referenceFrames frames, at twice the resolution, so
+	that it does not share their pixels' random numbers. First for the
+	frame right after a camera move, then for accumulating. Also whether
+	the wavefront integrator gets the same image */
+static void benchmarkLightSampling(const char* name, Model* model, const Camera& camera, int referenceFrames = 64) {
+	std::cout << TERMINAL_BOLD << "--- " << name << ", next event estimation ---" << TERMINAL_DEFAULT << "\n";
+	const glm::ivec2 size(benchmarkWidth / 8, benchmarkHeight / 8);
+	// the camera just before a move to 'camera', for reservoirs to reproject
+	Camera previousCamera = camera;
+	previousCamera.from += 0.02f * glm::length(camera.at - camera.from) * glm::vec3(1.f, 0.f, 0.f);
+	// renders at least numFrames frames and 'seconds', after previousFrames
+	// frames from previousCamera; 'frames' and 'elapsed' are what it took
+	int frames;
+	double elapsed;
+	auto renderImage = [&](Renderer* renderer, const glm::ivec2& imageSize, int previousFrames, int numFrames,
+						   double seconds) {
+		renderer->resize(imageSize);
+		renderer->setCamera(previousCamera);
+		for (int i = 0; i < previousFrames; i++)
+			renderer->render();
+		renderer->setCamera(camera);
+		auto start = std::chrono::steady_clock::now();
+		for (frames = 0; frames < numFrames
+			|| std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds; frames++)
+			renderer->render();
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::vector<uint32_t> image(size_t(imageSize.x) * imageSize.y);
+		renderer->downloadPixels(image.data());
+		delete renderer;
+		return image;
+	};
+
+	const std::vector<float> reference = downsampledColors(renderImage(new CpuRenderer(model, nullptr,
+		BvhBuildQuality::SAH, "", false, 0, true, LightSelection::HIERARCHY), 2 * size, 0, referenceFrames, 0.0),
+		size, 2);
+
+	struct Strategy {
+		const char* name;
+		bool nextEventEstimation;
+		LightSelection selection;
+		ReservoirReuse reuse;
+	};
+	const Strategy strategies[] = {
+		{ "scattering only", false, LightSelection::POWER, ReservoirReuse::NONE },
+		{ "lights by power", true, LightSelection::POWER, ReservoirReuse::NONE },
+		{ "light BVH", true, LightSelection::HIERARCHY, ReservoirReuse::NONE },
+		{ "reservoirs, biased", true, LightSelection::HIERARCHY, ReservoirReuse::BIASED },
+		{ "reservoirs", true, LightSelection::HIERARCHY, ReservoirReuse::UNBIASED },
+	};
+	// the first frame after the camera moved a little, as interaction
+	// shows it; reservoirs carry over from 8 frames before the move
+	for (const Strategy& strategy : strategies) {
+		const std::vector<uint32_t> image = renderImage(new CpuRenderer(model, nullptr, BvhBuildQuality::SAH, "",
+			false, 0, strategy.nextEventEstimation, strategy.selection, strategy.reuse), size, 8, 1, 0.0);
+		printf("  %-20s moved %5.0f ms %4d spp   RMSE %.4f\n", strategy.name, 1000.0 * elapsed, frames * 4,
+			imageRmse(image, reference));
+	}
+	const double budgets[] = { 1.0, 4.0, 16.0 };
+	for (double seconds : budgets)
+		for (const Strategy& strategy : strategies) {
+			const std::vector<uint32_t> image = renderImage(new CpuRenderer(model, nullptr, BvhBuildQuality::SAH, "",
+				false, 0, strategy.nextEventEstimation, strategy.selection, strategy.reuse), size, 0, 1, seconds);
+			printf("  %-20s %5.1f s %6d spp   RMSE %.4f   mean %+.1f%%\n", strategy.name, seconds, frames * 4,
+				imageRmse(image, reference), 100.0 * imageMeanError(image, reference));
+		}
+
+	const std::vector<uint32_t> megakernel = renderImage(new CpuRenderer(model, nullptr, BvhBuildQuality::SAH, "",
+		false, 0, true, LightSelection::HIERARCHY), size, 0, 2, 0.0);
+	const std::vector<uint32_t> wavefront = renderImage(new WavefrontRenderer(model, nullptr, BvhBuildQuality::SAH, "",
+		false, 0, false, true, LightSelection::HIERARCHY), size, 0, 2, 0.0);
+	size_t differing = 0;
+	for (size_t i = 0; i < megakernel.size(); i++)
+		if (megakernel[i] != wavefront[i])
+			differing++;
+	printf("  wavefront with next event estimation: %zu pixels differ from megakernel\n", differing);
+	delete model;
+}
+
+void runIntegratorBenchmark() {
+	std::cout << "Integrator benchmark: " << numHostThreads() << " threads, " << benchmarkWidth / 2 << "x"
+		<< benchmarkHeight / 2 << " pixels, 4 samples per pixel\n";
+	benchmarkIntegrators("materials", makeMaterials());
+	benchmarkIntegrators("rooms", withDiffuseMaterial(makeRooms()));
+	benchmarkIntegrators("terrain", withDiffuseMaterial(makeTerrain()));
+	const Camera cornellCamera = { glm::vec3(0.f, 1.f, 0.95f), glm::vec3(0.f, 1.f, -1.f), glm::vec3(0.f, 1.f, 0.f) };
+	benchmarkLightSampling("cornell box", makeCornellBox(), cornellCamera);
+	const Camera garageCamera = { glm::vec3(14.f, 2.f, 12.f), glm::vec3(17.f, 0.f, 15.f), glm::vec3(0.f, 1.f, 0.f) };
+	benchmarkLightSampling("garage, 32k lights", makeGarage(), garageCamera);
+}
+
+//------------------------------------------------------------------------------
+// BSDF checks
+//------------------------------------------------------------------------------
+
+// directions drawn per check, and the (theta, phi) bins of the
+// hemisphere they are counted in
+static const int bsdfSamples = 1000000;
+static const int thetaBins = 16;
+static const int phiBins = 32;
+
+/*! probability of a chi-square statistic of 'dof' degrees of freedom
+	being at least chiSquare, by the Wilson-Hilferty approximation */
+static double chiSquareTail(double chiSquare, int dof) {
+	const double k = dof;
+	const double z = (std::pow(chiSquare / k, 1.0 / 3.0) - (1.0 - 2.0 / (9.0 * k))) / std::sqrt(2.0 / (9.0 * k));
+	return 0.5 * std::erfc(z / std::sqrt(2.0));
+}
+
+/*! Pearson's chi-square test of counts against the counts expected in
+	the same bins. Bins expecting fewer than 5 are pooled, and the pool
+	joins the smallest other bin if it still expects fewer than 5.
+	Returns the probability of a statistic as large, and the statistic
+	and its degrees of freedom in chiSquare and dof */
+static double chiSquareTest(const std::vector<double>& observed, const std::vector<double>& expected,
+							double& chiSquare, int& dof) {
+	std::vector<double> binObserved, binExpected;
+	double pooledObserved = 0.0, pooledExpected = 0.0;
+	for (size_t i = 0; i < expected.size(); i++) {
+		if (expected[i] < 5.0) {
+			pooledObserved += observed[i];
+			pooledExpected += expected[i];
+			continue;
+		}
+		binObserved.push_back(observed[i]);
+		binExpected.push_back(expected[i]);
+	}
+	if (pooledExpected >= 5.0 || binExpected.empty()) {
+		binObserved.push_back(pooledObserved);
+		binExpected.push_back(pooledExpected);
+	}
+	else {
+		const size_t smallest = std::min_element(binExpected.begin(), binExpected.end()) - binExpected.begin();
+		binObserved[smallest] += pooledObserved;
+		binExpected[smallest] += pooledExpected;
+	}
+
+	chiSquare = 0.0;
+	for (size_t i = 0; i < binExpected.size(); i++)
+		if (binExpected[i] > 0.0)
+			chiSquare += (binObserved[i] - binExpected[i]) * (binObserved[i] - binExpected[i]) / binExpected[i];
+		else if (binObserved[i] > 0.0)
+			chiSquare = INFINITY;
+	dof = int(binExpected.size()) - 1;
+	return dof > 0 ? chiSquareTail(chiSquare, dof) : 1.0;
+}
+
+/*! uniform number 'dimension' of sample 'index' of a check; hashing the
+	index first keeps the dimensions of consecutive samples independent,
+	which hashFloat of consecutive numbers does not quite */
+static inline float checkFloat(uint32_t index, uint32_t dimension) {
+	return hashFloat(hashIndex(index) + 0x9e3779b9u * dimension);
+}
+
+/*! Bsdf::sample for 'wo' at 'normal', against the Bsdf's eval and pdf:
+	a chi-square test (see chiSquareTest) of the directions it draws,
+	binned by (theta, phi) about the normal, against the pdf integrated
+	over the bins (failed samples are one more bin); the directional
+	albedo, the mean sample weight, which
+	must not exceed 1 for a white surface; and the mean difference of
+	a sample's weight and pdf from eval / pdf and pdf, relative to
+	their means.
+	Returns whether the test passes at significance 'alpha' */
+static bool checkBsdf(const char* name, const Bsdf& bsdf, float thetaO, uint32_t seed, double alpha) {
+	const glm::vec3 normal = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
+	const glm::vec3 tangent = glm::normalize(glm::cross(normal, glm::vec3(1.f, 0.f, 0.f)));
+	const glm::vec3 bitangent = glm::cross(normal, tangent);
+	const glm::vec3 wo = std::sin(thetaO) * tangent + std::cos(thetaO) * normal;
+
+	// the time of sample() alone first
+	float checksum = 0.f;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < bsdfSamples; i++) {
+		const uint32_t index = seed + uint32_t(i);
+		BsdfSample sample;
+		if (bsdf.sample(wo, normal, checkFloat(index, 0), checkFloat(index, 1), checkFloat(index, 2), sample))
+			checksum += sample.direction.x;
+	}
+	const double nanoseconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+		/ bsdfSamples * 1e9 + 0.0 * checksum;
+
+	std::vector<double> observed(thetaBins * phiBins + 1, 0.0);
+	double weightSum = 0.0, weightSquares = 0.0;
+	double weightError = 0.0, pdfError = 0.0, pdfSum = 0.0;
+	for (int i = 0; i < bsdfSamples; i++) {
+		const uint32_t index = seed + uint32_t(i);
+		BsdfSample sample;
+		if (!bsdf.sample(wo, normal, checkFloat(index, 0), checkFloat(index, 1), checkFloat(index, 2), sample)) {
+			observed[thetaBins * phiBins] += 1.0;
+			continue;
+		}
+		weightSum += sample.weight.x;
+		weightSquares += double(sample.weight.x) * sample.weight.x;
+
+		const glm::vec3 wi = sample.direction;
+		const float cosTheta = glm::dot(wi, normal);
+		if (cosTheta <= 0.f) {
+			observed[thetaBins * phiBins] += 1.0;
+			continue;
+		}
+		const float theta = std::acos(std::min(cosTheta, 1.f));
+		const float phi = std::atan2(glm::dot(wi, bitangent), glm::dot(wi, tangent)) + PI;
+		const int t = std::min(int(theta / (0.5f * PI) * thetaBins), thetaBins - 1);
+		const int p = std::min(std::max(int(phi / (2.f * PI) * phiBins), 0), phiBins - 1);
+		observed[t * phiBins + p] += 1.0;
+
+		const float pdf = bsdf.pdf(wo, wi, normal);
+		weightError += std::abs(bsdf.eval(wo, wi, normal).x / pdf - sample.weight.x);
+		pdfError += std::abs(pdf - sample.pdf);
+		pdfSum += sample.pdf;
+	}
+	weightError /= weightSum;
+	pdfError /= pdfSum;
+
+	// the pdf integrated over each bin, by the midpoint rule on a finer grid
+	const int subdivisions = 32;
+	std::vector<double> expected(thetaBins * phiBins + 1, 0.0);
+	double total = 0.0;
+	for (int t = 0; t < thetaBins; t++)
+		for (int p = 0; p < phiBins; p++) {
+			double integral = 0.0;
+			for (int i = 0; i < subdivisions; i++)
+				for (int j = 0; j < subdivisions; j++) {
+					const float theta = (t + (i + 0.5f) / subdivisions) * (0.5f * PI / thetaBins);
+					const float phi = (p + (j + 0.5f) / subdivisions) * (2.f * PI / phiBins) - PI;
+					const glm::vec3 wi = std::sin(theta) * (std::cos(phi) * tangent + std::sin(phi) * bitangent)
+						+ std::cos(theta) * normal;
+					integral += bsdf.pdf(wo, wi, normal) * std::sin(theta);
+				}
+			integral *= (0.5 * PI / thetaBins) * (2.0 * PI / phiBins) / (subdivisions * subdivisions);
+			expected[t * phiBins + p] = integral * bsdfSamples;
+			total += integral;
+		}
+	expected[thetaBins * phiBins] = std::max(1.0 - total, 0.0) * bsdfSamples;
+
+	double chiSquare;
+	int dof;
+	const double pValue = chiSquareTest(observed, expected, chiSquare, dof);
+
+	const double albedo = weightSum / bsdfSamples;
+	const double albedoError = std::sqrt(std::max(weightSquares / bsdfSamples - albedo * albedo, 0.0) / bsdfSamples);
+	const bool passed = pValue >= alpha && albedo <= 1.0 + 3.0 * albedoError && weightError < 1e-3
+		&& pdfError < 1e-3;
+	printf("  %-18s wo %2.0f deg   chi2 %7.1f / %3d p %.3f   albedo %.4f +- %.4f   eval/pdf %.0e pdf %.0e   "
+		"%4.0f ns   %s\n", name, thetaO * 180.f / PI, chiSquare, dof, pValue, albedo, albedoError,
+		weightError, pdfError, nanoseconds, passed ? "ok" : "FAILED");
+	return passed;
+}
+
+/*! the delta lobes of a dielectric for 'wo' from outside (and back out,
+	from inside): whether it reflects as often as the Fresnel term
+	says, within 4 standard deviations, and whether refracted
+	directions follow Snell's law. Returns whether both hold */
+static bool checkDielectric(const Bsdf& bsdf, float thetaO, bool inside, uint32_t seed) {
+	const glm::vec3 normal = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
+	const glm::vec3 tangent = glm::normalize(glm::cross(normal, glm::vec3(1.f, 0.f, 0.f)));
+	const glm::vec3 wo = std::sin(thetaO) * tangent + (inside ? -1.f : 1.f) * std::cos(thetaO) * normal;
+	const float etaI = inside ? bsdf.ior : 1.f;
+	const float etaT = inside ? 1.f : bsdf.ior;
+
+	// the reference Fresnel term, in double precision
+	const double cosI = std::cos(double(thetaO));
+	const double sinT = etaI / etaT * std::sin(double(thetaO));
+	double reflectance = 1.0;
+	if (sinT < 1.0) {
+		const double cosT = std::sqrt(1.0 - sinT * sinT);
+		const double rs = (etaI * cosI - etaT * cosT) / (etaI * cosI + etaT * cosT);
+		const double rp = (etaT * cosI - etaI * cosT) / (etaT * cosI + etaI * cosT);
+		reflectance = 0.5 * (rs * rs + rp * rp);
+	}
+
+	int reflected = 0;
+	double energy = 0.0;
+	float maxSnellError = 0.f;
+	for (int i = 0; i < bsdfSamples; i++) {
+		BsdfSample sample;
+		if (!bsdf.sample(wo, normal, 0.5f, 0.5f, hashFloat(seed + uint32_t(i)), sample))
+			continue;
+		energy += sample.weight.x;
+		if (glm::dot(sample.direction, normal) * glm::dot(wo, normal) > 0.f) {
+			reflected++;
+			continue;
+		}
+		const float sinO = glm::length(glm::cross(wo, normal));
+		const float sinI = glm::length(glm::cross(sample.direction, normal));
+		maxSnellError = std::max(maxSnellError, std::abs(etaT * sinI - etaI * sinO));
+	}
+	const double fraction = double(reflected) / bsdfSamples;
+	const double deviation = std::sqrt(std::max(reflectance * (1.0 - reflectance), 1e-12) / bsdfSamples);
+	const bool passed = std::abs(fraction - reflectance) <= 4.0 * deviation && maxSnellError < 1e-4f;
+	printf("  dielectric %-7s wo %2.0f deg   reflected %.4f, Fresnel %.4f (%+.1f sd)   Snell %.0e   "
+		"albedo %.4f   %s\n", inside ? "inside" : "outside", thetaO * 180.f / PI, fraction, reflectance,
+		(fraction - reflectance) / deviation, maxSnellError, energy / bsdfSamples, passed ? "ok" : "FAILED");
+	return passed;
+}
+
+void runBsdfBenchmark() {
+	std::cout << "BSDF checks: " << bsdfSamples << " samples per direction, " << thetaBins << "x" << phiBins
+		<< " bins\n";
+	struct Case {
+		const char* name;
+		Bsdf bsdf;
+	};
+	const Case cases[] = {
+		{ "diffuse", Bsdf::diffuse(glm::vec3(1.f)) },
+		{ "glossy, Ns 10", Bsdf::glossy(glm::vec3(1.f), roughnessFromShininess(10.f)) },
+		{ "glossy, Ns 100", Bsdf::glossy(glm::vec3(1.f), roughnessFromShininess(100.f)) },
+		{ "glossy, Ns 900", Bsdf::glossy(glm::vec3(1.f), roughnessFromShininess(900.f)) },
+		{ "glossy, gold", Bsdf::glossy(glm::vec3(1.f, 0.78f, 0.34f), roughnessFromShininess(100.f)) },
+	};
+	const float angles[] = { 0.1f, 0.8f, 1.4f };
+	// significance of each test; a slightly wrong pdf shows at p < 0.01
+	const double alpha = 0.01;
+	int failed = 0;
+	uint32_t seed = 0;
+	for (const Case& c : cases)
+		for (float thetaO : angles) {
+			seed += bsdfSamples;
+			if (!checkBsdf(c.name, c.bsdf, thetaO, seed, alpha))
+				failed++;
+		}
+	for (int inside = 0; inside < 2; inside++)
+		for (float thetaO : angles) {
+			seed += bsdfSamples;
+			if (!checkDielectric(Bsdf::dielectric(1.5f), thetaO, inside == 1, seed))
+				failed++;
+		}
+	if (failed > 0)
+		std::cout << TERMINAL_RED << failed << " BSDF checks failed\n" << TERMINAL_DEFAULT;
+	else
+		std::cout << TERMINAL_GREEN << "all BSDF checks passed\n" << TERMINAL_DEFAULT;
+}
+
+//------------------------------------------------------------------------------
+// environment map checks
+//------------------------------------------------------------------------------
+
+// directions drawn per check, and the (theta, phi) bins of the sphere
+// they are counted in; the test maps' pixels split evenly into bins
+static const int environmentSamples = 1000000;
+static const int environmentThetaBins = 32;
+static const int environmentPhiBins = 64;
+
+/*! a width x height lat-long sky, noisy from pixel to pixel: a
+	gradient from the zenith to a bright horizon, a sun 1% of the width
+	across and a thousand times brighter, dim ground just below the
+	horizon and black further down, where nothing may be sampled */
+static EnvironmentMap* makeSky(int width, int height) {
+	EnvironmentMap* env = new EnvironmentMap;
+	env->resolution = glm::ivec2(width, height);
+	env->pixel.resize((size_t)width * height);
+	const glm::vec2 sun(0.3f * width, 0.25f * height);
+	const float sunRadius = 0.005f * width;
+	parallelFor(0, height, [&](int y) {
+		const float v = (y + 0.5f) / height;
+		for (int x = 0; x < width; x++) {
+			const float noise = 0.5f + hashFloat(uint32_t(x + y * width));
+			glm::vec3 color(0.f);
+			if (v < 0.5f)
+				color = noise * glm::mix(glm::vec3(0.2f, 0.4f, 1.f), glm::vec3(1.f, 0.9f, 0.8f), 2.f * v);
+			else if (v < 0.6f)
+				color = noise * glm::vec3(0.1f, 0.08f, 0.05f);
+			if (glm::length(glm::vec2(x + 0.5f, y + 0.5f) - sun) < sunRadius)
+				color = glm::vec3(1000.f);
+			env->pixel[x + (size_t)y * width] = color;
+		}
+	}, 16);
+	return env;
+}
+
+/*! EnvironmentMap::sample against EnvironmentMap::pdf: a chi-square
+	test (see chiSquareTest) of the directions it draws, binned by
+	(theta, phi), against the pdf integrated over the bins (failed
+	samples are one more bin); and the mean difference of a sample's
+	pdf from pdf() for its direction, relative to their mean.
+	Returns whether the test passes at significance 'alpha' */
+static bool checkEnvironment(const char* name, const EnvironmentMap& env, uint32_t seed, double alpha) {
+	// the time of sample() alone first
+	float checksum = 0.f;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < environmentSamples; i++) {
+		const uint32_t index = seed + uint32_t(i);
+		float pdf;
+		checksum += env.sample(glm::vec2(checkFloat(index, 0), checkFloat(index, 1)), pdf).x;
+	}
+	const double nanoseconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+		/ environmentSamples * 1e9 + 0.0 * checksum;
+
+	const int numBins = environmentThetaBins * environmentPhiBins;
+	std::vector<double> observed(numBins + 1, 0.0);
+	double pdfError = 0.0, pdfSum = 0.0;
+	for (int i = 0; i < environmentSamples; i++) {
+		const uint32_t index = seed + uint32_t(i);
+		float pdf;
+		const glm::vec3 dir = env.sample(glm::vec2(checkFloat(index, 0), checkFloat(index, 1)), pdf);
+		if (pdf <= 0.f) {
+			observed[numBins] += 1.0;
+			continue;
+		}
+		const float theta = std::acos(glm::clamp(dir.y, -1.f, 1.f));
+		const float phi = std::atan2(dir.x, -dir.z) + PI;
+		const int t = std::min(int(theta / PI * environmentThetaBins), environmentThetaBins - 1);
+		const int p = std::min(std::max(int(phi / (2.f * PI) * environmentPhiBins), 0), environmentPhiBins - 1);
+		observed[t * environmentPhiBins + p] += 1.0;
+
+		pdfError += std::abs(env.pdf(dir) - pdf);
+		pdfSum += pdf;
+	}
+	pdfError /= pdfSum;
+
+	// the pdf integrated over each bin, by the midpoint rule on a grid
+	// fine enough to give each pixel its own points
+	const int subdivisions = 2 * std::max(env.resolution.x / environmentPhiBins,
+		env.resolution.y / environmentThetaBins);
+	std::vector<double> expected(numBins + 1, 0.0);
+	double total = 0.0;
+	for (int t = 0; t < environmentThetaBins; t++)
+		for (int p = 0; p < environmentPhiBins; p++) {
+			double integral = 0.0;
+			for (int i = 0; i < subdivisions; i++)
+				for (int j = 0; j < subdivisions; j++) {
+					const float theta = (t + (i + 0.5f) / subdivisions) * (PI / environmentThetaBins);
+					const float phi = (p + (j + 0.5f) / subdivisions) * (2.f * PI / environmentPhiBins) - PI;
+					const glm::vec3 dir(std::sin(theta) * std::sin(phi), std::cos(theta),
+						-std::sin(theta) * std::cos(phi));
+					integral += env.pdf(dir) * std::sin(theta);
+				}
+			integral *= (PI / environmentThetaBins) * (2.0 * PI / environmentPhiBins) / (subdivisions * subdivisions);
+			expected[t * environmentPhiBins + p] = integral * environmentSamples;
+			total += integral;
+		}
+	expected[numBins] = std::max(1.0 - total, 0.0) * environmentSamples;
+
+	double chiSquare;
+	int dof;
+	const double pValue = chiSquareTest(observed, expected, chiSquare, dof);
+	const bool passed = pValue >= alpha && pdfError < 1e-3;
+	printf("  %-14s %4dx%-4d   chi2 %7.1f / %4d p %.3f   pdf %.0e   %4.0f ns   %s\n", name, env.resolution.x,
+		env.resolution.y, chiSquare, dof, pValue, pdfError, nanoseconds, passed ? "ok" : "FAILED");
+	return passed;
+}
+
+void runEnvironmentBenchmark() {
+	std::cout << "Environment map checks: " << environmentSamples << " samples per map, " << environmentThetaBins
+		<< "x" << environmentPhiBins << " bins\n";
+
+	EnvironmentMap* uniform = new EnvironmentMap;
+	uniform->resolution = glm::ivec2(256, 128);
+	uniform->pixel.assign(256 * 128, glm::vec3(1.f));
+	EnvironmentMap* sky = makeSky(512, 256);
+	EnvironmentMap* fineSky = makeSky(2048, 1024);
+	for (EnvironmentMap* env : { uniform, sky, fineSky })
+		buildSamplingTables(*env);
+
+	const double alpha = 0.01;
+	int failed = 0;
+	if (!checkEnvironment("uniform", *uniform, 0u, alpha))
+		failed++;
+	if (!checkEnvironment("sky and sun", *sky, uint32_t(environmentSamples), alpha))
+		failed++;
+	if (!checkEnvironment("sky and sun", *fineSky, 2u * environmentSamples, alpha))
+		failed++;
+	delete uniform;
+	delete sky;
+	delete fineSky;
+
+	// the build alone, at the sizes of common HDR probes
+	std::cout << "Table builds with " << numHostThreads() << " threads:\n";
+	const glm::ivec2 sizes[] = { glm::ivec2(1024, 512), glm::ivec2(2048, 1024), glm::ivec2(4096, 2048),
+		glm::ivec2(8192, 4096) };
+	for (const glm::ivec2& size : sizes) {
+		EnvironmentMap* env = makeSky(size.x, size.y);
+		double best = 1e30;
+		for (int run = 0; run < 3; run++) {
+			auto start = std::chrono::steady_clock::now();
+			buildSamplingTables(*env);
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		printf("  %4dx%-4d   %7.2f ms   %6.0f Mpixels/s\n", size.x, size.y, best,
+			double(size.x) * size.y / (best * 1e3));
+		delete env;
+	}
+
+	if (failed > 0)
+		std::cout << TERMINAL_RED << failed << " environment map checks failed\n" << TERMINAL_DEFAULT;
+	else
+		std::cout << TERMINAL_GREEN << "all environment map checks passed\n" << TERMINAL_DEFAULT;
+}
+
+//------------------------------------------------------------------------------
+// sample sequences
+//------------------------------------------------------------------------------
+
+static const char* sequenceName(SampleSequence sequence) {
+	return sequence == SampleSequence::RANDOM ? "random" : sequence == SampleSequence::SOBOL ? "sobol" : "blue noise";
+}
+
+/*! slope of the least squares line through (log x, log y), the order
+	of convergence of an error y at x samples */
+static double convergenceRate(const std::vector<double>& x, const std::vector<double>& y) {
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	const double n = double(x.size());
+	for (size_t i = 0; i < x.size(); i++) {
+		const double lx = std::log(x[i]), ly = std::log(y[i]);
+		sx += lx;
+		sy += ly;
+		sxx += lx * lx;
+		sxy += lx * ly;
+	}
+	return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+// integrals are estimated at the pixels of an image of this side,
+// and their errors also averaged over blocks of this side
+static const int samplerPixels = 32;
+static const int integrandBlock = 4;
+
+/*! the estimates of integrals over [0,1)^4 of one SampleSequence at
+	each pixel of a samplerPixels^2 image, after 1, 4, ... 1024 samples:
+	their RMSE over the pixels, which for low discrepancy sequences falls
+	faster than the N^-0.5 of random numbers, and the RMSE of the means
+	over blocks of 4x4 pixels, which falls by more than their 4 for
+	errors that cancel between neighbours. The integrands: smooth,
+	exp(u0 + u1); discontinuous, whether (u0, u1) is in the quarter
+	disk; and exp of the sum of dimensions 0 to 3, across two of the
+	sequences' dimension pairs */
+static void benchmarkIntegrands(SampleSequence sequence) {
+	const int numIntegrands = 3;
+	const char* names[numIntegrands] = { "smooth 2D", "disk 2D", "smooth 4D" };
+	const double e1 = std::exp(1.0) - 1.0;
+	const double exact[numIntegrands] = { e1 * e1, 0.25 * 3.14159265358979, e1 * e1 * e1 * e1 };
+	const int checkpoints[] = { 1, 4, 16, 64, 256, 1024 };
+	const int numCheckpoints = sizeof(checkpoints) / sizeof(checkpoints[0]);
+	const int numPixels = samplerPixels * samplerPixels;
+
+	// error of each integrand's estimate at each checkpoint, per pixel
+	std::vector<double> errors(size_t(numIntegrands) * numCheckpoints * numPixels);
+	auto start = std::chrono::steady_clock::now();
+	for (int pixel = 0; pixel < numPixels; pixel++) {
+		PathSampler sampler = PathSampler::forPixel(sequence, pixel % samplerPixels, pixel / samplerPixels,
+			samplerPixels, 0);
+		double sums[numIntegrands] = {};
+		for (int i = 0, checkpoint = 0; checkpoint < numCheckpoints; i++) {
+			sampler.startSample(uint32_t(i));
+			float u[4];
+			for (int d = 0; d < 4; d++)
+				u[d] = sampler.next();
+			sums[0] += std::exp(double(u[0]) + u[1]);
+			sums[1] += u[0] * u[0] + u[1] * u[1] < 1.f ? 1.0 : 0.0;
+			sums[2] += std::exp(double(u[0]) + u[1] + u[2] + u[3]);
+			if (i + 1 < checkpoints[checkpoint])
+				continue;
+			for (int f = 0; f < numIntegrands; f++)
+				errors[(size_t(f) * numCheckpoints + checkpoint) * numPixels + pixel] = sums[f] / (i + 1) - exact[f];
+			checkpoint++;
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	const int blocks = samplerPixels / integrandBlock;
+	for (int f = 0; f < numIntegrands; f++) {
+		std::vector<double> samples, rmse, blockRmse;
+		printf("  %-10s %-9s RMSE      ", sequenceName(sequence), names[f]);
+		for (int c = 0; c < numCheckpoints; c++) {
+			const double* error = &errors[(size_t(f) * numCheckpoints + c) * numPixels];
+			double sum = 0.0, blockSum = 0.0;
+			for (int i = 0; i < numPixels; i++)
+				sum += error[i] * error[i];
+			for (int by = 0; by < blocks; by++)
+				for (int bx = 0; bx < blocks; bx++) {
+					double mean = 0.0;
+					for (int y = 0; y < integrandBlock; y++)
+						for (int x = 0; x < integrandBlock; x++)
+							mean += error[bx * integrandBlock + x + (by * integrandBlock + y) * samplerPixels];
+					mean /= integrandBlock * integrandBlock;
+					blockSum += mean * mean;
+				}
+			samples.push_back(checkpoints[c]);
+			rmse.push_back(std::sqrt(sum / numPixels) / exact[f]);
+			blockRmse.push_back(std::sqrt(blockSum / (blocks * blocks)) / exact[f]);
+			printf(" %.1e", rmse.back());
+		}
+		printf("   N^%+.2f\n  %-10s %-9s 4x4 blocks", convergenceRate(samples, rmse), "", "");
+		for (int c = 0; c < numCheckpoints; c++)
+			printf(" %.1e", blockRmse[c]);
+		printf("   %.1fx to %.1fx less\n", rmse[0] / blockRmse[0], rmse.back() / blockRmse.back());
+	}
+	printf("  %-10s %.0f ns per sample\n", sequenceName(sequence),
+		seconds / (double(numPixels) * checkpoints[numCheckpoints - 1] * 4) * 1e9);
+}
+
+/*! root mean square of the means over blocks of block x block pixels
+	of an image's difference from reference colors: the error left once
+	the eye, or a denoiser, averages over the blocks */
+static double blockRmse(const std::vector<uint32_t>& image, const std::vector<float>& reference,
+						const glm::ivec2& size, int block) {
+	double sum = 0.0;
+	int count = 0;
+	for (int by = 0; by + block <= size.y; by += block)
+		for (int bx = 0; bx + block <= size.x; bx += block)
+			for (int c = 0; c < 3; c++) {
+				double mean = 0.0;
+				for (int y = by; y < by + block; y++)
+					for (int x = bx; x < bx + block; x++) {
+						const size_t i = size_t(x) + size_t(y) * size.x;
+						mean += ((image[i] >> (8 * c)) & 0xff) / 255.0 - reference[i * 3 + c];
+					}
+				mean /= block * block;
+				sum += mean * mean;
+				count++;
+			}
+	return std::sqrt(sum / count);
+}
+
+/*! the error of renders after 1 to 64 frames with each SampleSequence,
+	with next event estimation, against a reference of referenceFrames
+	frames at twice the resolution (random numbers): RMSE, and RMSE over
+	4x4 pixel blocks; and whether the wavefront integrator gets the
+	megakernel's image with each */
+static void benchmarkSequenceRenders(const char* name, Model* model, const Camera& camera,
+									 int referenceFrames = 256) {
+	std::cout << TERMINAL_BOLD << "--- " << name << ", next event estimation ---" << TERMINAL_DEFAULT << "\n";
+	const glm::ivec2 size(benchmarkWidth / 8, benchmarkHeight / 8);
+	auto render = [&](Renderer* renderer, const glm::ivec2& imageSize, int numFrames) {
+		renderer->resize(imageSize);
+		renderer->setCamera(camera);
+		for (int i = 0; i < numFrames; i++)
+			renderer->render();
+		std::vector<uint32_t> image(size_t(imageSize.x) * imageSize.y);
+		renderer->downloadPixels(image.data());
+		delete renderer;
+		return image;
+	};
+	const std::vector<float> reference = downsampledColors(render(new CpuRenderer(model, nullptr,
+		BvhBuildQuality::SAH, "", false, 0, true), 2 * size, referenceFrames), size, 2);
+
+	const SampleSequence sequences[] = { SampleSequence::RANDOM, SampleSequence::SOBOL, SampleSequence::BLUE_NOISE };
+	const int frameCounts[] = { 1, 4, 16, 64 };
+	std::vector<std::string> lines;
+	for (SampleSequence sequence : sequences) {
+		std::vector<double> samples, rmse, blocks;
+		for (int frames : frameCounts) {
+			const std::vector<uint32_t> image = render(new CpuRenderer(model, nullptr, BvhBuildQuality::SAH, "",
+				false, 0, true, LightSelection::POWER, ReservoirReuse::NONE, sequence), size, frames);
+			samples.push_back(4.0 * frames);
+			rmse.push_back(imageRmse(image, reference));
+			blocks.push_back(blockRmse(image, reference, size, 4));
+		}
+		const std::vector<uint32_t> megakernel = render(new CpuRenderer(model, nullptr, BvhBuildQuality::SAH, "",
+			false, 0, true, LightSelection::POWER, ReservoirReuse::NONE, sequence), size, 2);
+		const std::vector<uint32_t> wavefront = render(new WavefrontRenderer(model, nullptr, BvhBuildQuality::SAH,
+			"", false, 0, false, true, LightSelection::POWER, sequence), size, 2);
+		size_t differing = 0;
+		for (size_t i = 0; i < megakernel.size(); i++)
+			if (megakernel[i] != wavefront[i])
+				differing++;
+
+		// printed at the end, apart from what the renderers print
+		char line[256];
+		snprintf(line, sizeof(line), "  %-10s RMSE       %.4f %.4f %.4f %.4f   N^%+.2f\n"
+			"  %-10s 4x4 blocks %.4f %.4f %.4f %.4f   %.1fx to %.1fx less\n"
+			"  %-10s wavefront: %zu pixels differ from megakernel\n", sequenceName(sequence), rmse[0], rmse[1],
+			rmse[2], rmse[3], convergenceRate(samples, rmse), "", blocks[0], blocks[1], blocks[2], blocks[3],
+			rmse[0] / blocks[0], rmse[3] / blocks[3], "", differing);
+		lines.push_back(line);
+	}
+	printf("  spp: 4, 16, 64, 256\n");
+	for (const std::string& line : lines)
+		printf("%s", line.c_str());
+	delete model;
+}
+
+void runSamplerBenchmark() {
+	std::cout << "Sampler benchmark: estimates at " << samplerPixels << "x" << samplerPixels
+		<< " pixels, errors relative to the integral\n";
+	benchmarkIntegrands(SampleSequence::RANDOM);
+	benchmarkIntegrands(SampleSequence::SOBOL);
+	benchmarkIntegrands(SampleSequence::BLUE_NOISE);
+	const Camera camera = { glm::vec3(0.f, 2.5f, 4.f), glm::vec3(0.f, 0.3f, 0.f), glm::vec3(0.f, 1.f, 0.f) };
+	benchmarkSequenceRenders("soft shadows", makeSoftShadows(), camera);
+}
+
+//------------------------------------------------------------------------------
+// asset reads
+//------------------------------------------------------------------------------
+
+/*! writes 'count' files of incompressible bytes into 'directory',
+	sized like textures: 32 KB to 4 MB, evenly spread on a log scale.
+	Returns their paths, or nothing if one could not be written */
+static std::vector<std::string> writeTestFiles(const std::string& directory, int count) {
+	std::vector<std::string> paths;
+	for (int i = 0; i < count; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "/bench-io-%03d.bin", i);
+		const std::string path = directory + name;
+		const size_t size = size_t(32768.0 * std::pow(128.0, hashFloat(uint32_t(i))));
+		std::vector<uint32_t> words((size + 3) / 4);
+		for (size_t w = 0; w < words.size(); w++)
+			words[w] = hashIndex(uint32_t(w) ^ (uint32_t(i) << 24));
+		std::ofstream file(path, std::ios::binary);
+		file.write((const char*)words.data(), size);
+		paths.push_back(path);
+		if (!file) {
+			for (auto& written : paths)
+				std::remove(written.c_str());
+			return std::vector<std::string>();
+		}
+	}
+	return paths;
+}
+
+void runIoBenchmark(const std::string& directory) {
+	const int numFiles = 128;
+	const std::vector<std::string> paths = writeTestFiles(directory, numFiles);
+	if (paths.empty()) {
+		std::cout << TERMINAL_RED << "Could not write test files to " << directory << "\n" << TERMINAL_DEFAULT;
+		return;
+	}
+	size_t numBytes = 0;
+	for (const FileData& file : readFiles(paths))
+		numBytes += file.bytes.size();
+
+	struct Method {
+		const char* name;
+		ReadMethod method;
+	};
+	const Method methods[] = {
+		{ "sequential", ReadMethod::SEQUENTIAL },
+		{ "threads", ReadMethod::THREADS },
+		{ "io_uring", ReadMethod::IO_URING },
+	};
+	const bool canDrop = dropCachedFiles(paths);
+
+	// best of a few loads of the whole directory, each first dropped
+	// from the page cache for a cold load
+	std::vector<std::string> lines;
+	for (int cold = canDrop ? 1 : 0; cold >= 0; cold--)
+		for (const Method& m : methods) {
+			double best = 1e30;
+			bool ok = true;
+			for (int run = 0; run < 3; run++) {
+				if (cold)
+					dropCachedFiles(paths);
+				auto start = std::chrono::steady_clock::now();
+				const std::vector<FileData> files = readFiles(paths, m.method);
+				best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+				for (const FileData& file : files)
+					ok = ok && file.ok;
+			}
+			char line[256];
+			snprintf(line, sizeof(line), "  %-4s  %-10s  %8.2f ms  %7.0f MB/s%s\n", cold ? "cold" : "warm", m.name,
+				best, numBytes / (1024.0 * 1024.0) / (best * 1e-3), ok ? "" : "   some reads FAILED");
+			lines.push_back(line);
+		}
+	for (auto& path : paths)
+		std::remove(path.c_str());
+
+	// printed at the end, apart from what readFiles prints
+	std::cout << "Asset reads: " << numFiles << " files, " << numBytes / (1024.0 * 1024.0) << " MB in " << directory
+		<< ", " << numHostThreads() << " threads\n";
+	if (!canDrop)
+		std::cout << "  the page cache cannot be dropped here, only warm loads are timed\n";
+	for (const std::string& line : lines)
+		printf("%s", line.c_str());
+}
+
+//------------------------------------------------------------------------------
+// device memory plans
+//------------------------------------------------------------------------------
+
+// what cudaMalloc hands out for 'bytes', as MemoryPlanner counts it
+static size_t granules(size_t bytes) {
+	return (bytes + 511) / 512 * 512;
+}
+
+/*! the spheres scene with shading normals and texcoords on both
+	meshes, the ground textured with the first of four 4k textures that
+	have a resolution but no pixels (the planner only looks at sizes).
+	They outweigh the accel build, so the peak is when rendering */
+static Model* makePlannerModel() {
+	Model* model = makeSpheres();
+	for (auto mesh : model->meshes) {
+		for (auto& v : mesh->vertex) {
+			mesh->normal.push_back(glm::normalize(v - model->boundsCenter));
+			mesh->texcoord.push_back(glm::vec2(v.x, v.z));
+		}
+	}
+	model->meshes[0]->diffuseTextureID = 0;
+	for (int i = 0; i < 4; i++) {
+		Texture* texture = new Texture;
+		texture->resolution = glm::ivec2(4096);
+		model->textures.push_back(texture);
+	}
+	return model;
+}
+
+static bool checkPlan(const char* name, bool passed) {
+	printf("  %-52s %s\n", name, passed ? "ok" : "FAILED");
+	return passed;
+}
+
+static bool anyDownscaled(const MemoryPlan& plan) {
+	for (int steps : plan.textureDownscale)
+		if (steps > 0)
+			return true;
+	return false;
+}
+
+void runMemoryBenchmark() {
+	std::cout << "Device memory plan checks:\n";
+	Model* model = makePlannerModel();
+	EnvironmentMap* sky = makeSky(512, 256);
+	buildSamplingTables(*sky);
+	const glm::ivec2 noFramebuffer(0);
+	const glm::ivec2 fullHd(1920, 1080);
+	int failed = 0;
+
+	// budgets just below what each set of mitigations needs
+	const MemoryPlan generous = planDeviceMemory(model, nullptr, noFramebuffer, size_t(1) << 40);
+	if (!checkPlan("generous budget, no mitigations", generous.fits && !generous.dropUnusedTexcoords
+		&& !anyDownscaled(generous) && !generous.dropShadingNormals))
+		failed++;
+	const MemoryPlan texcoords = planDeviceMemory(model, nullptr, noFramebuffer, generous.peakBytes - 1);
+	if (!checkPlan("slightly less, unused texcoords dropped", texcoords.fits && texcoords.dropUnusedTexcoords
+		&& !anyDownscaled(texcoords) && !texcoords.dropShadingNormals
+		&& texcoords.uploadTexcoords(*model->meshes[0]) && !texcoords.uploadTexcoords(*model->meshes[1])))
+		failed++;
+	const MemoryPlan downscaled = planDeviceMemory(model, nullptr, noFramebuffer, texcoords.peakBytes - 1);
+	if (!checkPlan("less still, textures downscaled", downscaled.fits && anyDownscaled(downscaled)
+		&& !downscaled.dropShadingNormals && downscaled.textureResolution(model, 0).x < 4096))
+		failed++;
+	const MemoryPlan impossible = planDeviceMemory(model, nullptr, noFramebuffer, 1);
+	if (!checkPlan("one byte, does not fit with everything dropped", !impossible.fits
+		&& impossible.dropUnusedTexcoords && impossible.dropShadingNormals
+		&& impossible.textureResolution(model, 0) == glm::ivec2(256)))
+		failed++;
+	const MemoryPlan normals = planDeviceMemory(model, nullptr, noFramebuffer, impossible.peakBytes);
+	if (!checkPlan("just enough with everything dropped, normals dropped", normals.fits
+		&& normals.dropShadingNormals && !normals.uploadNormals(*model->meshes[1])))
+		failed++;
+
+	// the environment map and framebuffers count in full
+	const MemoryPlan lit = planDeviceMemory(model, sky, noFramebuffer, size_t(1) << 40);
+	const size_t skyBytes = granules(sky->pixel.size() * sizeof(glm::vec3))
+		+ granules(sky->conditionalCdf.size() * sizeof(float)) + granules(sky->marginalCdf.size() * sizeof(float));
+	if (!checkPlan("environment map pixels and CDFs", lit.environmentBytes == skyBytes
+		&& lit.peakBytes == generous.peakBytes + skyBytes))
+		failed++;
+	const MemoryPlan framed = planDeviceMemory(model, nullptr, fullHd, size_t(1) << 40);
+	const size_t framebufferBytes = granules(size_t(fullHd.x) * fullHd.y * sizeof(uint32_t))
+		+ granules(size_t(fullHd.x) * fullHd.y * sizeof(glm::vec3));
+	if (!checkPlan("1920x1080 color and accumulation buffers", framed.framebufferBytes == framebufferBytes
+		&& framed.peakBytes == generous.peakBytes + framebufferBytes))
+		failed++;
+	// a window opening (or growing) on a tight budget
+	const MemoryPlan resized = planDeviceMemory(model, nullptr, fullHd, generous.peakBytes);
+	if (!checkPlan("framebuffers on a full budget, mitigated", resized.fits && resized.dropUnusedTexcoords))
+		failed++;
+
+	// a build that needed twice the default compacted size
+	size_t numTriangles = 0;
+	for (auto mesh : model->meshes)
+		numTriangles += mesh->index.size();
+	const AccelSizeModel defaults;
+	AccelSizeModel calibrated;
+	calibrated.calibrate(numTriangles, size_t(numTriangles * defaults.outputBytesPerTriangle),
+		size_t(numTriangles * defaults.tempBytesPerTriangle),
+		size_t(2.0 * numTriangles * defaults.compactedBytesPerTriangle));
+	const MemoryPlan recalibrated = planDeviceMemory(model, nullptr, noFramebuffer, generous.peakBytes, calibrated);
+	if (!checkPlan("calibrated accel size, re-planned with mitigations",
+		recalibrated.accelBytes == granules(size_t(2.0 * numTriangles * defaults.compactedBytesPerTriangle))
+		&& recalibrated.dropUnusedTexcoords))
+		failed++;
+
+	// 2x2 blocks are averaged per channel, rounding to nearest
+	const uint32_t pixels[8] = { 0x00000000u, 0x04040404u, 0x08080808u, 0x0c0c0c0cu,
+		0x02020202u, 0x06060606u, 0x0a0a0a0au, 0x0e0e0e0eu };
+	glm::ivec2 halvedRes;
+	const std::vector<uint32_t> halved = halveTexture(pixels, glm::ivec2(4, 2), halvedRes);
+	if (!checkPlan("halveTexture of 4x2 pixels", halvedRes == glm::ivec2(2, 1)
+		&& halved[0] == 0x03030303u && halved[1] == 0x0b0b0b0bu))
+		failed++;
+	delete sky;
+	delete model;
+
+	// the worst case, every mitigation tried, on a large model
+	Model* soup = makeSoup();
+	for (int i = 0; i < 1000; i++) {
+		Texture* texture = new Texture;
+		texture->resolution = glm::ivec2(1024);
+		soup->textures.push_back(texture);
+	}
+	auto start = std::chrono::steady_clock::now();
+	planDeviceMemory(soup, nullptr, fullHd, 1);
+	printf("  planning %zu triangles and %zu textures, all mitigations: %.2f ms\n", soup->meshes[0]->index.size(),
+		soup->textures.size(), std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	delete soup;
+
+	if (failed > 0)
+		std::cout << TERMINAL_RED << failed << " device memory plan checks failed\n" << TERMINAL_DEFAULT;
+	else
+		std::cout << TERMINAL_GREEN << "all device memory plan checks passed\n" << TERMINAL_DEFAULT;
+}
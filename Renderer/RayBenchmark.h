@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+
+/*! builds the host acceleration structures over a few generated scenes
+	and prints their build times and ray throughput, for primary rays
+	and for diffuse bounce rays off the primary hits, traced one by one
+	(also with quantized BVH8 nodes) and in packets; then compares SAH
+	and SBVH trees on a scene of long wall triangles, trees before and
+	after treelet optimization, closest hit against occlusion queries
+	for shadow rays, bounce rays unsorted and binned by RaySorter, and
+	a two-level structure over 10k instances of a mesh against
+	flattening them. Run with --bench;
+	needs neither a GPU nor a window */
+void runRayBenchmark();
+
+/*! times the SAH, SBVH, LBVH and PLOC builders on generated scenes of 1M,
+	10M, ... triangles up to maxMillions, and prints the SAH cost of
+	their trees. Run with --bench-build [maxMillions] */
+void runBuildBenchmark(int maxMillions);
+
+/*! per frame latency of refitting (or, once their quality has degraded,
+	rebuilding) the host BVHs of deforming meshes and moving instances.
+	Run with --bench-refit */
+void runRefitBenchmark();
+
+/*! startup time of the CPU backend on large generated scenes: building
+	the BVHs and saving them to a BvhCache, against mapping them from
+	there, and the first frame of rays after each. Run with --bench-cache */
+void runCacheBenchmark();
+
+/*! samples per second of the CPU backend's megakernel style integrator
+	against the wavefront one (see WavefrontRenderer), without and with
+	ray sorting, rendering generated scenes with diffuse, metal and
+	glass materials; then the noise at equal time without next event
+	estimation, with it picking lights by power and from a light BVH,
+	and with reservoir resampling, in a Cornell box and a garage with
+	many lights. Run with --bench-integrator */
+void runIntegratorBenchmark();
+
+/*! checks the sampling of Bsdf against its eval and pdf, for a few
+	outgoing directions each of diffuse, glossy and dielectric ones: a
+	chi-square test of the sampled directions, the directional albedo
+	of white surfaces (at most 1, or energy is created), the Fresnel
+	fraction and Snell's law of dielectrics; and the time per sample.
+	Prints which pass. Run with --bench-bsdf */
+void runBsdfBenchmark();
+
+/*! checks the importance sampling of EnvironmentMap against its pdf:
+	a chi-square test of the sampled directions for a uniform map and
+	for skies with a small bright sun, and the time per sample; then
+	times buildSamplingTables at 1k to 8k wide maps. Prints which pass.
+	Run with --bench-env */
+void runEnvironmentBenchmark();
+
+/*! convergence of the SampleSequences: the error of estimates of
+	analytic integrals (smooth, discontinuous, and over four dimensions)
+	against the number of samples, with its fitted order, per pixel and
+	over 4x4 pixel blocks; then the same for renders of soft shadows
+	from an area light. Run with --bench-sampler */
+void runSamplerBenchmark();
+
+/*! time to load a directory of texture sized files with readFiles(),
+	through io_uring, the pread thread pool and one file after the
+	other, from a cold page cache (where it can be dropped) and a warm
+	one. The files are written to 'directory' first, so that storage
+	can be put to the test, and removed afterwards. Run with
+	--bench-io [directory] */
+void runIoBenchmark(const std::string& directory);
+
+/*! checks the device memory planner on a generated model with
+	textures: that tighter budgets switch on the mitigations in order,
+	that the environment map, framebuffers and a calibrated accel size
+	are counted, and that halveTexture averages; then times planning a
+	large model. Needs no GPU. Run with --bench-memory */
+void runMemoryBenchmark();
@@ -0,0 +1,423 @@
+#include "RayPacket.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+static inline int popCount(uint32_t mask) {
+	int count = 0;
+	for (; mask; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+// inner nodes entered by at most this many rays of a packet are
+// finished ray by ray, where the packet overhead no longer pays off
+static const int singleRayThreshold = 2;
+
+void RayPacket::set(int i, const Ray& ray) {
+	originX[i] = ray.origin.x;
+	originY[i] = ray.origin.y;
+	originZ[i] = ray.origin.z;
+	directionX[i] = ray.direction.x;
+	directionY[i] = ray.direction.y;
+	directionZ[i] = ray.direction.z;
+	tmin[i] = ray.tmin;
+	tmax[i] = ray.tmax;
+}
+
+Ray RayPacket::get(int i) const {
+	Ray ray;
+	ray.origin = glm::vec3(originX[i], originY[i], originZ[i]);
+	ray.direction = glm::vec3(directionX[i], directionY[i], directionZ[i]);
+	ray.tmin = tmin[i];
+	ray.tmax = tmax[i];
+	return ray;
+}
+
+void HitPacket::set(int i, const Hit& hit) {
+	t[i] = hit.t;
+	u[i] = hit.barycentrics.x;
+	v[i] = hit.barycentrics.y;
+	meshID[i] = hit.meshID;
+	primID[i] = hit.primID;
+	normalX[i] = hit.normal.x;
+	normalY[i] = hit.normal.y;
+	normalZ[i] = hit.normal.z;
+}
+
+Hit HitPacket::get(int i) const {
+	Hit hit;
+	hit.t = t[i];
+	hit.meshID = meshID[i];
+	hit.primID = primID[i];
+	hit.barycentrics = glm::vec2(u[i], v[i]);
+	hit.normal = glm::vec3(normalX[i], normalY[i], normalZ[i]);
+	return hit;
+}
+
+static uint32_t traceSingleRays(const Bvh8& bvh8, const RayPacket& packet, uint32_t mask, HitPacket& hits) {
+	uint32_t hitMask = 0;
+	for (; mask; mask &= mask - 1) {
+		const int i = firstBit(mask);
+		Hit hit;
+		if (bvh8.closestHit(packet.get(i), hit)) {
+			hits.set(i, hit);
+			hitMask |= 1u << i;
+		}
+	}
+	return hitMask;
+}
+
+static uint32_t occludedSingleRays(const Bvh8& bvh8, const RayPacket& packet, uint32_t mask) {
+	uint32_t occludedMask = 0;
+	for (; mask; mask &= mask - 1) {
+		const int i = firstBit(mask);
+		if (bvh8.occluded(packet.get(i)))
+			occludedMask |= 1u << i;
+	}
+	return occludedMask;
+}
+
+#ifdef SIMD_FLOAT
+
+struct Interval {
+	float lo, hi;
+};
+
+//! range of (plane - o) * inv over o in 'origin' and inv in 'invDir'
+static inline Interval planeDistance(float plane, const Interval& origin, const Interval& invDir) {
+	const float a = (plane - origin.lo) * invDir.lo, b = (plane - origin.lo) * invDir.hi;
+	const float c = (plane - origin.hi) * invDir.lo, d = (plane - origin.hi) * invDir.hi;
+	return { std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d)) };
+}
+
+namespace {
+	/*! per packet constants: per ray inverse directions, and the
+		intervals over all active rays used to cull whole nodes */
+	struct PacketTraversal {
+		alignas(32) float invX[packetSize], invY[packetSize], invZ[packetSize];
+		alignas(32) float originInvX[packetSize], originInvY[packetSize], originInvZ[packetSize];
+		Interval origin[3], invDir[3];
+		//! interval arithmetic is skipped if some direction component is 0
+		bool intervalsUsable;
+		//! all rays share direction signs; true for the near planes below
+		bool negative[3];
+		float tmin;
+	};
+}
+
+/*! per ray inverse directions, and the intervals over the rays in
+	'active'. Returns false if the rays do not share direction signs,
+	which the packet traversal relies on */
+static bool setupTraversal(const RayPacket& packet, uint32_t active, PacketTraversal& traversal) {
+	const int firstRay = firstBit(active);
+	for (int i = 0; i < packetSize; i++) {
+		traversal.invX[i] = 1.f / packet.directionX[i];
+		traversal.invY[i] = 1.f / packet.directionY[i];
+		traversal.invZ[i] = 1.f / packet.directionZ[i];
+		traversal.originInvX[i] = packet.originX[i] * traversal.invX[i];
+		traversal.originInvY[i] = packet.originY[i] * traversal.invY[i];
+		traversal.originInvZ[i] = packet.originZ[i] * traversal.invZ[i];
+	}
+	const float* inv[3] = { traversal.invX, traversal.invY, traversal.invZ };
+	const float* org[3] = { packet.originX, packet.originY, packet.originZ };
+	traversal.intervalsUsable = true;
+	traversal.tmin = packet.tmin[firstRay];
+	for (int axis = 0; axis < 3; axis++) {
+		traversal.negative[axis] = inv[axis][firstRay] < 0.f;
+		traversal.origin[axis] = { org[axis][firstRay], org[axis][firstRay] };
+		traversal.invDir[axis] = { inv[axis][firstRay], inv[axis][firstRay] };
+	}
+	for (uint32_t mask = active; mask; mask &= mask - 1) {
+		const int i = firstBit(mask);
+		for (int axis = 0; axis < 3; axis++) {
+			if ((inv[axis][i] < 0.f) != traversal.negative[axis])
+				return false;
+			traversal.origin[axis].lo = std::min(traversal.origin[axis].lo, org[axis][i]);
+			traversal.origin[axis].hi = std::max(traversal.origin[axis].hi, org[axis][i]);
+			traversal.invDir[axis].lo = std::min(traversal.invDir[axis].lo, inv[axis][i]);
+			traversal.invDir[axis].hi = std::max(traversal.invDir[axis].hi, inv[axis][i]);
+			if (!std::isfinite(inv[axis][i]))
+				traversal.intervalsUsable = false;
+		}
+		traversal.tmin = std::min(traversal.tmin, packet.tmin[i]);
+	}
+	return true;
+}
+
+/*! conservative: false only if no ray of the packet can hit the box
+	in [traversal.tmin, tmax] */
+static inline bool intervalHit(const BvhNode& node, const PacketTraversal& traversal, float tmax) {
+	if (!traversal.intervalsUsable)
+		return true;
+	float entry = traversal.tmin, exit = tmax;
+	for (int axis = 0; axis < 3; axis++) {
+		const float nearPlane = traversal.negative[axis] ? node.upper[axis] : node.lower[axis];
+		const float farPlane = traversal.negative[axis] ? node.lower[axis] : node.upper[axis];
+		entry = std::max(entry, planeDistance(nearPlane, traversal.origin[axis], traversal.invDir[axis]).lo);
+		exit = std::min(exit, planeDistance(farPlane, traversal.origin[axis], traversal.invDir[axis]).hi);
+	}
+	return entry <= exit;
+}
+
+/*! slab test of each ray in 'mask' against the node's box, up to the
+	ray's tmax in 'rayTmax': its closest hit so far, or its end */
+static inline uint32_t boxTestRays(const BvhNode& node, const PacketTraversal& traversal,
+								   const RayPacket& packet, const float* rayTmax, uint32_t mask) {
+	const float nearX = traversal.negative[0] ? node.upper.x : node.lower.x;
+	const float nearY = traversal.negative[1] ? node.upper.y : node.lower.y;
+	const float nearZ = traversal.negative[2] ? node.upper.z : node.lower.z;
+	const float farX = traversal.negative[0] ? node.lower.x : node.upper.x;
+	const float farY = traversal.negative[1] ? node.lower.y : node.upper.y;
+	const float farZ = traversal.negative[2] ? node.lower.z : node.upper.z;
+
+	uint32_t result = 0;
+	for (int first = 0; first < packetSize; first += simdWidth) {
+		const uint32_t lanes = (mask >> first) & ((1u << simdWidth) - 1);
+		if (!lanes)
+			continue;
+		const vfloat invX = vload(traversal.invX + first), invY = vload(traversal.invY + first), invZ = vload(traversal.invZ + first);
+		const vfloat oX = vload(traversal.originInvX + first), oY = vload(traversal.originInvY + first), oZ = vload(traversal.originInvZ + first);
+		const vfloat tnear = vmax(vsub(vmul(vset(nearX), invX), oX),
+								  vmax(vsub(vmul(vset(nearY), invY), oY),
+									   vmax(vsub(vmul(vset(nearZ), invZ), oZ), vload(packet.tmin + first))));
+		const vfloat tfar = vmin(vsub(vmul(vset(farX), invX), oX),
+								 vmin(vsub(vmul(vset(farY), invY), oY),
+									  vmin(vsub(vmul(vset(farZ), invZ), oZ), vload(rayTmax + first))));
+		result |= (vmovemask(vle(tnear, tfar)) & lanes) << first;
+	}
+	return result;
+}
+
+/*! Moeller-Trumbore of one triangle against the rays in 'mask', in
+	the undivided, sign folded form of Bvh8's triangleBlockMask (with
+	s = o - A, R = cross(s, d) and N = cross(e1, e2): det = -dot(d, N),
+	u * det = dot(e2, R), v * det = -dot(e1, R), t * det = dot(s, N)),
+	so that packets and single rays agree on hits along shared edges.
+	Acceptance matches Bvh::intersectTriangle, up to each ray's tmax in
+	'rayTmax'. Hits are written to 'hits' if it is not null, which is
+	then where rayTmax points; returns the rays hit */
+static inline uint32_t triangleTestRays(const Bvh& bvh, const Model* model, uint32_t primIndex,
+										const RayPacket& packet, const float* rayTmax, HitPacket* hits, uint32_t mask) {
+	const PrimRef prim = bvh.prims[primIndex];
+	const TriangleMesh& mesh = *model->meshes[prim.meshID];
+	const glm::ivec3 index = mesh.index[prim.primID];
+	const glm::vec3 A = mesh.vertex[index.x];
+	const glm::vec3 E1 = mesh.vertex[index.y] - A;
+	const glm::vec3 E2 = mesh.vertex[index.z] - A;
+	const glm::vec3 N = glm::cross(E1, E2);
+	const vfloat ax = vset(A.x), ay = vset(A.y), az = vset(A.z);
+	const vfloat e1x = vset(E1.x), e1y = vset(E1.y), e1z = vset(E1.z);
+	const vfloat e2x = vset(E2.x), e2y = vset(E2.y), e2z = vset(E2.z);
+	const vfloat nx = vset(N.x), ny = vset(N.y), nz = vset(N.z);
+	const vfloat signBit = vset(-0.f);
+	const vfloat zero = vset(0.f);
+
+	uint32_t hitMask = 0;
+	for (int first = 0; first < packetSize; first += simdWidth) {
+		const uint32_t lanes = (mask >> first) & ((1u << simdWidth) - 1);
+		if (!lanes)
+			continue;
+		const vfloat dx = vload(packet.directionX + first), dy = vload(packet.directionY + first), dz = vload(packet.directionZ + first);
+		const vfloat sx = vsub(vload(packet.originX + first), ax);
+		const vfloat sy = vsub(vload(packet.originY + first), ay);
+		const vfloat sz = vsub(vload(packet.originZ + first), az);
+
+		const vfloat det = vsub(zero, vadd(vmul(dx, nx), vadd(vmul(dy, ny), vmul(dz, nz))));
+		const vfloat sign = vand(det, signBit);
+		const vfloat absDet = vxor(det, sign);
+
+		const vfloat rx = vsub(vmul(sy, dz), vmul(sz, dy));
+		const vfloat ry = vsub(vmul(sz, dx), vmul(sx, dz));
+		const vfloat rz = vsub(vmul(sx, dy), vmul(sy, dx));
+		const vfloat u = vxor(vadd(vmul(e2x, rx), vadd(vmul(e2y, ry), vmul(e2z, rz))), sign);
+		const vfloat v = vxor(vsub(zero, vadd(vmul(e1x, rx), vadd(vmul(e1y, ry), vmul(e1z, rz)))), sign);
+		const vfloat t = vxor(vadd(vmul(sx, nx), vadd(vmul(sy, ny), vmul(sz, nz))), sign);
+
+		const vfloat tmin = vload(packet.tmin + first);
+		const vfloat tOld = vload(rayTmax + first);
+		vfloat accept = vand(vneq(det, zero), vand(vle(zero, u), vle(zero, v)));
+		accept = vand(accept, vle(vadd(u, v), absDet));
+		accept = vand(accept, vand(vlt(vmul(absDet, tmin), t), vlt(t, vmul(absDet, tOld))));
+		accept = vand(accept, vmaskFromBits(lanes));
+		if (!vmovemask(accept))
+			continue;
+
+		// only lanes that passed pay for the division; as for single
+		// rays, the divided t must still lie inside the interval
+		const vfloat hitT = vdiv(t, absDet);
+		accept = vand(accept, vand(vlt(tmin, hitT), vlt(hitT, tOld)));
+		const uint32_t accepted = vmovemask(accept);
+		hitMask |= accepted << first;
+		if (!accepted || !hits)
+			continue;
+		const vfloat invDet = vdiv(vset(1.f), absDet);
+		vstore(hits->t + first, vselect(accept, hitT, tOld));
+		vstore(hits->u + first, vselect(accept, vmul(u, invDet), vload(hits->u + first)));
+		vstore(hits->v + first, vselect(accept, vmul(v, invDet), vload(hits->v + first)));
+		vstore((float*)hits->meshID + first, vselect(accept, vset(prim.meshID), vload((const float*)hits->meshID + first)));
+		vstore((float*)hits->primID + first, vselect(accept, vset(prim.primID), vload((const float*)hits->primID + first)));
+		vstore(hits->normalX + first, vselect(accept, vset(N.x), vload(hits->normalX + first)));
+		vstore(hits->normalY + first, vselect(accept, vset(N.y), vload(hits->normalY + first)));
+		vstore(hits->normalZ + first, vselect(accept, vset(N.z), vload(hits->normalZ + first)));
+	}
+	return hitMask;
+}
+
+#endif
+
+uint32_t closestHitPacket(const Bvh& bvh, const Bvh8& bvh8, const RayPacket& packet, HitPacket& hits,
+						  PacketStats* stats) {
+	const uint32_t active = packet.activeMask;
+	for (int i = 0; i < packetSize; i++) {
+		hits.t[i] = (active >> i) & 1 ? packet.tmax[i] : -1.f;
+		hits.u[i] = hits.v[i] = 0.f;
+		hits.normalX[i] = hits.normalY[i] = hits.normalZ[i] = 0.f;
+		hits.meshID[i] = -1;
+		hits.primID[i] = -1;
+	}
+	if (stats)
+		stats->packets++;
+	if (!active)
+		return 0;
+
+#ifndef SIMD_FLOAT
+	return traceSingleRays(bvh8, packet, active, hits);
+#else
+	PacketTraversal traversal;
+	if (!setupTraversal(packet, active, traversal)) {
+		if (stats)
+			stats->incoherentPackets++;
+		return traceSingleRays(bvh8, packet, active, hits);
+	}
+	const int firstRay = firstBit(active);
+
+	// the farthest any active ray still has to look
+	auto packetTmax = [&]() {
+		float tmax = -1.f;
+		for (uint32_t mask = active; mask; mask &= mask - 1)
+			tmax = std::max(tmax, hits.t[firstBit(mask)]);
+		return tmax;
+	};
+	float tmax = packetTmax();
+
+	// ------------------------------------------------------------------
+	// depth first traversal, children in the packet's direction order
+	// ------------------------------------------------------------------
+	const glm::vec3 packetDirection(packet.directionX[firstRay], packet.directionY[firstRay], packet.directionZ[firstRay]);
+	uint32_t stack[128];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const uint32_t nodeID = stack[--stackSize];
+		const BvhNode& node = bvh.nodes[nodeID];
+		if (!intervalHit(node, traversal, tmax))
+			continue;
+		const uint32_t mask = boxTestRays(node, traversal, packet, hits.t, active);
+		if (!mask)
+			continue;
+
+		if (node.isLeaf()) {
+			for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+				triangleTestRays(bvh, bvh.builtModel(), i, packet, hits.t, &hits, mask);
+			tmax = packetTmax();
+			continue;
+		}
+
+		if (popCount(mask) <= singleRayThreshold) {
+			for (uint32_t rays = mask; rays; rays &= rays - 1) {
+				const int i = firstBit(rays);
+				Ray ray = packet.get(i);
+				ray.tmax = hits.t[i];
+				Hit hit;
+				if (bvh.closestHit(ray, hit, nodeID)) {
+					hits.set(i, hit);
+				}
+			}
+			if (stats)
+				stats->singleRayFallbacks += popCount(mask);
+			tmax = packetTmax();
+			continue;
+		}
+
+		const BvhNode& left = bvh.nodes[node.offset];
+		const BvhNode& right = bvh.nodes[node.offset + 1];
+		const glm::vec3 centerDelta = (right.lower + right.upper) - (left.lower + left.upper);
+		const bool rightFirst = glm::dot(packetDirection, centerDelta) < 0.f;
+		stack[stackSize++] = rightFirst ? node.offset : node.offset + 1;
+		stack[stackSize++] = rightFirst ? node.offset + 1 : node.offset;
+	}
+
+	uint32_t hitMask = 0;
+	for (uint32_t mask = active; mask; mask &= mask - 1) {
+		const int i = firstBit(mask);
+		if (hits.meshID[i] >= 0)
+			hitMask |= 1u << i;
+	}
+	return hitMask;
+#endif
+}
+
+uint32_t occludedPacket(const Bvh& bvh, const Bvh8& bvh8, const RayPacket& packet, PacketStats* stats) {
+	const uint32_t active = packet.activeMask;
+	if (stats)
+		stats->packets++;
+	if (!active)
+		return 0;
+
+#ifndef SIMD_FLOAT
+	return occludedSingleRays(bvh8, packet, active);
+#else
+	PacketTraversal traversal;
+	if (!setupTraversal(packet, active, traversal)) {
+		if (stats)
+			stats->incoherentPackets++;
+		return occludedSingleRays(bvh8, packet, active);
+	}
+	float tmax = -1.f;
+	for (uint32_t mask = active; mask; mask &= mask - 1)
+		tmax = std::max(tmax, packet.tmax[firstBit(mask)]);
+
+	// no ordering: rays leave the packet at their first hit, and the
+	// traversal ends when none are left
+	uint32_t remaining = active;
+	uint32_t stack[128];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0 && remaining) {
+		const uint32_t nodeID = stack[--stackSize];
+		const BvhNode& node = bvh.nodes[nodeID];
+		if (!intervalHit(node, traversal, tmax))
+			continue;
+		uint32_t mask = boxTestRays(node, traversal, packet, packet.tmax, remaining);
+		if (!mask)
+			continue;
+
+		if (node.isLeaf()) {
+			for (uint32_t i = node.offset; i < node.offset + node.count && mask; i++) {
+				const uint32_t hitMask = triangleTestRays(bvh, bvh.builtModel(), i, packet, packet.tmax, nullptr, mask);
+				mask &= ~hitMask;
+				remaining &= ~hitMask;
+			}
+			continue;
+		}
+
+		if (popCount(mask) <= singleRayThreshold) {
+			for (uint32_t rays = mask; rays; rays &= rays - 1) {
+				const int i = firstBit(rays);
+				Hit hit;
+				if (bvh.anyHit(packet.get(i), hit, nodeID))
+					remaining &= ~(1u << i);
+			}
+			if (stats)
+				stats->singleRayFallbacks += popCount(mask);
+			continue;
+		}
+
+		stack[stackSize++] = node.offset + 1;
+		stack[stackSize++] = node.offset;
+	}
+	return active & ~remaining;
+#endif
+}
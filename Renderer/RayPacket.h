@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Bvh.h"
+#include "Bvh8.h"
+
+//! rays per packet; the renderer fills one packet per 4x4 pixel tile
+static const int packetSize = 16;
+
+/*! a packet of rays stored by component, for SIMD traversal. Only
+	rays whose bit is set in activeMask are traced */
+struct alignas(32) RayPacket {
+	float originX[packetSize], originY[packetSize], originZ[packetSize];
+	float directionX[packetSize], directionY[packetSize], directionZ[packetSize];
+	float tmin[packetSize], tmax[packetSize];
+	uint32_t activeMask{ 0 };
+
+	void set(int i, const Ray& ray);
+	Ray get(int i) const;
+};
+
+/*! closest hits of a packet, one lane per ray; meshID is -1 where a
+	ray hit nothing */
+struct alignas(32) HitPacket {
+	float t[packetSize];
+	float u[packetSize], v[packetSize];
+	int meshID[packetSize];
+	int primID[packetSize];
+	float normalX[packetSize], normalY[packetSize], normalZ[packetSize];
+
+	void set(int i, const Hit& hit);
+	Hit get(int i) const;
+};
+
+/*! what closestHitPacket() or occludedPacket() did, summed up over calls by the caller */
+struct PacketStats {
+	size_t packets{ 0 };
+	//! packets whose rays did not share direction signs
+	size_t incoherentPackets{ 0 };
+	//! (ray, subtree) pairs finished by single ray traversal
+	size_t singleRayFallbacks{ 0 };
+};
+
+/*! traces a packet of coherent rays (e.g. primary rays of a pixel tile)
+	through the binary BVH together. Nodes are first culled for the
+	whole packet with interval arithmetic over the rays' origins and
+	inverse directions, then box tested per ray, 8 (AVX2) or 4 (SSE)
+	rays per instruction; triangles are tested the same way. Packets
+	whose direction signs disagree are traced ray by ray through bvh8,
+	and subtrees that at most a couple of rays enter are finished with
+	single ray traversal. Returns the mask of rays that hit something */
+uint32_t closestHitPacket(const Bvh& bvh, const Bvh8& bvh8, const RayPacket& packet, HitPacket& hits,
+						  PacketStats* stats = nullptr);
+
+/*! occlusion test of a packet of coherent shadow rays (e.g. from the
+	hits of a pixel tile towards a light), traversed like
+	closestHitPacket() but in any order: each ray leaves the packet at
+	the first triangle it hits, and no hit attributes are computed.
+	Packets whose direction signs disagree go ray by ray through
+	Bvh8::occluded. Returns the mask of rays that are blocked in
+	(tmin, tmax) */
+uint32_t occludedPacket(const Bvh& bvh, const Bvh8& bvh8, const RayPacket& packet, PacketStats* stats = nullptr);
@@ -0,0 +1,43 @@
+#include "RaySorter.h"
+
+#include <algorithm>
+
+RaySorter::RaySorter(const glm::vec3& lower, const glm::vec3& upper) : lower(lower) {
+	scale = 128.f / glm::max(upper - lower, glm::vec3(1e-20f));
+}
+
+void RaySorter::sort(std::vector<uint32_t>& keys, std::vector<uint32_t>& items) {
+	const size_t n = keys.size();
+	keysOut.resize(n);
+	itemsOut.resize(n);
+
+	// the histograms of all four digits in one pass over the keys
+	uint32_t counts[4][256] = {};
+	for (size_t i = 0; i < n; i++) {
+		const uint32_t key = keys[i];
+		counts[0][key & 0xff]++;
+		counts[1][(key >> 8) & 0xff]++;
+		counts[2][(key >> 16) & 0xff]++;
+		counts[3][key >> 24]++;
+	}
+
+	for (int pass = 0; pass < 4; pass++) {
+		const int shift = 8 * pass;
+		uint32_t* offset = counts[pass];
+		if (n == 0 || offset[(keys[0] >> shift) & 0xff] == n)
+			continue;
+		uint32_t sum = 0;
+		for (int digit = 0; digit < 256; digit++) {
+			const uint32_t count = offset[digit];
+			offset[digit] = sum;
+			sum += count;
+		}
+		for (size_t i = 0; i < n; i++) {
+			const uint32_t target = offset[(keys[i] >> shift) & 0xff]++;
+			keysOut[target] = keys[i];
+			itemsOut[target] = items[i];
+		}
+		keys.swap(keysOut);
+		items.swap(itemsOut);
+	}
+}
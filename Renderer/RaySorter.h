@@ -0,0 +1,55 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*! reorders batches of incoherent rays (diffuse bounces and the like)
+	before traversal, so that rays next to each other in a batch start
+	close together and head the same way, and so visit the same nodes
+	while those are still in cache. Rays are binned by a 32-bit key:
+	from the top, the Morton code of the origin's cell in a 128^3 grid
+	over the scene (21 bits), then the direction's octant (3 bits) and
+	its position within the octant (4 + 4 bits, octahedral). Origins
+	come first as they decide the nodes near the start of traversal;
+	direction major keys measured slower, as they tear rays of one
+	cell apart */
+class RaySorter {
+public:
+	//! origins are binned within these bounds, and clamped to them
+	RaySorter(const glm::vec3& lower, const glm::vec3& upper);
+
+	uint32_t key(const glm::vec3& origin, const glm::vec3& direction) const {
+		const glm::vec3 a = glm::abs(direction);
+		const uint32_t octant = (direction.x < 0.f ? 4u : 0u) | (direction.y < 0.f ? 2u : 0u) | (direction.z < 0.f ? 1u : 0u);
+		const float invSum = 1.f / std::max(a.x + a.y + a.z, 1e-20f);
+		const uint32_t u = std::min(15u, uint32_t(a.x * invSum * 16.f));
+		const uint32_t v = std::min(15u, uint32_t(a.y * invSum * 16.f));
+
+		const glm::vec3 cell = glm::clamp((origin - lower) * scale, glm::vec3(0.f), glm::vec3(127.f));
+		const uint32_t morton = (spread(uint32_t(cell.x)) << 2) | (spread(uint32_t(cell.y)) << 1) | spread(uint32_t(cell.z));
+		return (morton << 11) | (octant << 8) | (u << 4) | v;
+	}
+
+	/*! sorts 'items' by 'keys', both of the same length, with a least
+		significant digit radix sort over 8-bit digits; digits that are
+		the same for all keys are skipped. Single threaded, for the
+		batches of one worker; keeps its scratch memory between calls */
+	void sort(std::vector<uint32_t>& keys, std::vector<uint32_t>& items);
+
+private:
+	//! spreads the low 7 bits of x to every third bit
+	static uint32_t spread(uint32_t x) {
+		x = (x | (x << 8)) & 0x0000f00fu;
+		x = (x | (x << 4)) & 0x000c30c3u;
+		x = (x | (x << 2)) & 0x00249249u;
+		return x;
+	}
+
+	glm::vec3 lower;
+	glm::vec3 scale;
+	std::vector<uint32_t> keysOut;
+	std::vector<uint32_t> itemsOut;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <iostream>
+#ifndef TERMINAL_COLORS
+#define TERMINAL_COLORS
+#define TERMINAL_RED "\033[1;31m"
+#define TERMINAL_GREEN "\033[1;32m"
+#define TERMINAL_YELLOW "\033[1;33m"
+#define TERMINAL_BLUE "\033[1;34m"
+#define TERMINAL_RESET "\033[0m"
+#define TERMINAL_DEFAULT TERMINAL_RESET
+#define TERMINAL_BOLD "\033[1;1m"
+#endif
+#ifndef PRINT
+# define PRINT(var) std::cout << #var << "=" << var << std::endl;
+# define PING std::cout << __FILE__ << "::" << __LINE__ << ": " << __FUNCTION__ << std::endl;
+#endif
+
+#include "glm/glm.hpp"
+#include "Model.h"
+
+#include <cstdint>
+
+struct Camera {
+	glm::vec3 from;
+	glm::vec3 at;
+	glm::vec3 up;
+};
+
+/*! the vectors renderFrame spans its primary rays with: a ray through
+	normalized screen position s goes along
+	direction + (s.x - 0.5) * horizontal + (s.y - 0.5) * vertical */
+struct CameraBasis {
+	glm::vec3 position;
+	glm::vec3 direction;
+	glm::vec3 horizontal;
+	glm::vec3 vertical;
+};
+
+inline CameraBasis cameraBasis(const Camera& camera, const glm::ivec2& fbSize) {
+	CameraBasis basis;
+	basis.position = camera.from;
+	basis.direction = glm::normalize(camera.at - camera.from);
+	const float cosFovy = 0.66f;
+	const float aspect = fbSize.x / float(fbSize.y);
+	basis.horizontal = cosFovy * aspect * glm::normalize(glm::cross(basis.direction, camera.up));
+	basis.vertical = cosFovy * glm::normalize(glm::cross(basis.horizontal, basis.direction));
+	return basis;
+}
+
+/*! what the window needs from a render backend. SampleRenderer does
+	the work with OptiX on the GPU, CpuRenderer with host threads; both
+	produce the same progressively accumulated image */
+class Renderer {
+public:
+	virtual ~Renderer() {}
+
+	//! renders (and accumulates) one more frame
+	virtual void render() = 0;
+
+	virtual void resize(const glm::ivec2& newSize) = 0;
+
+	//! copies the current frame, as 0xAABBGGRR, into h_pixels
+	virtual void downloadPixels(uint32_t h_pixels[]) = 0;
+
+	virtual void setCamera(const Camera& camera) = 0;
+
+	//! picks up what a hot reload changed in the model
+	virtual void applyChanges(const ModelChanges& changes) = 0;
+};
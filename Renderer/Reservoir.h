@@ -0,0 +1,51 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+/*! whether and how CpuRenderer reuses light samples between pixels and
+	frames for the direct light at camera hits */
+enum class ReservoirReuse {
+	//! every hit samples its own lights
+	NONE,
+	//! merged reservoirs are normalized by their candidate counts; cheap,
+	//! but darkens contact shadows and edges, where neighbours see
+	//! lights the pixel does not
+	BIASED,
+	//! only neighbours that could have produced the kept sample, and see
+	//! it, count for normalization; a shadow ray per merged reservoir
+	UNBIASED
+};
+
+/*! a weighted reservoir of light samples for resampled importance
+	sampling (Bitterli et al., "Spatiotemporal Reservoir Resampling for
+	Real-Time Ray Tracing with Dynamic Direct Lighting", 2020). Candidates
+	stream through update(), which keeps one of them with probability
+	proportional to its weight; merging a whole reservoir is one more
+	update, weighted by its candidate count */
+struct Reservoir {
+	//! the kept point on an emitter, meshID -1 while there is none
+	glm::vec3 position{ 0.f };
+	glm::vec3 normal{ 0.f };
+	int meshID{ -1 };
+	//! sum of the weights of all candidates seen
+	float weightSum{ 0.f };
+	//! number of candidates behind the reservoir, merged ones included
+	float count{ 0.f };
+	//! contribution weight of the kept sample, an estimate of one over
+	//! its density; 0 if it is known not to contribute
+	float W{ 0.f };
+
+	//! adds a candidate of 'weight'; true if it is kept, decided by u in [0,1)
+	bool update(const glm::vec3& samplePosition, const glm::vec3& sampleNormal, int sampleMeshID, float weight,
+				float u) {
+		if (!(weight > 0.f))
+			return false;
+		weightSum += weight;
+		if (u * weightSum >= weight)
+			return false;
+		position = samplePosition;
+		normal = sampleNormal;
+		meshID = sampleMeshID;
+		return true;
+	}
+};
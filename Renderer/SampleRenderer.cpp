@@ -1,4 +1,5 @@
 #include "SampleRenderer.h"
+#include "Bsdf.h"
 
 #include <optix_function_table_definition.h>
 
@@ -20,12 +21,20 @@ struct __align__(OPTIX_SBT_RECORD_ALIGNMENT) HitgroupRecord {
 	TriangleMeshSBTData data;
 };
 
-SampleRenderer::SampleRenderer(const Model* model) : model(model) {
+SampleRenderer::SampleRenderer(const Model* model, const EnvironmentMap* environment, SampleSequence sequence)
+	: model(model), environment(environment) {
 	initOptix();
 
 	std::cout << "Optix Renderer: Creating Optix context ..\n";
 	createContext();
 
+	// no framebuffers until the window reports its size (see resize)
+	launchParams.fbSize = int2{ 0, 0 };
+
+	std::cout << "Optix Renderer: Planning device memory ..\n";
+	planMemory(glm::ivec2(0));
+	memoryPlan.print();
+
 	std::cout << "Optix Renderer: Setting up module ..\n";
 	createModule();
 
@@ -41,12 +50,21 @@ SampleRenderer::SampleRenderer(const Model* model) : model(model) {
 	std::cout << "Optix Renderer: Creating Acceleration Structure ..\n";
 	launchParams.traversable = buildAccel();
 
+	// the build calibrated the accel size model; plan the rest with it
+	replanMemory(glm::ivec2(0));
+
 	std::cout << "Optix Renderer: Setting up optix pipeline ..\n";
 	createPipeline();
 
 	std::cout << "Optix Renderer: Creating textures to pass ..\n";
 	createTextures();
 
+	std::cout << "Optix Renderer: Uploading environment map ..\n";
+	createEnvironment();
+
+	std::cout << "Optix Renderer: Setting up the sampler ..\n";
+	createSampler(sequence);
+
 	std::cout << "Optix Renderer: Building shader binding table ..\n";
 	buildSBT();
 
@@ -56,20 +74,112 @@ SampleRenderer::SampleRenderer(const Model* model) : model(model) {
 	std::cout << TERMINAL_GREEN << "Optix Renderer: Ready to be used \n" << TERMINAL_DEFAULT;
 }
 
+/*! checks that the model, environment map and framebuffers of
+	'fbSize' fit on the device, and picks mitigations (see
+	planDeviceMemory) if not. The budget is what was free before the
+	renderer uploaded anything */
+void SampleRenderer::planMemory(const glm::ivec2& fbSize) {
+	if (memoryBudgetBytes == 0) {
+		size_t freeBytes = 0, totalBytes = 0;
+		CUDA_CHECK(cudaMemGetInfo(&freeBytes, &totalBytes));
+
+		// leave some room for module, pipeline, SBT and driver allocations
+		const size_t reserveBytes = std::max<size_t>(freeBytes / 20, 64 << 20);
+		memoryBudgetBytes = freeBytes > reserveBytes ? freeBytes - reserveBytes : 1;
+	}
+
+	memoryPlan = planDeviceMemory(model, environment, fbSize, memoryBudgetBytes, accelSizeModel);
+	if (!memoryPlan.fits) {
+		memoryPlan.print();
+		throw std::runtime_error("Scene does not fit into device memory, even after downscaling textures and dropping attributes");
+	}
+}
+
+/*! plans again after something the plan depends on changed (the
+	framebuffer size, the model, or the accel size model after a build
+	calibrated it), and re-uploads what the new plan does differently:
+	textures that get halved another number of times, and all geometry
+	if other attributes get dropped. Returns whether the geometry (and
+	the accel) was rebuilt */
+bool SampleRenderer::replanMemory(const glm::ivec2& fbSize) {
+	const MemoryPlan previous = memoryPlan;
+	planMemory(fbSize);
+
+	bool texturesChanged = false;
+	for (int textureID = 0; textureID < (int)textureArrays.size(); textureID++) {
+		const int previousDownscale = textureID < (int)previous.textureDownscale.size()
+			? previous.textureDownscale[textureID] : 0;
+		if (textureArrays[textureID] && memoryPlan.textureDownscale[textureID] != previousDownscale) {
+			destroyTexture(textureID);
+			createTexture(textureID);
+			texturesChanged = true;
+		}
+	}
+
+	const bool geometryChanged = memoryPlan.dropUnusedTexcoords != previous.dropUnusedTexcoords
+		|| memoryPlan.dropShadingNormals != previous.dropShadingNormals;
+	if (geometryChanged) {
+		for (int meshID = 0; meshID < (int)vertexBuffer.size(); meshID++)
+			destroyMesh(meshID);
+		asBuffer.free();
+		launchParams.traversable = buildAccel();
+	}
+
+	if (texturesChanged || geometryChanged) {
+		memoryPlan.print();
+		// the records point at texture objects and mesh buffers
+		if (hitgroupRecordsBuffer.d_ptr)
+			buildHitgroupRecords();
+	}
+	return geometryChanged;
+}
+
 void SampleRenderer::createTextures() {
 	int numTextures = (int)model->textures.size();
 
     textureArrays.resize(numTextures);
     textureObjects.resize(numTextures);
     
-    for (int textureID=0;textureID<numTextures;textureID++) {
+    for (int textureID=0;textureID<numTextures;textureID++)
+      createTexture(textureID);
+}
+
+void SampleRenderer::destroyMesh(int meshID) {
+	if (vertexBuffer[meshID].d_ptr) vertexBuffer[meshID].free();
+	if (indexBuffer[meshID].d_ptr) indexBuffer[meshID].free();
+	if (normalBuffer[meshID].d_ptr) normalBuffer[meshID].free();
+	if (texcoordBuffer[meshID].d_ptr) texcoordBuffer[meshID].free();
+}
+
+void SampleRenderer::destroyTexture(int textureID) {
+    if (textureObjects[textureID])
+      CUDA_CHECK(cudaDestroyTextureObject(textureObjects[textureID]));
+    if (textureArrays[textureID])
+      CUDA_CHECK(cudaFreeArray(textureArrays[textureID]));
+    textureObjects[textureID] = 0;
+    textureArrays[textureID] = nullptr;
+}
+
+void SampleRenderer::createTexture(int textureID) {
       auto texture = model->textures[textureID];
+
+      // shrink on the host first if the memory plan asks for it
+      const uint32_t* pixels = texture->pixel;
+      glm::ivec2 resolution = texture->resolution;
+      std::vector<uint32_t> downscaled;
+      for (int step = 0; step < memoryPlan.textureDownscale[textureID]; step++) {
+        glm::ivec2 halvedRes;
+        std::vector<uint32_t> halved = halveTexture(pixels, resolution, halvedRes);
+        downscaled.swap(halved);
+        pixels = downscaled.data();
+        resolution = halvedRes;
+      }
       
       cudaResourceDesc res_desc = {};
       
       cudaChannelFormatDesc channel_desc;
-      int32_t width  = texture->resolution.x;
-      int32_t height = texture->resolution.y;
+      int32_t width  = resolution.x;
+      int32_t height = resolution.y;
       int32_t numComponents = 4;
       int32_t pitch  = width*numComponents*sizeof(uint8_t);
       channel_desc = cudaCreateChannelDesc<uchar4>();
@@ -81,7 +191,7 @@ void SampleRenderer::createTextures() {
       
       CUDA_CHECK(cudaMemcpy2DToArray(pixelArray,
                                  /* offset */0,0,
-                                 texture->pixel,
+                                 pixels,
                                  pitch,pitch,height,
                                  cudaMemcpyHostToDevice));
       
@@ -105,7 +215,40 @@ void SampleRenderer::createTextures() {
       cudaTextureObject_t cuda_tex = 0;
       CUDA_CHECK(cudaCreateTextureObject(&cuda_tex, &res_desc, &tex_desc, nullptr));
       textureObjects[textureID] = cuda_tex;
-	}
+}
+
+void SampleRenderer::createEnvironment() {
+	LaunchParams::Environment& env = launchParams.environment;
+	env = {};
+	env.resolution = int2{ 0, 0 };
+	if (!environment)
+		return;
+
+	environmentPixelBuffer.alloc_and_upload(environment->pixel);
+	environmentConditionalCdfBuffer.alloc_and_upload(environment->conditionalCdf);
+	environmentMarginalCdfBuffer.alloc_and_upload(environment->marginalCdf);
+
+	env.pixel.data = (float3*)environmentPixelBuffer.d_pointer();
+	env.pixel.size = environment->pixel.size();
+	env.conditionalCdf.data = (float*)environmentConditionalCdfBuffer.d_pointer();
+	env.conditionalCdf.size = environment->conditionalCdf.size();
+	env.marginalCdf.data = (float*)environmentMarginalCdfBuffer.d_pointer();
+	env.marginalCdf.size = environment->marginalCdf.size();
+	env.resolution = int2{ environment->resolution.x, environment->resolution.y };
+	env.integral = environment->integral;
+}
+
+void SampleRenderer::createSampler(SampleSequence sequence) {
+	launchParams.sampleSequence = unsigned(sequence);
+	launchParams.blueNoise = {};
+	if (sequence != SampleSequence::BLUE_NOISE)
+		return;
+
+	const uint16_t* ranks = blueNoiseRanks();
+	const std::vector<uint32_t> blueNoise(ranks, ranks + blueNoiseSize * blueNoiseSize);
+	blueNoiseBuffer.alloc_and_upload(blueNoise);
+	launchParams.blueNoise.data = (uint32_t*)blueNoiseBuffer.d_pointer();
+	launchParams.blueNoise.size = blueNoise.size();
 }
 
 OptixTraversableHandle SampleRenderer::buildAccel() {
@@ -132,12 +275,16 @@ OptixTraversableHandle SampleRenderer::buildAccel() {
 	for (int meshID = 0; meshID < numMeshes; meshID++) {
 		
 		TriangleMesh& mesh = *model->meshes[meshID];
-		vertexBuffer[meshID].alloc_and_upload(mesh.vertex);
-		indexBuffer[meshID].alloc_and_upload(mesh.index);
-		if (!mesh.normal.empty())
-			normalBuffer[meshID].alloc_and_upload(mesh.normal);
-		if (!mesh.texcoord.empty())
-			texcoordBuffer[meshID].alloc_and_upload(mesh.texcoord);
+		// meshes that are already on the device (e.g. when rebuilding
+		// after a hot reload) keep their buffers
+		if (!vertexBuffer[meshID].d_ptr) {
+			vertexBuffer[meshID].alloc_and_upload(mesh.vertex);
+			indexBuffer[meshID].alloc_and_upload(mesh.index);
+			if (memoryPlan.uploadNormals(mesh))
+				normalBuffer[meshID].alloc_and_upload(mesh.normal);
+			if (memoryPlan.uploadTexcoords(mesh))
+				texcoordBuffer[meshID].alloc_and_upload(mesh.texcoord);
+		}
 
 		triangleInput[meshID] = {};
 		triangleInput[meshID].type = OPTIX_BUILD_INPUT_TYPE_TRIANGLES;
@@ -232,6 +379,15 @@ OptixTraversableHandle SampleRenderer::buildAccel() {
     uint64_t compactedSize;
     compactedSizeBuffer.download(&compactedSize,1);
     
+    // feed the real sizes back into the planner's model
+    size_t numTriangles = 0;
+    for (auto mesh : model->meshes)
+      numTriangles += mesh->index.size();
+    accelSizeModel.calibrate(numTriangles,
+                             blasBufferSizes.outputSizeInBytes,
+                             blasBufferSizes.tempSizeInBytes,
+                             compactedSize);
+    
     asBuffer.alloc(compactedSize);
     OPTIX_CHECK(optixAccelCompact(optixContext,
                                   /*stream:*/0,
@@ -476,6 +632,10 @@ void SampleRenderer::buildSBT() {
 	sbt.missRecordStrideInBytes = sizeof(MissRecord);
 	sbt.missRecordCount = (int)missRecords.size();
 
+	buildHitgroupRecords();
+}
+
+void SampleRenderer::buildHitgroupRecords() {
 	// ------------------------------------------------------------------
 	// build hitgroup records
 	// ------------------------------------------------------------------
@@ -497,7 +657,7 @@ void SampleRenderer::buildSBT() {
 		rec.data.color = *((float3*)(&mesh->diffuse));
 		rec.data.emmisive = *((float3*)(&mesh->emmissive));
 		rec.data.specular = *((float3*)(&mesh->specular));
-		rec.data.shininess = (1000.f - mesh->shininess) / (800.f);
+		rec.data.roughness = roughnessFromShininess(mesh->shininess);
 		rec.data.ior = mesh->ior;
 		rec.data.matType = rec.data.DIFFUSE;
 
@@ -523,12 +683,68 @@ void SampleRenderer::buildSBT() {
 		rec.data.index.size = indexBuffer[meshID].sizeInBytes / sizeof(float3);
 		hitgroupRecords.push_back(rec);
 	}
+	if (hitgroupRecordsBuffer.d_ptr)
+		hitgroupRecordsBuffer.free();
 	hitgroupRecordsBuffer.alloc_and_upload(hitgroupRecords);
 	sbt.hitgroupRecordBase = hitgroupRecordsBuffer.d_pointer();
 	sbt.hitgroupRecordStrideInBytes = sizeof(HitgroupRecord);
 	sbt.hitgroupRecordCount = (int)hitgroupRecords.size();
 }
 
+/*! re-uploads what a hot reload changed in the model: new mesh
+	buffers and an accel rebuild for changed geometry, new device
+	arrays for changed textures, and fresh hitgroup records */
+void SampleRenderer::applyChanges(const ModelChanges& changes) {
+	if (changes.empty())
+		return;
+
+	const int numMeshes = (int)model->meshes.size();
+	const int numTextures = (int)model->textures.size();
+
+	// ------------------------------------------------------------------
+	// free what changed; it comes back below with the new plan
+	// ------------------------------------------------------------------
+	for (int textureID = numTextures; textureID < (int)textureArrays.size(); textureID++)
+		destroyTexture(textureID);
+	textureArrays.resize(numTextures, nullptr);
+	textureObjects.resize(numTextures, 0);
+	for (int textureID : changes.textures)
+		destroyTexture(textureID);
+
+	bool geometryChanged = !changes.meshes.empty() || numMeshes != (int)vertexBuffer.size();
+	for (int meshID = numMeshes; meshID < (int)vertexBuffer.size(); meshID++)
+		destroyMesh(meshID);
+	for (int meshID : changes.meshes)
+		if (meshID < (int)vertexBuffer.size())
+			destroyMesh(meshID);
+
+	// the model may have grown or shrunk; this also re-uploads textures
+	// and geometry that were kept but get mitigated differently now
+	if (replanMemory(glm::ivec2(launchParams.fbSize.x, launchParams.fbSize.y)))
+		geometryChanged = false;
+
+	// ------------------------------------------------------------------
+	// textures
+	// ------------------------------------------------------------------
+	for (int textureID = 0; textureID < numTextures; textureID++)
+		if (!textureArrays[textureID])
+			createTexture(textureID);
+
+	// ------------------------------------------------------------------
+	// geometry
+	// ------------------------------------------------------------------
+	if (geometryChanged) {
+		asBuffer.free();
+		launchParams.traversable = buildAccel();
+	}
+
+	buildHitgroupRecords();
+	sbt.hitgroupRecordBase = hitgroupRecordsBuffer.d_pointer();
+
+	// start accumulating from scratch
+	launchParams.frameID = 0;
+}
+
 void SampleRenderer::render() {
 	// Just a check to make sure there is a pixel to draw
 	if (launchParams.fbSize.x == 0) return;
@@ -556,6 +772,10 @@ void SampleRenderer::render() {
 void SampleRenderer::resize(const glm::ivec2& newSize) {
 	if (newSize.x == 0 | newSize.y == 0) return;
 
+	// the framebuffers are part of the plan; bigger ones may need
+	// textures or attributes to go, smaller ones let them come back
+	replanMemory(newSize);
+
 	colorBuffer.resize(newSize.x * newSize.y * sizeof(uint32_t));
 	accumBuffer.resize(newSize.x * newSize.y * sizeof(float3));
 
@@ -568,17 +788,12 @@ void SampleRenderer::resize(const glm::ivec2& newSize) {
 }
 
 void SampleRenderer::setCamera(const Camera& camera) {
-	glm::vec3 pos = camera.from;
-	glm::vec3 dir = glm::normalize(camera.at - camera.from);
 	lastSetCamera = camera;
-	launchParams.camera.position = *((float3*)(&pos));
-	launchParams.camera.direction = *((float3*)(&dir));
-	const float cosFovy = 0.66f;
-	const float aspect = launchParams.fbSize.x / float(launchParams.fbSize.y);
-	glm::vec3 horizontal = cosFovy * aspect * glm::normalize(glm::cross(dir, camera.up));
-	glm::vec3 vertical = cosFovy * glm::normalize(glm::cross(horizontal, dir));
-	launchParams.camera.horizontal = *((float3*)(&horizontal));
-	launchParams.camera.vertical = *((float3*)(&vertical));
+	CameraBasis basis = cameraBasis(camera, glm::ivec2(launchParams.fbSize.x, launchParams.fbSize.y));
+	launchParams.camera.position = *((float3*)(&basis.position));
+	launchParams.camera.direction = *((float3*)(&basis.direction));
+	launchParams.camera.horizontal = *((float3*)(&basis.horizontal));
+	launchParams.camera.vertical = *((float3*)(&basis.vertical));
 	launchParams.frameID = 0;
 }
 
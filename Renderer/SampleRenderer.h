@@ -1,48 +1,37 @@
 #pragma once
 
-#include <iostream>
-#ifndef TERMINAL_COLORS
-#define TERMINAL_COLORS
-#define TERMINAL_RED "\033[1;31m"
-#define TERMINAL_GREEN "\033[1;32m"
-#define TERMINAL_YELLOW "\033[1;33m"
-#define TERMINAL_BLUE "\033[1;34m"
-#define TERMINAL_RESET "\033[0m"
-#define TERMINAL_DEFAULT TERMINAL_RESET
-#define TERMINAL_BOLD "\033[1;1m"
-#endif
-#ifndef PRINT
-# define PRINT(var) std::cout << #var << "=" << var << std::endl;
-# define PING std::cout << __FILE__ << "::" << __LINE__ << ": " << __FUNCTION__ << std::endl;
-#endif
-
 #include "CUDABuffer.h"
 #include "LaunchParams.h"
 #include "Model.h"
+#include "EnvironmentMap.h"
+#include "MemoryPlanner.h"
+#include "Renderer.h"
+#include "Sampler.h"
 
-struct Camera {
-	glm::vec3 from;
-	glm::vec3 at;
-	glm::vec3 up;
-};
-
-class SampleRenderer {
+class SampleRenderer : public Renderer {
 public:
-	SampleRenderer(const Model *model);
+	SampleRenderer(const Model *model, const EnvironmentMap *environment = nullptr,
+				   SampleSequence sequence = SampleSequence::RANDOM);
 
-	void render();
+	void render() override;
 	
-	void resize(const glm::ivec2 &newSize);
+	void resize(const glm::ivec2 &newSize) override;
+
+	void downloadPixels(uint32_t h_pixels[]) override;
 
-	void downloadPixels(uint32_t h_pixels[]);
+	void setCamera(const Camera& camera) override;
 
-	void setCamera(const Camera& camera);
+	void applyChanges(const ModelChanges& changes) override;
 
 protected:
 	void initOptix();
 	
 	void createContext();
 
+	void planMemory(const glm::ivec2& fbSize);
+
+	bool replanMemory(const glm::ivec2& fbSize);
+
 	void createModule();
 
 	void createRaygenPrograms();
@@ -55,10 +44,22 @@ protected:
 
 	void buildSBT();
 
+	void buildHitgroupRecords();
+
 	OptixTraversableHandle buildAccel();
 
 	void createTextures();
 
+	void createTexture(int textureID);
+
+	void destroyTexture(int textureID);
+
+	void destroyMesh(int meshID);
+
+	void createEnvironment();
+
+	void createSampler(SampleSequence sequence);
+
 protected:
 
 	CUcontext cudaContext;
@@ -92,6 +93,11 @@ protected:
 	Camera lastSetCamera;
 
 	const Model* model;
+	//! what gets uploaded; planned again whenever its inputs change
+	MemoryPlan memoryPlan;
+	//! device memory the plan may use, measured once at startup
+	size_t memoryBudgetBytes{ 0 };
+	AccelSizeModel accelSizeModel;
 	std::vector<CUDABuffer> vertexBuffer;
 	std::vector<CUDABuffer> normalBuffer;
 	std::vector<CUDABuffer> texcoordBuffer;
@@ -101,4 +107,10 @@ protected:
 	std::vector<cudaArray_t> textureArrays;
 	// This thing is like a look up for all textures
 	std::vector<cudaTextureObject_t> textureObjects;
+
+	const EnvironmentMap* environment;
+	CUDABuffer environmentPixelBuffer;
+	CUDABuffer environmentConditionalCdfBuffer;
+	CUDABuffer environmentMarginalCdfBuffer;
+	CUDABuffer blueNoiseBuffer;
 };
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+static const int tilePixels = blueNoiseSize * blueNoiseSize;
+// width of the Gaussian that measures clustering, in pixels (Ulichney's 1.5)
+static const float clusterSigma = 1.5f;
+// the share of pixels in the initial pattern
+static const int initialPixels = tilePixels / 10;
+
+namespace {
+	/*! a binary pattern over the tile, with each pixel's energy: the sum
+		of the Gaussian filter over the pattern's pixels, toroidally, so
+		high where they cluster and low in voids */
+	struct Pattern {
+		const std::vector<float>* filter;
+		std::vector<bool> set;
+		std::vector<float> energy;
+
+		explicit Pattern(const std::vector<float>* filter)
+			: filter(filter), set(tilePixels, false), energy(tilePixels, 0.f) {}
+
+		void toggle(int pixel) {
+			set[pixel] = !set[pixel];
+			const float sign = set[pixel] ? 1.f : -1.f;
+			const int px = pixel % blueNoiseSize, py = pixel / blueNoiseSize;
+			for (int y = 0; y < blueNoiseSize; y++) {
+				const int dy = (y - py + blueNoiseSize) % blueNoiseSize;
+				for (int x = 0; x < blueNoiseSize; x++) {
+					const int dx = (x - px + blueNoiseSize) % blueNoiseSize;
+					energy[x + y * blueNoiseSize] += sign * (*filter)[dx + dy * blueNoiseSize];
+				}
+			}
+		}
+
+		//! the set pixel of the highest energy
+		int tightestCluster() const {
+			int best = -1;
+			for (int i = 0; i < tilePixels; i++)
+				if (set[i] && (best < 0 || energy[i] > energy[best]))
+					best = i;
+			return best;
+		}
+
+		//! the pixel not set of the lowest energy
+		int largestVoid() const {
+			int best = -1;
+			for (int i = 0; i < tilePixels; i++)
+				if (!set[i] && (best < 0 || energy[i] < energy[best]))
+					best = i;
+			return best;
+		}
+	};
+}
+
+/*! Ulichney, "The void-and-cluster method for dither array generation",
+	1993: an initial pattern is relaxed by moving its tightest cluster
+	into its largest void until that changes nothing; then pixels are
+	ranked by removing the tightest clusters from it, and by adding to it
+	the largest voids, or once more than half are set, the tightest
+	clusters of the pixels not set */
+static std::vector<uint16_t> buildBlueNoise() {
+	std::vector<float> filter(tilePixels);
+	for (int y = 0; y < blueNoiseSize; y++)
+		for (int x = 0; x < blueNoiseSize; x++) {
+			const int dx = std::min(x, blueNoiseSize - x), dy = std::min(y, blueNoiseSize - y);
+			filter[x + y * blueNoiseSize] = std::exp(-float(dx * dx + dy * dy) / (2.f * clusterSigma * clusterSigma));
+		}
+
+	Pattern initial(&filter);
+	int count = 0;
+	for (uint32_t i = 0; count < initialPixels; i++) {
+		const int pixel = int(hashSeed(i) % tilePixels);
+		if (!initial.set[pixel]) {
+			initial.toggle(pixel);
+			count++;
+		}
+	}
+	// a swap that is undone ends it; the bound is only a safeguard
+	for (int i = 0; i < tilePixels; i++) {
+		const int cluster = initial.tightestCluster();
+		initial.toggle(cluster);
+		const int hole = initial.largestVoid();
+		initial.toggle(hole);
+		if (hole == cluster)
+			break;
+	}
+
+	std::vector<uint16_t> ranks(tilePixels);
+	Pattern pattern = initial;
+	for (int rank = initialPixels - 1; rank >= 0; rank--) {
+		const int cluster = pattern.tightestCluster();
+		pattern.toggle(cluster);
+		ranks[cluster] = uint16_t(rank);
+	}
+
+	pattern = initial;
+	int rank = initialPixels;
+	for (; rank < tilePixels / 2; rank++) {
+		const int hole = pattern.largestVoid();
+		pattern.toggle(hole);
+		ranks[hole] = uint16_t(rank);
+	}
+
+	// the pixels not set, as a pattern of their own
+	Pattern inverse(&filter);
+	for (int i = 0; i < tilePixels; i++)
+		if (!pattern.set[i])
+			inverse.toggle(i);
+	for (; rank < tilePixels; rank++) {
+		const int cluster = inverse.tightestCluster();
+		inverse.toggle(cluster);
+		ranks[cluster] = uint16_t(rank);
+	}
+	return ranks;
+}
+
+const uint16_t* blueNoiseRanks() {
+	static const std::vector<uint16_t> ranks = buildBlueNoise();
+	return ranks.data();
+}
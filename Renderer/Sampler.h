@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+/*! where the integrators take their uniform numbers from. All are
+	indexed by (pixel, sample index, dimension): a path's camera ray
+	takes dimensions 0 and 1, each of its hits then the next
+	bounceDimensions (see HostPrograms.h) */
+enum class SampleSequence {
+	//! a xorshift stream per pixel, seeded from the pixel and frame;
+	//! neighbouring pixels and frames get correlated streams
+	RANDOM,
+	//! per pixel Sobol points, Owen scrambled: consecutive dimension
+	//! pairs are the first two Sobol dimensions, each pair with its own
+	//! shuffle of the sample order and each dimension with its own
+	//! scramble (Burley, "Practical Hash-based Owen Scrambling", 2020)
+	SOBOL,
+	//! one such sequence for all pixels, each shifted (mod 1) by a
+	//! point picked by the rank of the pixel in a blue-noise tile
+	//! (after Georgiev and Fajardo, "Blue-noise Dithered Sampling",
+	//! 2016), so that neighbouring pixels' errors cancel rather than
+	//! clump
+	BLUE_NOISE
+};
+
+// random numbers of devicePrograms.slang, bit for bit
+static const uint32_t ALMOST_MAX = 0x0fffffff;
+
+static inline uint32_t xorshift(uint32_t value) {
+	value ^= value << 13;
+	value ^= value >> 17;
+	value ^= value << 5;
+	return value;
+}
+
+static inline uint32_t nextInt(uint32_t& seed) {
+	seed = xorshift(seed);
+	return seed;
+}
+
+static inline float nextFloat(uint32_t& seed) {
+	uint32_t x = nextInt(seed);
+	float f = float(x) / float(ALMOST_MAX);
+	return f - std::floor(f);
+}
+
+// side of the blue-noise tile, in pixels; it repeats across the image
+static const int blueNoiseSize = 64;
+static_assert(blueNoiseSize * blueNoiseSize == 1 << 12, "blue-noise ranks have 12 bits");
+
+/*! the blue-noise tile: a rank in [0, blueNoiseSize^2) per pixel, in
+	rows, by Ulichney's void-and-cluster method, so that the pixels of
+	any lower ranks are evenly spread. Built on the first call */
+const uint16_t* blueNoiseRanks();
+
+static inline uint32_t reverseBits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+static inline uint32_t hashSeed(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline uint32_t hashCombine(uint32_t seed, uint32_t value) {
+	return seed ^ (value + (seed << 6) + (seed >> 2));
+}
+
+/*! a random Owen scramble of the 32-bit fraction x: each bit is flipped
+	depending on the bits above it only, so x keeps its stratum at every
+	power of two (Laine and Karras' hash, with Burley's constants) */
+static inline uint32_t owenScramble(uint32_t x, uint32_t seed) {
+	x = reverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverseBits(x);
+}
+
+/*! point 'index' of Sobol dimension 0 (van der Corput) or 1, as a
+	32-bit fraction; together they are a (0,2)-sequence */
+static inline uint32_t sobol(uint32_t index, uint32_t dimension) {
+	if (dimension == 0)
+		return reverseBits(index);
+	uint32_t v = 1u << 31, x = 0;
+	for (; index != 0; index >>= 1, v ^= v >> 1)
+		if (index & 1)
+			x ^= v;
+	return x;
+}
+
+//! dimension 'dimension' of sample 'index' of SampleSequence::SOBOL for 'seed'
+static inline uint32_t scrambledSobol(uint32_t seed, uint32_t index, uint32_t dimension) {
+	const uint32_t pairSeed = hashSeed(hashCombine(seed, dimension >> 1));
+	const uint32_t shuffled = owenScramble(index, pairSeed);
+	return owenScramble(sobol(shuffled, dimension & 1), hashSeed(hashCombine(pairSeed, 1 + (dimension & 1))));
+}
+
+//! the scrambling seed all pixels share with SampleSequence::BLUE_NOISE
+static const uint32_t blueNoiseSeed = 0x2545f491u;
+
+/*! dimension 'dimension' of sample 'index' of SampleSequence::BLUE_NOISE
+	at pixel (x, y). Each dimension pair reads the tile at its own offset,
+	and the rank there, bits reversed, picks the pixel's shift from one
+	more scrambled 2D Sobol sequence: ranks that differ in their top k
+	bits, as those of a block of 2^k pixels about do, then pick shifts
+	that differ in their low k index bits, which stratify both
+	dimensions together */
+static inline uint32_t blueNoiseSobol(const uint16_t* ranks, uint32_t x, uint32_t y, uint32_t index,
+									  uint32_t dimension) {
+	const uint32_t pairSeed = hashSeed(hashCombine(blueNoiseSeed, dimension >> 1));
+	const uint32_t tileX = (x + pairSeed) % blueNoiseSize;
+	const uint32_t tileY = (y + (pairSeed >> 16)) % blueNoiseSize;
+	const uint32_t rank = ranks[tileX + tileY * blueNoiseSize];
+	const uint32_t shift = owenScramble(sobol(reverseBits(rank) >> 20, dimension & 1),
+		hashSeed(hashCombine(pairSeed, 3 + (dimension & 1))));
+	return scrambledSobol(blueNoiseSeed, index, dimension) + shift;
+}
+
+/*! the uniform numbers of the paths of one pixel, one at a time; next()
+	takes the next dimension of the current sample. The integrators
+	skip the dimensions of strategies they do not use at a hit, so that
+	each dimension means the same in all samples. Same as in
+	devicePrograms.slang */
+struct PathSampler {
+	SampleSequence sequence;
+	//! the xorshift state with RANDOM, the pixel's scrambling seed with SOBOL
+	uint32_t seed;
+	uint32_t x, y;
+	//! sample of the pixel, counted over all frames since the last reset
+	uint32_t index;
+	uint32_t dimension;
+	//! blueNoiseRanks(), with BLUE_NOISE
+	const uint16_t* ranks;
+
+	/*! the sampler of pixel (x, y) of an image 'width' pixels wide, for
+		frame 'frameID'. With RANDOM, its stream continues over the
+		samples of the frame, as renderFrame's seed does */
+	static PathSampler forPixel(SampleSequence sequence, int x, int y, int width, uint32_t frameID) {
+		PathSampler sampler;
+		sampler.sequence = sequence;
+		sampler.x = uint32_t(x);
+		sampler.y = uint32_t(y);
+		sampler.index = 0;
+		sampler.dimension = 0;
+		sampler.ranks = sequence == SampleSequence::BLUE_NOISE ? blueNoiseRanks() : nullptr;
+		if (sequence == SampleSequence::RANDOM) {
+			uint32_t seed = x + y * width + 1 + frameID;
+			sampler.seed = nextInt(seed) + frameID;
+		}
+		else
+			sampler.seed = hashSeed(uint32_t(x + y * width));
+		return sampler;
+	}
+
+	//! starts sample 'sampleIndex' of the pixel, at dimension 0
+	void startSample(uint32_t sampleIndex) {
+		index = sampleIndex;
+		dimension = 0;
+	}
+
+	//! passes over 'count' dimensions; the xorshift stream does not move
+	void skip(uint32_t count) { dimension += count; }
+
+	//! continues at 'nextDimension'
+	void seek(uint32_t nextDimension) { dimension = nextDimension; }
+
+	//! a uniform number in [0,1)
+	float next() {
+		if (sequence == SampleSequence::RANDOM)
+			return nextFloat(seed);
+		const uint32_t bits = sequence == SampleSequence::SOBOL ? scrambledSobol(seed, index, dimension)
+			: blueNoiseSobol(ranks, x, y, index, dimension);
+		dimension++;
+		return float(bits >> 8) * (1.f / 16777216.f);
+	}
+};
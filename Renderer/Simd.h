@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+/*! thin wrappers over the widest float vector the build enables: 8
+	lanes with AVX2, 4 with SSE. SIMD_FLOAT is left undefined on other
+	targets, where callers use their scalar code paths */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_FLOAT
+typedef __m256 vfloat;
+static const int simdWidth = 8;
+static inline vfloat vload(const float* p) { return _mm256_load_ps(p); }
+static inline void vstore(float* p, vfloat a) { _mm256_store_ps(p, a); }
+static inline vfloat vset(float a) { return _mm256_set1_ps(a); }
+static inline vfloat vset(int a) { return _mm256_castsi256_ps(_mm256_set1_epi32(a)); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+static inline vfloat vlt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vfloat vle(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline vfloat vneq(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+static inline vfloat vand(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+static inline vfloat vxor(vfloat a, vfloat b) { return _mm256_xor_ps(a, b); }
+static inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+static inline uint32_t vmovemask(vfloat a) { return (uint32_t)_mm256_movemask_ps(a); }
+//! lane i is all ones where bit i of 'bits' is set
+static inline vfloat vmaskFromBits(uint32_t bits) {
+	const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lanes), lanes));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define SIMD_FLOAT
+typedef __m128 vfloat;
+static const int simdWidth = 4;
+static inline vfloat vload(const float* p) { return _mm_load_ps(p); }
+static inline void vstore(float* p, vfloat a) { _mm_store_ps(p, a); }
+static inline vfloat vset(float a) { return _mm_set1_ps(a); }
+static inline vfloat vset(int a) { return _mm_castsi128_ps(_mm_set1_epi32(a)); }
+static inline vfloat vadd(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat vsub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+static inline vfloat vmul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+static inline vfloat vdiv(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+static inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+static inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+static inline vfloat vlt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+static inline vfloat vle(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+static inline vfloat vneq(vfloat a, vfloat b) { return _mm_cmpneq_ps(a, b); }
+static inline vfloat vand(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+static inline vfloat vxor(vfloat a, vfloat b) { return _mm_xor_ps(a, b); }
+static inline vfloat vselect(vfloat mask, vfloat a, vfloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline uint32_t vmovemask(vfloat a) { return (uint32_t)_mm_movemask_ps(a); }
+static inline vfloat vmaskFromBits(uint32_t bits) {
+	const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), lanes), lanes));
+}
+#else
+static const int simdWidth = 4;
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline int firstBit(uint32_t mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
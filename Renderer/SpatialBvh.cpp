@@ -0,0 +1,518 @@
+#include "BvhBuild.h"
+
+#include "ParallelFor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+// planes per axis for spatial splits; they are spread over the node's
+// bounds rather than its centroids, so they get more than object splits
+static const int numSpatialBins = 32;
+// spatial splits are only tried where the children of the best object
+// split overlap by more than this fraction of the root's surface area
+static const float minSplitOverlap = 1e-5f;
+// nodes with fewer references are built serially by one thread
+static const int parallelBuildThreshold = 4096;
+// nodes with more references are binned with all threads
+static const int parallelBinThreshold = 128 * 1024;
+static const int binChunkSize = 16 * 1024;
+
+static inline bool isValid(const Box& box) {
+	return box.lower.x <= box.upper.x && box.lower.y <= box.upper.y && box.lower.z <= box.upper.z;
+}
+
+static inline Box intersect(const Box& a, const Box& b) {
+	Box box;
+	box.lower = glm::max(a.lower, b.lower);
+	box.upper = glm::min(a.upper, b.upper);
+	return box;
+}
+
+/*! bounds of the parts of triangle v that lie within 'box' on either
+	side of the plane at 'position'; a side the triangle does not reach
+	comes back invalid */
+static void clipTriangle(const glm::vec3 v[3], const Box& box, int axis, float position, Box& left, Box& right) {
+	left = right = Box();
+	for (int i = 0; i < 3; i++) {
+		const glm::vec3& p = v[i];
+		const glm::vec3& q = v[(i + 1) % 3];
+		if (p[axis] <= position)
+			left.extend(p);
+		if (p[axis] >= position)
+			right.extend(p);
+		if ((p[axis] < position && q[axis] > position) || (p[axis] > position && q[axis] < position)) {
+			glm::vec3 x = glm::mix(p, q, (position - p[axis]) / (q[axis] - p[axis]));
+			x[axis] = position;
+			left.extend(x);
+			right.extend(x);
+		}
+	}
+	left = intersect(left, box);
+	left.upper[axis] = std::min(left.upper[axis], position);
+	right = intersect(right, box);
+	right.lower[axis] = std::max(right.lower[axis], position);
+}
+
+static inline Box boxOf(const BuildPrim& prim) {
+	Box box;
+	box.lower = prim.lower;
+	box.upper = prim.upper;
+	return box;
+}
+
+static inline void setBox(BuildPrim& prim, const Box& box) {
+	prim.lower = box.lower;
+	prim.upper = box.upper;
+	prim.centroid = 0.5f * (box.lower + box.upper);
+}
+
+/*! per axis bounds of the triangle pieces clipped to each bin, and how
+	many references start (entry) and end (exit) in each bin */
+struct SpatialBins {
+	Box bounds[3][numSpatialBins];
+	int entry[3][numSpatialBins];
+	int exit[3][numSpatialBins];
+
+	SpatialBins() {
+		std::memset(entry, 0, sizeof(entry));
+		std::memset(exit, 0, sizeof(exit));
+	}
+
+	void merge(const SpatialBins& other) {
+		for (int axis = 0; axis < 3; axis++)
+			for (int bin = 0; bin < numSpatialBins; bin++) {
+				bounds[axis][bin].extend(other.bounds[axis][bin]);
+				entry[axis][bin] += other.entry[axis][bin];
+				exit[axis][bin] += other.exit[axis][bin];
+			}
+	}
+};
+
+/*! the split a node is divided by; spatial splits cut at a plane between
+	spatial bins, object splits between centroid bins */
+struct Split {
+	float cost{ 1e30f };
+	int axis{ -1 };
+	int bin{ -1 };
+	bool spatial{ false };
+	//! references that a spatial split would add
+	int duplicates{ 0 };
+};
+
+/*! top-down builder like BvhBuilder, but every node owns its list of
+	(possibly clipped) references, since spatial splits make the lists
+	of the children longer than the parent's. Leaves take their slots
+	in 'refs' from a shared counter, and the references added by spatial
+	splits are taken from a shared budget before a split is made */
+class SpatialBvhBuilder {
+public:
+	SpatialBvhBuilder(const Model* model, std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs, int64_t budget, float rootArea)
+		: model(model), nodes(nodes), refs(refs), rootArea(rootArea), numNodes(1), numRefs(0), budget(budget),
+		  activeThreads(1), maxThreads(numHostThreads()) {}
+
+	void build(uint32_t nodeID, std::vector<BuildPrim>& prims, int depth);
+
+	uint32_t size() const { return numNodes; }
+	uint32_t references() const { return numRefs; }
+
+private:
+	void triangle(const PrimRef& ref, glm::vec3 v[3]) const {
+		const TriangleMesh& mesh = *model->meshes[ref.meshID];
+		const glm::ivec3 index = mesh.index[ref.primID];
+		v[0] = mesh.vertex[index.x];
+		v[1] = mesh.vertex[index.y];
+		v[2] = mesh.vertex[index.z];
+	}
+
+	template<typename Binner>
+	void binParallel(int count, Binner&& binRange) const;
+
+	Split findObjectSplit(const std::vector<BuildPrim>& prims, const Box& centroidBounds, Box& left, Box& right) const;
+	Split findSpatialSplit(const std::vector<BuildPrim>& prims, const Box& bounds) const;
+	void splitSpatially(std::vector<BuildPrim>& prims, const Box& bounds, const Split& split,
+						std::vector<BuildPrim>& left, std::vector<BuildPrim>& right) const;
+
+	const Model* model;
+	std::vector<BvhNode>& nodes;
+	std::vector<PrimRef>& refs;
+	const float rootArea;
+	std::atomic<uint32_t> numNodes;
+	std::atomic<uint32_t> numRefs;
+	std::atomic<int64_t> budget;
+	std::atomic<int> activeThreads;
+	const int maxThreads;
+};
+
+/*! calls binRange(first, last, chunk) over the references; in chunks of
+	binChunkSize on all threads for the top few levels, else once with
+	chunk -1 */
+template<typename Binner>
+void SpatialBvhBuilder::binParallel(int count, Binner&& binRange) const {
+	if (count < parallelBinThreshold) {
+		binRange(0, count, -1);
+		return;
+	}
+	const int numChunks = (count + binChunkSize - 1) / binChunkSize;
+	parallelFor(0, numChunks, [&](int chunk) {
+		const int first = chunk * binChunkSize;
+		binRange(first, std::min(count, first + binChunkSize), chunk);
+	});
+}
+
+Split SpatialBvhBuilder::findObjectSplit(const std::vector<BuildPrim>& prims, const Box& centroidBounds,
+										 Box& leftBounds, Box& rightBounds) const {
+	const glm::vec3 extent = centroidBounds.upper - centroidBounds.lower;
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; axis++)
+		scale[axis] = extent[axis] > 0.f ? numBins / extent[axis] : 0.f;
+
+	const int count = (int)prims.size();
+	std::vector<Bins> chunkBins(count < parallelBinThreshold ? 1 : (count + binChunkSize - 1) / binChunkSize);
+	binParallel(count, [&](int first, int last, int chunk) {
+		Bins& out = chunkBins[std::max(chunk, 0)];
+		for (int i = first; i < last; i++) {
+			const BuildPrim& prim = prims[i];
+			for (int axis = 0; axis < 3; axis++) {
+				const int bin = binOf(prim.centroid[axis], centroidBounds.lower[axis], scale[axis]);
+				out.count[axis][bin]++;
+				out.bounds[axis][bin].extend(prim.lower);
+				out.bounds[axis][bin].extend(prim.upper);
+			}
+		}
+	});
+	Bins& bins = chunkBins[0];
+	for (size_t chunk = 1; chunk < chunkBins.size(); chunk++)
+		bins.merge(chunkBins[chunk]);
+
+	Split best;
+	for (int axis = 0; axis < 3; axis++) {
+		if (extent[axis] <= 0.f)
+			continue;
+		Box rightBox[numBins];
+		int rightCount[numBins];
+		Box box;
+		int n = 0;
+		for (int bin = numBins - 1; bin > 0; bin--) {
+			box.extend(bins.bounds[axis][bin]);
+			n += bins.count[axis][bin];
+			rightBox[bin] = box;
+			rightCount[bin] = n;
+		}
+		box = Box();
+		n = 0;
+		for (int bin = 0; bin < numBins - 1; bin++) {
+			box.extend(bins.bounds[axis][bin]);
+			n += bins.count[axis][bin];
+			if (n == 0 || rightCount[bin + 1] == 0)
+				continue;
+			const float cost = box.halfArea() * n + rightBox[bin + 1].halfArea() * rightCount[bin + 1];
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = axis;
+				best.bin = bin;
+				leftBounds = box;
+				rightBounds = rightBox[bin + 1];
+			}
+		}
+	}
+	return best;
+}
+
+Split SpatialBvhBuilder::findSpatialSplit(const std::vector<BuildPrim>& prims, const Box& bounds) const {
+	const glm::vec3 extent = bounds.upper - bounds.lower;
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; axis++)
+		scale[axis] = extent[axis] > 0.f ? numSpatialBins / extent[axis] : 0.f;
+	auto binOfPosition = [&](int axis, float position) {
+		return std::min(numSpatialBins - 1, std::max(0, int((position - bounds.lower[axis]) * scale[axis])));
+	};
+
+	// each reference is chopped into one piece per bin it spans, so the
+	// bins get the bounds of the clipped triangle instead of its box
+	const int count = (int)prims.size();
+	std::vector<SpatialBins> chunkBins(count < parallelBinThreshold ? 1 : (count + binChunkSize - 1) / binChunkSize);
+	binParallel(count, [&](int first, int last, int chunk) {
+		SpatialBins& out = chunkBins[std::max(chunk, 0)];
+		glm::vec3 v[3];
+		for (int i = first; i < last; i++) {
+			const BuildPrim& prim = prims[i];
+			bool fetched = false;
+			for (int axis = 0; axis < 3; axis++) {
+				if (extent[axis] <= 0.f)
+					continue;
+				const int firstBin = binOfPosition(axis, prim.lower[axis]);
+				const int lastBin = binOfPosition(axis, prim.upper[axis]);
+				Box rest = boxOf(prim);
+				// most references fall into a single bin and need no clipping
+				if (firstBin < lastBin && !fetched) {
+					triangle(prim.ref, v);
+					fetched = true;
+				}
+				for (int bin = firstBin; bin < lastBin; bin++) {
+					Box piece, remainder;
+					clipTriangle(v, rest, axis, bounds.lower[axis] + (bin + 1) / scale[axis], piece, remainder);
+					if (isValid(piece))
+						out.bounds[axis][bin].extend(piece);
+					if (isValid(remainder))
+						rest = remainder;
+				}
+				out.bounds[axis][lastBin].extend(rest);
+				out.entry[axis][firstBin]++;
+				out.exit[axis][lastBin]++;
+			}
+		}
+	});
+	SpatialBins& bins = chunkBins[0];
+	for (size_t chunk = 1; chunk < chunkBins.size(); chunk++)
+		bins.merge(chunkBins[chunk]);
+
+	// references entering left of a plane go left, those leaving right
+	// of it go right; the ones that do both are counted on both sides
+	Split best;
+	for (int axis = 0; axis < 3; axis++) {
+		if (extent[axis] <= 0.f)
+			continue;
+		float rightArea[numSpatialBins];
+		int rightCount[numSpatialBins];
+		Box box;
+		int n = 0;
+		for (int bin = numSpatialBins - 1; bin > 0; bin--) {
+			box.extend(bins.bounds[axis][bin]);
+			n += bins.exit[axis][bin];
+			rightArea[bin] = box.halfArea();
+			rightCount[bin] = n;
+		}
+		box = Box();
+		n = 0;
+		for (int bin = 0; bin < numSpatialBins - 1; bin++) {
+			box.extend(bins.bounds[axis][bin]);
+			n += bins.entry[axis][bin];
+			if (n == 0 || rightCount[bin + 1] == 0)
+				continue;
+			const float cost = box.halfArea() * n + rightArea[bin + 1] * rightCount[bin + 1];
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = axis;
+				best.bin = bin;
+				best.spatial = true;
+				best.duplicates = n + rightCount[bin + 1] - count;
+			}
+		}
+	}
+	return best;
+}
+
+/*! distributes the references over the two sides of the split plane.
+	Straddling ones are clipped into both, unless keeping one whole on a
+	single side is cheaper by the SAH ("reference unsplitting") */
+void SpatialBvhBuilder::splitSpatially(std::vector<BuildPrim>& prims, const Box& bounds, const Split& split,
+									   std::vector<BuildPrim>& left, std::vector<BuildPrim>& right) const {
+	const int axis = split.axis;
+	const float position = bounds.lower[axis] + (split.bin + 1) * (bounds.upper[axis] - bounds.lower[axis]) / numSpatialBins;
+
+	Box leftBounds, rightBounds;
+	std::vector<BuildPrim> straddling;
+	std::vector<Box> leftPieces, rightPieces;
+	glm::vec3 v[3];
+	for (const BuildPrim& prim : prims) {
+		if (prim.upper[axis] <= position) {
+			left.push_back(prim);
+			leftBounds.extend(boxOf(prim));
+		}
+		else if (prim.lower[axis] >= position) {
+			right.push_back(prim);
+			rightBounds.extend(boxOf(prim));
+		}
+		else {
+			Box leftPiece, rightPiece;
+			triangle(prim.ref, v);
+			clipTriangle(v, boxOf(prim), axis, position, leftPiece, rightPiece);
+			straddling.push_back(prim);
+			leftPieces.push_back(leftPiece);
+			rightPieces.push_back(rightPiece);
+			if (isValid(leftPiece))
+				leftBounds.extend(leftPiece);
+			if (isValid(rightPiece))
+				rightBounds.extend(rightPiece);
+		}
+	}
+
+	int leftCount = int(left.size() + straddling.size());
+	int rightCount = int(right.size() + straddling.size());
+	for (size_t i = 0; i < straddling.size(); i++) {
+		BuildPrim prim = straddling[i];
+		const Box whole = boxOf(prim);
+		// a piece lost to clipping round-off leaves the whole on the other side
+		if (!isValid(leftPieces[i]) || !isValid(rightPieces[i])) {
+			if (isValid(leftPieces[i])) {
+				left.push_back(prim);
+				leftBounds.extend(whole);
+				rightCount--;
+			}
+			else {
+				right.push_back(prim);
+				rightBounds.extend(whole);
+				leftCount--;
+			}
+			continue;
+		}
+
+		Box leftWith = leftBounds, rightWith = rightBounds;
+		leftWith.extend(whole);
+		rightWith.extend(whole);
+		const float splitCost = leftBounds.halfArea() * leftCount + rightBounds.halfArea() * rightCount;
+		const float leftOnlyCost = leftWith.halfArea() * leftCount + rightBounds.halfArea() * (rightCount - 1);
+		const float rightOnlyCost = leftBounds.halfArea() * (leftCount - 1) + rightWith.halfArea() * rightCount;
+		if (leftOnlyCost < splitCost && leftOnlyCost <= rightOnlyCost) {
+			left.push_back(prim);
+			leftBounds = leftWith;
+			rightCount--;
+		}
+		else if (rightOnlyCost < splitCost) {
+			right.push_back(prim);
+			rightBounds = rightWith;
+			leftCount--;
+		}
+		else {
+			setBox(prim, leftPieces[i]);
+			left.push_back(prim);
+			setBox(prim, rightPieces[i]);
+			right.push_back(prim);
+		}
+	}
+}
+
+void SpatialBvhBuilder::build(uint32_t nodeID, std::vector<BuildPrim>& prims, int depth) {
+	const int count = (int)prims.size();
+	Box bounds, centroidBounds;
+	for (const BuildPrim& prim : prims) {
+		bounds.extend(boxOf(prim));
+		centroidBounds.extend(prim.centroid);
+	}
+	nodes[nodeID].lower = bounds.lower;
+	nodes[nodeID].upper = bounds.upper;
+
+	auto makeLeaf = [&]() {
+		const uint32_t offset = numRefs.fetch_add(count);
+		for (int i = 0; i < count; i++)
+			refs[offset + i] = prims[i].ref;
+		nodes[nodeID].offset = offset;
+		nodes[nodeID].count = count;
+	};
+
+	if (count <= 1) {
+		makeLeaf();
+		return;
+	}
+
+	std::vector<BuildPrim> left, right;
+	if (depth < maxSahDepth) {
+		Box objectLeft, objectRight;
+		Split best;
+		const glm::vec3 extent = centroidBounds.upper - centroidBounds.lower;
+		if (glm::max(extent.x, glm::max(extent.y, extent.z)) > 0.f)
+			best = findObjectSplit(prims, centroidBounds, objectLeft, objectRight);
+
+		// only where the object split leaves the children overlapping (or
+		// finds no plane at all) can clipping the triangles do better
+		const Box overlap = intersect(objectLeft, objectRight);
+		if (best.axis < 0 || (isValid(overlap) && overlap.halfArea() > minSplitOverlap * rootArea)) {
+			if (budget.load(std::memory_order_relaxed) > 0) {
+				const Split spatial = findSpatialSplit(prims, bounds);
+				if (spatial.cost < best.cost) {
+					// reserve the duplicates up front, so that concurrent
+					// subtrees together stay within the budget
+					if (budget.fetch_sub(spatial.duplicates) >= spatial.duplicates)
+						best = spatial;
+					else
+						budget += spatial.duplicates;
+				}
+			}
+		}
+
+		const float splitCost = traversalCost + intersectionCost * best.cost / std::max(bounds.halfArea(), 1e-30f);
+		const float leafCost = intersectionCost * count;
+		if (best.axis >= 0 && (splitCost < leafCost || count > maxLeafSize)) {
+			if (best.spatial) {
+				splitSpatially(prims, bounds, best, left, right);
+				// hand back what reference unsplitting saved
+				budget += best.duplicates - int(left.size() + right.size() - count);
+			}
+			else {
+				const float lower = centroidBounds.lower[best.axis];
+				const float scale = numBins / extent[best.axis];
+				for (const BuildPrim& prim : prims)
+					(binOf(prim.centroid[best.axis], lower, scale) <= best.bin ? left : right).push_back(prim);
+			}
+		}
+		else if (count <= maxLeafSize) {
+			makeLeaf();
+			return;
+		}
+	}
+	else if (count <= maxLeafSize) {
+		makeLeaf();
+		return;
+	}
+
+	if (left.empty() || right.empty()) {
+		// too deep, or no usable plane: split at the object median
+		const glm::vec3 extent = centroidBounds.upper - centroidBounds.lower;
+		const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		const int mid = count / 2;
+		std::nth_element(prims.begin(), prims.begin() + mid, prims.end(),
+			[axis](const BuildPrim& a, const BuildPrim& b) { return a.centroid[axis] < b.centroid[axis]; });
+		left.assign(prims.begin(), prims.begin() + mid);
+		right.assign(prims.begin() + mid, prims.end());
+	}
+	// the children's lists replace this node's
+	std::vector<BuildPrim>().swap(prims);
+
+	const uint32_t leftID = numNodes.fetch_add(2);
+	nodes[nodeID].offset = leftID;
+	nodes[nodeID].count = 0;
+
+	bool spawn = false;
+	if (std::min(left.size(), right.size()) >= size_t(parallelBuildThreshold)) {
+		if (activeThreads.fetch_add(1) < maxThreads)
+			spawn = true;
+		else
+			activeThreads--;
+	}
+	if (spawn) {
+		std::thread leftThread([&]() { build(leftID, left, depth + 1); });
+		build(leftID + 1, right, depth + 1);
+		leftThread.join();
+		activeThreads--;
+	}
+	else {
+		build(leftID, left, depth + 1);
+		build(leftID + 1, right, depth + 1);
+	}
+}
+
+void buildSpatialBvh(const Model* model, const std::vector<BuildPrim>& prims, float maxGrowth,
+					 std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs) {
+	const size_t numPrims = prims.size();
+	const int64_t budget = int64_t(maxGrowth * numPrims);
+	Box rootBounds;
+	for (const BuildPrim& prim : prims)
+		rootBounds.extend(boxOf(prim));
+
+	// every reference ends up in exactly one leaf, and a binary tree over
+	// n leaves of at least one reference has < 2n nodes
+	const size_t maxRefs = numPrims + size_t(budget);
+	nodes.assign(2 * maxRefs, BvhNode());
+	refs.assign(maxRefs, PrimRef());
+
+	SpatialBvhBuilder builder(model, nodes, refs, budget, rootBounds.halfArea());
+	std::vector<BuildPrim> rootPrims(prims);
+	builder.build(0, rootPrims, 0);
+
+	nodes.resize(builder.size());
+	nodes.shrink_to_fit();
+	refs.resize(builder.references());
+	refs.shrink_to_fit();
+}
@@ -0,0 +1,204 @@
+#include "BvhBuild.h"
+#include "Simd.h"
+
+#include <atomic>
+
+// leaves per treelet; the search over their topologies grows with 3^n
+static const int treeletSize = 7;
+static const int numSubsets = 1 << treeletSize;
+
+static inline Box nodeBounds(const BvhNode& node) {
+	Box box;
+	box.lower = node.lower;
+	box.upper = node.upper;
+	return box;
+}
+
+namespace {
+	/*! one pass of treelet restructuring over a tree. Every inner node
+		in turn roots a treelet, which is grown by opening its largest
+		leaf until it has treeletSize leaves; dynamic programming over
+		all subsets of those leaves then finds the topology with the
+		lowest SAH cost, which replaces the treelet if it is cheaper.
+		Treelets are visited bottom-up by height, so that each one sees
+		the optimized subtrees below it; nodes of equal height root
+		disjoint subtrees, and are restructured in parallel */
+	class TreeletOptimizer {
+	public:
+		TreeletOptimizer(std::vector<BvhNode>& nodes) : nodes(nodes), cost(nodes.size()) {}
+
+		//! returns the number of treelets that were restructured
+		size_t run() {
+			// subtree costs, and inner nodes by height; children are
+			// allocated after their parents
+			std::vector<uint32_t> height(nodes.size(), 0);
+			std::vector<std::vector<uint32_t>> levels;
+			for (size_t i = nodes.size(); i-- > 0;) {
+				const BvhNode& node = nodes[i];
+				const float area = nodeBounds(node).halfArea();
+				if (node.isLeaf()) {
+					cost[i] = intersectionCost * node.count * area;
+					continue;
+				}
+				cost[i] = traversalCost * area + cost[node.offset] + cost[node.offset + 1];
+				height[i] = std::max(height[node.offset], height[node.offset + 1]) + 1;
+				if (levels.size() < height[i])
+					levels.resize(height[i]);
+				levels[height[i] - 1].push_back(uint32_t(i));
+			}
+
+			std::atomic<size_t> numRestructured(0);
+			for (const std::vector<uint32_t>& level : levels)
+				parallelFor(0, (int)level.size(), [&](int i) {
+					if (restructure(level[i]))
+						numRestructured++;
+				}, 64);
+			return numRestructured;
+		}
+
+	private:
+		bool restructure(uint32_t rootID) {
+			// grow the treelet by the leaf with the largest surface area,
+			// as that one has the most cost to gain
+			uint32_t leaves[treeletSize];
+			uint32_t inner[treeletSize - 1];
+			int numLeaves = 0, numInner = 0;
+			inner[numInner++] = rootID;
+			leaves[numLeaves++] = nodes[rootID].offset;
+			leaves[numLeaves++] = nodes[rootID].offset + 1;
+			while (numLeaves < treeletSize) {
+				int best = -1;
+				float bestArea = -1.f;
+				for (int i = 0; i < numLeaves; i++) {
+					const BvhNode& node = nodes[leaves[i]];
+					const float area = nodeBounds(node).halfArea();
+					if (!node.isLeaf() && area > bestArea) {
+						best = i;
+						bestArea = area;
+					}
+				}
+				if (best < 0)
+					break;
+				const uint32_t opened = leaves[best];
+				inner[numInner++] = opened;
+				leaves[best] = nodes[opened].offset;
+				leaves[numLeaves++] = nodes[opened].offset + 1;
+			}
+			// with two leaves there is only one topology
+			if (numLeaves < 3)
+				return false;
+
+			// bounds and optimal cost of every subset; its proper subsets
+			// have smaller masks, so they are done before it
+			const uint32_t all = (1u << numLeaves) - 1;
+			Box bounds[numSubsets];
+			float optimal[numSubsets];
+			uint8_t split[numSubsets];
+			for (uint32_t subset = 1; subset <= all; subset++) {
+				const uint32_t lowest = subset & (0u - subset);
+				const int first = firstBit(subset);
+				bounds[subset] = bounds[subset ^ lowest];
+				bounds[subset].extend(nodeBounds(nodes[leaves[first]]));
+				if (subset == lowest) {
+					optimal[subset] = cost[leaves[first]];
+					continue;
+				}
+				// each partition once: the part with the lowest leaf
+				float best = 1e30f;
+				for (uint32_t part = (subset - 1) & subset; part; part = (part - 1) & subset) {
+					if (!(part & lowest))
+						continue;
+					const float partitionCost = optimal[part] + optimal[subset ^ part];
+					if (partitionCost < best) {
+						best = partitionCost;
+						split[subset] = (uint8_t)part;
+					}
+				}
+				optimal[subset] = traversalCost * bounds[subset].halfArea() + best;
+			}
+			if (optimal[all] >= cost[rootID] * (1.f - 1e-5f))
+				return false;
+
+			// lay out the new topology in the slots of the old one: the
+			// root stays, the others take the inner nodes' child pairs
+			BvhNode leafNodes[treeletSize];
+			float leafCosts[treeletSize];
+			for (int i = 0; i < numLeaves; i++) {
+				leafNodes[i] = nodes[leaves[i]];
+				leafCosts[i] = cost[leaves[i]];
+			}
+			uint32_t pairs[treeletSize - 1];
+			for (int i = 0; i < numInner; i++)
+				pairs[i] = nodes[inner[i]].offset;
+
+			struct Pending {
+				uint32_t subset;
+				uint32_t nodeID;
+			};
+			Pending pending[2 * treeletSize];
+			int numPending = 0, numPairs = 0;
+			pending[numPending++] = { all, rootID };
+			while (numPending > 0) {
+				const Pending item = pending[--numPending];
+				if ((item.subset & (item.subset - 1)) == 0) {
+					const int leaf = firstBit(item.subset);
+					nodes[item.nodeID] = leafNodes[leaf];
+					cost[item.nodeID] = leafCosts[leaf];
+					continue;
+				}
+				const uint32_t pair = pairs[numPairs++];
+				const Box& box = bounds[item.subset];
+				nodes[item.nodeID] = { box.lower, pair, box.upper, 0 };
+				cost[item.nodeID] = optimal[item.subset];
+				pending[numPending++] = { split[item.subset], pair };
+				pending[numPending++] = { item.subset ^ split[item.subset], pair + 1 };
+			}
+			return true;
+		}
+
+		std::vector<BvhNode>& nodes;
+		//! SAH cost of each subtree, not yet divided by the root's area
+		std::vector<float> cost;
+	};
+}
+
+/*! depth first copy, which puts children after their parents again and
+	keeps subtrees together in memory. The references are put into leaf
+	order too, so that the leaves of a subtree are one range of them,
+	as Bvh8 expects where it merges small leaves */
+static void relayout(std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs) {
+	std::vector<BvhNode> ordered;
+	ordered.reserve(nodes.size());
+	ordered.push_back(nodes[0]);
+	std::vector<PrimRef> orderedRefs;
+	orderedRefs.reserve(refs.size());
+	std::vector<uint32_t> stack(1, 0);
+	while (!stack.empty()) {
+		const uint32_t nodeID = stack.back();
+		stack.pop_back();
+		const BvhNode node = ordered[nodeID];
+		if (node.isLeaf()) {
+			ordered[nodeID].offset = (uint32_t)orderedRefs.size();
+			orderedRefs.insert(orderedRefs.end(), refs.begin() + node.offset, refs.begin() + node.offset + node.count);
+			continue;
+		}
+		const uint32_t pair = (uint32_t)ordered.size();
+		ordered.push_back(nodes[node.offset]);
+		ordered.push_back(nodes[node.offset + 1]);
+		ordered[nodeID].offset = pair;
+		stack.push_back(pair + 1);
+		stack.push_back(pair);
+	}
+	nodes.swap(ordered);
+	refs.swap(orderedRefs);
+}
+
+void optimizeTreelets(std::vector<BvhNode>& nodes, std::vector<PrimRef>& refs, int rounds) {
+	if (nodes.empty() || nodes[0].isLeaf())
+		return;
+	for (int round = 0; round < rounds; round++) {
+		if (TreeletOptimizer(nodes).run() == 0)
+			break;
+		relayout(nodes, refs);
+	}
+}
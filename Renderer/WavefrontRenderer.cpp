@@ -0,0 +1,413 @@
+#include "WavefrontRenderer.h"
+#include "HostPrograms.h"
+#include "ParallelFor.h"
+#include "RaySorter.h"
+
+#include <chrono>
+
+// tiles per wavefront; its path state (about 210 bytes a path) then
+// stays within a core's L2 cache while the stages go over it
+static const int wavefrontTiles = 64;
+
+namespace {
+	//! one vector per path, stored by component
+	struct Float3Array {
+		std::vector<float> x, y, z;
+
+		void resize(size_t n) {
+			x.resize(n);
+			y.resize(n);
+			z.resize(n);
+		}
+		glm::vec3 get(uint32_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+		void set(uint32_t i, const glm::vec3& v) {
+			x[i] = v.x;
+			y[i] = v.y;
+			z[i] = v.z;
+		}
+	};
+
+	//! what all materials compute of a hit first, as in closestHit
+	struct SurfaceHit {
+		glm::vec3 hitPoint;
+		//! unit shading normal, interpolated if the mesh has normals
+		glm::vec3 normal;
+		//! unit direction back along the ray
+		glm::vec3 wo;
+		glm::vec2 barycentrics;
+		glm::ivec3 index;
+	};
+}
+
+static inline SurfaceHit surfaceHit(const TriangleMesh& mesh, int primID, float t, float u, float v,
+									const glm::vec3& normal, const glm::vec3& origin, const glm::vec3& rayDir) {
+	SurfaceHit surface;
+	surface.index = mesh.index[primID];
+	surface.barycentrics = glm::vec2(u, v);
+	glm::vec3 sN = glm::normalize(normal);
+	if (!mesh.normal.empty())
+		sN = (1.f - u - v) * mesh.normal[surface.index.x]
+			+ u * mesh.normal[surface.index.y]
+			+ v * mesh.normal[surface.index.z];
+	surface.normal = glm::normalize(sN);
+	surface.wo = -glm::normalize(rayDir);
+	surface.hitPoint = origin + t * rayDir;
+	return surface;
+}
+
+/*! the state of up to wavefrontTiles tiles of paths: one slot per
+	pixel, packetSize consecutive slots per tile. The stages go over
+	slot lists: 'live' for extend and sort, 'queues' for shading, which
+	fills 'next' */
+struct WavefrontRenderer::Wavefront {
+	//! bounce rays are binned within the scene bounds
+	Wavefront(const glm::vec3& lower, const glm::vec3& upper) : sorter(lower, upper) {}
+
+	//! paths by what shades them: a queue per Material::Type, then misses
+	static const int missQueue = 3;
+	static const int numQueues = 4;
+
+	int numTiles;
+	//! frame buffer index of each slot, -1 past the edge of the image
+	std::vector<int> pixel;
+
+	// path state, as in the Payload of devicePrograms.slang
+	Float3Array origin;
+	Float3Array direction;
+	Float3Array attenuation;
+	Float3Array radiance;
+	std::vector<PathSampler> sampler;
+	Float3Array accumColor;
+
+	// closest hit of the last extension; meshID is -1 for misses
+	std::vector<float> t, u, v;
+	std::vector<int> meshID, primID;
+	Float3Array normal;
+	//! density of the last scatter direction, 0 if it came from a delta
+	//! lobe or without next event estimation, and where that scatter was
+	std::vector<float> bsdfPdf;
+	Float3Array scatterPoint;
+	Float3Array scatterNormal;
+
+	// the shadow rays of shading, and what they bring if unoccluded
+	Float3Array shadowOrigin;
+	Float3Array shadowDirection;
+	std::vector<float> shadowTmax;
+	Float3Array shadowRadiance;
+	std::vector<uint32_t> shadowQueue;
+
+	std::vector<uint32_t> live, next;
+	std::vector<uint32_t> queues[numQueues];
+
+	RaySorter sorter;
+	std::vector<uint32_t> keys;
+
+	void resize(size_t numSlots) {
+		pixel.resize(numSlots);
+		origin.resize(numSlots);
+		direction.resize(numSlots);
+		attenuation.resize(numSlots);
+		radiance.resize(numSlots);
+		sampler.resize(numSlots);
+		accumColor.resize(numSlots);
+		t.resize(numSlots);
+		u.resize(numSlots);
+		v.resize(numSlots);
+		meshID.resize(numSlots);
+		primID.resize(numSlots);
+		normal.resize(numSlots);
+		bsdfPdf.resize(numSlots);
+		scatterPoint.resize(numSlots);
+		scatterNormal.resize(numSlots);
+		shadowOrigin.resize(numSlots);
+		shadowDirection.resize(numSlots);
+		shadowTmax.resize(numSlots);
+		shadowRadiance.resize(numSlots);
+		shadowQueue.reserve(numSlots);
+		live.reserve(numSlots);
+		next.reserve(numSlots);
+		keys.reserve(numSlots);
+		for (std::vector<uint32_t>& queue : queues)
+			queue.reserve(numSlots);
+	}
+};
+
+WavefrontRenderer::WavefrontRenderer(const Model* model, const EnvironmentMap* environment, BvhBuildQuality bvhQuality,
+									 const std::string& bvhCacheDirectory, bool quantizedBvh8, int treeletRounds,
+									 bool sortRays, bool nextEventEstimation, LightSelection lightSelection,
+									 SampleSequence sequence)
+	: CpuRenderer(model, environment, bvhQuality, bvhCacheDirectory, quantizedBvh8, treeletRounds, nextEventEstimation,
+				  lightSelection, ReservoirReuse::NONE, sequence),
+	sortRays(sortRays) {
+	std::cout << "CPU Renderer: wavefront integrator, " << wavefrontTiles * packetSize << " paths per wavefront"
+		<< (sortRays ? ", bounce rays sorted" : "") << "\n";
+}
+
+//! what the material of a path's hit emits towards it, as closestHit weighs it
+glm::vec3 WavefrontRenderer::emitted(const Wavefront& wavefront, uint32_t slot, const Material& material) const {
+	glm::vec3 emitted = 10.f * material.emissive;
+	if (nextEventEstimation)
+		emitted *= emissionWeight(wavefront.meshID[slot], wavefront.primID[slot], wavefront.normal.get(slot),
+								  wavefront.direction.get(slot), wavefront.t[slot], wavefront.bsdfPdf[slot],
+								  wavefront.scatterPoint.get(slot), wavefront.scatterNormal.get(slot));
+	return emitted;
+}
+
+/*! camera rays of every pixel, as renderFrame starts a sample */
+void WavefrontRenderer::generate(Wavefront& wavefront, int sample) const {
+	wavefront.live.clear();
+	for (uint32_t slot = 0; slot < wavefront.pixel.size(); slot++) {
+		const int fbIndex = wavefront.pixel[slot];
+		if (fbIndex < 0)
+			continue;
+		const int ix = fbIndex % fbSize.x;
+		const int iy = fbIndex / fbSize.x;
+		PathSampler& sampler = wavefront.sampler[slot];
+		sampler.startSample(frameID * raysPerPixel + sample);
+		const float xShift = sampler.next();
+		const float yShift = sampler.next();
+
+		// normalized screen plane position, in [0,1]^2
+		const glm::vec2 screen = glm::vec2(ix + xShift, iy + yShift) * glm::vec2(1.f / fbSize.x, 1.f / fbSize.y);
+
+		wavefront.attenuation.set(slot, glm::vec3(1.f));
+		wavefront.origin.set(slot, camera.position);
+		wavefront.direction.set(slot, glm::normalize(camera.direction
+			+ (screen.x - 0.5f) * camera.horizontal
+			+ (screen.y - 0.5f) * camera.vertical));
+		wavefront.radiance.set(slot, glm::vec3(0.f));
+		wavefront.bsdfPdf[slot] = 0.f;
+		wavefront.live.push_back(slot);
+	}
+}
+
+/*! closest hits of the live paths. Camera rays of a tile are traced as
+	one packet, as CpuRenderer does; later rays one by one, in the order
+	of their sort keys with sortRays */
+void WavefrontRenderer::extend(Wavefront& wavefront, bool primary) const {
+	if (primary) {
+		for (int tile = 0; tile < wavefront.numTiles; tile++) {
+			const uint32_t first = uint32_t(tile * packetSize);
+			RayPacket packet = RayPacket();
+			for (int k = 0; k < packetSize; k++) {
+				if (wavefront.pixel[first + k] < 0)
+					continue;
+				Ray ray;
+				ray.origin = wavefront.origin.get(first + k);
+				ray.direction = wavefront.direction.get(first + k);
+				packet.set(k, ray);
+				packet.activeMask |= 1u << k;
+			}
+
+			HitPacket hits;
+			const uint32_t hitMask = closestHitPacket(bvh, bvh8, packet, hits);
+			for (int k = 0; k < packetSize; k++) {
+				const uint32_t slot = first + k;
+				wavefront.meshID[slot] = (hitMask >> k) & 1 ? hits.meshID[k] : -1;
+				wavefront.primID[slot] = hits.primID[k];
+				wavefront.t[slot] = hits.t[k];
+				wavefront.u[slot] = hits.u[k];
+				wavefront.v[slot] = hits.v[k];
+				wavefront.normal.set(slot, glm::vec3(hits.normalX[k], hits.normalY[k], hits.normalZ[k]));
+			}
+		}
+		return;
+	}
+
+	if (sortRays) {
+		wavefront.keys.resize(wavefront.live.size());
+		for (size_t i = 0; i < wavefront.live.size(); i++) {
+			const uint32_t slot = wavefront.live[i];
+			wavefront.keys[i] = wavefront.sorter.key(wavefront.origin.get(slot), wavefront.direction.get(slot));
+		}
+		wavefront.sorter.sort(wavefront.keys, wavefront.live);
+	}
+
+	for (uint32_t slot : wavefront.live) {
+		Ray ray;
+		ray.origin = wavefront.origin.get(slot);
+		ray.direction = wavefront.direction.get(slot);
+		ray.tmin = 0.f;
+		ray.tmax = 1e20f;
+		Hit hit;
+		if (!bvh8.closestHit(ray, hit)) {
+			wavefront.meshID[slot] = -1;
+			continue;
+		}
+		wavefront.meshID[slot] = hit.meshID;
+		wavefront.primID[slot] = hit.primID;
+		wavefront.t[slot] = hit.t;
+		wavefront.u[slot] = hit.barycentrics.x;
+		wavefront.v[slot] = hit.barycentrics.y;
+		wavefront.normal.set(slot, hit.normal);
+	}
+}
+
+/*! the live paths into the shading queues, by material type; one pass,
+	in order, so each queue keeps the paths' order */
+void WavefrontRenderer::sort(Wavefront& wavefront) const {
+	for (std::vector<uint32_t>& queue : wavefront.queues)
+		queue.clear();
+	wavefront.next.clear();
+	wavefront.shadowQueue.clear();
+	for (uint32_t slot : wavefront.live) {
+		const int meshID = wavefront.meshID[slot];
+		const int queue = meshID < 0 ? Wavefront::missQueue : int(materials[meshID].type);
+		wavefront.queues[queue].push_back(slot);
+	}
+}
+
+//! miss_radiance; ends the paths
+void WavefrontRenderer::shadeMisses(Wavefront& wavefront) const {
+	for (uint32_t slot : wavefront.queues[Wavefront::missQueue]) {
+		const glm::vec3 rayDir = wavefront.direction.get(slot);
+		glm::vec3 emitted;
+		if (environment && environment->resolution.x > 0) {
+			emitted = environment->lookup(glm::normalize(rayDir));
+		}
+		else {
+			// sky type blue
+			float a = 0.5f * (rayDir.y + 1.0f);
+			emitted = (1.0f - a) * glm::vec3(1.f, 1.0f, 1.0f) + a * glm::vec3(0.5f, 0.7f, 1.0f);
+		}
+		wavefront.radiance.set(slot, wavefront.radiance.get(slot) + wavefront.attenuation.get(slot) * emitted);
+	}
+}
+
+/*! the paths in the queue of material type 'type': their emission,
+	next event estimation unless the material is a delta one, and the
+	next direction from its Bsdf. Ends the paths whose sample fails */
+void WavefrontRenderer::shade(Wavefront& wavefront, Material::Type type) const {
+	const float err = 1e-5f;
+	for (uint32_t slot : wavefront.queues[type]) {
+		const int meshID = wavefront.meshID[slot];
+		const TriangleMesh& mesh = *model->meshes[meshID];
+		const Material& material = materials[meshID];
+		const SurfaceHit surface = surfaceHit(mesh, wavefront.primID[slot], wavefront.t[slot], wavefront.u[slot],
+			wavefront.v[slot], wavefront.normal.get(slot), wavefront.origin.get(slot), wavefront.direction.get(slot));
+
+		glm::vec3 diffuseColor = material.color;
+		if (type == Material::DIFFUSE && material.textureID >= 0 && !mesh.texcoord.empty()) {
+			const float u = surface.barycentrics.x, v = surface.barycentrics.y;
+			const glm::vec2 tc = (1.f - u - v) * mesh.texcoord[surface.index.x]
+				+ u * mesh.texcoord[surface.index.y]
+				+ v * mesh.texcoord[surface.index.z];
+			diffuseColor *= sampleTexture(material.textureID, tc);
+		}
+		const Bsdf bsdf = materialBsdf(material, diffuseColor);
+
+		const glm::vec3 attenuation = wavefront.attenuation.get(slot);
+		wavefront.radiance.set(slot, wavefront.radiance.get(slot) + emitted(wavefront, slot, material) * attenuation);
+		wavefront.bsdfPdf[slot] = 0.f;
+		const bool sampleLights = nextEventEstimation && !bsdf.isDelta() && !lights.empty();
+		const glm::vec3 facing = glm::dot(surface.normal, surface.wo) < 0.f ? -surface.normal : surface.normal;
+		if (sampleLights) {
+			Ray shadowRay;
+			glm::vec3 radiance;
+			if (sampleDirectLight(surface.hitPoint, facing, surface.wo, bsdf, wavefront.sampler[slot], shadowRay,
+								  radiance)) {
+				wavefront.shadowOrigin.set(slot, shadowRay.origin);
+				wavefront.shadowDirection.set(slot, shadowRay.direction);
+				wavefront.shadowTmax[slot] = shadowRay.tmax;
+				wavefront.shadowRadiance.set(slot, attenuation * radiance);
+				wavefront.shadowQueue.push_back(slot);
+			}
+		}
+
+		PathSampler& sampler = wavefront.sampler[slot];
+		if (!sampleLights)
+			sampler.skip(lightDimensions);
+		const float u0 = sampler.next();
+		const float u1 = sampler.next();
+		const float u2 = sampler.next();
+		sampler.skip(bounceDimensions - lightDimensions - bsdfDimensions);
+		BsdfSample sample;
+		if (!bsdf.sample(surface.wo, surface.normal, u0, u1, u2, sample))
+			continue;
+		wavefront.attenuation.set(slot, attenuation * sample.weight);
+		wavefront.direction.set(slot, sample.direction);
+		wavefront.origin.set(slot, surface.hitPoint + err * sample.direction);
+		if (sampleLights) {
+			wavefront.bsdfPdf[slot] = sample.pdf;
+			wavefront.scatterPoint.set(slot, surface.hitPoint);
+			wavefront.scatterNormal.set(slot, facing);
+		}
+		wavefront.next.push_back(slot);
+	}
+}
+
+/*! the shadow rays of shading; adds the light of those that
+	reach their emitter */
+void WavefrontRenderer::connect(Wavefront& wavefront) const {
+	for (uint32_t slot : wavefront.shadowQueue) {
+		Ray ray;
+		ray.origin = wavefront.shadowOrigin.get(slot);
+		ray.direction = wavefront.shadowDirection.get(slot);
+		ray.tmin = 0.f;
+		ray.tmax = wavefront.shadowTmax[slot];
+		if (!bvh8.occluded(ray))
+			wavefront.radiance.set(slot, wavefront.radiance.get(slot) + wavefront.shadowRadiance.get(slot));
+	}
+}
+
+void WavefrontRenderer::renderWavefront(int firstTile, int numTiles, Wavefront& wavefront) {
+	const int tilesX = (fbSize.x + tileSize - 1) / tileSize;
+	wavefront.numTiles = numTiles;
+	wavefront.resize(size_t(numTiles) * packetSize);
+	for (uint32_t slot = 0; slot < wavefront.pixel.size(); slot++) {
+		const int tile = firstTile + int(slot) / packetSize;
+		const int k = int(slot) % packetSize;
+		const int ix = (tile % tilesX) * tileSize + k % tileSize;
+		const int iy = (tile / tilesX) * tileSize + k / tileSize;
+		if (ix >= fbSize.x || iy >= fbSize.y) {
+			wavefront.pixel[slot] = -1;
+			continue;
+		}
+		const int fbIndex = ix + iy * fbSize.x;
+		wavefront.pixel[slot] = fbIndex;
+		wavefront.sampler[slot] = PathSampler::forPixel(sequence, ix, iy, fbSize.x, frameID);
+		wavefront.accumColor.set(slot, (accumBuffer[fbIndex] * float(frameID)) / (frameID + 1.f));
+	}
+
+	for (int i = 0; i < raysPerPixel; i++) {
+		generate(wavefront, i);
+		for (int depth = 0; depth < maxDepth && !wavefront.live.empty(); depth++) {
+			extend(wavefront, depth == 0);
+			sort(wavefront);
+			shadeMisses(wavefront);
+			shade(wavefront, Material::DIFFUSE);
+			shade(wavefront, Material::SPECULAR);
+			shade(wavefront, Material::DIELECTRIC);
+			connect(wavefront);
+			wavefront.live.swap(wavefront.next);
+		}
+		for (uint32_t slot = 0; slot < wavefront.pixel.size(); slot++)
+			if (wavefront.pixel[slot] >= 0)
+				wavefront.accumColor.set(slot, wavefront.accumColor.get(slot)
+					+ wavefront.radiance.get(slot) / (raysPerPixel * (frameID + 1.f)));
+	}
+
+	for (uint32_t slot = 0; slot < wavefront.pixel.size(); slot++)
+		if (wavefront.pixel[slot] >= 0)
+			writePixel(wavefront.pixel[slot], wavefront.accumColor.get(slot));
+}
+
+void WavefrontRenderer::render() {
+	if (fbSize.x == 0) return;
+
+	auto start = std::chrono::steady_clock::now();
+	const int tilesX = (fbSize.x + tileSize - 1) / tileSize;
+	const int tilesY = (fbSize.y + tileSize - 1) / tileSize;
+	const int numTiles = tilesX * tilesY;
+	const int numWavefronts = (numTiles + wavefrontTiles - 1) / wavefrontTiles;
+	parallelFor(0, numWavefronts, [&](int i) {
+		Wavefront wavefront(bvh.nodes[0].lower, bvh.nodes[0].upper);
+		const int firstTile = i * wavefrontTiles;
+		renderWavefront(firstTile, std::min(wavefrontTiles, numTiles - firstTile), wavefront);
+	});
+	auto end = std::chrono::steady_clock::now();
+	frameID++;
+
+	statSamples += double(fbSize.x) * fbSize.y * raysPerPixel;
+	reportThroughput(std::chrono::duration<double>(end - start).count());
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "CpuRenderer.h"
+
+/*! CpuRenderer with its integrator turned inside out. Instead of
+	following each path to its end, as the megakernel loop of
+	renderFrame does, a wavefront of paths is advanced one bounce at a
+	time through separate stages, each a loop over compact structure
+	of arrays path state:
+	- generate: camera rays for all pixels of the wavefront
+	- extend: closest hits of the live paths, primary rays in packets;
+	  with sortRays, bounce rays are first binned by origin and
+	  direction (see RaySorter)
+	- sort: paths into a miss queue and one queue per Material::Type
+	- shade: a pass per queue, which appends the paths that go on to
+	  the next live list; with nextEventEstimation, shading of other
+	  than dielectric materials also queues a shadow ray per path
+	- connect: occlusion queries for the shadow rays
+	so each stage runs the same code over many paths. Every pixel keeps
+	its own sampler, so the image is the same as CpuRenderer's */
+class WavefrontRenderer : public CpuRenderer {
+public:
+	WavefrontRenderer(const Model* model, const EnvironmentMap* environment = nullptr,
+					  BvhBuildQuality bvhQuality = BvhBuildQuality::SAH, const std::string& bvhCacheDirectory = "",
+					  bool quantizedBvh8 = false, int treeletRounds = 0, bool sortRays = false,
+					  bool nextEventEstimation = false, LightSelection lightSelection = LightSelection::POWER,
+					  SampleSequence sequence = SampleSequence::RANDOM);
+
+	void render() override;
+
+private:
+	struct Wavefront;
+
+	void renderWavefront(int firstTile, int numTiles, Wavefront& wavefront);
+
+	//! for sample 'sample' of the frame's raysPerPixel
+	void generate(Wavefront& wavefront, int sample) const;
+
+	void extend(Wavefront& wavefront, bool primary) const;
+
+	void sort(Wavefront& wavefront) const;
+
+	glm::vec3 emitted(const Wavefront& wavefront, uint32_t slot, const Material& material) const;
+
+	void shadeMisses(Wavefront& wavefront) const;
+
+	void shade(Wavefront& wavefront, Material::Type type) const;
+
+	void connect(Wavefront& wavefront) const;
+
+	const bool sortRays;
+};
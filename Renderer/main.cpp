@@ -1,4 +1,8 @@
 #include "SampleRenderer.h"
+#include "CpuRenderer.h"
+#include "WavefrontRenderer.h"
+#include "FileWatcher.h"
+#include "RayBenchmark.h"
 
 // our helper library for window handling
 #include "glfWindow/GLFWindow.h"
@@ -6,25 +10,58 @@
 
 #include "glm/glm.hpp"
 
+#include <chrono>
+#include <cstdlib>
+
 struct SampleWindow : public osc::GLFCameraWindow {
     SampleWindow(const std::string& title,
-                 const Model* model,
+                 Model* model,
+                 Renderer* renderer,
                  const Camera& camera,
                  const float worldScale)
-        : GLFCameraWindow(title, camera.from, camera.at, camera.up, worldScale), sample(model) {}
+        : GLFCameraWindow(title, camera.from, camera.at, camera.up, worldScale), sample(renderer), model(model) {
+        watcher.watch(watchedFiles(model));
+    }
+
+    /*! patches edited model/material/texture files into the live
+        model, and lets the renderer re-upload just those */
+    void hotReload() {
+        std::vector<std::string> changed = watcher.poll();
+        if (changed.empty())
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+        try {
+            ModelChanges changes = reloadChangedFiles(model, changed);
+            sample->applyChanges(changes);
+            auto end = std::chrono::steady_clock::now();
+            std::cout << "Hot reload: " << changes.meshes.size() << " meshes, "
+                << changes.materials.size() << " materials, "
+                << changes.textures.size() << " textures in "
+                << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+        }
+        catch (std::runtime_error& e) {
+            // keep running with what we have, the next save may fix it
+            std::cout << TERMINAL_RED << "Hot reload failed: " << e.what()
+                << TERMINAL_DEFAULT << std::endl;
+        }
+        // materials may now reference different texture files
+        watcher.watch(watchedFiles(model));
+    }
 
     virtual void render() override {
+        hotReload();
         if (cameraFrame.modified) {
-            sample.setCamera(Camera{ cameraFrame.get_from(),
+            sample->setCamera(Camera{ cameraFrame.get_from(),
                                      cameraFrame.get_at(),
                                      cameraFrame.get_up() });
             cameraFrame.modified = false;
         }
-        sample.render();
+        sample->render();
     }
 
     virtual void draw() override {
-        sample.downloadPixels(pixels.data());
+        sample->downloadPixels(pixels.data());
         if (fbTexture == 0)
             glGenTextures(1, &fbTexture);
 
@@ -72,14 +109,16 @@ struct SampleWindow : public osc::GLFCameraWindow {
 
     virtual void resize(const glm::ivec2& newSize) {
         fbSize = newSize;
-        sample.resize(newSize);
+        sample->resize(newSize);
         pixels.resize(newSize.x * newSize.y);
     }
 
     glm::ivec2            fbSize;
     GLuint                fbTexture{ 0 };
-    SampleRenderer        sample;
+    Renderer*             sample;
     std::vector<uint32_t> pixels;
+    Model*                model;
+    FileWatcher           watcher;
 };
 
 inline uint32_t XOrShift32(uint32_t* state)
@@ -92,13 +131,183 @@ inline uint32_t XOrShift32(uint32_t* state)
     return x;
 }
 
+/*! the OptiX backend, unless asked for the CPU one or there is no
+    usable CUDA device. 'wavefront' and 'sortRays' pick the CPU backend's
+    integrator, 'nextEventEstimation', 'lightSelection' and 'reuse' its light sampling */
+Renderer* createRenderer(const Model* model, const EnvironmentMap* environment, bool useCpu,
+                         BvhBuildQuality bvhQuality, const std::string& bvhCacheDirectory, bool quantizedBvh8,
+                         int treeletRounds, bool wavefront, bool sortRays, bool nextEventEstimation,
+                         LightSelection lightSelection, ReservoirReuse reuse, SampleSequence sequence) {
+    if (!useCpu) {
+        try {
+            return new SampleRenderer(model, environment, sequence);
+        }
+        catch (std::runtime_error& e) {
+            std::cout << TERMINAL_YELLOW << "Optix Renderer unavailable (" << e.what()
+                << "), falling back to the CPU renderer" << TERMINAL_DEFAULT << std::endl;
+        }
+    }
+    if (wavefront && reuse != ReservoirReuse::NONE)
+        throw std::runtime_error("reservoir resampling needs the megakernel integrator, not --wavefront");
+    if (wavefront)
+        return new WavefrontRenderer(model, environment, bvhQuality, bvhCacheDirectory, quantizedBvh8, treeletRounds,
+                                     sortRays, nextEventEstimation, lightSelection, sequence);
+    return new CpuRenderer(model, environment, bvhQuality, bvhCacheDirectory, quantizedBvh8, treeletRounds,
+                           nextEventEstimation, lightSelection, reuse, sequence);
+}
+
 /*! main entry point to this example - initially optix, print hello
   world, then exit */
 extern "C" int main(int ac, char** av) {
     try {
+        std::string environmentFile;
+        bool useCpu = false;
+        BvhBuildQuality bvhQuality = BvhBuildQuality::SAH;
+        std::string bvhCacheDirectory;
+        bool quantizedBvh8 = false;
+        int treeletRounds = 0;
+        bool wavefront = false;
+        bool sortRays = false;
+        bool nextEventEstimation = false;
+        LightSelection lightSelection = LightSelection::POWER;
+        ReservoirReuse reuse = ReservoirReuse::NONE;
+        SampleSequence sequence = SampleSequence::RANDOM;
+        for (int i = 1; i < ac; i++) {
+            const std::string arg = av[i];
+            if (arg == "--env" && i + 1 < ac)
+                environmentFile = av[++i];
+            else if (arg == "--cpu")
+                useCpu = true;
+            else if (arg == "--bvh" && i + 1 < ac) {
+                // fast builds for scenes that are edited a lot, spatial
+                // splits for scenes with long triangles
+                const std::string quality = av[++i];
+                if (quality == "sah")
+                    bvhQuality = BvhBuildQuality::SAH;
+                else if (quality == "sbvh")
+                    bvhQuality = BvhBuildQuality::SBVH;
+                else if (quality == "lbvh")
+                    bvhQuality = BvhBuildQuality::LBVH;
+                else if (quality == "ploc")
+                    bvhQuality = BvhBuildQuality::PLOC;
+                else
+                    throw std::runtime_error("unknown BVH build '" + quality + "', expected sah, sbvh, lbvh or ploc");
+            }
+            else if (arg == "--bvh-cache" && i + 1 < ac)
+                // keeps the CPU backend's BVHs between runs
+                bvhCacheDirectory = av[++i];
+            else if (arg == "--bvh-compress")
+                // about a third of the node memory, for huge scenes
+                quantizedBvh8 = true;
+            else if (arg == "--bvh-optimize")
+                // seconds more of startup for faster tracing of static scenes
+                treeletRounds = 3;
+            else if (arg == "--wavefront") {
+                // the CPU backend, tracing bounce by bounce over many paths
+                useCpu = true;
+                wavefront = true;
+            }
+            else if (arg == "--sort-rays") {
+                // the wavefront integrator, binning bounce rays before tracing
+                useCpu = true;
+                wavefront = true;
+                sortRays = true;
+            }
+            else if (arg == "--nee") {
+                // the CPU backend, sampling emissive triangles directly
+                useCpu = true;
+                nextEventEstimation = true;
+            }
+            else if (arg == "--lights" && i + 1 < ac) {
+                // next event estimation, picking emitters by power alone
+                // or, for scenes with many of them, through a light BVH
+                const std::string selection = av[++i];
+                if (selection == "power")
+                    lightSelection = LightSelection::POWER;
+                else if (selection == "bvh")
+                    lightSelection = LightSelection::HIERARCHY;
+                else
+                    throw std::runtime_error("unknown light selection '" + selection + "', expected power or bvh");
+                useCpu = true;
+                nextEventEstimation = true;
+            }
+            else if (arg == "--restir" && i + 1 < ac) {
+                // next event estimation, sharing light samples between
+                // pixels and frames; the biased variant saves shadow rays
+                const std::string variant = av[++i];
+                if (variant == "biased")
+                    reuse = ReservoirReuse::BIASED;
+                else if (variant == "unbiased")
+                    reuse = ReservoirReuse::UNBIASED;
+                else
+                    throw std::runtime_error("unknown resampling '" + variant + "', expected biased or unbiased");
+                useCpu = true;
+                nextEventEstimation = true;
+            }
+            else if (arg == "--sampler" && i + 1 < ac) {
+                // the random numbers of the paths; the low discrepancy
+                // ones converge faster, blue noise also looks smoother
+                const std::string name = av[++i];
+                if (name == "random")
+                    sequence = SampleSequence::RANDOM;
+                else if (name == "sobol")
+                    sequence = SampleSequence::SOBOL;
+                else if (name == "bluenoise")
+                    sequence = SampleSequence::BLUE_NOISE;
+                else
+                    throw std::runtime_error("unknown sampler '" + name + "', expected random, sobol or bluenoise");
+            }
+            else if (arg == "--bench") {
+                runRayBenchmark();
+                return 0;
+            }
+            else if (arg == "--bench-refit") {
+                runRefitBenchmark();
+                return 0;
+            }
+            else if (arg == "--bench-cache") {
+                runCacheBenchmark();
+                return 0;
+            }
+            else if (arg == "--bench-integrator") {
+                runIntegratorBenchmark();
+                return 0;
+            }
+            else if (arg == "--bench-bsdf") {
+                runBsdfBenchmark();
+                return 0;
+            }
+            else if (arg == "--bench-env") {
+                runEnvironmentBenchmark();
+                return 0;
+            }
+            else if (arg == "--bench-sampler") {
+                runSamplerBenchmark();
+                return 0;
+            }
+            else if (arg == "--bench-memory") {
+                runMemoryBenchmark();
+                return 0;
+            }
+            else if (arg == "--bench-io") {
+                runIoBenchmark(i + 1 < ac ? av[++i] : ".");
+                return 0;
+            }
+            else if (arg == "--bench-build") {
+                runBuildBenchmark(i + 1 < ac ? std::atoi(av[++i]) : 100);
+                return 0;
+            }
+            else
+                throw std::runtime_error("unknown command line argument '" + arg + "'");
+        }
+
         Model* model = loadOBJ("C:/Users/Vishu.Main-Laptop/Downloads/optix-examples-main/models/CornellBox/CornellBox-Water.obj");
         
         std::cout << "Model loaded perfectly!\n";
+
+        EnvironmentMap* environment = nullptr;
+        if (!environmentFile.empty())
+            environment = loadEnvironmentMap(environmentFile);
         
         Camera camera = { /*from*/glm::vec3(model->boundsCenter) + glm::vec3(2.f),
                         /* at */glm::vec3(model->boundsCenter),
@@ -108,8 +317,11 @@ extern "C" int main(int ac, char** av) {
         // camera knows how much to move for any given user interaction:
         const float worldScale = glm::length(model->boundsSpan);
         
+        Renderer* renderer = createRenderer(model, environment, useCpu, bvhQuality, bvhCacheDirectory, quantizedBvh8,
+                                            treeletRounds, wavefront, sortRays,
+                                            nextEventEstimation, lightSelection, reuse, sequence);
         SampleWindow* window = new SampleWindow("Optix 7 Course Example",
-                                                model, camera, worldScale);
+                                                model, renderer, camera, worldScale);
         window->run();
 
     }